@@ -5,19 +5,31 @@
 #include <string>
 #include <vector>
 
+#include "emulator/app/soc.h"
 #include "emulator/bus/bus.h"
 #include "emulator/cpu/cpu.h"
 #include "emulator/debugger/debugger.h"
+#include "emulator/debugger/gdb_server.h"
+#include "emulator/device/memory.h"
 
 constexpr uint64_t kDefaultRomBase = 0x00000000;
 constexpr uint64_t kDefaultRamBase = 0x80000000;
 constexpr uint64_t kDefaultRamSize = 256ull * 1024 * 1024;
 constexpr uint64_t kDefaultUartBase = 0x20000000;
 constexpr uint64_t kDefaultTimerBase = 0x20001000;
+constexpr uint64_t kDefaultDmaBase = 0x20002000;
+constexpr uint64_t kDefaultIntcBase = 0x20003000;
 constexpr uint64_t kDefaultSdlBase = 0x30000000;
 
 constexpr uint64_t kUartSize = 0x100;
 constexpr uint64_t kTimerSize = 0x100;
+constexpr uint64_t kDmaSize = 0x100;
+constexpr uint64_t kIntcSize = 0x100;
+
+// Interrupt controller lines of the default machine.
+constexpr uint32_t kTimerIrqLine = 0;
+constexpr uint32_t kUartIrqLine = 1;
+constexpr uint32_t kDisplayIrqLine = 2;
 
 constexpr uint32_t kDefaultWidth = 640;
 constexpr uint32_t kDefaultHeight = 480;
@@ -30,20 +42,63 @@ struct EmulatorConfig {
     uint64_t ramBase = kDefaultRamBase;
     uint64_t ramSize = kDefaultRamSize;
     uint64_t uartBase = kDefaultUartBase;
+    std::string uartOutput;
     uint64_t timerBase = kDefaultTimerBase;
+    uint64_t dmaBase = kDefaultDmaBase;
+    uint64_t intcBase = kDefaultIntcBase;
     uint64_t sdlBase = kDefaultSdlBase;
+    // Devices from the config file's [type name] sections. Empty builds the
+    // default machine from the *_base options above.
+    std::vector<SocDevice> soc;
     uint32_t width = kDefaultWidth;
     uint32_t height = kDefaultHeight;
     uint32_t cpuFrequency = 1000000;
+    ExecutionEngine engine = ExecutionEngine::Interpreter;
+    PacingMode pacing = PacingMode::MaxSpeed;
+    MemoryBacking memoryBacking = MemoryBacking::Mapped;
+    uint32_t harts = 1;
+    uint64_t hartQuantum = Debugger::kDefaultHartQuantum;
+    uint64_t checkpointInterval = Debugger::kDefaultCheckpointInterval;
+    uint64_t checkpointBudgetMiB = Debugger::kDefaultCheckpointBudget >> 20;
     bool debug = false;
     bool showHelp = false;
+    // Non-interactive runs stop once a hart passes this many cycles (0: never).
+    uint64_t maxCycles = 0;
+
+    // Farm mode: run every ROM listed in farmList on its own machine.
+    std::string farmList;
+    // Worker threads; 0 uses one per host CPU.
+    uint32_t farmJobs = 0;
+    std::string farmReport;
+    // Directory for each machine's UART output, <index>.uart; empty drops it.
+    std::string farmOutputDir;
 
     bool iTrace = false;
     bool mTrace = false;
     bool bpTrace = false;
+    TraceFilter traceFilter;
+    std::string traceFile;
+    bool traceCompress = false;
+    std::string symbolsPath;
+    std::string profileOutput;
+    uint64_t profilePeriod = PcProfiler::kDefaultPeriod;
+    std::string heatmapOutput;
+    // Input log to write, or to replay instead of taking host input.
+    std::string inputRecord;
+    std::string inputReplay;
+    // Fast-forward before the run starts; 0 leaves each off.
+    uint64_t runUntilInstructions = 0;
+    uint64_t runUntilCycle = 0;
+    // 0 leaves the GDB server off.
+    uint32_t gdbPort = 0;
+    uint32_t gdbRegisterBytes = GdbServer::kDefaultRegisterBytes;
     bool headless = false;
+    std::string frameOutput;
+    uint32_t frameEvery = 1;
+    uint32_t perfIntervalMs = 0;
     std::string logLevel = "info";
     std::string logFilename = "";
+    bool logAsync = false;
 };
 
 bool loadConfigFile(const std::string& path, bool required, EmulatorConfig* config,
@@ -0,0 +1,61 @@
+#ifndef EMULATOR_APP_FARM_H
+#define EMULATOR_APP_FARM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "emulator/app/app.h"
+#include "emulator/cpu/cpu.h"
+
+// Farm mode: many short, independent runs in one process. Each ROM gets its
+// own Machine, boot core, UART output and log context, and the machines run
+// headless on a work-stealing pool, so process startup and display setup are
+// paid once.
+
+enum class FarmOutcome {
+    Halted,
+    Fault,
+    Timeout,
+    Error
+};
+
+struct FarmResult {
+    std::string romPath;
+    FarmOutcome outcome = FarmOutcome::Error;
+    // Build error or fault description.
+    std::string detail;
+    uint64_t pc = 0;
+    uint64_t cycles = 0;
+    uint64_t instructions = 0;
+    double seconds = 0.0;
+};
+
+// Calls task(i) for every i below `count` on `workers` threads. Indices are
+// dealt round-robin to per-worker queues; a worker that runs dry steals from
+// the back of the others, so a few long tasks don't leave threads idle.
+void runWorkStealing(size_t count, uint32_t workers, const std::function<void(size_t)>& task);
+
+// One ROM path per line; blank lines and lines starting with '#' are skipped.
+bool loadFarmList(const std::string& path, std::vector<std::string>* roms, std::string* error);
+
+// Runs every ROM on a machine built from `base`, `jobs` machines at a time.
+// `createCpu` makes a fresh boot core for each machine. Results come back in
+// `roms` order.
+std::vector<FarmResult> runFarmJobs(const EmulatorConfig& base,
+    const std::vector<std::string>& roms, uint32_t jobs,
+    const std::function<std::unique_ptr<ICpuExecutor>()>& createCpu);
+
+const char* farmOutcomeToString(FarmOutcome outcome);
+// CSV with one row per ROM: rom,outcome,pc,cycles,instructions,seconds,detail.
+std::string formatFarmReport(const std::vector<FarmResult>& results);
+// One line with counts per outcome and the aggregate guest speed.
+std::string formatFarmSummary(const std::vector<FarmResult>& results, double wallSeconds);
+
+// The --farm entry point: returns 0 when every machine halted cleanly.
+int RunFarm(const EmulatorConfig& config);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef EMULATOR_APP_MACHINE_H
+#define EMULATOR_APP_MACHINE_H
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "emulator/app/app.h"
+#include "emulator/bus/bus.h"
+#include "emulator/cpu/cpu.h"
+#include "emulator/debugger/debugger.h"
+#include "emulator/device/dma.h"
+#include "emulator/device/display.h"
+#include "emulator/device/interrupt_controller.h"
+#include "emulator/device/memory.h"
+#include "emulator/device/timer.h"
+#include "emulator/device/uart.h"
+
+// Resolves the machine a config describes: its [type name] sections, or the
+// default machine from the *_base options. Fills in names, sizes, images,
+// UART outputs and irq lines, and checks the map for overlaps.
+bool describeMachine(const EmulatorConfig& config, std::vector<SocDevice>* devices,
+    std::string* error);
+
+// One emulated machine built from a config: its memories and devices, the
+// harts and their debugger. It owns everything but the boot core, so
+// several machines can run side by side in one process. Members are
+// declared in teardown order: each one outlives everything declared after it.
+class Machine {
+public:
+    Machine() = default;
+    Machine(const Machine&) = delete;
+    Machine& operator=(const Machine&) = delete;
+
+    // Maps the devices, creates the extra harts from `cpu` and configures
+    // the debugger, then resets every hart to the first ROM's base. `cpu` must
+    // outlive the machine.
+    bool build(const EmulatorConfig& config, ICpuExecutor* cpu, std::string* error);
+
+    Debugger& debugger() { return *mDebugger; }
+    MemoryBus& bus() { return mBus; }
+    // The first UART, or null when the description has none.
+    UartDevice* uart() { return mUarts.empty() ? nullptr : mUarts[0].get(); }
+    ICpuExecutor* cpu() const { return mHarts.empty() ? nullptr : mHarts[0]; }
+    const std::vector<ICpuExecutor*>& harts() const { return mHarts; }
+
+private:
+    std::vector<std::unique_ptr<MemoryDevice>> mMemories;
+    // Outlives every interrupt source, including the UART drain threads.
+    InterruptController mIntc;
+    // Outlive the UARTs, whose destructors drain pending output into them.
+    std::vector<std::unique_ptr<FILE, decltype(&std::fclose)>> mUartFiles;
+    std::vector<std::unique_ptr<UartDevice>> mUarts;
+    TimerDevice mTimer;
+    MemoryBus mBus;
+    std::unique_ptr<DmaDevice> mDma;
+    SdlDisplayDevice mSdl;
+    // Before the debugger so the extra harts outlive its threads.
+    std::vector<std::unique_ptr<ICpuExecutor>> mExtraHarts;
+    std::vector<ICpuExecutor*> mHarts;
+    std::unique_ptr<Debugger> mDebugger;
+};
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef EMULATOR_APP_SOC_H
+#define EMULATOR_APP_SOC_H
+
+#include <cstdint>
+#include <string>
+
+// One device of a machine description. The config file lists them as
+// sections:
+//
+//     [uart console]
+//     base = 0x20000000
+//     irq = 1
+//
+// The section header is the device type and an optional bus name; the keys
+// that follow, up to the next section, describe that device.
+enum class SocDeviceType {
+    Rom,
+    Ram,
+    Uart,
+    Timer,
+    Dma,
+    Intc,
+    Display
+};
+
+struct SocDevice {
+    SocDeviceType type = SocDeviceType::Ram;
+    // Bus mapping name. The first device of each type defaults to the name
+    // the default machine uses ("UART", "RAM", ...), later ones get an index
+    // ("UART1", "RAM2", ...).
+    std::string name;
+    uint64_t base = 0;
+    bool hasBase = false;
+    // 0 picks the natural size: the image file for a ROM, the register block
+    // for MMIO devices and the framebuffer for the display. RAM needs one.
+    uint64_t size = 0;
+    // Interrupt controller line; -1 leaves the device unwired. The first
+    // timer, UART and display default to the default machine's lines.
+    int32_t irq = -1;
+    bool hasIrq = false;
+    // ROM image, defaulting to the rom option for the first ROM.
+    std::string image;
+    // UART output file or "stdout"; empty logs it as device output. The
+    // first UART defaults to the uart_output option.
+    std::string output;
+};
+
+bool parseSocDeviceType(const std::string& value, SocDeviceType* type);
+const char* socDeviceTypeName(SocDeviceType type);
+
+// Parses "<type> [name]" from a section header without its brackets.
+bool parseSocSection(const std::string& header, SocDevice* device, std::string* error);
+// Applies one key of a device section.
+bool applySocDeviceValue(SocDevice* device, const std::string& key, const std::string& value,
+    std::string* error);
+
+#endif
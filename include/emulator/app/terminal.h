@@ -36,6 +36,9 @@ public:
     void runCursesInputLoop();
     void stop() { mShouldClose = true; }
     void setOnInput(std::function<void(const std::string&)> callback) { mOnInput = callback; }
+    // Called from the input loop whenever no key arrived within the poll
+    // timeout, for work the UI does at its own pace.
+    void setOnIdle(std::function<void()> callback) { mOnIdle = callback; }
 
 private:
     void renderAll();
@@ -63,6 +66,7 @@ private:
     std::atomic<bool> mShouldClose{false};
     
     std::function<void(const std::string&)> mOnInput;
+    std::function<void()> mOnIdle;
 };
 
 
@@ -3,12 +3,17 @@
 
 #include <cctype>
 #include <cerrno>
+#include <cstdio>
 #include <cstdlib>
 #include <fstream>
 #include <limits>
 #include <string>
 #include <vector>
 
+#include "emulator/cpu/cpu.h"
+#include "emulator/debugger/pacer.h"
+#include "emulator/device/memory.h"
+
 namespace {
 inline bool isSpaceChar(char ch) {
     return std::isspace(static_cast<unsigned char>(ch)) != 0;
@@ -118,6 +123,93 @@ inline bool parseU64(const std::string& text, uint64_t* value) {
     return true;
 }
 
+// Comma-separated "begin-end" pairs, end exclusive, e.g. "0x100-0x180,0x200-0x204".
+inline bool parseTraceRanges(const std::string& text, std::vector<TraceRange>* ranges) {
+    if (ranges == nullptr || isEmpty(text)) {
+        return false;
+    }
+    std::vector<TraceRange> parsed;
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t comma = text.find(',', start);
+        std::string item = text.substr(start, comma == std::string::npos ? std::string::npos :
+            comma - start);
+        trimInPlace(&item);
+        size_t dash = item.find('-');
+        TraceRange range;
+        if (dash == std::string::npos || !parseU64(item.substr(0, dash), &range.begin) ||
+            !parseU64(item.substr(dash + 1), &range.end) || range.end <= range.begin) {
+            return false;
+        }
+        parsed.push_back(range);
+        if (comma == std::string::npos) {
+            break;
+        }
+        start = comma + 1;
+    }
+    *ranges = std::move(parsed);
+    return true;
+}
+
+inline std::string formatTraceRanges(const std::vector<TraceRange>& ranges) {
+    std::string text;
+    char buffer[48];
+    for (const TraceRange& range : ranges) {
+        std::snprintf(buffer, sizeof(buffer), "%s0x%llx-0x%llx", text.empty() ? "" : ",",
+            (unsigned long long)range.begin, (unsigned long long)range.end);
+        text += buffer;
+    }
+    return text;
+}
+
+inline bool parseExecutionEngine(const std::string& text, ExecutionEngine* engine) {
+    if (engine == nullptr) {
+        return false;
+    }
+    std::string lowered = toLower(text);
+    if (lowered == "interpreter") {
+        *engine = ExecutionEngine::Interpreter;
+        return true;
+    }
+    if (lowered == "threaded") {
+        *engine = ExecutionEngine::Threaded;
+        return true;
+    }
+    return false;
+}
+
+inline bool parsePacingMode(const std::string& text, PacingMode* mode) {
+    if (mode == nullptr) {
+        return false;
+    }
+    std::string lowered = toLower(text);
+    if (lowered == "realtime") {
+        *mode = PacingMode::Realtime;
+        return true;
+    }
+    if (lowered == "max") {
+        *mode = PacingMode::MaxSpeed;
+        return true;
+    }
+    return false;
+}
+
+inline bool parseMemoryBacking(const std::string& text, MemoryBacking* backing) {
+    if (backing == nullptr) {
+        return false;
+    }
+    std::string lowered = toLower(text);
+    if (lowered == "heap") {
+        *backing = MemoryBacking::Heap;
+        return true;
+    }
+    if (lowered == "mmap") {
+        *backing = MemoryBacking::Mapped;
+        return true;
+    }
+    return false;
+}
+
 inline bool getFileSize(const std::string& path, uint64_t* size) {
     if (size == nullptr) {
         return false;
@@ -1,11 +1,19 @@
 #ifndef EMULATOR_BUS_BUS_H
 #define EMULATOR_BUS_BUS_H
 
+#include <array>
+#include <atomic>
 #include <cstdint>
+#include <deque>
+#include <functional>
 #include <limits>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
+#include "emulator/bus/event_scheduler.h"
+#include "emulator/bus/perf_counter.h"
 #include "emulator/cpu/cpu.h"
 
 class Device;
@@ -37,59 +45,218 @@ inline bool regionsOverlap(const MemoryRegion& a, const MemoryRegion& b) {
     return a.base < endB && b.base < endA;
 }
 
-inline bool validateMappings(const std::vector<MemoryRegion>& mappings, std::string* error) {
-    for (const auto& mapping : mappings) {
-        uint64_t end = 0;
-        if (!computeRegionEnd(mapping.base, mapping.size, &end)) {
-            if (error != nullptr) {
-                *error = std::string("Invalid mapping: ") + mapping.name;
-            }
-            return false;
-        }
-    }
-    for (size_t i = 0; i < mappings.size(); ++i) {
-        for (size_t j = i + 1; j < mappings.size(); ++j) {
-            if (regionsOverlap(mappings[i], mappings[j])) {
-                if (error != nullptr) {
-                    *error = std::string("Overlapping mappings: ") + mappings[i].name +
-                        " and " + mappings[j].name;
-                }
-                return false;
-            }
-        }
-    }
-    return true;
-}
+// Fails on an empty or wrapping region, or on any two that overlap. Sorts by
+// base and sweeps, so large maps validate in O(n log n).
+bool validateMappings(const std::vector<MemoryRegion>& mappings, std::string* error);
+
+// One entry of MemoryBus::registerDevices().
+struct DeviceRegistration {
+    Device* device = nullptr;
+    uint64_t base = 0;
+    uint64_t size = 0;
+    std::string name;
+};
+
+struct BusMappingStats {
+    std::string name;
+    uint64_t reads = 0;
+    uint64_t writes = 0;
+};
+
+// Cumulative since the bus was created. Block transfers count once per
+// mapping they touch; atomics count as writes.
+struct BusStats {
+    uint64_t tlbHits = 0;
+    uint64_t tlbMisses = 0;
+    std::vector<BusMappingStats> mappings;
+};
+
+struct HeatCell {
+    uint64_t address = 0;
+    uint64_t reads = 0;
+    uint64_t writes = 0;
+    uint64_t fetches = 0;
+
+    uint64_t total() const { return reads + writes + fetches; }
+};
+
+// Access counts for one mapping, in cells of 1 << granuleShift bytes. Only
+// cells that saw an access are listed.
+struct MappingHeat {
+    std::string name;
+    uint64_t base = 0;
+    uint64_t size = 0;
+    uint32_t granuleShift = 0;
+    HeatCell totals;
+    std::vector<HeatCell> cells;
+};
 
 class MemoryBus {
 public:
+    static constexpr uint32_t kPageShift = 12;
+    static constexpr uint64_t kPageSize = 1ull << kPageShift;
+
+    using WriteListener = std::function<void(uint64_t address, uint64_t size)>;
+
     MemoryBus() = default;
 
     void registerDevice(Device* device, uint64_t base, uint64_t size, const std::string& name = "");
+    // Registers a whole memory map, sorting it and flushing the lookup cache
+    // once. Unlike registerDevice(), entries are not checked for duplicates.
+    void registerDevices(const std::vector<DeviceRegistration>& devices);
     Device* findDevice(uint64_t address) const;
     Device* getDevice(const std::string& name) const;
     MemResponse read(const MemAccess& access);
     MemResponse write(const MemAccess& access);
+    // AtomicRmw, CompareExchange, LoadReserved and StoreConditional accesses.
+    MemResponse atomic(const MemAccess& access);
+    // Block transfers across however many mappings the range covers. RAM/ROM
+    // and devices implementing Device::readBlock()/writeBlock() are copied
+    // with memcpy; other devices see naturally aligned accesses of up to four
+    // bytes. Stops at the first unmapped or failing address; `done` receives
+    // the number of bytes transferred.
+    bool readBlock(uint64_t address, void* out, uint64_t length, uint64_t* done = nullptr);
+    bool writeBlock(uint64_t address, const void* data, uint64_t length,
+        uint64_t* done = nullptr);
+    bool getDirectMemory(uint64_t address, DirectMemoryRange* range) const;
+    // Copies from RAM/ROM host memory only, heatmap or not, without counting
+    // the access; false when any byte is in a device or unmapped. Lets the
+    // debugger inspect memory without triggering device read side effects.
+    bool peekDirect(uint64_t address, void* out, uint64_t length) const;
     void syncAll(uint64_t currentCycle);
     void setDebugger(Debugger* debugger);
 
+    // Device wakeups; the CPU loop runs until the next event and then calls
+    // runDue() instead of polling every device with syncAll().
+    EventScheduler& scheduler() { return *mScheduler; }
+
+    // With several harts on the bus, device handlers and the scheduler are
+    // serialized by one lock. RAM/ROM never take it; their atomics use host
+    // atomics on the backing storage instead. The lock is recursive so device
+    // handlers and events may issue bus accesses of their own (DMA).
+    using DeviceLock = std::unique_lock<std::recursive_mutex>;
+    void setConcurrent(bool concurrent) { mConcurrent = concurrent; }
+    bool isConcurrent() const { return mConcurrent; }
+    DeviceLock lockDevices() {
+        return mConcurrent ? DeviceLock(mDeviceMutex) : DeviceLock();
+    }
+
+    // Listeners are told about writes to direct-memory (RAM/ROM) mappings,
+    // which are the only regions executable code can live in.
+    uint32_t addWriteListener(WriteListener listener);
+    void removeWriteListener(uint32_t id);
+
     const std::vector<Device*>& getDevices() const { return mUniqueDevices; }
+    BusStats getStats() const;
+
+    // Page-granular read, write and fetch counters per mapping. While they
+    // are on, getDirectMemory() hands out no ranges so every CPU access is
+    // seen here; cores must drop cached ranges (the debugger does this).
+    // Mappings larger than kMaxHeatCells pages are counted in coarser cells;
+    // a block transfer counts once in each cell it covers. Off, they cost the
+    // hot path one flag test. Counts survive disabling until clearHeatmap().
+    static constexpr uint64_t kMaxHeatCells = 1ull << 16;
+    void setHeatmapEnabled(bool enabled);
+    bool isHeatmapEnabled() const { return mHeatmap.load(std::memory_order_acquire); }
+    void clearHeatmap();
+    std::vector<MappingHeat> getHeatmap() const;
 
 private:
     struct DeviceMapping {
         std::string name;
         Device* devicePtr = nullptr;
+        // The device's dispatch entries, or thunks through Device::read()
+        // and friends for devices that bind std::function handlers.
+        MemResponse (*read)(Device* device, const MemAccess& access) = nullptr;
+        MemResponse (*write)(Device* device, const MemAccess& access) = nullptr;
+        MemResponse (*atomic)(Device* device, const MemAccess& access) = nullptr;
         uint64_t base = 0;
         uint64_t size = 0;
         uint64_t end = 0;
+        DirectMemoryRange direct;
+        mutable ShardedPerfCounter reads;
+        mutable ShardedPerfCounter writes;
+        // Allocated by the first setHeatmapEnabled(true), then kept.
+        struct HeatCounters {
+            PerfCounter reads;
+            PerfCounter writes;
+            PerfCounter fetches;
+        };
+        std::unique_ptr<HeatCounters[]> heat;
+        uint32_t heatShift = 0;
+        uint64_t heatCells = 0;
+    };
+
+    // Three-level radix table over a 48-bit address space with 4 KiB leaves.
+    // Upper levels hold block entries when a single mapping covers the whole
+    // span, so large RAM regions do not allocate leaf tables. Pages shared by
+    // several small mappings are resolved through mSorted.
+    static constexpr uint32_t kLevelBits = 12;
+    static constexpr uint32_t kLevelSize = 1u << kLevelBits;
+    static constexpr uint32_t kAddressBits = kPageShift + 3 * kLevelBits;
+    static constexpr uint32_t kTlbEntries = 64;
+
+    struct PageEntry {
+        const DeviceMapping* mapping = nullptr;
+        bool shared = false;
+
+        bool empty() const { return mapping == nullptr && !shared; }
     };
 
-    const DeviceMapping* findMapping(uint64_t address) const;
+    struct LeafTable {
+        std::array<PageEntry, kLevelSize> pages;
+    };
+
+    struct MidTable {
+        std::array<PageEntry, kLevelSize> blocks;
+        std::array<std::unique_ptr<LeafTable>, kLevelSize> leaves;
+    };
+
+    struct TopTable {
+        std::array<PageEntry, kLevelSize> blocks;
+        std::array<std::unique_ptr<MidTable>, kLevelSize> mids;
+    };
+
+    enum TlbKind {
+        kTlbFetch,
+        kTlbRead,
+        kTlbWrite,
+        kTlbKindCount
+    };
+
+    using Tlb = std::array<std::atomic<const DeviceMapping*>, kTlbEntries>;
+
+    const DeviceMapping* findMapping(uint64_t address,
+        MemAccessType type = MemAccessType::Read) const;
+    const DeviceMapping* walkPageTable(uint64_t address) const;
+    const DeviceMapping* resolveEntry(const PageEntry& entry, uint64_t address) const;
+    const DeviceMapping* searchSorted(uint64_t address) const;
+    const DeviceMapping* addMapping(Device* device, uint64_t base, uint64_t size,
+        const std::string& name);
+    void insertPages(const DeviceMapping* mapping);
+    void flushTlb();
+    void notifyWrite(uint64_t address, uint64_t size) const;
+    // Counts one access in each cell the range overlaps.
+    void recordHeat(const DeviceMapping& mapping, uint64_t address, uint64_t length,
+        MemAccessType type) const;
+
+    static void mergeEntry(PageEntry* entry, const DeviceMapping* mapping);
 
-    std::vector<DeviceMapping> mDevices;
+    std::deque<DeviceMapping> mDevices;
+    std::vector<const DeviceMapping*> mSorted;
     std::vector<Device*> mUniqueDevices;
-    mutable const DeviceMapping* mLastHit = nullptr;
+    // Shared so devices outliving the bus can still cancel their events.
+    std::shared_ptr<EventScheduler> mScheduler = std::make_shared<EventScheduler>();
+    std::unique_ptr<TopTable> mPageTable;
+    mutable std::array<Tlb, kTlbKindCount> mTlb{};
+    mutable ShardedPerfCounter mTlbHits;
+    mutable ShardedPerfCounter mTlbMisses;
+    std::vector<std::pair<uint32_t, WriteListener>> mWriteListeners;
+    uint32_t mNextListenerId = 1;
     Debugger* mDbg = nullptr;
+    bool mConcurrent = false;
+    std::atomic<bool> mHeatmap{false};
+    std::recursive_mutex mDeviceMutex;
 };
 
 #endif
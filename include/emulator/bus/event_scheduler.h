@@ -0,0 +1,63 @@
+#ifndef EMULATOR_BUS_EVENT_SCHEDULER_H
+#define EMULATOR_BUS_EVENT_SCHEDULER_H
+
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Cycle-ordered event queue shared by the devices on a bus. Devices schedule
+// wakeups at absolute CPU cycles; the CPU loop runs until nextEventCycle()
+// and then calls runDue(). Owned and driven by the CPU thread: schedule() and
+// cancel() must be called from device handlers or before the CPU starts.
+class EventScheduler {
+public:
+    using EventId = uint64_t;
+    using Callback = std::function<void(uint64_t now)>;
+    using Clock = std::function<uint64_t()>;
+
+    static constexpr uint64_t kNoEvent = std::numeric_limits<uint64_t>::max();
+
+    EventId schedule(uint64_t cycle, Callback callback);
+    EventId scheduleIn(uint64_t delay, Callback callback);
+    bool cancel(EventId id);
+
+    uint64_t nextEventCycle() const;
+    // Runs every event due at or before `now` in cycle order. Callbacks may
+    // schedule further events; ones already due run in the same call.
+    size_t runDue(uint64_t now);
+
+    uint64_t now() const { return mNow; }
+    // The cycle of the instruction being executed, for device handlers that
+    // need exact time mid-batch; now() only moves when events run. Without a
+    // clock, or when the clock lags behind, this is now().
+    uint64_t currentCycle() const;
+    // Set before the CPU starts; called from device handlers on any hart.
+    void setClock(Clock clock) { mClock = std::move(clock); }
+    void setNow(uint64_t now) { mNow = now; }
+    size_t size() const { return mCallbacks.size(); }
+    bool empty() const { return mCallbacks.empty(); }
+    void clear();
+
+private:
+    struct Entry {
+        uint64_t cycle = 0;
+        EventId id = 0;
+    };
+
+    static bool later(const Entry& a, const Entry& b) {
+        return a.cycle != b.cycle ? a.cycle > b.cycle : a.id > b.id;
+    }
+
+    void dropCancelled() const;
+
+    mutable std::vector<Entry> mHeap;
+    std::unordered_map<EventId, Callback> mCallbacks;
+    EventId mNextId = 1;
+    uint64_t mNow = 0;
+    Clock mClock;
+};
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef EMULATOR_BUS_PERF_COUNTER_H
+#define EMULATOR_BUS_PERF_COUNTER_H
+
+#include <atomic>
+#include <cstdint>
+
+// Statistics counter for hot paths. add() is a relaxed load and store rather
+// than a read-modify-write, so it costs about as much as a plain increment
+// and can be read from any thread. Increments racing on another thread may
+// be lost, so counters shared by several harts are approximate.
+class PerfCounter {
+public:
+    void add(uint64_t n = 1) {
+        mValue.store(mValue.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    uint64_t load() const { return mValue.load(std::memory_order_relaxed); }
+    void reset() { mValue.store(0, std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> mValue{0};
+};
+
+// PerfCounter split into one cache line per thread, for counters every hart
+// bumps on every access. Each thread adds to its own shard, so harts neither
+// lose increments nor bounce a shared line; load() sums the shards. Threads
+// are given shards round-robin, and past kShards threads they start sharing.
+class ShardedPerfCounter {
+public:
+    static constexpr uint32_t kShards = 16;
+
+    void add(uint64_t n = 1) { mShards[shardIndex()].value.add(n); }
+    uint64_t load() const {
+        uint64_t total = 0;
+        for (const Shard& shard : mShards) {
+            total += shard.value.load();
+        }
+        return total;
+    }
+    void reset() {
+        for (Shard& shard : mShards) {
+            shard.value.reset();
+        }
+    }
+
+private:
+    struct alignas(64) Shard {
+        PerfCounter value;
+    };
+
+    static uint32_t shardIndex() {
+        static std::atomic<uint32_t> next{0};
+        thread_local uint32_t index = next.fetch_add(1, std::memory_order_relaxed) % kShards;
+        return index;
+    }
+
+    Shard mShards[kShards];
+};
+
+#endif
@@ -0,0 +1,280 @@
+#ifndef EMULATOR_CPU_BLOCK_CACHE_H
+#define EMULATOR_CPU_BLOCK_CACHE_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+enum class BlockDecodeStatus {
+    Continue,
+    EndBlock,
+    Fault
+};
+
+struct BlockCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t invalidations = 0;
+};
+
+// Tracks which guest pages hold cached code. The filter is conservative so
+// the common "store to a data page" case costs one bit test.
+class CodePageIndex {
+public:
+    static constexpr uint32_t kPageShift = 12;
+
+    void add(uint64_t page, uint64_t blockPc);
+    std::vector<uint64_t> take(uint64_t page);
+    void clear();
+
+    bool mayContain(uint64_t address) const {
+        uint64_t bit = (address >> kPageShift) & (kFilterBits - 1);
+        return (mFilter[bit / 64] >> (bit % 64)) & 1u;
+    }
+
+private:
+    static constexpr uint32_t kFilterBits = 4096;
+
+    std::array<uint64_t, kFilterBits / 64> mFilter{};
+    std::unordered_map<uint64_t, std::vector<uint64_t>> mPages;
+};
+
+// Which guest pages hold code decoded by which harts of one machine, so a
+// core storing through direct memory can tell whether another hart's decode
+// caches must hear about it. Entries are a conservative hash of the page with
+// one bit per hart. A hart marks a page before decoding from it and a storer
+// checks after its store, each behind a full fence, so a store racing a
+// decode is never missed. Bits only go away through forget(); a stale bit
+// costs one queued invalidation.
+class SharedCodePages {
+public:
+    static constexpr uint32_t kEntries = 4096;
+
+    void mark(uint64_t address, uint32_t hart) {
+        std::atomic<uint64_t>& entry = mEntries[slot(address)];
+        uint64_t bit = 1ull << (hart % 64);
+        if ((entry.load(std::memory_order_relaxed) & bit) == 0) {
+            entry.fetch_or(bit, std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    // Bit i is set if hart i may hold code decoded from the range.
+    uint64_t harts(uint64_t address, uint64_t size) const {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t first = address >> CodePageIndex::kPageShift;
+        uint64_t last = (address + (size == 0 ? 0 : size - 1)) >> CodePageIndex::kPageShift;
+        if (last - first >= kEntries) {
+            last = first + kEntries - 1;
+        }
+        uint64_t mask = 0;
+        for (uint64_t page = first; page <= last; ++page) {
+            mask |= mEntries[page & (kEntries - 1)].load(std::memory_order_relaxed);
+        }
+        return mask;
+    }
+
+    // Clears the hart's bits; it must drop all of its decoded code next.
+    void forget(uint32_t hart) {
+        uint64_t keep = ~(1ull << (hart % 64));
+        for (auto& entry : mEntries) {
+            if ((entry.load(std::memory_order_relaxed) & ~keep) != 0) {
+                entry.fetch_and(keep, std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    static uint64_t slot(uint64_t address) {
+        return (address >> CodePageIndex::kPageShift) & (kEntries - 1);
+    }
+
+    std::array<std::atomic<uint64_t>, kEntries> mEntries{};
+};
+
+// Address-keyed cache of pre-decoded basic blocks. The executor plugs in its
+// own decoder with the signature
+//     BlockDecodeStatus decode(uint64_t pc, DecodedInst* out, uint32_t* length)
+// and gets back a block of consecutive instructions ending at the first
+// instruction that reports EndBlock, a decode fault, or kMaxBlockInsts.
+template <typename DecodedInst>
+class BlockCache {
+public:
+    static constexpr uint32_t kMaxBlockInsts = 64;
+
+    struct Block {
+        uint64_t startPc = 0;
+        uint64_t endPc = 0;
+        std::vector<DecodedInst> insts;
+        std::vector<uint64_t> pcs;
+    };
+
+    template <typename Decoder>
+    const Block* lookupOrBuild(uint64_t pc, Decoder&& decoder) {
+        mRetired.clear();
+        FrontEntry& front = mFront[(pc >> 2) & (kFrontEntries - 1)];
+        if (front.block != nullptr && front.pc == pc) {
+            ++mStats.hits;
+            return front.block;
+        }
+        auto it = mBlocks.find(pc);
+        if (it != mBlocks.end()) {
+            ++mStats.hits;
+            front = FrontEntry{pc, it->second.get()};
+            return it->second.get();
+        }
+        ++mStats.misses;
+
+        auto block = std::make_unique<Block>();
+        block->startPc = pc;
+        uint64_t cursor = pc;
+        uint64_t sharedPage = std::numeric_limits<uint64_t>::max();
+        while (block->insts.size() < kMaxBlockInsts) {
+            if (mShared != nullptr && (cursor >> CodePageIndex::kPageShift) != sharedPage) {
+                sharedPage = cursor >> CodePageIndex::kPageShift;
+                mShared->mark(cursor, mSharedHart);
+            }
+            DecodedInst inst{};
+            uint32_t length = 0;
+            BlockDecodeStatus status = decoder(cursor, &inst, &length);
+            if (status == BlockDecodeStatus::Fault || length == 0) {
+                break;
+            }
+            block->insts.push_back(std::move(inst));
+            block->pcs.push_back(cursor);
+            cursor += length;
+            if (status == BlockDecodeStatus::EndBlock) {
+                break;
+            }
+        }
+        if (block->insts.empty()) {
+            return nullptr;
+        }
+        block->endPc = cursor;
+        uint64_t lastPage = (cursor - 1) >> CodePageIndex::kPageShift;
+        for (uint64_t page = pc >> CodePageIndex::kPageShift; page <= lastPage; ++page) {
+            mPages.add(page, pc);
+            if (mShared != nullptr && page != sharedPage) {
+                // The last instruction ran onto the next page.
+                mShared->mark(page << CodePageIndex::kPageShift, mSharedHart);
+            }
+        }
+        Block* raw = block.get();
+        mBlocks[pc] = std::move(block);
+        front = FrontEntry{pc, raw};
+        return raw;
+    }
+
+    // Drops every block overlapping [address, address + size) and returns
+    // whether anything was removed. Blocks are kept alive until the next
+    // lookup so an executor may finish the instruction that triggered the
+    // write; it should leave the block afterwards if this returned true.
+    // Ranges spanning more pages than there are blocks, up to the whole
+    // address space, are checked block by block instead.
+    bool invalidateRange(uint64_t address, uint64_t size) {
+        if (size == 0 || !mayContainCode(address, size)) {
+            return false;
+        }
+        uint64_t last = lastAddress(address, size);
+        uint64_t firstPage = address >> CodePageIndex::kPageShift;
+        uint64_t lastPage = last >> CodePageIndex::kPageShift;
+        bool removed = false;
+        if (lastPage - firstPage >= mBlocks.size()) {
+            for (auto it = mBlocks.begin(); it != mBlocks.end();) {
+                if (it->second->startPc > last || it->second->endPc <= address) {
+                    ++it;
+                    continue;
+                }
+                mRetired.push_back(std::move(it->second));
+                it = mBlocks.erase(it);
+                removed = true;
+            }
+        } else {
+            for (uint64_t page = firstPage; page <= lastPage; ++page) {
+                for (uint64_t blockPc : mPages.take(page)) {
+                    auto it = mBlocks.find(blockPc);
+                    if (it == mBlocks.end()) {
+                        continue;
+                    }
+                    mRetired.push_back(std::move(it->second));
+                    mBlocks.erase(it);
+                    removed = true;
+                }
+            }
+        }
+        if (removed) {
+            ++mGeneration;
+            ++mStats.invalidations;
+            mFront.fill(FrontEntry{});
+        }
+        return removed;
+    }
+
+    bool mayContainCode(uint64_t address, uint64_t size) const {
+        if (mBlocks.empty()) {
+            return false;
+        }
+        uint64_t last = lastAddress(address, size);
+        if ((last >> CodePageIndex::kPageShift) - (address >> CodePageIndex::kPageShift) >=
+            mBlocks.size()) {
+            return true;
+        }
+        for (uint64_t page = address >> CodePageIndex::kPageShift;
+             page <= (last >> CodePageIndex::kPageShift); ++page) {
+            if (mPages.mayContain(page << CodePageIndex::kPageShift)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void clear() {
+        for (auto& entry : mBlocks) {
+            mRetired.push_back(std::move(entry.second));
+        }
+        mBlocks.clear();
+        mPages.clear();
+        mFront.fill(FrontEntry{});
+        ++mGeneration;
+    }
+
+    // Marks every page this cache decodes from as code of `hart` in `pages`;
+    // nullptr stops marking.
+    void share(SharedCodePages* pages, uint32_t hart) {
+        mShared = pages;
+        mSharedHart = hart;
+    }
+
+    uint64_t generation() const { return mGeneration; }
+    size_t size() const { return mBlocks.size(); }
+    const BlockCacheStats& stats() const { return mStats; }
+
+private:
+    static constexpr uint32_t kFrontEntries = 256;
+
+    static uint64_t lastAddress(uint64_t address, uint64_t size) {
+        return size - 1 > std::numeric_limits<uint64_t>::max() - address ?
+            std::numeric_limits<uint64_t>::max() : address + (size - 1);
+    }
+
+    struct FrontEntry {
+        uint64_t pc = 0;
+        Block* block = nullptr;
+    };
+
+    std::unordered_map<uint64_t, std::unique_ptr<Block>> mBlocks;
+    std::vector<std::unique_ptr<Block>> mRetired;
+    std::array<FrontEntry, kFrontEntries> mFront{};
+    CodePageIndex mPages;
+    SharedCodePages* mShared = nullptr;
+    uint32_t mSharedHart = 0;
+    uint64_t mGeneration = 0;
+    BlockCacheStats mStats;
+};
+
+#endif
@@ -1,12 +1,17 @@
 #ifndef EMULATOR_CPU_CPU_H
 #define EMULATOR_CPU_CPU_H
 
+#include <atomic>
+#include <bit>
 #include <cstdint>
+#include <cstring>
+#include <limits>
 #include <string>
 #include <vector>
 #include <functional>
 
 class MemoryBus;
+class SharedCodePages;
 
 enum class CpuState {
     Running,
@@ -29,19 +34,88 @@ struct CpuErrorDetail {
     uint64_t data = 0;
 };
 
+constexpr uint32_t kMaxHarts = 64;
+
+// AtomicRmw, CompareExchange and the LR/SC pair are performed on RAM with host
+// atomics; the response carries the value memory held before the access.
+// StoreConditional responds with 0 when the store happened and 1 otherwise.
 enum class MemAccessType {
     Read,
     Write,
-    Fetch
+    Fetch,
+    AtomicRmw,
+    CompareExchange,
+    LoadReserved,
+    StoreConditional
+};
+
+enum class AtomicOp {
+    Swap,
+    Add,
+    And,
+    Or,
+    Xor,
+    Min,
+    Max,
+    MinU,
+    MaxU
 };
 
+inline bool isAtomicAccess(MemAccessType type) {
+    return type == MemAccessType::AtomicRmw || type == MemAccessType::CompareExchange ||
+        type == MemAccessType::LoadReserved || type == MemAccessType::StoreConditional;
+}
+
+// New memory value for an AtomicRmw of the given width; Min/Max compare the
+// operands as signed values of that width.
+inline uint64_t applyAtomicOp(AtomicOp op, uint64_t old, uint64_t operand, uint32_t size) {
+    uint32_t shift = size >= 8 ? 0 : 64 - 8 * size;
+    int64_t oldSigned = static_cast<int64_t>(old << shift) >> shift;
+    int64_t operandSigned = static_cast<int64_t>(operand << shift) >> shift;
+    uint64_t mask = size >= 8 ? ~0ull : (1ull << (8 * size)) - 1;
+    old &= mask;
+    operand &= mask;
+    uint64_t result = operand;
+    switch (op) {
+        case AtomicOp::Swap: result = operand; break;
+        case AtomicOp::Add:  result = old + operand; break;
+        case AtomicOp::And:  result = old & operand; break;
+        case AtomicOp::Or:   result = old | operand; break;
+        case AtomicOp::Xor:  result = old ^ operand; break;
+        case AtomicOp::Min:  result = oldSigned <= operandSigned ? old : operand; break;
+        case AtomicOp::Max:  result = oldSigned >= operandSigned ? old : operand; break;
+        case AtomicOp::MinU: result = old <= operand ? old : operand; break;
+        case AtomicOp::MaxU: result = old >= operand ? old : operand; break;
+    }
+    return result & mask;
+}
+
 struct MemAccess {
     uint64_t address = 0;
     uint32_t size = 0;
     MemAccessType type = MemAccessType::Read;
     uint64_t data = 0;
+    // AtomicRmw operation and CompareExchange comparand.
+    AtomicOp atomicOp = AtomicOp::Swap;
+    uint64_t expected = 0;
+    // Hart that issued the access; filled in by the debugger for bus accesses
+    // made from a hart thread.
+    uint32_t hartId = 0;
+    // Payload of a 16, 32 or 64-byte access in guest (little-endian) byte
+    // order, owned by the issuer: a read fills it and a write stores it;
+    // `data` is unused. A pointer, so the 1-8 byte accesses the bus copies
+    // around stay small.
+    uint8_t* wide = nullptr;
 };
 
+// Widest access the bus carries as one transaction.
+constexpr uint32_t kMaxAccessBytes = 64;
+
+inline bool isWideAccess(const MemAccess& access) {
+    return (access.size == 16 || access.size == 32 || access.size == 64) &&
+        access.wide != nullptr;
+}
+
 struct MemResponse {
     bool success = true;
     uint64_t data = 0;
@@ -49,6 +123,67 @@ struct MemResponse {
     CpuErrorDetail error;
 };
 
+// Host view of a plain memory region. Executors may cache a range and access
+// guest RAM/ROM through it without going through the bus dispatch path.
+// Writes must go through store() (or markDirty()) so snapshots see them.
+struct DirectMemoryRange {
+    static constexpr uint32_t kDirtyPageShift = 12;
+
+    uint8_t* host = nullptr;
+    uint64_t base = 0;
+    uint64_t size = 0;
+    bool writable = false;
+    // One bit per 4 KiB page written since the owner's last snapshot, indexed
+    // from `dirtyOffset` bytes before `base`.
+    std::atomic<uint64_t>* dirty = nullptr;
+    uint64_t dirtyOffset = 0;
+
+    bool contains(uint64_t address, uint64_t length) const {
+        return host != nullptr && address >= base && length <= size &&
+            address - base <= size - length;
+    }
+
+    uint64_t load(uint64_t address, uint32_t length) const {
+        const uint8_t* src = host + (address - base);
+        uint64_t value = 0;
+        if constexpr (std::endian::native == std::endian::little) {
+            std::memcpy(&value, src, length);
+        } else {
+            for (uint32_t i = 0; i < length; ++i) {
+                value |= static_cast<uint64_t>(src[i]) << (8 * i);
+            }
+        }
+        return value;
+    }
+
+    void markDirty(uint64_t address, uint64_t length) const {
+        uint64_t offset = address - base + dirtyOffset;
+        uint64_t first = offset >> kDirtyPageShift;
+        uint64_t last = (offset + length - 1) >> kDirtyPageShift;
+        for (uint64_t page = first; page <= last; ++page) {
+            std::atomic<uint64_t>& word = dirty[page >> 6];
+            uint64_t bit = 1ull << (page & 63);
+            if ((word.load(std::memory_order_relaxed) & bit) == 0) {
+                word.fetch_or(bit, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void store(uint64_t address, uint32_t length, uint64_t value) const {
+        if (dirty != nullptr) {
+            markDirty(address, length);
+        }
+        uint8_t* dst = host + (address - base);
+        if constexpr (std::endian::native == std::endian::little) {
+            std::memcpy(dst, &value, length);
+        } else {
+            for (uint32_t i = 0; i < length; ++i) {
+                dst[i] = static_cast<uint8_t>(value >> (8 * i));
+            }
+        }
+    }
+};
+
 struct StepResult {
     bool success = true;
     uint64_t instructionsExecuted = 0;
@@ -80,12 +215,83 @@ struct TraceRecord {
     bool isBranch = false;
     BranchDetails branch;
     std::vector<std::pair<std::string, std::string>> extra;
+
+    // Empties the record but keeps its buffers' capacity, so a core reusing
+    // one record per hart traces without allocating once they have grown.
+    void reset() {
+        pc = 0;
+        inst = 0;
+        decoded.clear();
+        cycleBegin = 0;
+        cycleEnd = 0;
+        memEvents.clear();
+        isBranch = false;
+        branch = BranchDetails{};
+        extra.clear();
+    }
+};
+
+// Half-open address range [begin, end).
+struct TraceRange {
+    uint64_t begin = 0;
+    uint64_t end = 0;
+
+    bool contains(uint64_t address) const { return address >= begin && address < end; }
+};
+
+// Narrows a trace to the instructions of interest. Empty range lists match
+// everything. The PC, cycle, skip and sampling checks run in
+// ICpuDebugger::shouldTrace() before a core builds the record; data ranges
+// need the record's memory events and are checked in logTrace().
+struct TraceFilter {
+    std::vector<TraceRange> pcRanges;
+    // Kept when any non-fetch memory event falls inside; needs memory events
+    // in the trace.
+    std::vector<TraceRange> dataRanges;
+    uint64_t cycleBegin = 0;
+    uint64_t cycleEnd = std::numeric_limits<uint64_t>::max();
+    // Instructions each hart runs untraced once the options are applied.
+    uint64_t skipInstructions = 0;
+    // Keeps one of every sampleEvery instructions that pass the other checks.
+    uint64_t sampleEvery = 1;
+
+    bool matchesPc(uint64_t pc) const {
+        if (pcRanges.empty()) {
+            return true;
+        }
+        for (const TraceRange& range : pcRanges) {
+            if (range.contains(pc)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool inWindow(uint64_t cycle) const { return cycle >= cycleBegin && cycle < cycleEnd; }
+
+    bool matchesData(const std::vector<MemAccessEvent>& events) const {
+        if (dataRanges.empty()) {
+            return true;
+        }
+        for (const MemAccessEvent& event : events) {
+            if (event.type == MemAccessType::Fetch) {
+                continue;
+            }
+            for (const TraceRange& range : dataRanges) {
+                if (range.contains(event.address)) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
 };
 
 struct TraceOptions {
     bool logInstruction = true;
     bool logMemEvents = true;
     bool logBranchPrediction = true;
+    TraceFilter filter;
 };
 
 using TraceFormatter = std::function<std::string(const TraceRecord&, const TraceOptions&)>;
@@ -98,6 +304,11 @@ public:
 
     virtual MemResponse busRead(const MemAccess& access) = 0;
     virtual MemResponse busWrite(const MemAccess& access) = 0;
+    virtual MemResponse busAtomic(const MemAccess& access) = 0;
+    virtual bool getDirectMemory(uint64_t address, DirectMemoryRange* range) = 0;
+    // Checked before each instruction while hasBreakpoints() is true. Also
+    // returns true right after an access hit a watchpoint, so the core stops
+    // behind the accessing instruction.
     virtual bool isBreakpoint(uint64_t address) = 0;
     virtual bool hasBreakpoints() = 0;
 
@@ -105,6 +316,20 @@ public:
     virtual void setTraceFormatter(TraceFormatter formatter) = 0;
     virtual void logTrace(const TraceRecord& record) = 0;
     virtual const TraceOptions& getTraceOptions() const = 0;
+    // Asked by tracing cores before they build a record for the instruction
+    // at `pc`; false means skip the record and run the instruction untraced.
+    // Call it once per instruction, from the hart's own thread.
+    virtual bool shouldTrace(uint64_t pc, uint64_t cycle) = 0;
+    // A store the core made through direct memory landed in code that the
+    // harts in `harts` (bit i for hart i, never the caller) may have decoded,
+    // as told by SharedCodePages::harts(). Their caches are invalidated before
+    // their next batch.
+    virtual void onCodeWritten(uint64_t address, uint64_t size, uint64_t harts) = 0;
+};
+
+enum class ExecutionEngine {
+    Interpreter,
+    Threaded
 };
 
 class ICpuExecutor {
@@ -126,6 +351,72 @@ public:
     virtual void setDebugger(ICpuDebugger* debugger) = 0;
 
     virtual uint32_t getRegisterCount() const = 0;
+
+    // Called when memory that may hold code is modified by someone other than
+    // the executor itself. Executors that cache decoded instructions drop
+    // anything overlapping the range, which may be the whole address space.
+    virtual void invalidateCode(uint64_t address, uint64_t size) {
+        (void)address;
+        (void)size;
+    }
+
+    // Called on every hart of a multi-hart machine. Executors that cache
+    // decoded code mark the pages they decode from in `pages` as `hart` and,
+    // after each direct-memory store, report stores into pages other harts
+    // marked through ICpuDebugger::onCodeWritten(); they return true. Harts
+    // returning false only hear about code writes made on the bus, all of them.
+    virtual bool shareCodePages(SharedCodePages* pages, uint32_t hart) {
+        (void)pages;
+        (void)hart;
+        return false;
+    }
+
+    // Called before a batch when the ranges getDirectMemory() hands out have
+    // changed, e.g. because a watchpoint now withholds a page. Executors drop
+    // every cached DirectMemoryRange.
+    virtual void invalidateDirectMemory() {}
+
+    // Called by the debugger whenever trace options change, so executors can
+    // switch to a step loop specialized for the active options.
+    virtual void onTraceOptionsChanged(const TraceOptions& options) {
+        (void)options;
+    }
+
+    // Selects how decoded code is dispatched. Returns false if the core does
+    // not provide the requested engine; the interpreter is always available.
+    virtual bool setExecutionEngine(ExecutionEngine engine) {
+        return engine == ExecutionEngine::Interpreter;
+    }
+
+    // Creates another core of the same kind for an SMP system. The caller owns
+    // the returned executor; cores without SMP support return nullptr.
+    virtual ICpuExecutor* createHart(uint32_t hartId) {
+        (void)hartId;
+        return nullptr;
+    }
+
+    // The interrupt controller's output for this hart, delivered by the
+    // debugger before every batch. Cores without interrupts ignore it.
+    virtual void setInterruptLine(bool asserted) {
+        (void)asserted;
+    }
+
+    // True while the core idles in a wait-for-interrupt state. step() then
+    // retires nothing and just advances the cycle counter by maxCycles, which
+    // the debugger caps at the next device event; with no event pending and
+    // the line low it parks the hart until an interrupt arrives.
+    virtual bool isWaitingForInterrupt() const { return false; }
+
+    // Architectural state for machine snapshots. loadState() must also drop
+    // any decoded-code caches, since memory is restored underneath them.
+    virtual bool saveState(std::vector<uint8_t>* out) const {
+        (void)out;
+        return false;
+    }
+    virtual bool loadState(const std::vector<uint8_t>& in) {
+        (void)in;
+        return false;
+    }
 };
 
 #endif
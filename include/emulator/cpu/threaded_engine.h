@@ -0,0 +1,161 @@
+#ifndef EMULATOR_CPU_THREADED_ENGINE_H
+#define EMULATOR_CPU_THREADED_ENGINE_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <utility>
+
+#include "emulator/cpu/block_cache.h"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define EMULATOR_HAS_COMPUTED_GOTO 1
+#else
+#define EMULATOR_HAS_COMPUTED_GOTO 0
+#endif
+
+enum class ThreadedStatus {
+    Next,   // fall through to the next slot
+    Exit,   // control flow left the block (taken branch, code modified)
+    Stop    // halt or fault; the executor should end the step
+};
+
+// Threaded-code execution engine shared by ISA cores. Decoded blocks are
+// compiled into arrays of slots holding a pre-resolved handler, so running a
+// block is a chain of indirect jumps instead of a decode switch.
+//
+// A core plugs in with:
+//     static uint32_t threadedOpIndex(const Inst& inst);        // < kOpCount
+//     template <uint32_t Op>
+//     static ThreadedStatus threadedExecute(Core& core, const Inst& inst);
+//
+// With GCC/Clang the run loop dispatches through a computed-goto label table
+// and the handlers are inlined into it; otherwise it walks the handler
+// pointers.
+template <typename Core, typename Inst, uint32_t kOpCount>
+class ThreadedEngine {
+public:
+    static constexpr uint32_t kMaxOps = 256;
+    static_assert(kOpCount > 0 && kOpCount <= kMaxOps, "threaded engine supports 256 ops");
+
+    using Handler = ThreadedStatus (*)(Core& core, const Inst& inst);
+
+    struct Slot {
+        Handler handler = nullptr;
+        uint32_t op = 0;
+        Inst inst{};
+    };
+
+    using Cache = BlockCache<Slot>;
+    using Block = typename Cache::Block;
+
+    template <typename Decoder>
+    const Block* lookupOrBuild(uint64_t pc, Decoder&& decoder) {
+        return mCache.lookupOrBuild(pc, [&](uint64_t at, Slot* slot, uint32_t* length) {
+            BlockDecodeStatus status = decoder(at, &slot->inst, length);
+            if (status != BlockDecodeStatus::Fault) {
+                slot->op = std::min(Core::threadedOpIndex(slot->inst), kOpCount - 1);
+                slot->handler = kHandlers[slot->op];
+            }
+            return status;
+        });
+    }
+
+    bool invalidateRange(uint64_t address, uint64_t size) {
+        return mCache.invalidateRange(address, size);
+    }
+
+    void clear() { mCache.clear(); }
+    void share(SharedCodePages* pages, uint32_t hart) { mCache.share(pages, hart); }
+    const BlockCacheStats& stats() const { return mCache.stats(); }
+
+    // Runs at most `budget` slots from the start of `block` and returns how
+    // many executed. `status` receives the status of the last slot.
+    static uint64_t run(Core& core, const Block& block, uint64_t budget, ThreadedStatus* status);
+
+private:
+    template <size_t... Ops>
+    static constexpr std::array<Handler, kOpCount> makeHandlers(std::index_sequence<Ops...>) {
+        return {{&Core::template threadedExecute<static_cast<uint32_t>(Ops)>...}};
+    }
+
+    static constexpr std::array<Handler, kOpCount> kHandlers =
+        makeHandlers(std::make_index_sequence<kOpCount>{});
+
+    Cache mCache;
+};
+
+#if EMULATOR_HAS_COMPUTED_GOTO
+
+#define EMULATOR_TC_ROW(M, h) \
+    M(h##0) M(h##1) M(h##2) M(h##3) M(h##4) M(h##5) M(h##6) M(h##7) \
+    M(h##8) M(h##9) M(h##A) M(h##B) M(h##C) M(h##D) M(h##E) M(h##F)
+#define EMULATOR_TC_ALL(M) \
+    EMULATOR_TC_ROW(M, 0x0) EMULATOR_TC_ROW(M, 0x1) EMULATOR_TC_ROW(M, 0x2) \
+    EMULATOR_TC_ROW(M, 0x3) EMULATOR_TC_ROW(M, 0x4) EMULATOR_TC_ROW(M, 0x5) \
+    EMULATOR_TC_ROW(M, 0x6) EMULATOR_TC_ROW(M, 0x7) EMULATOR_TC_ROW(M, 0x8) \
+    EMULATOR_TC_ROW(M, 0x9) EMULATOR_TC_ROW(M, 0xA) EMULATOR_TC_ROW(M, 0xB) \
+    EMULATOR_TC_ROW(M, 0xC) EMULATOR_TC_ROW(M, 0xD) EMULATOR_TC_ROW(M, 0xE) \
+    EMULATOR_TC_ROW(M, 0xF)
+
+#define EMULATOR_TC_LABEL_ADDR(n) &&tc_op_##n,
+#define EMULATOR_TC_LABEL_BODY(n) \
+    tc_op_##n: \
+    if constexpr ((n) < kOpCount) { \
+        *status = Core::template threadedExecute<(n)>(core, slot->inst); \
+    } \
+    ++slot; \
+    if (*status != ThreadedStatus::Next || slot == end) { \
+        goto tc_done; \
+    } \
+    goto *kLabels[slot->op];
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+template <typename Core, typename Inst, uint32_t kOpCount>
+uint64_t ThreadedEngine<Core, Inst, kOpCount>::run(Core& core, const Block& block,
+    uint64_t budget, ThreadedStatus* status) {
+    static const void* const kLabels[kMaxOps] = {EMULATOR_TC_ALL(EMULATOR_TC_LABEL_ADDR)};
+    const Slot* begin = block.insts.data();
+    const Slot* slot = begin;
+    const Slot* end = begin + std::min<uint64_t>(budget, block.insts.size());
+    *status = ThreadedStatus::Next;
+    if (slot == end) {
+        return 0;
+    }
+    goto *kLabels[slot->op];
+    EMULATOR_TC_ALL(EMULATOR_TC_LABEL_BODY)
+tc_done:
+    return static_cast<uint64_t>(slot - begin);
+}
+
+#pragma GCC diagnostic pop
+
+#undef EMULATOR_TC_LABEL_BODY
+#undef EMULATOR_TC_LABEL_ADDR
+#undef EMULATOR_TC_ALL
+#undef EMULATOR_TC_ROW
+
+#else
+
+template <typename Core, typename Inst, uint32_t kOpCount>
+uint64_t ThreadedEngine<Core, Inst, kOpCount>::run(Core& core, const Block& block,
+    uint64_t budget, ThreadedStatus* status) {
+    const Slot* begin = block.insts.data();
+    const Slot* end = begin + std::min<uint64_t>(budget, block.insts.size());
+    *status = ThreadedStatus::Next;
+    const Slot* slot = begin;
+    while (slot != end) {
+        *status = slot->handler(core, slot->inst);
+        ++slot;
+        if (*status != ThreadedStatus::Next) {
+            break;
+        }
+    }
+    return static_cast<uint64_t>(slot - begin);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef EMULATOR_DEBUGGER_BREAKPOINTS_H
+#define EMULATOR_DEBUGGER_BREAKPOINTS_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "emulator/cpu/cpu.h"
+#include "emulator/debugger/expression_parser.h"
+
+// Address sets consulted by hart threads on every instruction or access and
+// edited by debugger commands. Lookups never lock: every edit publishes a new
+// immutable table, and a hashed filter over 4 KiB pages rejects addresses on
+// pages without an entry with one load and a bit test. Retired tables stay
+// alive until reclaim(), so a reader still holding an old one is safe.
+template <typename Table>
+class PublishedTable {
+public:
+    const Table* get() const { return mCurrent.load(std::memory_order_acquire); }
+
+    // Callers serialize edits with lock().
+    void publish(std::unique_ptr<Table> table) {
+        mCurrent.store(table.get(), std::memory_order_release);
+        mTables.push_back(std::move(table));
+    }
+
+    // Frees every retired table. Only call once no reader can still hold a
+    // table it loaded before the last publish().
+    void reclaim() {
+        std::lock_guard<std::mutex> guard(mMutex);
+        if (mTables.size() > 1) {
+            mTables.erase(mTables.begin(), mTables.end() - 1);
+        }
+    }
+
+    std::unique_lock<std::mutex> lock() { return std::unique_lock<std::mutex>(mMutex); }
+
+private:
+    std::atomic<const Table*> mCurrent{nullptr};
+    std::vector<std::unique_ptr<Table>> mTables;
+    std::mutex mMutex;
+};
+
+class PageFilter {
+public:
+    static constexpr uint32_t kPageShift = 12;
+    static constexpr uint64_t kBits = 4096;
+
+    void add(uint64_t firstPage, uint64_t lastPage) {
+        if (lastPage - firstPage >= kBits) {
+            mBits.fill(~0ull);
+            return;
+        }
+        for (uint64_t page = firstPage; page <= lastPage; ++page) {
+            mBits[(page % kBits) >> 6] |= 1ull << (page & 63);
+        }
+    }
+
+    bool mayContain(uint64_t page) const {
+        return (mBits[(page % kBits) >> 6] >> (page & 63)) & 1u;
+    }
+
+private:
+    std::array<uint64_t, kBits / 64> mBits{};
+};
+
+// Breakpoint addresses, each with an optional condition compiled once when
+// the breakpoint is set.
+class BreakpointSet {
+public:
+    // Adding an existing address replaces its condition and returns false.
+    bool add(uint64_t address, std::shared_ptr<const CompiledExpression> condition = nullptr);
+    bool remove(uint64_t address);
+    bool contains(uint64_t address) const { return find(address, nullptr); }
+    // Like contains(); `condition` receives the breakpoint's condition, or
+    // null when it has none. The pointer stays valid until reclaim().
+    bool find(uint64_t address, const CompiledExpression** condition) const {
+        const Table* table = mTable.get();
+        if (table == nullptr || !table->filter.mayContain(address >> PageFilter::kPageShift)) {
+            return false;
+        }
+        return table->findExact(address, condition);
+    }
+    bool empty() const { return mCount.load(std::memory_order_relaxed) == 0; }
+    // `conditions`, when given, receives each address's condition or null.
+    std::vector<uint64_t> list(
+        std::vector<std::shared_ptr<const CompiledExpression>>* conditions = nullptr) const;
+    // See PublishedTable::reclaim().
+    void reclaim() { mTable.reclaim(); }
+
+private:
+    struct Table {
+        std::vector<uint64_t> addresses;
+        // Parallel to `addresses`; shared between tables so edits don't
+        // recompile other breakpoints' conditions.
+        std::vector<std::shared_ptr<const CompiledExpression>> conditions;
+        PageFilter filter;
+
+        bool findExact(uint64_t address, const CompiledExpression** condition) const;
+    };
+
+    void publish(std::vector<uint64_t> addresses,
+        std::vector<std::shared_ptr<const CompiledExpression>> conditions);
+
+    mutable PublishedTable<Table> mTable;
+    std::atomic<size_t> mCount{0};
+};
+
+enum class WatchKind : uint8_t {
+    Read = 1,
+    Write = 2,
+    Access = 3
+};
+
+struct Watchpoint {
+    uint64_t address = 0;
+    uint64_t size = 1;
+    WatchKind kind = WatchKind::Write;
+};
+
+// Data watchpoints. Watched pages are withheld from direct memory ranges, so
+// accesses to them take the bus path where match() is checked; every other
+// page keeps its fast path.
+class WatchpointSet {
+public:
+    bool add(const Watchpoint& watch);
+    bool remove(uint64_t address);
+    bool empty() const { return mCount.load(std::memory_order_relaxed) == 0; }
+    std::vector<Watchpoint> list() const;
+    // See PublishedTable::reclaim().
+    void reclaim() { mTable.reclaim(); }
+
+    bool match(uint64_t address, uint64_t size, bool write, Watchpoint* hit) const;
+    bool isPageWatched(uint64_t page) const;
+    // Shrinks `range` to the unwatched pages around `address`; false when the
+    // page holding `address` is watched itself.
+    bool clipDirect(uint64_t address, DirectMemoryRange* range) const;
+
+private:
+    struct Table {
+        std::vector<Watchpoint> watches;
+        // Merged, sorted [first, last] page spans covered by a watchpoint.
+        std::vector<std::pair<uint64_t, uint64_t>> pages;
+        PageFilter filter;
+    };
+
+    void publish(std::vector<Watchpoint> watches);
+
+    mutable PublishedTable<Table> mTable;
+    std::atomic<size_t> mCount{0};
+};
+
+#endif
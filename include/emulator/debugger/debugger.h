@@ -3,6 +3,9 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
 #include <mutex>
 #include <sstream>
 #include <string>
@@ -10,8 +13,19 @@
 #include <memory>
 
 #include "emulator/bus/bus.h"
+#include "emulator/cpu/block_cache.h"
 #include "emulator/cpu/cpu.h"
+#include "emulator/debugger/breakpoints.h"
+#include "emulator/debugger/input_log.h"
+#include "emulator/debugger/pacer.h"
+#include "emulator/debugger/perf_report.h"
+#include "emulator/debugger/profiler.h"
+#include "emulator/debugger/seqlock.h"
+#include "emulator/debugger/symbols.h"
+#include "emulator/snapshot/snapshot.h"
 
+class BinaryTraceWriter;
+class InterruptController;
 class SdlDisplayDevice;
 class Terminal;
 enum class FocusPanel;
@@ -24,31 +38,177 @@ struct CpuControl {
 struct EmulatorRunState {
     std::atomic<CpuState> state{CpuState::Pause};
     std::atomic<bool> shouldExit{false};
-    std::atomic<uint32_t> stepsPending{0};
+    // Bumped by debugger commands and guest input; each hart loop shrinks its
+    // next batch when it sees a new value so the request is handled promptly.
+    std::atomic<uint64_t> attention{0};
+    // Set by pause(); a fast-forward stops at its next chunk when it sees it.
+    std::atomic<bool> pauseRequested{false};
+};
+
+struct HartStatus {
+    uint32_t id = 0;
+    bool paused = false;
+    bool halted = false;
+    uint64_t pc = 0;
+    uint64_t cycle = 0;
+    uint64_t instructions = 0;
+    // Stopped in front of a breakpoint it reached.
+    bool breakpoint = false;
+    // Why the hart halted; None while it can run.
+    CpuErrorType error = CpuErrorType::None;
+};
+
+struct BatchStats {
+    uint64_t batches = 0;
+    uint64_t grows = 0;
+    uint64_t shrinks = 0;
+    uint64_t eventLimited = 0;
+    uint32_t current = 0;
+    uint32_t smallest = 0;
+    uint32_t largest = 0;
 };
 
 class Debugger : public ICpuDebugger {
 public:
+    static constexpr uint64_t kDefaultHartQuantum = 10000;
+    static constexpr uint64_t kDefaultCheckpointInterval = 10000000;
+    static constexpr uint64_t kDefaultCheckpointBudget = 256ull << 20;
+    // Bounds of the adaptive batch size each hart loop runs between checks.
+    static constexpr uint32_t kMinInstructionsPerBatch = 64;
+    static constexpr uint32_t kMaxInstructionsPerBatch = 1u << 20;
+
     Debugger(ICpuExecutor* cpu, MemoryBus* bus);
     ~Debugger() override;
 
+    // Harts share the bus and each run on their own host thread. A hart never
+    // gets more than the quantum ahead of the slowest running hart. Add harts
+    // before run() and before opening a binary trace.
+    uint32_t addHart(ICpuExecutor* cpu);
+    uint32_t getHartCount() const { return static_cast<uint32_t>(mHarts.size()); }
+    void setHartQuantum(uint64_t cycles);
+    bool selectHart(uint32_t id);
+    bool pauseHart(uint32_t id);
+    bool resumeHart(uint32_t id);
+    HartStatus getHartStatus(uint32_t id) const;
+
+    // Machine snapshots; the machine must be paused. Waits for harts that are
+    // still finishing a batch.
+    bool takeSnapshot(MachineSnapshot* out, std::string* error);
+    bool restoreSnapshot(const MachineSnapshot& snapshot, std::string* error);
+
+    // Reverse execution: a single-hart machine takes a checkpoint every
+    // `cycles` cycles (0 disables them) and drops the oldest ones once they
+    // hold more than the budget. travelTo() restores the nearest checkpoint at
+    // or before the given retired-instruction count and replays forward to it.
+    void setCheckpointInterval(uint64_t cycles);
+    void setCheckpointBudget(uint64_t bytes);
+    size_t getCheckpointCount();
+    bool travelTo(uint64_t instruction, std::string* error);
+
+    // Fast-forward: runs a paused single-hart machine on the calling thread
+    // until it has retired `target` instructions in total (exactly, even
+    // mid-batch) or reached cycle `target`. The core runs its untraced loop;
+    // breakpoints, watchpoints, status updates and checkpoints are off, and
+    // it only syncs when a device event is due. Checkpoints restart from the
+    // point reached. Between chunks of kMaxInstructionsPerBatch instructions
+    // it runs pending runOnMachine() tasks, and pause(), exit, or a task that
+    // resumes or steps the machine ends it early with an error.
+    enum class RunUntilUnit {
+        Instructions,
+        Cycles
+    };
+    bool runUntil(uint64_t target, RunUntilUnit unit, std::string* error);
+
     void setSdl(SdlDisplayDevice* sdl);
+    // Delivers the controller's output to each hart before every batch and
+    // wakes harts parked in wait-for-interrupt when it asserts.
+    void setInterruptController(InterruptController* controller);
     void run(bool interactive);
+    // Non-interactive runs start paused instead, e.g. until a remote
+    // debugger resumes them.
+    void setStartPaused(bool paused) { mStartPaused = paused; }
+    // Non-interactive runs keep a halted machine around until quit, so it
+    // can still be inspected.
+    void setHoldOnHalt(bool hold) { mHoldOnHalt = hold; }
+    // Non-interactive runs feed stdin to the UART and send the current log
+    // context to stderr unless turned off, e.g. for machines sharing a
+    // process that set up their own log context.
+    void setHostInput(bool enabled) { mHostInput = enabled; }
+    // Non-interactive runs end once any hart passes `cycles` (0: no limit).
+    // Checked at the input loop's poll rate, so the run overshoots a little.
+    void setCycleLimit(uint64_t cycles) { mCycleLimit = cycles; }
+    bool cycleLimitReached() const { return mCycleLimitReached; }
+
+    // External input from the terminal, stdin or the SDL window. Normally it
+    // reaches the guest at once; while recording it waits for the
+    // timekeeper's next sync point and is logged with that cycle; a replay
+    // drops it.
+    void injectUartInput(const uint8_t* data, size_t length);
+    void injectKey(uint32_t key);
+    // Call before run(). Recording logs every input with the cycle it was
+    // delivered at; a replay delivers a log at exactly those cycles through
+    // the event scheduler instead of reading stdin or polling the window.
+    // Exact for single-hart machines; several harts race each other anyway.
+    bool recordInput(const std::string& path, std::string* error);
+    bool replayInput(const std::string& path, std::string* error);
+
+    // Execution control behind the run, step and pause commands, also used
+    // by remote debuggers. step() runs the selected hart only.
+    bool resume(std::string* error);
+    bool step(uint32_t count, std::string* error);
+    // Pauses a running machine; harts stop at the end of their batch.
+    void pause();
+    CpuState getState() const { return mState.state.load(std::memory_order_acquire); }
+    // Paused or halted, with no batch running and no steps left to run.
+    bool isStopped();
+    uint32_t getSelectedHart() const { return mSelectedHart.load(std::memory_order_acquire); }
 
     std::vector<uint8_t> scanMemory(uint64_t address, uint32_t length);
+    // Block transfers run through runOnMachine(); `done` gets the number of
+    // bytes moved before the first failing address.
+    bool readMemory(uint64_t address, void* out, uint64_t length, uint64_t* done);
+    bool writeMemory(uint64_t address, const void* data, uint64_t length, uint64_t* done);
     std::vector<uint64_t> readRegisters();
+    // General registers of the selected hart, not counting the PC.
+    uint32_t getRegisterCount() const;
+    // Writes a register of the selected hart between batches; register
+    // getRegisterCount() names the PC.
+    bool writeRegister(uint32_t regId, uint64_t value);
     void printRegisters();
     uint64_t evalExpression(const std::string& expression);
     void addBreakpoint(uint64_t address);
+    // Sets a breakpoint that only stops when `condition` evaluates non-zero
+    // on the hart reaching it. The condition is compiled here, once.
+    bool addBreakpoint(uint64_t address, const std::string& condition, std::string* error);
     void removeBreakpoint(uint64_t address);
     bool hasBreakpoints() override;
+    // A hit pauses the machine after the accessing instruction. Changes reach
+    // running harts at their next batch.
+    bool addWatchpoint(const Watchpoint& watch);
+    bool removeWatchpoint(uint64_t address);
+    // Commands that read guest memory or registers run through
+    // runOnMachine(); the rest run on the calling thread.
     bool processCommand(const std::string& command);
+    // Runs `task` on a hart thread between two batches, or on the calling
+    // thread when no hart thread is running, and returns once it has run. On
+    // a single-hart machine the task never overlaps guest execution; other
+    // harts keep running, as they do while device events are handled. Must
+    // not be called with CpuControl::mutex held.
+    void runOnMachine(const std::function<void()>& task);
 
     void setRegisterCount(uint32_t count);
     void setCpuFrequency(uint32_t cpuFreq);
+    // Realtime pacing holds the timekeeper hart to the CPU frequency in host
+    // time; max speed runs as fast as the host allows. Can change while
+    // running.
+    void setPacing(PacingMode mode);
+    PacingMode getPacing() const;
+    PacingStats getPacingStats() const;
 
     MemResponse busRead(const MemAccess& access) override;
     MemResponse busWrite(const MemAccess& access) override;
+    MemResponse busAtomic(const MemAccess& access) override;
+    bool getDirectMemory(uint64_t address, DirectMemoryRange* range) override;
 
     bool isBreakpoint(uint64_t address) override;
 
@@ -56,33 +216,178 @@ public:
     void setTraceFormatter(TraceFormatter formatter) override;
     void logTrace(const TraceRecord& record) override;
     const TraceOptions& getTraceOptions() const override;
+    bool shouldTrace(uint64_t pc, uint64_t cycle) override;
+    void onCodeWritten(uint64_t address, uint64_t size, uint64_t harts) override;
+    // configureTrace() for a machine that has run: waits for the harts to
+    // stop and fails while they are running.
+    bool updateTrace(const TraceOptions& options, std::string* error);
+
+    // Routes trace records to a chunked binary file drained by a background
+    // thread instead of the formatted log. Decode it with tools/trace_decode.
+    bool openBinaryTrace(const std::string& path, bool compress, std::string* error);
+    void closeBinaryTrace();
+
+    BatchStats getBatchStats() const;
+
+    // Counters since construction or the last reset. With an interval set,
+    // non-interactive runs also write the report as a JSON line to the log
+    // that often and once more when the run ends.
+    PerfReport getPerfReport();
+    void resetPerfCounters();
+    void setPerfDumpInterval(uint32_t milliseconds);
+
+    // Guest symbols for profile reports, from an ELF file or an nm-style map.
+    bool loadSymbols(const std::string& path, std::string* error);
+    const SymbolMap& getSymbols() const { return mSymbols; }
+    // Sampling starts and stops while running; samples are kept until
+    // cleared.
+    PcProfiler& profiler() { return mProfiler; }
+
+    // Page-granular bus traffic counters. Enabling routes every core access
+    // through the bus, so expect a slowdown while it is on.
+    void setHeatmapEnabled(bool enabled);
+    // One "mapping,address,reads,writes,fetches" CSV row per touched cell.
+    bool exportHeatmap(const std::string& path, std::string* error) const;
 
 private:
-    ICpuExecutor* mCpu = nullptr;
+    // What the status line shows, published by each hart after every batch.
+    struct HartSnapshot {
+        uint64_t pc = 0;
+        uint64_t cycle = 0;
+        uint64_t instructions = 0;
+    };
+
+    struct ControlTask {
+        const std::function<void()>* run = nullptr;
+        bool done = false;
+    };
+
+    struct Hart {
+        ICpuExecutor* cpu = nullptr;
+        std::atomic<bool> paused{false};
+        std::atomic<bool> halted{false};
+        // Set while a batch runs; changed under CpuControl::mutex.
+        bool executing = false;
+        // The last batch stopped on a breakpoint; the next one starts by
+        // executing that instruction instead of stopping again.
+        // Read by getHartStatus() from other threads.
+        std::atomic<bool> breakpointStop{false};
+        std::atomic<bool> directInvalidatePending{false};
+        // Parked in wait-for-interrupt with nothing scheduled; does not hold
+        // the other harts back.
+        std::atomic<bool> sleeping{false};
+        std::atomic<uint32_t> stepsPending{0};
+        // Published after every batch for the skew check and status display.
+        std::atomic<uint64_t> cycle{0};
+        std::atomic<uint64_t> instructions{0};
+        SeqLock<HartSnapshot> snapshot;
+        // Written by the hart thread only.
+        PerfCounter stepNs;
+        PerfCounter syncNs;
+        uint64_t nextSampleCycle = 0;
+        uint64_t profileGeneration = 0;
+        // Trace filter progress, reset by configureTrace().
+        uint64_t traceSeen = 0;
+        uint64_t traceMatched = 0;
+        // Owned by the hart thread.
+        uint32_t batchInstructions = 0;
+        uint64_t attentionSeen = 0;
+        // Code writes made from other threads, applied before the next batch.
+        // Past kMaxPendingInvalidations ranges they collapse into one flush.
+        std::mutex invalidateMutex;
+        std::vector<std::pair<uint64_t, uint64_t>> pendingInvalidations;
+        bool invalidateAll = false;
+        std::atomic<bool> invalidatePending{false};
+        // The core marks its decoded pages in mCodePages.
+        bool sharesCodePages = false;
+    };
+
+    std::vector<std::unique_ptr<Hart>> mHarts;
+    // Set up once a second hart is added.
+    std::unique_ptr<SharedCodePages> mCodePages;
+    std::atomic<uint32_t> mSelectedHart{0};
+    uint64_t mHartQuantumCycles = kDefaultHartQuantum;
     MemoryBus* mBus = nullptr;
+    uint32_t mWriteListenerId = 0;
     SdlDisplayDevice* mSdl = nullptr;
+    InterruptController* mInterrupts = nullptr;
     uint32_t mRegisterCount = 0;
     uint32_t mCpuFrequency = 1000000;
     uint32_t mSyncThresholdCycles = 1000;
-    std::vector<uint64_t> mBreakpoints;
-    std::mutex mMutex;
+    // Longest batch while pacing, so sleeps stay short and interrupts are
+    // not held back behind a far device event.
+    uint32_t mPacingSliceCycles = 1000;
+    std::atomic<PacingMode> mPacing{PacingMode::MaxSpeed};
+    std::atomic<bool> mPacerRebase{true};
+    // Driven by the timekeeper hart thread only.
+    Pacer mPacer;
+    BreakpointSet mBreakpoints;
+    WatchpointSet mWatchpoints;
 
     EmulatorRunState mState;
     CpuControl mControl;
     bool mIsInteractive = false;
+    bool mStartPaused = false;
+    bool mHoldOnHalt = false;
+    bool mHostInput = true;
+    uint64_t mCycleLimit = 0;
+    bool mCycleLimitReached = false;
 
     struct CommandEntry {
         std::string name;
         std::string help;
         bool (Debugger::*Handler)(std::istringstream&);
+        // Reads guest state, so it runs between batches.
+        bool onMachine = false;
     };
     std::vector<CommandEntry> mCommands;
     void registerCommands();
 
-    void cpuThreadLoop();
+    ICpuExecutor* currentCpu() const;
+    // Whether the breakpoint at `address`, if any, stops `cpu` there.
+    bool breakpointFires(ICpuExecutor* cpu, uint64_t address) const;
+    bool isHartActive(const Hart& hart) const;
+    uint64_t skewHorizon(uint32_t index) const;
+    bool interruptAsserted(uint32_t index) const;
+    uint32_t timekeeperIndex() const;
+    void invalidateHarts(uint64_t address, uint64_t size);
+    void queueInvalidation(Hart& hart, uint64_t address, uint64_t size);
+    void applyPendingInvalidations(uint32_t index);
+    void onHartHalted(uint32_t index);
+    void checkWatchpoint(const MemAccess& access, bool write);
+    void hartThreadLoop(uint32_t index);
+    std::vector<ICpuExecutor*> hartCpus() const;
+    bool waitForHartsIdle(std::unique_lock<std::mutex>& lock, std::string* error);
+    // Frees retired breakpoint and watchpoint tables once no hart is in a
+    // batch. Called with mControl.mutex held.
+    void reclaimRetiredTables();
+
+    // Instructions retired by each batch after a checkpoint are recorded so a
+    // replay runs device events at exactly the same points.
+    struct Checkpoint {
+        uint64_t instructions = 0;
+        uint64_t bytes = 0;
+        MachineSnapshot snapshot;
+        std::vector<uint64_t> batches;
+    };
+    bool checkpointsEnabled() const;
+    void pushCheckpoint();
+    void resetCheckpoints();
+    void recordBatch(uint64_t instructions);
+    bool travelLocked(uint64_t target, std::string* error);
+    bool replayFrom(const Checkpoint& checkpoint, uint64_t target,
+        const std::vector<uint64_t>* breakpoints, uint64_t* lastHit, std::string* error);
     void sdlThreadLoop();
     void runPlainInputLoop();
 
+    // Timekeeper hart, under the bus device lock, after the batch's events.
+    void syncInput(uint64_t cycle);
+    void deliverReplayInput(uint64_t cycle);
+    // Returns how many bytes (or keys) the device took.
+    size_t deliverInput(const InputEvent& event);
+    // After a restore: skips the events delivered at or before `cycle`.
+    void rewindInputReplay(uint64_t cycle);
+
     void setDefaultLogHandler();
     void setTerminalLogHandler();
 
@@ -94,19 +399,99 @@ private:
     bool cmdMem(std::istringstream& args);
     bool cmdEval(std::istringstream& args);
     bool cmdBp(std::istringstream& args);
+    bool cmdWatch(std::istringstream& args);
     bool cmdLog(std::istringstream& args);
+    bool cmdTrace(std::istringstream& args);
     bool cmdHelp(std::istringstream& args);
+    bool cmdBatch(std::istringstream& args);
+    bool cmdPace(std::istringstream& args);
+    bool cmdPerf(std::istringstream& args);
+    bool cmdProfile(std::istringstream& args);
+    bool cmdHeat(std::istringstream& args);
+    bool cmdHart(std::istringstream& args);
+    bool cmdSnap(std::istringstream& args);
+    bool cmdRstep(std::istringstream& args);
+    bool cmdRcontinue(std::istringstream& args);
+    bool cmdUntil(std::istringstream& args);
+
+    void requestAttention();
+    uint32_t nextBatchSize(Hart& hart, const StepResult& result, uint32_t steps,
+        bool eventLimited);
 
+    // Stores the hart's cycle count and its status snapshot. Called by the
+    // hart's thread, or by others while the hart is idle.
+    void publishStatus(Hart& hart);
+    // Runs queued control tasks; CpuControl::mutex is held on entry and exit
+    // but released while a task runs.
+    void runControlTasks(std::unique_lock<std::mutex>& lock);
+    // Terminal thread only: formats the status line from the snapshots.
     void updateStatusDisplay();
+    void refreshStatusDisplay();
+    PerfReport collectPerfTotals() const;
+    void dumpPerf();
 
     std::unique_ptr<Terminal> mTerminal;
-    uint64_t mTotalInstructions = 0;
     bool mLastCommandSuccess = true;
 
     TraceOptions mTraceOptions;
     TraceFormatter mTraceFormatter;
+    std::unique_ptr<BinaryTraceWriter> mBinaryTrace;
+    std::map<std::string, MachineSnapshot> mSnapshots;
+
+    // Touched by the hart thread during a batch and by commands while the
+    // hart is idle with CpuControl::mutex held.
+    std::deque<Checkpoint> mCheckpoints;
+    uint64_t mCheckpointInterval = kDefaultCheckpointInterval;
+    uint64_t mCheckpointBudget = kDefaultCheckpointBudget;
+    uint64_t mCheckpointBytes = 0;
+    uint64_t mNextCheckpointCycle = 0;
+    std::atomic<bool> mReplaying{false};
+
+    enum class InputMode {
+        Live,
+        Record,
+        Replay
+    };
+    InputMode mInputMode = InputMode::Live;
+    InputLogWriter mInputLog;
+    std::mutex mPendingInputMutex;
+    std::vector<InputEvent> mPendingInput;
+    std::atomic<bool> mInputPending{false};
+    // Owned by the timekeeper hart while running. Only the next event is
+    // scheduled; it just ends the batch there so syncInput() sees it.
+    std::vector<InputEvent> mReplayInput;
+    size_t mReplayNext = 0;
+    uint64_t mReplayArmedCycle = EventScheduler::kNoEvent;
+
+    // Adaptive batch sizing counters, summed over all harts.
+    std::atomic<uint64_t> mBatchCount{0};
+    std::atomic<uint64_t> mBatchGrows{0};
+    std::atomic<uint64_t> mBatchShrinks{0};
+    std::atomic<uint64_t> mBatchEventLimited{0};
+    std::atomic<uint32_t> mBatchCurrent{0};
+    std::atomic<uint32_t> mBatchSmallest{0};
+    std::atomic<uint32_t> mBatchLargest{0};
+
+    PerfCounter mSyncs;
+    PerfCounter mEventsRun;
+    PerfCounter mTraceRecords;
+    std::mutex mPerfMutex;
+    const std::chrono::steady_clock::time_point mPerfEpoch = std::chrono::steady_clock::now();
+    PerfReport mPerfBaseline;
+    uint32_t mPerfDumpIntervalMs = 0;
+    PcProfiler mProfiler;
+    SymbolMap mSymbols;
+
+    // Guarded by CpuControl::mutex.
+    std::deque<ControlTask*> mControlTasks;
+    uint32_t mLiveHartThreads = 0;
+    std::atomic<bool> mControlTasksPending{false};
+    // While runUntil() drives hart 0, hart threads stay parked and leave
+    // control tasks to it.
+    bool mFastForwarding = false;
 
     std::chrono::steady_clock::time_point mLastCpsTime;
+    std::chrono::steady_clock::time_point mLastStatusTime;
     uint64_t mLastCpsCycles = 0;
 };
 
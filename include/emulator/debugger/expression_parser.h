@@ -3,21 +3,64 @@
 
 #include <string>
 #include <cstdint>
+#include <vector>
 
 class ICpuExecutor;
 class MemoryBus;
 
+// An expression compiled to postfix bytecode. Register names are resolved to
+// ids and numbers to constants when it is compiled, so evaluate() only runs
+// the code: a breakpoint condition checked on every pass costs no parsing.
+// Memory operands read 4 little-endian bytes straight from RAM or ROM host
+// memory; anywhere else, device registers included, they read as 0.
+class CompiledExpression {
+public:
+    static constexpr uint32_t kMaxStack = 32;
+
+    uint64_t evaluate(ICpuExecutor* cpu, MemoryBus* bus) const;
+    const std::string& text() const { return mText; }
+    bool empty() const { return mCode.empty(); }
+
+private:
+    friend class ExpressionParser;
+
+    enum class Op : uint8_t {
+        Const, Pc, Register, Load,
+        Negate, Not, Bool,
+        Add, Sub, Mul, Div,
+        Eq, Ne, Lt, Le, Gt, Ge,
+        // Short-circuit for && and ||: the operand is the jump target.
+        JumpIfZero, JumpIfNonZero
+    };
+
+    struct Insn {
+        Op op;
+        uint64_t operand;
+    };
+
+    std::vector<Insn> mCode;
+    std::string mText;
+};
+
+// Grammar, loosest first: || && (== != < <= > >=) (+ -) (* /) unary (- + !).
+// Operands are numbers (decimal or 0x hex), $pc, $rN or $N registers,
+// (expr) and [expr] memory reads. Division by zero leaves the dividend.
 class ExpressionParser {
 public:
     ExpressionParser(ICpuExecutor* cpu, MemoryBus* bus, const std::string& expr);
+    // Compiles and evaluates in one go; 0 when the expression does not compile.
     uint64_t parse();
 
+    static bool compile(const std::string& expr, CompiledExpression* out, std::string* error);
+
 private:
+    using Op = CompiledExpression::Op;
+
     ICpuExecutor* mCpu;
     MemoryBus* mBus;
     std::string mExpr;
     size_t mPos;
-    
+
     enum class TokenType {
         End,
         Number,
@@ -25,6 +68,8 @@ private:
         Plus, Minus, Multiply, Divide,
         LParen, RParen,
         LBracket, RBracket,
+        Not, AndAnd, OrOr,
+        Eq, Ne, Lt, Le, Gt, Ge,
         Error
     };
 
@@ -35,13 +80,23 @@ private:
     };
 
     Token mCurr;
+    std::vector<CompiledExpression::Insn>* mCode = nullptr;
+    std::string mError;
+    uint32_t mDepth = 0;
+    uint32_t mMaxDepth = 0;
+    uint32_t mNesting = 0;
 
     void nextToken();
-    uint64_t parseExpr();
-    uint64_t parseTerm();
-    uint64_t parseFactor();
-    uint64_t readMemory(uint64_t addr);
-    uint64_t getRegisterValue(const std::string& name);
+    bool compileInto(CompiledExpression* out, std::string* error);
+    void emit(Op op, uint64_t operand = 0);
+    void fail(const std::string& message);
+    void parseOr();
+    void parseAnd();
+    void parseCompare();
+    void parseExpr();
+    void parseTerm();
+    void parseFactor();
+    bool resolveRegister(const std::string& name, Op* op, uint64_t* id);
 };
 
 #endif
@@ -0,0 +1,70 @@
+#ifndef EMULATOR_DEBUGGER_GDB_SERVER_H
+#define EMULATOR_DEBUGGER_GDB_SERVER_H
+
+#include <atomic>
+#include <cstdint>
+#include <set>
+#include <string>
+#include <thread>
+
+class Debugger;
+
+// GDB Remote Serial Protocol stub on a TCP port, one client at a time. It
+// drives the machine through the Debugger's control and block-transfer
+// calls from its own thread, polling a non-blocking socket, so a waiting
+// client costs the harts nothing. Harts appear as threads 1..N; registers
+// are the core's general registers followed by the PC, little-endian.
+class GdbServer {
+public:
+    static constexpr uint32_t kDefaultRegisterBytes = 8;
+    static constexpr size_t kMaxPacketSize = 0x4000;
+
+    explicit GdbServer(Debugger* debugger);
+    ~GdbServer();
+
+    GdbServer(const GdbServer&) = delete;
+    GdbServer& operator=(const GdbServer&) = delete;
+
+    // Listens on 127.0.0.1 unless `anyAddress` is set; port 0 picks a free
+    // port, see getPort().
+    bool start(uint16_t port, bool anyAddress, std::string* error);
+    // Tells a client waiting for the machine how it ended, then closes.
+    void stop();
+    uint16_t getPort() const { return mPort; }
+    void setRegisterBytes(uint32_t bytes) { mRegisterBytes = bytes; }
+
+    // Handles one packet payload. Returns false when the reply is deferred
+    // until the machine stops (continue and step).
+    bool handlePacket(const std::string& payload, std::string* reply);
+    // The stop reply for the machine's current state.
+    std::string stopReply();
+
+private:
+    void serverLoop();
+    void serveClient();
+    bool sendPacket(const std::string& payload);
+    bool sendRaw(const std::string& data);
+    void closeClient();
+
+    std::string readRegisters();
+    bool readMemory(const std::string& args, std::string* reply);
+    bool writeMemory(const std::string& args, const std::string& data, bool binary);
+    std::string setPoint(const std::string& args, bool insert);
+    bool resume(bool stepping);
+
+    Debugger* mDbg;
+    uint32_t mRegisterBytes = kDefaultRegisterBytes;
+    int mListenFd = -1;
+    int mClientFd = -1;
+    uint16_t mPort = 0;
+    bool mNoAck = false;
+    // A continue or step is in flight; its stop reply is still owed.
+    bool mWaiting = false;
+    std::string mInput;
+    // Addresses inserted with Z1, reported as hwbreak rather than swbreak.
+    std::set<uint64_t> mHardwareBreakpoints;
+    std::atomic<bool> mStop{false};
+    std::thread mThread;
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef EMULATOR_DEBUGGER_INPUT_LOG_H
+#define EMULATOR_DEBUGGER_INPUT_LOG_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// On-disk input log layout:
+//   InputLogHeader
+//   { varint cycleDelta, varint tag, payload }*
+// The tag is (value << 1) | kind. A UART record's value is its byte count
+// and the bytes follow; a key record's value is the key code. Cycle deltas
+// are from the previous record (the first from 0), so a run of keystrokes
+// costs a few bytes each. A file cut short by a crash reads up to its last
+// complete record.
+
+constexpr uint32_t kInputLogMagic = 0x4e494d45; // "EMIN"
+constexpr uint32_t kInputLogVersion = 1;
+
+struct InputLogHeader {
+    uint32_t magic = kInputLogMagic;
+    uint32_t version = kInputLogVersion;
+};
+
+enum class InputEventKind : uint8_t {
+    Uart = 0,
+    Key = 1
+};
+
+// External input as the guest saw it: delivered at the sync point after the
+// batch that ended on `cycle`.
+struct InputEvent {
+    uint64_t cycle = 0;
+    InputEventKind kind = InputEventKind::Uart;
+    uint32_t key = 0;
+    std::vector<uint8_t> bytes;
+};
+
+class InputLogWriter {
+public:
+    InputLogWriter() = default;
+    ~InputLogWriter();
+
+    InputLogWriter(const InputLogWriter&) = delete;
+    InputLogWriter& operator=(const InputLogWriter&) = delete;
+
+    bool open(const std::string& path, std::string* error);
+    // Events must come in cycle order.
+    void append(const InputEvent& event);
+    void close();
+    bool isOpen() const { return mFile != nullptr; }
+
+private:
+    std::FILE* mFile = nullptr;
+    uint64_t mLastCycle = 0;
+    std::vector<uint8_t> mEncoded;
+};
+
+bool readInputLog(const std::string& path, std::vector<InputEvent>* events, std::string* error);
+
+#endif
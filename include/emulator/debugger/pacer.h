@@ -0,0 +1,60 @@
+#ifndef EMULATOR_DEBUGGER_PACER_H
+#define EMULATOR_DEBUGGER_PACER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+enum class PacingMode {
+    MaxSpeed,
+    Realtime
+};
+
+struct PacingStats {
+    uint64_t waits = 0;
+    // Times the guest fell more than kMaxLag behind and was rebased, and the
+    // host time given up that way.
+    uint64_t slips = 0;
+    uint64_t slippedNs = 0;
+    // Host time minus guest time at the last check; positive when behind.
+    int64_t driftNs = 0;
+    uint64_t maxDriftNs = 0;
+};
+
+// Keeps guest cycles in step with host time. The timekeeper hart calls
+// pace() after each batch: when the guest is ahead it sleeps and then spins
+// for the last stretch; when it has fallen too far behind it gives up the
+// lost time instead of running flat out to catch up.
+class Pacer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr auto kSpinWindow = std::chrono::microseconds(200);
+    static constexpr auto kMaxLag = std::chrono::milliseconds(50);
+
+    void setFrequency(uint64_t cyclesPerSecond);
+    // Starts counting from `cycle` at `now`, e.g. after the machine resumes.
+    void rebase(uint64_t cycle, Clock::time_point now);
+    // How long the guest has to wait before it may run past `cycle`.
+    Clock::duration update(uint64_t cycle, Clock::time_point now);
+    void pace(uint64_t cycle);
+
+    PacingStats getStats() const;
+    void resetStats();
+
+private:
+    int64_t guestNanos(uint64_t cycles) const;
+
+    uint64_t mFrequency = 1000000;
+    uint64_t mBaseCycle = 0;
+    Clock::time_point mBaseTime;
+    bool mBased = false;
+
+    std::atomic<uint64_t> mWaits{0};
+    std::atomic<uint64_t> mSlips{0};
+    std::atomic<uint64_t> mSlippedNs{0};
+    std::atomic<int64_t> mDriftNs{0};
+    std::atomic<uint64_t> mMaxDriftNs{0};
+};
+
+#endif
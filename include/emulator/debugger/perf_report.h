@@ -0,0 +1,40 @@
+#ifndef EMULATOR_DEBUGGER_PERF_REPORT_H
+#define EMULATOR_DEBUGGER_PERF_REPORT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "emulator/bus/bus.h"
+
+// Hot-path counters gathered from the bus, the hart loops, the trace path,
+// the UART and the logger, over the window since the last reset.
+struct PerfReport {
+    double seconds = 0.0;
+    uint64_t instructions = 0;
+    uint64_t batches = 0;
+    // Host time the hart threads spent in ICpuExecutor::step() and running
+    // device events, summed over harts.
+    uint64_t stepNs = 0;
+    uint64_t syncNs = 0;
+    uint64_t syncs = 0;
+    uint64_t events = 0;
+    uint64_t traceRecords = 0;
+    uint64_t tlbHits = 0;
+    uint64_t tlbMisses = 0;
+    std::vector<BusMappingStats> mappings;
+    uint64_t uartTxStalls = 0;
+    uint64_t uartRxContended = 0;
+    uint64_t logMessages = 0;
+    uint64_t logContended = 0;
+    uint64_t logQueueStalls = 0;
+};
+
+// `later` minus `earlier`, counter by counter; mappings are matched by name.
+PerfReport diffPerfReports(const PerfReport& later, const PerfReport& earlier);
+// A single-line JSON object.
+std::string formatPerfJson(const PerfReport& report);
+// Human-readable lines for the debugger.
+std::vector<std::string> formatPerfSummary(const PerfReport& report);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef EMULATOR_DEBUGGER_PROFILER_H
+#define EMULATOR_DEBUGGER_PROFILER_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "emulator/debugger/symbols.h"
+
+struct ProfileHotspot {
+    // The symbol name, or the PC in hex when no symbol covers it.
+    std::string name;
+    uint64_t address = 0;
+    uint64_t samples = 0;
+};
+
+// PC histogram fed by the hart loops, one sample every `period` guest cycles
+// per hart. Samples land on batch boundaries, which the loop places at the
+// sample points, so guest timing is unaffected.
+class PcProfiler {
+public:
+    static constexpr uint64_t kDefaultPeriod = 10000;
+
+    void start(uint64_t periodCycles);
+    void stop();
+    void clear();
+    bool isRunning() const { return mRunning.load(std::memory_order_acquire); }
+    uint64_t getPeriod() const { return mPeriod.load(std::memory_order_acquire); }
+    // Bumped by start() so harts re-align their next sample point.
+    uint64_t getGeneration() const { return mGeneration.load(std::memory_order_acquire); }
+
+    void record(uint32_t hart, uint64_t pc);
+    uint64_t getSampleCount() const;
+
+    // Samples summed per symbol over all harts, most sampled first.
+    std::vector<ProfileHotspot> hotspots(const SymbolMap& symbols, size_t limit) const;
+    // One "hart<N>;<function> <count>" line per function, the folded-stack
+    // format read by flamegraph.pl, speedscope and pprof's converters.
+    bool exportFolded(const std::string& path, const SymbolMap& symbols,
+        std::string* error) const;
+
+private:
+    using Histogram = std::unordered_map<uint64_t, uint64_t>;
+
+    std::atomic<bool> mRunning{false};
+    std::atomic<uint64_t> mPeriod{kDefaultPeriod};
+    std::atomic<uint64_t> mGeneration{0};
+    mutable std::mutex mMutex;
+    std::vector<Histogram> mHarts;
+    uint64_t mSamples = 0;
+};
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef EMULATOR_DEBUGGER_SEQLOCK_H
+#define EMULATOR_DEBUGGER_SEQLOCK_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Single-writer snapshot of a small trivially copyable struct. store() never
+// blocks and costs a few relaxed stores; load() retries while a store is in
+// progress, so readers polling at their own rate never slow the writer down.
+template <typename T>
+class SeqLock {
+    static_assert(std::is_trivially_copyable_v<T>, "SeqLock needs a trivially copyable type");
+
+public:
+    void store(const T& value) {
+        uint64_t words[kWords] = {};
+        std::memcpy(words, &value, sizeof(T));
+        uint64_t sequence = mSequence.load(std::memory_order_relaxed);
+        mSequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < kWords; ++i) {
+            mWords[i].store(words[i], std::memory_order_relaxed);
+        }
+        mSequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    T load() const {
+        uint64_t words[kWords] = {};
+        uint64_t before = 0;
+        uint64_t after = 0;
+        do {
+            before = mSequence.load(std::memory_order_acquire);
+            for (size_t i = 0; i < kWords; ++i) {
+                words[i] = mWords[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = mSequence.load(std::memory_order_relaxed);
+        } while ((before & 1) != 0 || before != after);
+        T value;
+        std::memcpy(&value, words, sizeof(T));
+        return value;
+    }
+
+private:
+    static constexpr size_t kWords = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    std::atomic<uint64_t> mSequence{0};
+    std::array<std::atomic<uint64_t>, kWords> mWords{};
+};
+
+#endif
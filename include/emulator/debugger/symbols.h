@@ -0,0 +1,36 @@
+#ifndef EMULATOR_DEBUGGER_SYMBOLS_H
+#define EMULATOR_DEBUGGER_SYMBOLS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct Symbol {
+    uint64_t address = 0;
+    // Zero when unknown; the symbol then extends to the next one.
+    uint64_t size = 0;
+    std::string name;
+};
+
+// Guest function symbols, read from an ELF file's symbol table or from a
+// text map in `nm` format ("<addr> [<size>] [<type>] <name>" per line).
+class SymbolMap {
+public:
+    bool load(const std::string& path, std::string* error);
+    void add(const Symbol& symbol);
+    void clear();
+
+    // The symbol covering `address`, or nullptr.
+    const Symbol* lookup(uint64_t address) const;
+    bool empty() const { return mSymbols.empty(); }
+    size_t size() const { return mSymbols.size(); }
+
+private:
+    bool loadElf(const std::vector<uint8_t>& image, std::string* error);
+    bool loadText(const std::vector<uint8_t>& image, std::string* error);
+    void sort();
+
+    std::vector<Symbol> mSymbols;
+};
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef EMULATOR_DEBUGGER_TRACE_BUFFER_H
+#define EMULATOR_DEBUGGER_TRACE_BUFFER_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "emulator/cpu/cpu.h"
+
+constexpr size_t kTraceMaxMemEvents = 3;
+constexpr size_t kTraceDecodedSize = 40;
+
+struct BinaryMemEvent {
+    uint64_t address;
+    uint64_t data;
+    uint32_t latencyCycles;
+    uint16_t size;
+    uint8_t type;
+    uint8_t reserved;
+};
+
+// Fixed-size, allocation-free image of a TraceRecord. The decoded text is
+// stored inline (truncated) and the trace options active when the record was
+// taken travel with it, so a file can be formatted offline exactly like the
+// live log. `extra` fields are not recorded.
+struct BinaryTraceRecord {
+    static constexpr uint8_t kBranch = 1u << 0;
+    static constexpr uint8_t kTaken = 1u << 1;
+    static constexpr uint8_t kPredictedTaken = 1u << 2;
+
+    static constexpr uint8_t kOptInstruction = 1u << 0;
+    static constexpr uint8_t kOptMemEvents = 1u << 1;
+    static constexpr uint8_t kOptBranchPrediction = 1u << 2;
+
+    uint64_t pc;
+    uint64_t cycleBegin;
+    uint64_t cycleEnd;
+    uint64_t branchTarget;
+    uint64_t predictedTarget;
+    uint32_t inst;
+    uint8_t flags;
+    uint8_t options;
+    uint8_t memCount;
+    uint8_t decodedLength;
+    BinaryMemEvent mem[kTraceMaxMemEvents];
+    char decoded[kTraceDecodedSize];
+};
+
+static_assert(sizeof(BinaryTraceRecord) == 160, "trace record layout changed");
+
+void encodeTraceRecord(const TraceRecord& record, const TraceOptions& options,
+    BinaryTraceRecord* out);
+void decodeTraceRecord(const BinaryTraceRecord& in, TraceRecord* record, TraceOptions* options);
+
+// The human-readable line used by the live trace log and the offline decoder.
+std::string formatTraceRecord(const TraceRecord& record, const TraceOptions& options);
+
+// Single-producer/single-consumer ring of binary records. The producer is a
+// CPU thread, the consumer the writer's drain thread.
+class TraceRing {
+public:
+    explicit TraceRing(size_t capacity);
+
+    bool tryPush(const BinaryTraceRecord& record);
+    size_t pop(BinaryTraceRecord* out, size_t maxRecords);
+    bool empty() const;
+
+private:
+    std::vector<BinaryTraceRecord> mSlots;
+    size_t mMask = 0;
+    alignas(64) std::atomic<uint64_t> mHead{0};
+    alignas(64) std::atomic<uint64_t> mTail{0};
+};
+
+class TraceFileWriter;
+
+// Streams records from one ring per CPU to a chunked trace file (see
+// trace_file.h) on a background thread.
+class BinaryTraceWriter {
+public:
+    static constexpr size_t kDefaultRingCapacity = 1u << 14;
+
+    BinaryTraceWriter();
+    ~BinaryTraceWriter();
+
+    BinaryTraceWriter(const BinaryTraceWriter&) = delete;
+    BinaryTraceWriter& operator=(const BinaryTraceWriter&) = delete;
+
+    bool open(const std::string& path, size_t ringCount, bool compress, std::string* error,
+        size_t ringCapacity = kDefaultRingCapacity);
+    // False when the file could not be written completely.
+    bool close(std::string* error = nullptr);
+    bool isOpen() const { return mOpen; }
+
+    // Blocks (yielding) while the ring is full so no record is lost.
+    void push(size_t ring, const BinaryTraceRecord& record);
+
+    uint64_t recordsWritten() const { return mWritten.load(std::memory_order_relaxed); }
+
+private:
+    void drainLoop();
+    size_t drainOnce(BinaryTraceRecord* scratch, size_t scratchSize);
+
+    std::unique_ptr<TraceFileWriter> mFile;
+    bool mOpen = false;
+    std::vector<std::unique_ptr<TraceRing>> mRings;
+    std::thread mThread;
+    std::atomic<bool> mStop{false};
+    std::atomic<uint64_t> mWritten{0};
+};
+
+#endif
@@ -0,0 +1,150 @@
+#ifndef EMULATOR_DEBUGGER_TRACE_FILE_H
+#define EMULATOR_DEBUGGER_TRACE_FILE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "emulator/debugger/trace_buffer.h"
+
+// On-disk trace layout:
+//   TraceFileHeader
+//   { TraceChunkHeader, payload }*      chunks are self-contained
+//   TraceChunkIndexEntry[chunkCount]    in file order
+//   TracePcIndexEntry[pcCount]          sorted by (pc, chunk)
+//   TraceFileFooter
+// A file without a valid footer (e.g. after a crash) is still readable; the
+// chunk index is rebuilt by walking chunk headers and PC lookups scan. Chunk
+// cycle ranges are only ordered for single-hart traces, so cycle lookups
+// check the order instead of relying on it.
+
+constexpr uint32_t kTraceFileMagic = 0x52544d45;   // "EMTR"
+constexpr uint32_t kTraceChunkMagic = 0x43544d45;  // "EMTC"
+constexpr uint32_t kTraceFooterMagic = 0x46544d45; // "EMTF"
+constexpr uint32_t kTraceFileVersion = 2;
+constexpr uint32_t kTraceDefaultChunkRecords = 4096;
+
+enum class TraceChunkEncoding : uint32_t {
+    Raw = 0,
+    ZeroRle = 1
+};
+
+struct TraceFileHeader {
+    uint32_t magic = kTraceFileMagic;
+    uint32_t version = kTraceFileVersion;
+    uint32_t recordSize = 0;
+    uint32_t chunkRecords = 0;
+};
+
+struct TraceChunkHeader {
+    uint32_t magic = kTraceChunkMagic;
+    uint32_t encoding = 0;
+    uint32_t recordCount = 0;
+    uint32_t payloadSize = 0;
+    uint64_t firstCycle = 0;
+    uint64_t lastCycle = 0;
+};
+
+struct TraceChunkIndexEntry {
+    uint64_t offset = 0;
+    uint64_t firstRecord = 0;
+    uint64_t firstCycle = 0;
+    uint64_t lastCycle = 0;
+    uint32_t recordCount = 0;
+    uint32_t encoding = 0;
+};
+
+struct TracePcIndexEntry {
+    uint64_t pc = 0;
+    uint64_t chunk = 0;
+};
+
+struct TraceFileFooter {
+    uint64_t chunkIndexOffset = 0;
+    uint64_t chunkCount = 0;
+    uint64_t pcIndexOffset = 0;
+    uint64_t pcCount = 0;
+    uint64_t recordCount = 0;
+    uint32_t magic = kTraceFooterMagic;
+    uint32_t reserved = 0;
+};
+
+// Splits a record stream into chunks and maintains the cycle and PC indices.
+// Not thread-safe; BinaryTraceWriter calls it from its drain thread. After a
+// failed write (a full disk) it drops further records, and close() reports
+// the error since the file then has no footer.
+class TraceFileWriter {
+public:
+    TraceFileWriter() = default;
+    ~TraceFileWriter();
+
+    TraceFileWriter(const TraceFileWriter&) = delete;
+    TraceFileWriter& operator=(const TraceFileWriter&) = delete;
+
+    bool open(const std::string& path, bool compress, std::string* error,
+        uint32_t chunkRecords = kTraceDefaultChunkRecords);
+    bool append(const BinaryTraceRecord* records, size_t count);
+    bool close(std::string* error = nullptr);
+    bool isOpen() const { return mFile != nullptr; }
+
+private:
+    bool flushChunk();
+    bool write(const void* data, size_t size);
+
+    std::FILE* mFile = nullptr;
+    std::string mPath;
+    bool mFailed = false;
+    bool mCompress = false;
+    uint32_t mChunkRecords = kTraceDefaultChunkRecords;
+    uint64_t mOffset = 0;
+    uint64_t mRecordCount = 0;
+    std::vector<BinaryTraceRecord> mPending;
+    std::vector<uint8_t> mEncoded;
+    std::vector<TraceChunkIndexEntry> mChunks;
+    std::vector<TracePcIndexEntry> mPcs;
+};
+
+// Read-only view of a trace file through mmap. Raw chunks are read in place;
+// compressed chunks are decoded on demand into a one-chunk cache.
+class TraceFileView {
+public:
+    TraceFileView() = default;
+    ~TraceFileView();
+
+    TraceFileView(const TraceFileView&) = delete;
+    TraceFileView& operator=(const TraceFileView&) = delete;
+
+    bool open(const std::string& path, std::string* error);
+    void close();
+
+    uint64_t recordCount() const { return mRecordCount; }
+    size_t chunkCount() const { return mChunks.size(); }
+    bool hasPcIndex() const { return mPcs != nullptr; }
+
+    bool readRecord(uint64_t index, BinaryTraceRecord* out);
+    // Index of the first record whose cycleBegin >= cycle, or recordCount().
+    uint64_t findCycle(uint64_t cycle);
+    // Indices of every record executed at `pc`, in trace order.
+    std::vector<uint64_t> findPc(uint64_t pc);
+
+private:
+    const BinaryTraceRecord* chunkRecords(size_t chunk);
+    size_t chunkForRecord(uint64_t index) const;
+    bool checkChunk(const TraceChunkIndexEntry& entry, uint64_t end) const;
+    bool loadFooterIndex(const TraceFileFooter& footer);
+    bool rebuildChunkIndex();
+
+    uint8_t* mBase = nullptr;
+    size_t mSize = 0;
+    uint64_t mRecordCount = 0;
+    std::vector<TraceChunkIndexEntry> mChunks;
+    // Chunk lastCycle values never decrease, so findCycle() can bisect.
+    bool mCyclesSorted = true;
+    const TracePcIndexEntry* mPcs = nullptr;
+    uint64_t mPcCount = 0;
+    size_t mCachedChunk = SIZE_MAX;
+    std::vector<BinaryTraceRecord> mCache;
+};
+
+#endif
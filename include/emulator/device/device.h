@@ -1,12 +1,16 @@
 #ifndef EMULATOR_DEVICE_DEVICE_H
 #define EMULATOR_DEVICE_DEVICE_H
 
+#include <atomic>
 #include <cstdint>
 #include <functional>
+#include <memory>
 #include <string>
 
 #include "emulator/bus/bus.h"
+#include "emulator/bus/event_scheduler.h"
 #include "emulator/cpu/cpu.h"
+#include "emulator/snapshot/snapshot.h"
 
 enum class DeviceType {
     Ram,
@@ -14,41 +18,159 @@ enum class DeviceType {
     Display,
     Timer,
     Uart,
+    Dma,
+    InterruptController,
     Other
 };
 
+class Device;
+
+// Plain function pointers the bus calls for a device's accesses. Devices
+// built on MmioDevice<> bind them straight to their handlers; a null entry
+// falls back to the std::function handlers.
+struct DeviceDispatch {
+    MemResponse (*read)(Device* device, const MemAccess& access) = nullptr;
+    MemResponse (*write)(Device* device, const MemAccess& access) = nullptr;
+    MemResponse (*atomic)(Device* device, const MemAccess& access) = nullptr;
+    void (*tick)(Device* device, uint64_t cycles) = nullptr;
+};
+
 class Device {
 public:
     using ReadHandler = std::function<MemResponse(const MemAccess& access)>;
     using WriteHandler = std::function<MemResponse(const MemAccess& access)>;
+    using AtomicHandler = std::function<MemResponse(const MemAccess& access)>;
     using TickHandler = std::function<void(uint64_t cycles)>;
+    // Called with the new level whenever the device's interrupt output
+    // changes, from whichever thread caused the change.
+    using InterruptHandler = std::function<void(bool asserted)>;
 
     Device();
-    virtual ~Device() = default;
+    virtual ~Device();
 
     MemResponse read(const MemAccess& access);
     MemResponse write(const MemAccess& access);
+    // Without an atomic handler, AtomicRmw and CompareExchange are emulated
+    // with a read and a write, which the bus serializes for MMIO devices.
+    MemResponse atomic(const MemAccess& access);
     void tick(uint64_t cycles);
     virtual void sync(uint64_t currentCycle);
     DeviceType getType() const;
+    const DeviceDispatch& getDispatch() const { return mDispatch; }
 
     void setReadHandler(ReadHandler handler);
     void setWriteHandler(WriteHandler handler);
+    void setAtomicHandler(AtomicHandler handler);
     void setTickHandler(TickHandler handler);
     void setType(DeviceType type);
     void setSyncThreshold(uint64_t threshold);
-    
+    // Connects the interrupt output, usually to an InterruptController line.
+    // Set before the guest starts.
+    void setInterruptHandler(InterruptHandler handler);
+    bool getInterruptLevel() const;
+
+    // Called when the device is registered on a bus. Devices with a tick
+    // handler get a sync event every mSyncThreshold cycles; others schedule
+    // their own wakeups on mScheduler as needed.
+    virtual void attachScheduler(std::shared_ptr<EventScheduler> scheduler);
+
+    // Captures sync bookkeeping plus saveState(); restore() puts both back and
+    // re-arms the sync event.
+    DeviceSnapshot snapshot();
+    bool restore(const DeviceSnapshot& snapshot);
+
     virtual uint32_t getUpdateFrequency() const { return 0; }
+    // Devices backed by plain host memory return a device-relative range here
+    // so the bus and executors can bypass the read/write handlers.
+    virtual bool getDirectMemory(DirectMemoryRange* range) {
+        (void)range;
+        return false;
+    }
+    // Copies a device-relative span in one go when the device keeps it in a
+    // host buffer. Returning false makes the bus fall back to register-sized
+    // accesses for the span.
+    virtual bool readBlock(uint64_t offset, uint8_t* out, uint64_t length) {
+        (void)offset;
+        (void)out;
+        (void)length;
+        return false;
+    }
+    virtual bool writeBlock(uint64_t offset, const uint8_t* data, uint64_t length) {
+        (void)offset;
+        (void)data;
+        (void)length;
+        return false;
+    }
 
 protected:
+    // Set once, from the constructor; the bus copies it at registration.
+    void setDispatch(const DeviceDispatch& dispatch) { mDispatch = dispatch; }
+    void scheduleSync();
+    // Only calls the handler when the level actually changes; a device that
+    // signals an edge raises and drops the line back to back.
+    void setInterruptLevel(bool asserted);
+
+    // Stateless devices keep the defaults. Devices that schedule their own
+    // events must re-schedule them in restoreState().
+    virtual std::shared_ptr<const DeviceState> saveState() { return nullptr; }
+    virtual bool restoreState(const std::shared_ptr<const DeviceState>& state) {
+        (void)state;
+        return true;
+    }
+
     uint64_t mLastSyncCycle = 0;
     uint64_t mSyncThreshold = 128;
+    std::shared_ptr<EventScheduler> mScheduler;
+    EventScheduler::EventId mSyncEvent = 0;
 
 private:
+    DeviceDispatch mDispatch;
     ReadHandler mReadHandler;
     WriteHandler mWriteHandler;
+    AtomicHandler mAtomicHandler;
     TickHandler mTickHandler;
+    InterruptHandler mInterruptHandler;
+    std::atomic<bool> mInterruptLevel{false};
     DeviceType mType = DeviceType::Other;
 };
 
+// Base for devices with fixed handlers, bound statically instead of through
+// std::function. Derived provides
+//     MemResponse handleRead(const MemAccess& access);
+//     MemResponse handleWrite(const MemAccess& access);
+// and optionally handleAtomic(const MemAccess&) and handleTick(uint64_t).
+// Each access is then one call through the bus's dispatch entry, with the
+// handler inlined into it. Derived befriends MmioDevice<Derived> when the
+// handlers are private. setReadHandler() and friends still work for ad-hoc
+// devices built on Device directly.
+template <typename Derived>
+class MmioDevice : public Device {
+protected:
+    MmioDevice() { setDispatch(makeDispatch()); }
+
+private:
+    static DeviceDispatch makeDispatch() {
+        DeviceDispatch dispatch;
+        dispatch.read = [](Device* device, const MemAccess& access) {
+            return static_cast<Derived*>(device)->handleRead(access);
+        };
+        dispatch.write = [](Device* device, const MemAccess& access) {
+            return static_cast<Derived*>(device)->handleWrite(access);
+        };
+        if constexpr (requires(Derived& device, const MemAccess& access) {
+            device.handleAtomic(access);
+        }) {
+            dispatch.atomic = [](Device* device, const MemAccess& access) {
+                return static_cast<Derived*>(device)->handleAtomic(access);
+            };
+        }
+        if constexpr (requires(Derived& device, uint64_t cycles) { device.handleTick(cycles); }) {
+            dispatch.tick = [](Device* device, uint64_t cycles) {
+                static_cast<Derived*>(device)->handleTick(cycles);
+            };
+        }
+        return dispatch;
+    }
+};
+
 #endif
@@ -1,20 +1,31 @@
 #ifndef EMULATOR_DEVICE_DISPLAY_H
 #define EMULATOR_DEVICE_DISPLAY_H
 
+#include <array>
 #include <atomic>
 #include <deque>
+#include <functional>
 #include <mutex>
+#include <vector>
 #include "emulator/device/device.h"
+#include "emulator/device/frame_sink.h"
 
 struct SDL_Window;
 struct SDL_Renderer;
 struct SDL_Texture;
 
-class SdlDisplayDevice : public Device {
+class SdlDisplayDevice : public MmioDevice<SdlDisplayDevice> {
 public:
     static constexpr uint64_t kControlRegionSize = 0x1000;
     static constexpr uint64_t kFrameBufferOffset = kControlRegionSize;
 
+    // Run of consecutive framebuffer rows written since the last published
+    // frame.
+    struct DirtyBand {
+        uint32_t firstRow = 0;
+        uint32_t rowCount = 0;
+    };
+
     SdlDisplayDevice();
     ~SdlDisplayDevice();
 
@@ -26,6 +37,10 @@ public:
     void pollEvents(uint32_t timeoutMs);
     bool isQuitRequested() const;
     void pushKey(uint32_t key);
+    // Host key presses go to `handler` instead of the key queue, e.g. so the
+    // debugger can deliver them at a recorded cycle. Set it while no thread
+    // polls events.
+    void setKeyHandler(std::function<void(uint32_t)> handler);
 
     uint32_t getWidth() const;
     uint32_t getHeight() const;
@@ -33,28 +48,98 @@ public:
     uint64_t getFrameBufferSize() const;
     uint64_t getMappedSize() const;
 
+    // The guest draws into a working framebuffer without taking any lock.
+    // publishFrame() runs on the CPU side (present request or vsync event) and
+    // copies the rows changed since that slot's last use into the back slot of
+    // a triple buffer, then swaps it in as the latest frame. present() runs on
+    // the SDL thread and swaps the latest frame out; neither side waits for
+    // the other, and frames the SDL thread is too slow for are dropped.
+    bool publishFrame();
+    bool hasPendingFrame() const;
+    // Publishes dirty rows every `cycles` CPU cycles even without a present
+    // request; 0 publishes only on request.
+    void setVsyncInterval(uint64_t cycles);
+
     bool isDirty() const;
     bool isPresentRequested() const;
     bool consumePresentRequest();
+    std::vector<DirtyBand> getDirtyBands() const;
+    // Uploads only the rows the latest frame changed, or the whole frame if
+    // frames were dropped since the last present, then hands the frame to the
+    // frame sink if one is set.
     void present();
+    // Sends every `every`-th presented frame to `sink`, in headless mode too.
+    // The sink reads the front slot in place; a write error drops the sink.
+    void setFrameSink(std::unique_ptr<FrameSink> sink, uint32_t every = 1);
+    bool hasFrameSink() const { return mFrameSink != nullptr; }
 
     uint32_t getUpdateFrequency() const override;
+    // Framebuffer spans are copied directly; the control registers are not.
+    bool readBlock(uint64_t offset, uint8_t* out, uint64_t length) override;
+    bool writeBlock(uint64_t offset, const uint8_t* data, uint64_t length) override;
+
+protected:
+    std::shared_ptr<const DeviceState> saveState() override;
+    bool restoreState(const std::shared_ptr<const DeviceState>& state) override;
 
 private:
+    friend class MmioDevice<SdlDisplayDevice>;
     struct SdlDisplayState;
     SdlDisplayState* mState = nullptr;
     
+    struct FrameSlot {
+        std::vector<uint8_t> pixels;
+        // Rows that differ from the frame published before this one.
+        std::vector<uint64_t> rows;
+        uint64_t sequence = 0;
+    };
+
+    static constexpr uint32_t kFrameSlots = 3;
+    static constexpr uint32_t kSlotFresh = 1u << 31;
+
     std::atomic<bool> mDirty{false};
     std::atomic<bool> mPresentRequested{false};
     
     mutable std::mutex mInputMutex;
-    mutable std::mutex mFrameMutex;
     bool mQuitRequested = false;
     uint32_t mLastKey = 0;
     std::deque<uint32_t> mKeyQueue;
+    std::function<void(uint32_t)> mKeyHandler;
+
+    // Blitter parameters: destination x/y, source x/y, width, height and
+    // fill color. Touched under the bus device lock.
+    static constexpr size_t kBlitRegisters = 7;
+    std::array<uint32_t, kBlitRegisters> mBlit{};
+
+    // Producer side, touched only by the CPU thread or under the bus device
+    // lock: rows written since the last publish, and per slot the rows its
+    // pixels are behind the working framebuffer.
+    std::vector<uint64_t> mDirtyRows;
+    std::array<std::vector<uint64_t>, kFrameSlots> mStaleRows;
+    uint32_t mBackSlot = 0;
+    uint64_t mPublishedSequence = 0;
+    uint64_t mVsyncInterval = 0;
+    EventScheduler::EventId mVsyncEvent = 0;
+    // Slot index of the latest frame, with kSlotFresh until present() takes it.
+    std::atomic<uint32_t> mReadySlot{1};
+    std::array<FrameSlot, kFrameSlots> mSlots;
+    // Consumer side, touched only by present().
+    uint32_t mFrontSlot = 2;
+    uint64_t mPresentedSequence = 0;
+    std::unique_ptr<FrameSink> mFrameSink;
+    uint32_t mFrameEvery = 1;
+    uint64_t mFramesPresented = 0;
 
+    void resetFrames();
+    void markRowsDirty(uint64_t fbOffset, uint64_t length);
+    void markAllRowsDirty();
+    void armVsync();
+    void deliverHostKey(uint32_t key);
+    static std::vector<DirtyBand> collectBands(const std::vector<uint64_t>& rows,
+        uint32_t height);
     bool readRegister(uint64_t offset, uint64_t* value);
     bool writeRegister(uint64_t offset, uint64_t value);
+    bool runBlit(uint64_t command);
     MemResponse handleRead(const MemAccess& access);
     MemResponse handleWrite(const MemAccess& access);
 };
@@ -0,0 +1,62 @@
+#ifndef EMULATOR_DEVICE_DMA_H
+#define EMULATOR_DEVICE_DMA_H
+
+#include <vector>
+
+#include "emulator/device/device.h"
+
+class MemoryBus;
+
+// Memory-to-memory copy engine. A transfer is either the source/destination/
+// length registers or a chain of descriptors in guest memory. Each transfer
+// completes kSetupCycles + length / kBytesPerCycle cycles after it starts;
+// the copy itself is done at completion with the bus block API, so the data is
+// valid once STATUS.DONE is set.
+class DmaDevice : public MmioDevice<DmaDevice> {
+public:
+    static constexpr uint64_t kSetupCycles = 16;
+    static constexpr uint64_t kBytesPerCycle = 8;
+    // In-memory descriptor: little-endian u64 source, destination, length and
+    // next-descriptor address (0 ends the chain).
+    static constexpr uint64_t kDescriptorSize = 32;
+
+    explicit DmaDevice(MemoryBus* bus);
+    ~DmaDevice() override;
+
+    static uint64_t transferCycles(uint64_t length);
+
+protected:
+    std::shared_ptr<const DeviceState> saveState() override;
+    bool restoreState(const std::shared_ptr<const DeviceState>& state) override;
+
+private:
+    friend class MmioDevice<DmaDevice>;
+    struct Transfer {
+        uint64_t source = 0;
+        uint64_t destination = 0;
+        uint64_t length = 0;
+        uint64_t next = 0;
+    };
+
+    MemoryBus* mBus = nullptr;
+    uint64_t mSource = 0;
+    uint64_t mDestination = 0;
+    uint32_t mLength = 0;
+    uint64_t mDescriptor = 0;
+    uint32_t mStatus = 0;
+    Transfer mCurrent;
+    uint64_t mDueCycle = 0;
+    EventScheduler::EventId mEvent = 0;
+    std::vector<uint8_t> mBuffer;
+
+    void start(bool chained);
+    bool loadDescriptor(uint64_t address);
+    void arm(uint64_t cycle);
+    void complete();
+    bool copy(const Transfer& transfer);
+    void finish(bool ok);
+    MemResponse handleRead(const MemAccess& access);
+    MemResponse handleWrite(const MemAccess& access);
+};
+
+#endif
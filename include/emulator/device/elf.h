@@ -0,0 +1,62 @@
+#ifndef EMULATOR_DEVICE_ELF_H
+#define EMULATOR_DEVICE_ELF_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Bounds-checked field reads from an ELF image of either byte order.
+class ElfReader {
+public:
+    ElfReader(const std::vector<uint8_t>& image, bool bigEndian)
+        : mImage(image), mBigEndian(bigEndian) {}
+
+    bool read(uint64_t offset, uint32_t size, uint64_t* value) const {
+        if (offset > mImage.size() || size > mImage.size() - offset) {
+            return false;
+        }
+        uint64_t result = 0;
+        for (uint32_t i = 0; i < size; ++i) {
+            uint32_t index = mBigEndian ? i : size - 1 - i;
+            result = (result << 8) | mImage[offset + index];
+        }
+        *value = result;
+        return true;
+    }
+
+    std::string string(uint64_t offset, uint64_t limit) const {
+        std::string text;
+        for (uint64_t i = offset; i < limit && i < mImage.size() && mImage[i] != 0; ++i) {
+            text.push_back(static_cast<char>(mImage[i]));
+        }
+        return text;
+    }
+
+private:
+    const std::vector<uint8_t>& mImage;
+    bool mBigEndian;
+};
+
+// One PT_LOAD segment. `address` is the physical (load) address, which is
+// where a bare-metal image expects to find its bytes at reset.
+struct ElfSegment {
+    uint64_t address = 0;
+    uint64_t fileOffset = 0;
+    uint64_t fileSize = 0;
+    // At least fileSize; the rest is BSS.
+    uint64_t memorySize = 0;
+    bool writable = false;
+    bool executable = false;
+};
+
+struct ElfImage {
+    uint64_t entry = 0;
+    std::vector<ElfSegment> segments;
+};
+
+bool isElfFile(const std::string& path);
+// Reads the header and program headers only; segment contents stay in the
+// file for MemoryDevice::mapFileRange().
+bool readElfImage(const std::string& path, ElfImage* image, std::string* error);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef EMULATOR_DEVICE_FRAME_SINK_H
+#define EMULATOR_DEVICE_FRAME_SINK_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// A presented frame, borrowed from the display's front slot for the duration
+// of FrameSink::write(). Pixels are 32-bit ARGB, i.e. B, G, R, A bytes in
+// memory.
+struct FrameView {
+    const uint8_t* pixels = nullptr;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t pitch = 0;
+    uint64_t sequence = 0;
+};
+
+// Receives frames on the SDL thread. A slow sink never stalls the guest: the
+// display's triple buffer drops the frames published while write() runs.
+class FrameSink {
+public:
+    virtual ~FrameSink() = default;
+    virtual bool write(const FrameView& frame, std::string* error) = 0;
+};
+
+// `file:<prefix>` writes <prefix>_<sequence>.ppm per frame; `pipe:<command>`
+// streams raw BGRA frames to the command's stdin, e.g. an encoder reading
+// rawvideo.
+std::unique_ptr<FrameSink> CreateFrameSink(const std::string& spec, std::string* error);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef EMULATOR_DEVICE_INTERRUPT_CONTROLLER_H
+#define EMULATOR_DEVICE_INTERRUPT_CONTROLLER_H
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+
+#include "emulator/device/device.h"
+
+// Collects device interrupt lines and drives one output towards the target
+// hart. A line is pending while it is high or after a rising edge until the
+// guest acknowledges it, so both level and pulse sources work.
+class InterruptController : public MmioDevice<InterruptController> {
+public:
+    static constexpr uint32_t kLineCount = 32;
+
+    // Called after any change that leaves the output asserted, from whichever
+    // thread made it. It must not block: it can run under the bus device lock.
+    using Listener = std::function<void()>;
+
+    InterruptController();
+
+    // Thread-safe; lines outside kLineCount are ignored.
+    void setLine(uint32_t line, bool asserted);
+    // A handler for Device::setInterruptHandler() that drives `line`.
+    InterruptHandler lineHandler(uint32_t line);
+    bool isAsserted(uint32_t hartId) const;
+    uint32_t getPending() const;
+    void setListener(Listener listener);
+
+protected:
+    std::shared_ptr<const DeviceState> saveState() override;
+    bool restoreState(const std::shared_ptr<const DeviceState>& state) override;
+
+private:
+    friend class MmioDevice<InterruptController>;
+    std::atomic<uint32_t> mLevels{0};
+    std::atomic<uint32_t> mLatched{0};
+    std::atomic<uint32_t> mEnable{0};
+    std::atomic<uint32_t> mTarget{0};
+    std::mutex mListenerMutex;
+    Listener mListener;
+
+    void notify();
+    MemResponse handleRead(const MemAccess& access);
+    MemResponse handleWrite(const MemAccess& access);
+};
+
+#endif
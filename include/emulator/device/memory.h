@@ -1,23 +1,109 @@
 #ifndef EMULATOR_DEVICE_MEMORY_H
 #define EMULATOR_DEVICE_MEMORY_H
 
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
 #include <vector>
 #include <string>
 #include "emulator/device/device.h"
 
-class MemoryDevice : public Device {
+// Heap storage is allocated and zero-filled up front. Mapped storage is an
+// anonymous MAP_NORESERVE mapping whose pages the kernel allocates on first
+// touch; it falls back to the heap where mmap is unavailable.
+enum class MemoryBacking {
+    Heap,
+    Mapped
+};
+
+class MemoryDevice : public MmioDevice<MemoryDevice> {
 public:
-    MemoryDevice(uint64_t size, bool readOnly);
+    // Granularity of dirty tracking and snapshot sharing.
+    static constexpr uint64_t kPageSize = 1ull << DirectMemoryRange::kDirtyPageShift;
+
+    MemoryDevice(uint64_t size, bool readOnly, MemoryBacking backing = MemoryBacking::Mapped);
+    ~MemoryDevice() override;
+    MemoryDevice(const MemoryDevice&) = delete;
+    MemoryDevice& operator=(const MemoryDevice&) = delete;
+
     bool loadImage(const std::string& path, uint64_t offset = 0);
+    // Read-only devices with mapped backing map the image file itself instead
+    // of copying it; the file must cover the whole device.
+    bool mapImage(const std::string& path, std::string* error);
+    // Places `length` bytes of the file from `fileOffset` at device `offset`,
+    // as for an ELF segment. With mapped backing, whole host pages whose file
+    // and device offsets line up are mapped from the file and only the ragged
+    // head and tail are copied; read-only devices map them read-only. Bytes
+    // past `length` are left alone, so BSS stays untouched anonymous memory.
+    bool mapFileRange(const std::string& path, uint64_t fileOffset, uint64_t offset,
+        uint64_t length, std::string* error);
     uint64_t getSize() const;
     bool isReadOnly() const;
+    MemoryBacking getBacking() const;
+    bool isFileMapped() const;
+    // Bytes of storage currently backed by host memory.
+    uint64_t getResidentSize() const;
+    bool getDirectMemory(DirectMemoryRange* range) override;
+
+    // Pages written since the last snapshot or restore.
+    uint64_t getDirtyPageCount() const;
+
+protected:
+    // Snapshots are copy-on-write: each one shares every page that was not
+    // written since the previous one, so taking it costs O(dirty pages) and
+    // restoring rewrites only pages that differ from the current contents.
+    std::shared_ptr<const DeviceState> saveState() override;
+    bool restoreState(const std::shared_ptr<const DeviceState>& state) override;
 
 private:
-    std::vector<uint8_t> mStorage;
+    friend class MmioDevice<MemoryDevice>;
+    static constexpr uint64_t kPagesPerGroup = 64;
+
+    struct Page {
+        uint8_t bytes[kPageSize];
+    };
+    // One group per dirty-bitmap word; a null page or group is all zeros.
+    struct PageGroup {
+        std::array<std::shared_ptr<const Page>, kPagesPerGroup> pages;
+    };
+    struct Snapshot : DeviceState {
+        std::vector<std::shared_ptr<const PageGroup>> groups;
+        uint64_t copiedBytes = 0;
+
+        uint64_t getSizeBytes() const override { return copiedBytes; }
+    };
+
+    // LR/SC reservation of one hart; only that hart's thread touches it.
+    struct Reservation {
+        bool valid = false;
+        uint64_t address = 0;
+        uint32_t size = 0;
+        uint64_t value = 0;
+    };
+
+    void releaseStorage();
+    void markDirty(uint64_t offset, uint64_t length);
+    uint64_t pageLength(uint64_t page) const;
+
+    std::vector<uint8_t> mHeap;
+    uint8_t* mData = nullptr;
+    uint64_t mSize = 0;
+    uint64_t mMappedSize = 0;
     bool mReadOnly;
+    MemoryBacking mBacking;
+    bool mFileMapped = false;
+    size_t mDirtyWords = 0;
+    std::unique_ptr<std::atomic<uint64_t>[]> mDirty;
+    // Contents as of the last snapshot or restore; null means all zeros.
+    std::shared_ptr<const Snapshot> mBase;
+    std::array<Reservation, kMaxHarts> mReservations{};
 
     MemResponse handleRead(const MemAccess& access);
     MemResponse handleWrite(const MemAccess& access);
+    MemResponse handleAtomic(const MemAccess& access);
+    template <typename T>
+    MemResponse atomicAccess(const MemAccess& access);
 };
 
 #endif
@@ -0,0 +1,69 @@
+#ifndef EMULATOR_DEVICE_SPSC_RING_H
+#define EMULATOR_DEVICE_SPSC_RING_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+// Bounded single-producer/single-consumer ring. push() may only be
+// called from one thread and pop()/peek()/clear() from one other; size() and
+// empty() are safe anywhere. Capacity is rounded up to a power of two.
+template <typename T>
+class SpscRing {
+public:
+    explicit SpscRing(size_t capacity) : mMask(roundUp(capacity) - 1),
+        mSlots(new T[mMask + 1]) {}
+
+    size_t capacity() const { return mMask + 1; }
+    size_t size() const {
+        return mHead.load(std::memory_order_acquire) - mTail.load(std::memory_order_acquire);
+    }
+    bool empty() const { return size() == 0; }
+    bool full() const { return size() == capacity(); }
+
+    // Returns how many of `count` items fit.
+    size_t push(const T* items, size_t count) {
+        size_t head = mHead.load(std::memory_order_relaxed);
+        size_t free = capacity() - (head - mTail.load(std::memory_order_acquire));
+        count = std::min(count, free);
+        for (size_t i = 0; i < count; ++i) {
+            mSlots[(head + i) & mMask] = items[i];
+        }
+        mHead.store(head + count, std::memory_order_release);
+        return count;
+    }
+
+    size_t pop(T* out, size_t maxCount) {
+        size_t count = peek(out, maxCount);
+        mTail.store(mTail.load(std::memory_order_relaxed) + count, std::memory_order_release);
+        return count;
+    }
+
+    size_t peek(T* out, size_t maxCount) const {
+        size_t tail = mTail.load(std::memory_order_relaxed);
+        size_t count = std::min(maxCount, mHead.load(std::memory_order_acquire) - tail);
+        for (size_t i = 0; i < count; ++i) {
+            out[i] = mSlots[(tail + i) & mMask];
+        }
+        return count;
+    }
+
+    void clear() { mTail.store(mHead.load(std::memory_order_acquire), std::memory_order_release); }
+
+private:
+    static size_t roundUp(size_t value) {
+        size_t capacity = 1;
+        while (capacity < value) {
+            capacity <<= 1;
+        }
+        return capacity;
+    }
+
+    size_t mMask;
+    std::unique_ptr<T[]> mSlots;
+    alignas(64) std::atomic<size_t> mHead{0};
+    alignas(64) std::atomic<size_t> mTail{0};
+};
+
+#endif
@@ -3,16 +3,34 @@
 
 #include "emulator/device/device.h"
 
-class TimerDevice : public Device {
+// Counts CPU cycles since the last reset. The counter is computed from the
+// scheduler's current cycle on every read, so it needs no periodic ticking.
+// The alarm fires a scheduler event when the counter reaches the compare
+// value and, with a period set, re-arms itself that many counts later.
+class TimerDevice : public MmioDevice<TimerDevice> {
 public:
     TimerDevice();
+    ~TimerDevice() override;
 
     uint64_t getCounterMicros();
 
+protected:
+    std::shared_ptr<const DeviceState> saveState() override;
+    bool restoreState(const std::shared_ptr<const DeviceState>& state) override;
+
 private:
-    uint64_t mAccumulatedMicros = 0;
-    
-    void handleTick(uint64_t cycles);
+    friend class MmioDevice<TimerDevice>;
+    uint64_t mBaseCycle = 0;
+    uint64_t mCompare = 0;
+    uint32_t mPeriod = 0;
+    uint32_t mAlarmCtrl = 0;
+    uint32_t mStatus = 0;
+    EventScheduler::EventId mAlarmEvent = 0;
+
+    uint64_t currentCycle() const;
+    void armAlarm();
+    void fireAlarm();
+    void updateInterrupt();
     MemResponse handleRead(const MemAccess& access);
     MemResponse handleWrite(const MemAccess& access);
 };
@@ -1,31 +1,67 @@
 #ifndef EMULATOR_DEVICE_UART_H
 #define EMULATOR_DEVICE_UART_H
 
-#include <deque>
-#include <functional>
+#include <atomic>
 #include <mutex>
 #include <string>
-#include <vector>
+#include <thread>
 #include "emulator/device/device.h"
+#include "emulator/device/spsc_ring.h"
 
-class UartDevice : public Device {
+struct UartStats {
+    uint64_t txBytes = 0;
+    // Guest writes that found the TX FIFO full and waited for the drain.
+    uint64_t txStalls = 0;
+    // RX pushes that found another producer holding the producer lock.
+    uint64_t rxContended = 0;
+};
+
+// Serial console with RX and TX FIFOs. The CPU side never takes a lock: RX is
+// a ring filled by the host input thread, TX a ring emptied by a drain thread
+// that writes to the output fd (or logging::device() when none is set).
+class UartDevice : public MmioDevice<UartDevice> {
 public:
+    static constexpr size_t kDefaultFifoDepth = 4096;
 
-    UartDevice();
+    explicit UartDevice(size_t fifoDepth = kDefaultFifoDepth);
     ~UartDevice();
 
-    void pushRx(uint8_t ch);
+    // Returns how many bytes fit in the RX FIFO; the rest are dropped.
+    size_t pushRx(const uint8_t* data, size_t length);
+    size_t pushRx(uint8_t ch) { return pushRx(&ch, 1); }
+    // Blocks until everything written so far has left the TX FIFO.
     void flush();
+    // Set before the guest starts; -1 routes output through logging::device().
+    void setOutputFd(int fd);
+    UartStats getStats() const;
+
+protected:
+    std::shared_ptr<const DeviceState> saveState() override;
+    bool restoreState(const std::shared_ptr<const DeviceState>& state) override;
 
 private:
-    std::deque<uint8_t> mRxBuffer;
-    std::string mTxBuffer;
-    mutable std::mutex mMutex;
-    uint64_t mIdleCycles = 0;
+    friend class MmioDevice<UartDevice>;
+    SpscRing<uint8_t> mRx;
+    SpscRing<uint8_t> mTx;
+    // Serializes RX producers (host input and restoreState); never taken by
+    // the CPU side.
+    std::mutex mRxProducerMutex;
+    std::atomic<uint32_t> mCtrl{0};
+    int mOutputFd = -1;
+
+    std::thread mDrainThread;
+    std::atomic<uint64_t> mTxSignal{0};
+    std::atomic<bool> mDrainIdle{false};
+    std::atomic<bool> mStopDrain{false};
+    std::atomic<uint64_t> mTxQueued{0};
+    std::atomic<uint64_t> mTxWritten{0};
+    PerfCounter mTxStalls;
+    PerfCounter mRxContended;
 
     uint32_t getStatus() const;
-    void flushTxLocked();
-    void handleTick(uint64_t cycles);
+    void updateInterrupt();
+    void drainLoop();
+    void writeOut(const uint8_t* data, size_t length);
     MemResponse handleRead(const MemAccess& access);
     MemResponse handleWrite(const MemAccess& access);
 };
@@ -0,0 +1,57 @@
+#ifndef EMULATOR_DEVICE_WIDE_COPY_H
+#define EMULATOR_DEVICE_WIDE_COPY_H
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define EMULATOR_HAS_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define EMULATOR_HAS_NEON 1
+#endif
+
+// Copies the payload of a 16, 32 or 64-byte access in 16-byte vector moves.
+// Neither side needs to be aligned. The payload is a byte image in guest
+// order, so no host swaps it.
+inline void copyWide(uint8_t* dst, const uint8_t* src, uint32_t size) {
+    for (uint32_t i = 0; i < size; i += 16) {
+#if defined(EMULATOR_HAS_SSE2)
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+#elif defined(EMULATOR_HAS_NEON)
+        vst1q_u8(dst + i, vld1q_u8(src + i));
+#else
+        std::memcpy(dst + i, src + i, 16);
+#endif
+    }
+}
+
+// Stores `count` copies of a 32-bit little-endian pixel, four per vector
+// store.
+inline void fillPixels(uint8_t* dst, uint32_t pixel, size_t count) {
+    if constexpr (std::endian::native == std::endian::big) {
+        pixel = (pixel >> 24) | ((pixel >> 8) & 0xff00u) | ((pixel << 8) & 0xff0000u) |
+            (pixel << 24);
+    }
+    size_t i = 0;
+#if defined(EMULATOR_HAS_SSE2)
+    __m128i lanes = _mm_set1_epi32(static_cast<int>(pixel));
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), lanes);
+    }
+#elif defined(EMULATOR_HAS_NEON)
+    uint8x16_t lanes = vreinterpretq_u8_u32(vdupq_n_u32(pixel));
+    for (; i + 4 <= count; i += 4) {
+        vst1q_u8(dst + i * 4, lanes);
+    }
+#endif
+    for (; i < count; ++i) {
+        std::memcpy(dst + i * 4, &pixel, sizeof(pixel));
+    }
+}
+
+#endif
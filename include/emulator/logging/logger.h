@@ -1,9 +1,15 @@
 #ifndef EMULATOR_LOGGING_LOGGER_H
 #define EMULATOR_LOGGING_LOGGER_H
 
+#include <atomic>
 #include <cstdarg>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <memory>
 #include <string>
+#include <thread>
+#include <utility>
 
 namespace logging {
 
@@ -21,10 +27,95 @@ struct Config {
     std::string mDeviceFile;
     std::function<void(const char*)> mOnMessage;
     std::function<void(const char*)> mOnDeviceMessage;
+
+    // Async mode: callers format into a lock-free queue and a writer thread
+    // batches output, flushing every mFlushIntervalMs or once mFlushBytes are
+    // pending. Output handlers then run on the writer thread.
+    bool mAsync = false;
+    uint32_t mFlushIntervalMs = 50;
+    size_t mFlushBytes = 64 * 1024;
+};
+
+// Cumulative since startup.
+struct Stats {
+    uint64_t messages = 0;
+    // Synchronous writes that found another thread holding the output lock.
+    uint64_t contended = 0;
+    // Async fragments that found the queue full and waited for the writer.
+    uint64_t queueStalls = 0;
+};
+
+class Backend;
+
+// An independent logger: level, outputs, async writer and statistics. The
+// logging functions and macros below go to the calling thread's current
+// context, so machines sharing a process each log through their own context
+// and never contend on another's lock.
+class Context {
+public:
+    Context();
+    explicit Context(const Config& config);
+    ~Context();
+
+    Context(const Context&) = delete;
+    Context& operator=(const Context&) = delete;
+
+    // The context of threads that never set one.
+    static Context& process();
+
+    void init(const Config& config);
+    void flush();
+    void shutdown();
+    void setLevel(Level newLevel);
+    Level getLevel() const { return mLevel.load(std::memory_order_relaxed); }
+    // The level gate, one relaxed load; filtered messages are never formatted.
+    bool enabled(Level level) const { return level >= getLevel(); }
+    Stats getStats() const;
+    void setOutputHandler(std::function<void(const char*)> logHandler,
+                            std::function<void(const char*)> deviceHandler);
+    void log(Level level, const char* file, int line, const char* fmt, va_list args);
+    void raw(const char* text);
+    void device(const char* text);
+
+private:
+    std::unique_ptr<Backend> mBackend;
+    std::atomic<Level> mLevel{Level::Info};
 };
 
+Context& current();
+bool enabled(Level level);
+
+// Makes `context` the calling thread's current context for its lifetime.
+class ScopedContext {
+public:
+    explicit ScopedContext(Context* context);
+    ~ScopedContext();
+
+    ScopedContext(const ScopedContext&) = delete;
+    ScopedContext& operator=(const ScopedContext&) = delete;
+
+private:
+    Context* mPrevious;
+};
+
+// std::thread that logs to the starting thread's current context.
+template <typename Fn>
+std::thread startThread(Fn&& fn) {
+    return std::thread([context = &current(), fn = std::forward<Fn>(fn)]() mutable {
+        ScopedContext scope(context);
+        fn();
+    });
+}
+
+// The rest act on the calling thread's current context.
 void init(const Config& config);
+// Blocks until every message logged so far has been written. No-op in
+// synchronous mode.
+void flush();
+// Drains pending messages and stops the async writer, if any.
+void shutdown();
 void level(Level newLevel);
+Stats getStats();
 void setOutputHandler(std::function<void(const char*)> logHandler,
                         std::function<void(const char*)> deviceHandler);
 void info(const char* file, int line, const char* fmt, ...);
@@ -40,10 +131,30 @@ Level levelFromString(const std::string& str);
 
 } // namespace logging
 
-#define INFO(...)    logging::info(__FILE__, __LINE__, __VA_ARGS__)
-#define DEBUG(...)   logging::debug(__FILE__, __LINE__, __VA_ARGS__)
-#define WARN(...)    logging::warn(__FILE__, __LINE__, __VA_ARGS__)
-#define ERROR(...)   logging::error(__FILE__, __LINE__, __VA_ARGS__)
-#define TRACE(...)  logging::trace(__FILE__, __LINE__, __VA_ARGS__)
+// Levels below this compile to nothing (0 = Trace ... 4 = Error). Builds
+// with NDEBUG drop TRACE unless the build sets it.
+#ifndef EMULATOR_LOG_MIN_LEVEL
+#ifdef NDEBUG
+#define EMULATOR_LOG_MIN_LEVEL 1
+#else
+#define EMULATOR_LOG_MIN_LEVEL 0
+#endif
+#endif
+
+// Arguments are only evaluated when the current context takes the level.
+#define EMULATOR_LOG(level, fn, ...) \
+    do { \
+        if constexpr (static_cast<int>(level) >= EMULATOR_LOG_MIN_LEVEL) { \
+            if (logging::enabled(level)) { \
+                fn(__FILE__, __LINE__, __VA_ARGS__); \
+            } \
+        } \
+    } while (0)
+
+#define INFO(...)    EMULATOR_LOG(logging::Level::Info, logging::info, __VA_ARGS__)
+#define DEBUG(...)   EMULATOR_LOG(logging::Level::Debug, logging::debug, __VA_ARGS__)
+#define WARN(...)    EMULATOR_LOG(logging::Level::Warn, logging::warn, __VA_ARGS__)
+#define ERROR(...)   EMULATOR_LOG(logging::Level::Error, logging::error, __VA_ARGS__)
+#define TRACE(...)   EMULATOR_LOG(logging::Level::Trace, logging::trace, __VA_ARGS__)
 
 #endif // EMULATOR_LOGGING_LOGGER_H
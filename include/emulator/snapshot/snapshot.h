@@ -0,0 +1,122 @@
+#ifndef EMULATOR_SNAPSHOT_SNAPSHOT_H
+#define EMULATOR_SNAPSHOT_SNAPSHOT_H
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+class ICpuExecutor;
+class MemoryBus;
+
+// Opaque per-device state. Devices return their own subclass from
+// Device::saveState() and get the same object back in restoreState().
+class DeviceState {
+public:
+    virtual ~DeviceState() = default;
+    // Host memory this state holds beyond what it shares with earlier states.
+    virtual uint64_t getSizeBytes() const { return 0; }
+};
+
+// State captured as a flat byte stream, for devices with small register state.
+class ByteState : public DeviceState {
+public:
+    std::vector<uint8_t> bytes;
+
+    uint64_t getSizeBytes() const override { return bytes.size(); }
+};
+
+struct DeviceSnapshot {
+    uint64_t lastSyncCycle = 0;
+    std::shared_ptr<const DeviceState> state;
+};
+
+// Snapshots are immutable and share unchanged memory pages, so keeping many of
+// them costs only the pages written in between.
+struct MachineSnapshot {
+    uint64_t schedulerNow = 0;
+    std::vector<std::vector<uint8_t>> harts;
+    std::vector<DeviceSnapshot> devices;
+
+    uint64_t getSizeBytes() const {
+        uint64_t total = 0;
+        for (const auto& hart : harts) {
+            total += hart.size();
+        }
+        for (const auto& device : devices) {
+            total += device.state ? device.state->getSizeBytes() : 0;
+        }
+        return total;
+    }
+};
+
+class StateWriter {
+public:
+    template <typename T>
+    void put(const T& value) {
+        static_assert(std::is_trivially_copyable_v<T>, "StateWriter::put needs a POD value");
+        putBytes(&value, sizeof(T));
+    }
+
+    void putBytes(const void* data, size_t size) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        mBytes.insert(mBytes.end(), bytes, bytes + size);
+    }
+
+    void putString(const std::string& text) {
+        put<uint64_t>(text.size());
+        putBytes(text.data(), text.size());
+    }
+
+    std::vector<uint8_t> take() { return std::move(mBytes); }
+
+private:
+    std::vector<uint8_t> mBytes;
+};
+
+class StateReader {
+public:
+    explicit StateReader(const std::vector<uint8_t>& bytes) : mBytes(bytes) {}
+
+    template <typename T>
+    bool get(T* value) {
+        static_assert(std::is_trivially_copyable_v<T>, "StateReader::get needs a POD value");
+        return getBytes(value, sizeof(T));
+    }
+
+    bool getBytes(void* data, size_t size) {
+        if (size > mBytes.size() - mPos) {
+            return false;
+        }
+        std::memcpy(data, mBytes.data() + mPos, size);
+        mPos += size;
+        return true;
+    }
+
+    bool getString(std::string* text) {
+        uint64_t size = 0;
+        if (!get(&size) || size > mBytes.size() - mPos) {
+            return false;
+        }
+        text->assign(reinterpret_cast<const char*>(mBytes.data() + mPos), size);
+        mPos += size;
+        return true;
+    }
+
+    bool atEnd() const { return mPos == mBytes.size(); }
+
+private:
+    const std::vector<uint8_t>& mBytes;
+    size_t mPos = 0;
+};
+
+// Both require every hart to be stopped. Devices are matched by their order in
+// MemoryBus::getDevices(), so restore into the machine the snapshot came from.
+bool takeMachineSnapshot(const std::vector<ICpuExecutor*>& harts, MemoryBus* bus,
+    MachineSnapshot* out, std::string* error);
+bool restoreMachineSnapshot(const std::vector<ICpuExecutor*>& harts, MemoryBus* bus,
+    const MachineSnapshot& snapshot, std::string* error);
+
+#endif
@@ -19,14 +19,50 @@ void printUsage(const char* exe) {
         "  --ram-base <addr> RAM base address (default: 0x80000000)\n"
         "  --ram-size <bytes> RAM size (default: 0x10000000)\n"
         "  --uart-base <addr> UART base address (default: 0x20000000)\n"
+        "  --uart-output <path> Write UART output straight to a file or \"stdout\"\n"
+        "                    (default: through the log's device channel)\n"
         "  --timer-base <addr> TIMER base address (default: 0x20001000)\n"
+        "  --dma-base <addr>   DMA base address (default: 0x20002000)\n"
+        "  --intc-base <addr>  Interrupt controller base address (default: 0x20003000)\n"
         "  --title <string> Window title (default: Emulator)\n"
+        "  --engine <name>   CPU dispatch engine (interpreter, threaded; default: interpreter)\n"
+        "  --pacing <mode>   Run at max speed or hold cpu_frequency in host time\n"
+        "                    (max, realtime; default: max)\n"
+        "  --memory-backing <kind> ROM/RAM storage (mmap, heap; default: mmap)\n"
+        "  --harts <n>       Number of CPU harts, each on its own thread (default: 1)\n"
+        "  --hart-quantum <cycles> Maximum cycle skew between harts (default: 10000)\n"
+        "  --checkpoint-interval <cycles> Cycles between reverse-execution checkpoints\n"
+        "                    (0 disables; default: 10000000)\n"
+        "  --checkpoint-budget <MiB> Memory kept for checkpoints (default: 256)\n"
         "  --itrace          Enable Instruction Trace\n"
         "  --mtrace          Enable Memory Trace\n"
         "  --bptrace         Enable Branch Prediction Trace\n"
+        "  --trace-file <path>   Write traces to a binary file (see tools/trace_decode)\n"
+        "  --trace-compress      Compress binary trace chunks\n"
+        "  --symbols <path>      Guest symbols (ELF or nm map) for profile reports\n"
+        "  --profile <path>      Sample the PC for the whole run and write folded stacks\n"
+        "  --profile-period <cycles> Cycles between profile samples (default: 10000)\n"
+        "  --heatmap <path>      Count bus accesses per page and write them as CSV\n"
+        "  --record-input <path> Log UART and key input with the guest cycle it arrived at\n"
+        "  --replay-input <path> Deliver a recorded input log instead of host input\n"
+        "  --run-until <n>       Fast-forward to n retired instructions before the run starts\n"
+        "  --run-until-cycle <n> Fast-forward to guest cycle n before the run starts\n"
+        "  --max-cycles <n>      Stop non-interactive runs after n guest cycles (default: 0, off)\n"
+        "  --farm <list>         Run every ROM in the list on its own headless machine\n"
+        "  --farm-jobs <n>       Farm worker threads (default: one per host CPU)\n"
+        "  --farm-report <path>  Write the farm results CSV here (default: stdout)\n"
+        "  --farm-output <dir>   Keep each farm machine's UART output as <dir>/<index>.uart\n"
+        "  --gdb <port>          Start paused and serve GDB remote debugging on the port\n"
+        "  --gdb-register-bytes <n> Register width reported to GDB (4 or 8; default: 8)\n"
         "  --log-level <lvl>     Set log level (trace, debug, info, warn, error)\n"
         "  --log-filename <path> Set log file path (device->name.out, other->name.err)\n"
+        "  --log-async           Write logs from a background thread\n"
         "  --headless            Run without SDL window (headless mode)\n"
+        "  --frame-output <spec> Write presented frames to file:<prefix> (PPM sequence)\n"
+        "                        or pipe:<command> (raw BGRA on stdin)\n"
+        "  --frame-every <n>     Write only every n-th presented frame (default: 1)\n"
+        "  --perf-interval <ms>  Log performance counters as JSON this often\n"
+        "                        (non-interactive runs; default: 0, off)\n"
         "  --help, -h            Show this help\n",
         name);
 }
@@ -146,6 +182,14 @@ bool parseArgs(int argc, char** argv, EmulatorConfig* config, std::string* error
             }
             continue;
         }
+        if (arg == "--uart-output") {
+            std::string value;
+            if (!requireArgValue(argc, argv, &i, "--uart-output", &value, error)) {
+                return false;
+            }
+            config->uartOutput = value;
+            continue;
+        }
         if (arg == "--timer-base") {
             std::string value;
             if (!requireArgValue(argc, argv, &i, "--timer-base", &value, error)) {
@@ -156,6 +200,26 @@ bool parseArgs(int argc, char** argv, EmulatorConfig* config, std::string* error
             }
             continue;
         }
+        if (arg == "--dma-base") {
+            std::string value;
+            if (!requireArgValue(argc, argv, &i, "--dma-base", &value, error)) {
+                return false;
+            }
+            if (!parseU64Arg("dma-base", value, &config->dmaBase, error)) {
+                return false;
+            }
+            continue;
+        }
+        if (arg == "--intc-base") {
+            std::string value;
+            if (!requireArgValue(argc, argv, &i, "--intc-base", &value, error)) {
+                return false;
+            }
+            if (!parseU64Arg("intc-base", value, &config->intcBase, error)) {
+                return false;
+            }
+            continue;
+        }
         if (arg == "--title") {
             std::string value;
             if (!requireArgValue(argc, argv, &i, "--title", &value, error)) {
@@ -164,6 +228,97 @@ bool parseArgs(int argc, char** argv, EmulatorConfig* config, std::string* error
             config->windowTitle = value;
             continue;
         }
+        if (arg == "--engine") {
+            std::string value;
+            if (!requireArgValue(argc, argv, &i, "--engine", &value, error)) {
+                return false;
+            }
+            if (!parseExecutionEngine(value, &config->engine)) {
+                if (error != nullptr) {
+                    *error = "Invalid engine value: " + value;
+                }
+                return false;
+            }
+            continue;
+        }
+        if (arg == "--pacing") {
+            std::string value;
+            if (!requireArgValue(argc, argv, &i, "--pacing", &value, error)) {
+                return false;
+            }
+            if (!parsePacingMode(value, &config->pacing)) {
+                if (error != nullptr) {
+                    *error = "Invalid pacing value: " + value;
+                }
+                return false;
+            }
+            continue;
+        }
+        if (arg == "--memory-backing") {
+            std::string value;
+            if (!requireArgValue(argc, argv, &i, "--memory-backing", &value, error)) {
+                return false;
+            }
+            if (!parseMemoryBacking(value, &config->memoryBacking)) {
+                if (error != nullptr) {
+                    *error = "Invalid memory-backing value: " + value;
+                }
+                return false;
+            }
+            continue;
+        }
+        if (arg == "--harts") {
+            std::string value;
+            if (!requireArgValue(argc, argv, &i, "--harts", &value, error)) {
+                return false;
+            }
+            if (!parseU32Arg("harts", value, &config->harts, error)) {
+                return false;
+            }
+            if (config->harts == 0 || config->harts > kMaxHarts) {
+                if (error != nullptr) {
+                    *error = "Invalid harts value: " + value;
+                }
+                return false;
+            }
+            continue;
+        }
+        if (arg == "--hart-quantum") {
+            std::string value;
+            if (!requireArgValue(argc, argv, &i, "--hart-quantum", &value, error)) {
+                return false;
+            }
+            if (!parseU64Arg("hart-quantum", value, &config->hartQuantum, error)) {
+                return false;
+            }
+            if (config->hartQuantum == 0) {
+                if (error != nullptr) {
+                    *error = "Invalid hart-quantum value: " + value;
+                }
+                return false;
+            }
+            continue;
+        }
+        if (arg == "--checkpoint-interval") {
+            std::string value;
+            if (!requireArgValue(argc, argv, &i, "--checkpoint-interval", &value, error)) {
+                return false;
+            }
+            if (!parseU64Arg("checkpoint-interval", value, &config->checkpointInterval, error)) {
+                return false;
+            }
+            continue;
+        }
+        if (arg == "--checkpoint-budget") {
+            std::string value;
+            if (!requireArgValue(argc, argv, &i, "--checkpoint-budget", &value, error)) {
+                return false;
+            }
+            if (!parseU64Arg("checkpoint-budget", value, &config->checkpointBudgetMiB, error)) {
+                return false;
+            }
+            continue;
+        }
         if (arg == "--itrace") {
             config->iTrace = true;
             continue;
@@ -176,6 +331,164 @@ bool parseArgs(int argc, char** argv, EmulatorConfig* config, std::string* error
             config->bpTrace = true;
             continue;
         }
+        if (arg == "--trace-file") {
+            std::string value;
+            if (!requireArgValue(argc, argv, &i, "--trace-file", &value, error)) {
+                return false;
+            }
+            config->traceFile = value;
+            continue;
+        }
+        if (arg == "--trace-compress") {
+            config->traceCompress = true;
+            continue;
+        }
+        if (arg == "--symbols") {
+            std::string value;
+            if (!requireArgValue(argc, argv, &i, "--symbols", &value, error)) {
+                return false;
+            }
+            config->symbolsPath = value;
+            continue;
+        }
+        if (arg == "--profile") {
+            std::string value;
+            if (!requireArgValue(argc, argv, &i, "--profile", &value, error)) {
+                return false;
+            }
+            config->profileOutput = value;
+            continue;
+        }
+        if (arg == "--heatmap") {
+            std::string value;
+            if (!requireArgValue(argc, argv, &i, "--heatmap", &value, error)) {
+                return false;
+            }
+            config->heatmapOutput = value;
+            continue;
+        }
+        if (arg == "--record-input") {
+            std::string value;
+            if (!requireArgValue(argc, argv, &i, "--record-input", &value, error)) {
+                return false;
+            }
+            config->inputRecord = value;
+            continue;
+        }
+        if (arg == "--replay-input") {
+            std::string value;
+            if (!requireArgValue(argc, argv, &i, "--replay-input", &value, error)) {
+                return false;
+            }
+            config->inputReplay = value;
+            continue;
+        }
+        if (arg == "--run-until") {
+            std::string value;
+            if (!requireArgValue(argc, argv, &i, "--run-until", &value, error)) {
+                return false;
+            }
+            if (!parseU64Arg("run-until", value, &config->runUntilInstructions, error)) {
+                return false;
+            }
+            continue;
+        }
+        if (arg == "--run-until-cycle") {
+            std::string value;
+            if (!requireArgValue(argc, argv, &i, "--run-until-cycle", &value, error)) {
+                return false;
+            }
+            if (!parseU64Arg("run-until-cycle", value, &config->runUntilCycle, error)) {
+                return false;
+            }
+            continue;
+        }
+        if (arg == "--max-cycles") {
+            std::string value;
+            if (!requireArgValue(argc, argv, &i, "--max-cycles", &value, error)) {
+                return false;
+            }
+            if (!parseU64Arg("max-cycles", value, &config->maxCycles, error)) {
+                return false;
+            }
+            continue;
+        }
+        if (arg == "--farm") {
+            std::string value;
+            if (!requireArgValue(argc, argv, &i, "--farm", &value, error)) {
+                return false;
+            }
+            config->farmList = value;
+            continue;
+        }
+        if (arg == "--farm-jobs") {
+            std::string value;
+            if (!requireArgValue(argc, argv, &i, "--farm-jobs", &value, error)) {
+                return false;
+            }
+            if (!parseU32Arg("farm-jobs", value, &config->farmJobs, error)) {
+                return false;
+            }
+            continue;
+        }
+        if (arg == "--farm-report") {
+            std::string value;
+            if (!requireArgValue(argc, argv, &i, "--farm-report", &value, error)) {
+                return false;
+            }
+            config->farmReport = value;
+            continue;
+        }
+        if (arg == "--farm-output") {
+            std::string value;
+            if (!requireArgValue(argc, argv, &i, "--farm-output", &value, error)) {
+                return false;
+            }
+            config->farmOutputDir = value;
+            continue;
+        }
+        if (arg == "--gdb") {
+            std::string value;
+            if (!requireArgValue(argc, argv, &i, "--gdb", &value, error)) {
+                return false;
+            }
+            if (!parseU32Arg("gdb", value, &config->gdbPort, error)) {
+                return false;
+            }
+            if (config->gdbPort == 0 || config->gdbPort > 0xffff) {
+                if (error != nullptr) {
+                    *error = "Invalid gdb port: " + value;
+                }
+                return false;
+            }
+            continue;
+        }
+        if (arg == "--gdb-register-bytes") {
+            std::string value;
+            if (!requireArgValue(argc, argv, &i, "--gdb-register-bytes", &value, error)) {
+                return false;
+            }
+            if (!parseU32Arg("gdb-register-bytes", value, &config->gdbRegisterBytes, error)) {
+                return false;
+            }
+            if (config->gdbRegisterBytes != 4 && config->gdbRegisterBytes != 8) {
+                if (error != nullptr) {
+                    *error = "Invalid gdb-register-bytes value: " + value;
+                }
+                return false;
+            }
+            continue;
+        }
+        if (arg == "--profile-period") {
+            std::string value;
+            if (!requireArgValue(argc, argv, &i, "--profile-period", &value, error)) {
+                return false;
+            }
+            if (!parseU64Arg("profile-period", value, &config->profilePeriod, error)) {
+                return false;
+            }
+            continue;
+        }
         if (arg == "--log-level") {
             std::string value;
             if (!requireArgValue(argc, argv, &i, "--log-level", &value, error)) {
@@ -192,6 +505,44 @@ bool parseArgs(int argc, char** argv, EmulatorConfig* config, std::string* error
             config->logFilename = value;
             continue;
         }
+        if (arg == "--log-async") {
+            config->logAsync = true;
+            continue;
+        }
+        if (arg == "--frame-output") {
+            std::string value;
+            if (!requireArgValue(argc, argv, &i, "--frame-output", &value, error)) {
+                return false;
+            }
+            config->frameOutput = value;
+            continue;
+        }
+        if (arg == "--frame-every") {
+            std::string value;
+            if (!requireArgValue(argc, argv, &i, "--frame-every", &value, error)) {
+                return false;
+            }
+            if (!parseU32Arg("frame-every", value, &config->frameEvery, error)) {
+                return false;
+            }
+            if (config->frameEvery == 0) {
+                if (error != nullptr) {
+                    *error = "Invalid frame-every value: " + value;
+                }
+                return false;
+            }
+            continue;
+        }
+        if (arg == "--perf-interval") {
+            std::string value;
+            if (!requireArgValue(argc, argv, &i, "--perf-interval", &value, error)) {
+                return false;
+            }
+            if (!parseU32Arg("perf-interval", value, &config->perfIntervalMs, error)) {
+                return false;
+            }
+            continue;
+        }
         if (arg == "--headless") {
             config->headless = true;
             continue;
@@ -53,10 +53,149 @@ bool applyConfigValue(EmulatorConfig* config, const std::string& key, const std:
         config->bpTrace = flag;
         return true;
     }
+    if (key == "trace_pc" || key == "trace_data") {
+        if (!parseTraceRanges(value, key == "trace_pc" ? &config->traceFilter.pcRanges :
+            &config->traceFilter.dataRanges)) {
+            if (error != nullptr) *error = "Invalid " + key + " value: " + value;
+            return false;
+        }
+        return true;
+    }
+    if (key == "trace_cycles") {
+        std::vector<TraceRange> window;
+        if (!parseTraceRanges(value, &window) || window.size() != 1) {
+            if (error != nullptr) *error = "Invalid trace_cycles value: " + value;
+            return false;
+        }
+        config->traceFilter.cycleBegin = window[0].begin;
+        config->traceFilter.cycleEnd = window[0].end;
+        return true;
+    }
+    if (key == "trace_after") {
+        if (!parseU64(value, &config->traceFilter.skipInstructions)) {
+            if (error != nullptr) *error = "Invalid trace_after value: " + value;
+            return false;
+        }
+        return true;
+    }
+    if (key == "trace_sample") {
+        uint64_t parsed = 0;
+        if (!parseU64(value, &parsed) || parsed == 0) {
+            if (error != nullptr) *error = "Invalid trace_sample value: " + value;
+            return false;
+        }
+        config->traceFilter.sampleEvery = parsed;
+        return true;
+    }
+    if (key == "trace_file") {
+        config->traceFile = value;
+        return true;
+    }
+    if (key == "symbols") {
+        config->symbolsPath = value;
+        return true;
+    }
+    if (key == "profile_output") {
+        config->profileOutput = value;
+        return true;
+    }
+    if (key == "heatmap_output") {
+        config->heatmapOutput = value;
+        return true;
+    }
+    if (key == "record_input") {
+        config->inputRecord = value;
+        return true;
+    }
+    if (key == "replay_input") {
+        config->inputReplay = value;
+        return true;
+    }
+    if (key == "run_until") {
+        if (!parseU64(value, &config->runUntilInstructions)) {
+            if (error != nullptr) *error = "Invalid run_until value: " + value;
+            return false;
+        }
+        return true;
+    }
+    if (key == "run_until_cycle") {
+        if (!parseU64(value, &config->runUntilCycle)) {
+            if (error != nullptr) *error = "Invalid run_until_cycle value: " + value;
+            return false;
+        }
+        return true;
+    }
+    if (key == "max_cycles") {
+        if (!parseU64(value, &config->maxCycles)) {
+            if (error != nullptr) *error = "Invalid max_cycles value: " + value;
+            return false;
+        }
+        return true;
+    }
+    if (key == "farm_jobs") {
+        uint64_t parsed = 0;
+        if (!parseU64(value, &parsed) || parsed > 0xffffffffull) {
+            if (error != nullptr) *error = "Invalid farm_jobs value: " + value;
+            return false;
+        }
+        config->farmJobs = static_cast<uint32_t>(parsed);
+        return true;
+    }
+    if (key == "gdb_port") {
+        uint64_t parsed = 0;
+        if (!parseU64(value, &parsed) || parsed > 0xffff) {
+            if (error != nullptr) *error = "Invalid gdb_port value: " + value;
+            return false;
+        }
+        config->gdbPort = static_cast<uint32_t>(parsed);
+        return true;
+    }
+    if (key == "gdb_register_bytes") {
+        uint64_t parsed = 0;
+        if (!parseU64(value, &parsed) || (parsed != 4 && parsed != 8)) {
+            if (error != nullptr) *error = "Invalid gdb_register_bytes value: " + value;
+            return false;
+        }
+        config->gdbRegisterBytes = static_cast<uint32_t>(parsed);
+        return true;
+    }
+    if (key == "profile_period") {
+        uint64_t parsed = 0;
+        if (!parseU64(value, &parsed) || parsed == 0) {
+            if (error != nullptr) {
+                *error = "Invalid profile_period value: " + value;
+            }
+            return false;
+        }
+        config->profilePeriod = parsed;
+        return true;
+    }
+    if (key == "trace_compress") {
+        bool flag = false;
+        if (!parseBool(value, &flag)) {
+            if (error != nullptr) *error = "Invalid trace_compress value: " + value;
+            return false;
+        }
+        config->traceCompress = flag;
+        return true;
+    }
     if (key == "log_level") {
         config->logLevel = value;
         return true;
     }
+    if (key == "log_async") {
+        bool flag = false;
+        if (!parseBool(value, &flag)) {
+            if (error != nullptr) *error = "Invalid log_async value: " + value;
+            return false;
+        }
+        config->logAsync = flag;
+        return true;
+    }
+    if (key == "uart_output") {
+        config->uartOutput = value;
+        return true;
+    }
     if (key == "log_filename") {
         config->logFilename = value;
         return true;
@@ -138,6 +277,28 @@ bool applyConfigValue(EmulatorConfig* config, const std::string& key, const std:
         config->timerBase = parsed;
         return true;
     }
+    if (key == "dma_base") {
+        uint64_t parsed = 0;
+        if (!parseU64(value, &parsed)) {
+            if (error != nullptr) {
+                *error = "Invalid dma_base value: " + value;
+            }
+            return false;
+        }
+        config->dmaBase = parsed;
+        return true;
+    }
+    if (key == "intc_base") {
+        uint64_t parsed = 0;
+        if (!parseU64(value, &parsed)) {
+            if (error != nullptr) {
+                *error = "Invalid intc_base value: " + value;
+            }
+            return false;
+        }
+        config->intcBase = parsed;
+        return true;
+    }
     if (key == "sdl_base") {
         uint64_t parsed = 0;
         if (!parseU64(value, &parsed)) {
@@ -164,6 +325,104 @@ bool applyConfigValue(EmulatorConfig* config, const std::string& key, const std:
         config->cpuFrequency = static_cast<uint32_t>(parsed);
         return true;
     }
+    if (key == "memory_backing") {
+        if (!parseMemoryBacking(value, &config->memoryBacking)) {
+            if (error != nullptr) {
+                *error = "Invalid memory_backing value: " + value;
+            }
+            return false;
+        }
+        return true;
+    }
+    if (key == "frame_output") {
+        config->frameOutput = value;
+        return true;
+    }
+    if (key == "frame_every") {
+        uint64_t parsed = 0;
+        if (!parseU64(value, &parsed) || parsed == 0 ||
+            parsed > std::numeric_limits<uint32_t>::max()) {
+            if (error != nullptr) {
+                *error = "Invalid frame_every value: " + value;
+            }
+            return false;
+        }
+        config->frameEvery = static_cast<uint32_t>(parsed);
+        return true;
+    }
+    if (key == "perf_interval_ms") {
+        uint64_t parsed = 0;
+        if (!parseU64(value, &parsed) || parsed > std::numeric_limits<uint32_t>::max()) {
+            if (error != nullptr) {
+                *error = "Invalid perf_interval_ms value: " + value;
+            }
+            return false;
+        }
+        config->perfIntervalMs = static_cast<uint32_t>(parsed);
+        return true;
+    }
+    if (key == "harts") {
+        uint64_t parsed = 0;
+        if (!parseU64(value, &parsed) || parsed == 0 || parsed > kMaxHarts) {
+            if (error != nullptr) {
+                *error = "Invalid harts value: " + value;
+            }
+            return false;
+        }
+        config->harts = static_cast<uint32_t>(parsed);
+        return true;
+    }
+    if (key == "hart_quantum") {
+        uint64_t parsed = 0;
+        if (!parseU64(value, &parsed) || parsed == 0) {
+            if (error != nullptr) {
+                *error = "Invalid hart_quantum value: " + value;
+            }
+            return false;
+        }
+        config->hartQuantum = parsed;
+        return true;
+    }
+    if (key == "checkpoint_interval") {
+        uint64_t parsed = 0;
+        if (!parseU64(value, &parsed)) {
+            if (error != nullptr) {
+                *error = "Invalid checkpoint_interval value: " + value;
+            }
+            return false;
+        }
+        config->checkpointInterval = parsed;
+        return true;
+    }
+    if (key == "checkpoint_budget") {
+        uint64_t parsed = 0;
+        if (!parseU64(value, &parsed)) {
+            if (error != nullptr) {
+                *error = "Invalid checkpoint_budget value: " + value;
+            }
+            return false;
+        }
+        config->checkpointBudgetMiB = parsed;
+        return true;
+    }
+    if (key == "pacing") {
+        if (!parsePacingMode(value, &config->pacing)) {
+            if (error != nullptr) {
+                *error = "Invalid pacing value: " + value;
+            }
+            return false;
+        }
+        return true;
+    }
+    if (key == "cpu_engine") {
+        if (!parseExecutionEngine(value, &config->engine)) {
+            if (error != nullptr) {
+                *error = "Invalid cpu_engine value: " + value;
+            }
+            return false;
+        }
+        return true;
+    }
     if (error != nullptr) {
         *error = "Unknown config key: " + key;
     }
@@ -183,6 +442,9 @@ bool loadConfigFile(const std::string& path, bool required, EmulatorConfig* conf
         }
         return true;
     }
+    // Keys after a [type name] header describe that device, up to the next
+    // header; a file that has any replaces the default machine's devices.
+    std::vector<SocDevice> soc;
     std::string line;
     size_t lineNumber = 0;
     while (std::getline(input, line)) {
@@ -192,6 +454,19 @@ bool loadConfigFile(const std::string& path, bool required, EmulatorConfig* conf
         if (line.empty()) {
             continue;
         }
+        if (line.front() == '[') {
+            std::string sectionError;
+            if (line.back() != ']' ||
+                !parseSocSection(line.substr(1, line.size() - 2), &soc.emplace_back(),
+                    &sectionError)) {
+                if (error != nullptr) {
+                    *error = "Invalid config line " + std::to_string(lineNumber) +
+                        (sectionError.empty() ? "" : ": " + sectionError);
+                }
+                return false;
+            }
+            continue;
+        }
         size_t eq = line.find('=');
         if (eq == std::string::npos) {
             if (error != nullptr) {
@@ -212,9 +487,23 @@ bool loadConfigFile(const std::string& path, bool required, EmulatorConfig* conf
             }
         }
         key = toLower(key);
+        if (!soc.empty()) {
+            std::string keyError;
+            if (!applySocDeviceValue(&soc.back(), key, value, &keyError)) {
+                if (error != nullptr) {
+                    *error = "Invalid config line " + std::to_string(lineNumber) + ": " +
+                        keyError;
+                }
+                return false;
+            }
+            continue;
+        }
         if (!applyConfigValue(config, key, value, error)) {
             return false;
         }
     }
+    if (!soc.empty()) {
+        config->soc = std::move(soc);
+    }
     return true;
 }
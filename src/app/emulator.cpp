@@ -1,28 +1,15 @@
 #include "emulator/app/app.h"
+#include "emulator/app/farm.h"
+#include "emulator/app/machine.h"
 #include "emulator/app/utils.h"
 #include "emulator/logging/logger.h"
 #include "emulator/debugger/debugger.h"
+#include "emulator/debugger/gdb_server.h"
 
-#include <chrono>
 #include <cstdint>
-#include <cstdio>
-#include <iostream>
-#include <limits>
 #include <string>
-#include <thread>
-#include <vector>
 
-#if defined(__unix__) || defined(__APPLE__)
-#include <unistd.h>
-#endif
-
-#include "emulator/bus/bus.h"
 #include "emulator/cpu/cpu.h"
-#include "emulator/device/device.h"
-#include "emulator/device/memory.h"
-#include "emulator/device/timer.h"
-#include "emulator/device/uart.h"
-#include "emulator/device/display.h"
 
 extern "C" ICpuExecutor* CreateCpuExecutor();
 
@@ -57,102 +44,84 @@ int RunEmulator(int argc, char** argv) {
         logConfig.mDeviceFile = config.logFilename + ".out";
         logConfig.mFile = config.logFilename + ".err";
     }
+    logConfig.mAsync = config.logAsync;
     logging::init(logConfig);
 
+    if (!config.farmList.empty()) {
+        int status = RunFarm(config);
+        logging::shutdown();
+        return status;
+    }
     if (config.romPath.empty()) {
         ERROR("ROM path is required");
         printUsage(argv[0]);
         return 1;
     }
-    if (config.romBase != kDefaultRomBase) {
-        ERROR("ROM base must be 0x00000000");
-        return 1;
-    }
-    if (config.width == 0 || config.height == 0) {
-        ERROR("SDL width/height must be non-zero");
-        return 1;
-    }
 
-    uint64_t romSize = 0;
-    if (!getFileSize(config.romPath, &romSize) || romSize == 0) {
-        ERROR("failed to read ROM file size");
-        return 1;
-    }
-    uint64_t fbSize = 0;
-    if (!computeFramebufferSize(config.width, config.height, &fbSize)) {
-        ERROR("invalid SDL size");
-        return 1;
-    }
-    uint64_t sdlSize = SdlDisplayDevice::kControlRegionSize + fbSize;
-    if (sdlSize < fbSize) {
-        ERROR("SDL mapping size overflow");
+    ICpuExecutor* cpu = CreateCpuExecutor();
+    if (cpu == nullptr) {
+        ERROR("CreateCpuExecutor returned null");
         return 1;
     }
-
-    std::vector<MemoryRegion> mappings = {
-        {"ROM", config.romBase, romSize},
-        {"UART", config.uartBase, kUartSize},
-        {"TIMER", config.timerBase, kTimerSize},
-        {"SDL", config.sdlBase, sdlSize},
-        {"RAM", config.ramBase, config.ramSize},
-    };
-    if (!validateMappings(mappings, &error)) {
+    Machine machine;
+    if (!machine.build(config, cpu, &error)) {
         ERROR("%s", error.c_str());
         return 1;
     }
-
-    MemoryDevice rom(romSize, true);
-    if (!rom.loadImage(config.romPath)) {
-        ERROR("failed to load ROM image");
+    Debugger& debugger = machine.debugger();
+    if (config.runUntilInstructions > 0 && config.runUntilCycle > 0) {
+        ERROR("Use either --run-until or --run-until-cycle");
         return 1;
     }
-    MemoryDevice ram(config.ramSize, false);
-    UartDevice uart;
-    TimerDevice timer;
-
-    MemoryBus bus;
-    bus.registerDevice(&rom, config.romBase, romSize, "ROM");
-    bus.registerDevice(&uart, config.uartBase, kUartSize, "UART");
-    bus.registerDevice(&timer, config.timerBase, kTimerSize, "TIMER");
-
-    SdlDisplayDevice sdl;
-    if (config.headless) {
-        if (!sdl.initHeadless(config.width, config.height)) {
-            ERROR("SDL headless initialization failed");
-            return 1;
-        }
-    } else {
-        if (!sdl.init(config.width, config.height, config.windowTitle.c_str())) {
-            ERROR("SDL initialization failed");
+    if (config.runUntilInstructions > 0 || config.runUntilCycle > 0) {
+        bool byCycles = config.runUntilCycle > 0;
+        if (!debugger.runUntil(byCycles ? config.runUntilCycle : config.runUntilInstructions,
+            byCycles ? Debugger::RunUntilUnit::Cycles : Debugger::RunUntilUnit::Instructions,
+            &error)) {
+            ERROR("Fast-forward failed: %s", error.c_str());
             return 1;
         }
+        HartStatus status = debugger.getHartStatus(0);
+        INFO("Fast-forwarded to instruction %llu, cycle %llu",
+            (unsigned long long)status.instructions, (unsigned long long)status.cycle);
     }
-    bus.registerDevice(&sdl, config.sdlBase, sdl.getMappedSize(), "SDL");
-    bus.registerDevice(&ram, config.ramBase, config.ramSize, "RAM");
 
-    ICpuExecutor* cpu = CreateCpuExecutor();
-    if (cpu == nullptr) {
-        ERROR("CreateCpuExecutor returned null");
-        return 1;
+    GdbServer gdb(&debugger);
+    if (config.gdbPort != 0) {
+        gdb.setRegisterBytes(config.gdbRegisterBytes);
+        if (!gdb.start(static_cast<uint16_t>(config.gdbPort), false, &error)) {
+            ERROR("%s", error.c_str());
+            return 1;
+        }
+        debugger.setStartPaused(true);
+        debugger.setHoldOnHalt(true);
+        INFO("Waiting for GDB on port %u", (unsigned)gdb.getPort());
     }
-
-    Debugger debugger(cpu, &bus);
-    debugger.setRegisterCount(cpu->getRegisterCount());
-    debugger.setCpuFrequency(config.cpuFrequency);
-    debugger.setSdl(&sdl);
-
-    TraceOptions traceOpts;
-    traceOpts.logInstruction = config.iTrace;
-    traceOpts.logMemEvents = config.mTrace;
-    traceOpts.logBranchPrediction = config.bpTrace;
-    debugger.configureTrace(traceOpts);
-
-    bus.setDebugger(&debugger);
-    cpu->setDebugger(&debugger);
-    cpu->reset();
-    cpu->setPc(config.romBase);
-
     debugger.run(config.debug);
+    gdb.stop();
+    if (!config.profileOutput.empty()) {
+        if (debugger.profiler().exportFolded(config.profileOutput, debugger.getSymbols(),
+            &error)) {
+            INFO("Profile: %llu samples written to %s",
+                (unsigned long long)debugger.profiler().getSampleCount(),
+                config.profileOutput.c_str());
+        } else {
+            ERROR("%s", error.c_str());
+        }
+    }
+    if (!config.heatmapOutput.empty()) {
+        if (debugger.exportHeatmap(config.heatmapOutput, &error)) {
+            INFO("Heatmap written to %s", config.heatmapOutput.c_str());
+        } else {
+            ERROR("%s", error.c_str());
+        }
+    }
+    logging::shutdown();
 
-    return !(cpu->getLastError().type == CpuErrorType::None);
+    for (ICpuExecutor* hart : machine.harts()) {
+        if (hart->getLastError().type != CpuErrorType::None) {
+            return 1;
+        }
+    }
+    return 0;
 }
@@ -0,0 +1,286 @@
+#include "emulator/app/farm.h"
+
+#include "emulator/app/machine.h"
+#include "emulator/app/utils.h"
+#include "emulator/logging/logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+extern "C" ICpuExecutor* CreateCpuExecutor();
+
+namespace {
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<size_t> items;
+    };
+
+    const char* errorTypeName(CpuErrorType type) {
+        switch (type) {
+            case CpuErrorType::InvalidOp: return "invalid instruction";
+            case CpuErrorType::AccessFault: return "access fault";
+            case CpuErrorType::DeviceFault: return "device fault";
+            default: return "error";
+        }
+    }
+
+    // Options that write to one shared place, or need a host terminal or a
+    // window, make no sense per farm machine.
+    EmulatorConfig farmMachineConfig(const EmulatorConfig& base, const std::string& rom,
+        size_t index) {
+        EmulatorConfig config = base;
+        config.romPath = rom;
+        config.debug = false;
+        config.headless = true;
+        config.gdbPort = 0;
+        config.frameOutput.clear();
+        config.traceFile.clear();
+        config.profileOutput.clear();
+        config.heatmapOutput.clear();
+        config.inputRecord.clear();
+        config.perfIntervalMs = 0;
+        config.uartOutput = base.farmOutputDir.empty() ? "/dev/null" :
+            base.farmOutputDir + "/" + std::to_string(index) + ".uart";
+        // Described UARTs would all write the same files: the first one takes
+        // the output above, the others log through the machine's context.
+        for (auto& device : config.soc) {
+            device.output.clear();
+        }
+        return config;
+    }
+
+    // Each machine logs through its own context, to <dir>/<index>.log or to
+    // stderr behind an "[index] " prefix, so machines never share a log lock.
+    logging::Config farmLogConfig(const EmulatorConfig& base, size_t index) {
+        logging::Config config;
+        config.level = logging::levelFromString(base.logLevel);
+        if (!base.farmOutputDir.empty()) {
+            config.mFile = base.farmOutputDir + "/" + std::to_string(index) + ".log";
+            return config;
+        }
+        std::string prefix = "[" + std::to_string(index) + "] ";
+        config.mOnMessage = [prefix](const char* message) {
+            std::fprintf(stderr, "%s%s", prefix.c_str(), message);
+        };
+        return config;
+    }
+
+    FarmResult runFarmMachine(const EmulatorConfig& config, size_t index,
+        const std::function<std::unique_ptr<ICpuExecutor>()>& createCpu) {
+        logging::Context log(farmLogConfig(config, index));
+        logging::ScopedContext scope(&log);
+        FarmResult result;
+        result.romPath = config.romPath;
+        auto start = std::chrono::steady_clock::now();
+        std::unique_ptr<ICpuExecutor> cpu = createCpu();
+        if (!cpu) {
+            result.detail = "CPU cannot create independent instances";
+            return result;
+        }
+        Machine machine;
+        if (!machine.build(config, cpu.get(), &result.detail)) {
+            return result;
+        }
+        Debugger& debugger = machine.debugger();
+        debugger.setHostInput(false);
+        debugger.run(false);
+        result.seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+
+        HartStatus boot = debugger.getHartStatus(0);
+        result.pc = boot.pc;
+        result.cycles = boot.cycle;
+        for (uint32_t i = 0; i < debugger.getHartCount(); ++i) {
+            result.instructions += debugger.getHartStatus(i).instructions;
+        }
+        result.outcome = debugger.cycleLimitReached() ? FarmOutcome::Timeout : FarmOutcome::Halted;
+        for (ICpuExecutor* hart : machine.harts()) {
+            CpuErrorDetail error = hart->getLastError();
+            if (error.type != CpuErrorType::None && error.type != CpuErrorType::Halt) {
+                char text[64];
+                std::snprintf(text, sizeof(text), "%s at 0x%llx", errorTypeName(error.type),
+                    (unsigned long long)error.address);
+                result.outcome = FarmOutcome::Fault;
+                result.detail = text;
+                break;
+            }
+        }
+        return result;
+    }
+
+    std::string csvField(const std::string& text) {
+        if (text.find_first_of(",\"\n") == std::string::npos) {
+            return text;
+        }
+        std::string quoted = "\"";
+        for (char c : text) {
+            quoted += c == '"' ? "\"\"" : std::string(1, c);
+        }
+        return quoted + "\"";
+    }
+}
+
+void runWorkStealing(size_t count, uint32_t workers, const std::function<void(size_t)>& task) {
+    workers = static_cast<uint32_t>(std::clamp<size_t>(workers, 1, std::max<size_t>(count, 1)));
+    std::vector<WorkQueue> queues(workers);
+    for (size_t i = 0; i < count; ++i) {
+        queues[i % workers].items.push_back(i);
+    }
+    // Nothing is queued once the workers start, so a worker that finds every
+    // queue empty is done.
+    auto next = [&queues, workers](uint32_t self, size_t* index) {
+        for (uint32_t offset = 0; offset < workers; ++offset) {
+            WorkQueue& queue = queues[(self + offset) % workers];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.items.empty()) {
+                continue;
+            }
+            if (offset == 0) {
+                *index = queue.items.front();
+                queue.items.pop_front();
+            } else {
+                *index = queue.items.back();
+                queue.items.pop_back();
+            }
+            return true;
+        }
+        return false;
+    };
+    std::vector<std::thread> threads;
+    for (uint32_t worker = 0; worker < workers; ++worker) {
+        threads.emplace_back([&next, &task, worker]() {
+            size_t index = 0;
+            while (next(worker, &index)) {
+                task(index);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+bool loadFarmList(const std::string& path, std::vector<std::string>* roms, std::string* error) {
+    std::ifstream file(path);
+    if (!file) {
+        if (error != nullptr) *error = "Cannot open farm list: " + path;
+        return false;
+    }
+    roms->clear();
+    std::string line;
+    while (std::getline(file, line)) {
+        trimInPlace(&line);
+        if (!line.empty() && line[0] != '#') {
+            roms->push_back(line);
+        }
+    }
+    if (roms->empty()) {
+        if (error != nullptr) *error = "Farm list has no ROMs: " + path;
+        return false;
+    }
+    return true;
+}
+
+std::vector<FarmResult> runFarmJobs(const EmulatorConfig& base,
+    const std::vector<std::string>& roms, uint32_t jobs,
+    const std::function<std::unique_ptr<ICpuExecutor>()>& createCpu) {
+    std::vector<FarmResult> results(roms.size());
+    runWorkStealing(roms.size(), jobs, [&](size_t index) {
+        results[index] = runFarmMachine(farmMachineConfig(base, roms[index], index), index,
+            createCpu);
+    });
+    return results;
+}
+
+const char* farmOutcomeToString(FarmOutcome outcome) {
+    switch (outcome) {
+        case FarmOutcome::Halted: return "halted";
+        case FarmOutcome::Fault: return "fault";
+        case FarmOutcome::Timeout: return "timeout";
+        case FarmOutcome::Error: return "error";
+    }
+    return "error";
+}
+
+std::string formatFarmReport(const std::vector<FarmResult>& results) {
+    std::ostringstream out;
+    out << "rom,outcome,pc,cycles,instructions,seconds,detail\n";
+    for (const auto& result : results) {
+        char pc[24];
+        std::snprintf(pc, sizeof(pc), "0x%llx", (unsigned long long)result.pc);
+        char seconds[32];
+        std::snprintf(seconds, sizeof(seconds), "%.6f", result.seconds);
+        out << csvField(result.romPath) << ',' << farmOutcomeToString(result.outcome) << ','
+            << pc << ',' << result.cycles << ',' << result.instructions << ',' << seconds << ','
+            << csvField(result.detail) << '\n';
+    }
+    return out.str();
+}
+
+std::string formatFarmSummary(const std::vector<FarmResult>& results, double wallSeconds) {
+    size_t counts[4] = {};
+    uint64_t instructions = 0;
+    for (const auto& result : results) {
+        ++counts[static_cast<size_t>(result.outcome)];
+        instructions += result.instructions;
+    }
+    char text[256];
+    std::snprintf(text, sizeof(text),
+        "Farm: %zu machines, %zu halted, %zu faulted, %zu timed out, %zu failed to start; "
+        "%llu instructions in %.3f s (%.2f MIPS)",
+        results.size(), counts[0], counts[1], counts[2], counts[3],
+        (unsigned long long)instructions, wallSeconds,
+        wallSeconds > 0.0 ? instructions / wallSeconds / 1e6 : 0.0);
+    return text;
+}
+
+int RunFarm(const EmulatorConfig& config) {
+    std::vector<std::string> roms;
+    std::string error;
+    if (!loadFarmList(config.farmList, &roms, &error)) {
+        ERROR("%s", error.c_str());
+        return 1;
+    }
+    ICpuExecutor* prototype = CreateCpuExecutor();
+    if (prototype == nullptr) {
+        ERROR("CreateCpuExecutor returned null");
+        return 1;
+    }
+    // The factory hands out one shared core; each machine gets a fresh one
+    // of the same kind instead, through the SMP hook.
+    auto createCpu = [prototype]() {
+        return std::unique_ptr<ICpuExecutor>(prototype->createHart(0));
+    };
+    uint32_t jobs = config.farmJobs != 0 ? config.farmJobs :
+        std::max(1u, std::thread::hardware_concurrency());
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<FarmResult> results = runFarmJobs(config, roms, jobs, createCpu);
+    double wallSeconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+
+    std::string report = formatFarmReport(results);
+    if (config.farmReport.empty() || config.farmReport == "stdout") {
+        std::fwrite(report.data(), 1, report.size(), stdout);
+        std::fflush(stdout);
+    } else {
+        std::ofstream file(config.farmReport, std::ios::binary);
+        if (!file || !file.write(report.data(), static_cast<std::streamsize>(report.size()))) {
+            ERROR("Cannot write farm report: %s", config.farmReport.c_str());
+            return 1;
+        }
+    }
+    INFO("%s", formatFarmSummary(results, wallSeconds).c_str());
+    for (const auto& result : results) {
+        if (result.outcome != FarmOutcome::Halted) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -1,16 +1,130 @@
 #include "emulator/logging/logger.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdio>
 #include <cstring>
 #include <ctime>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <thread>
 
 namespace {
 
 constexpr size_t kBufferSize = 4096;
 
+void lockCounted(std::unique_lock<std::mutex>* lock, std::atomic<uint64_t>* contended) {
+    if (!lock->try_lock()) {
+        contended->fetch_add(1, std::memory_order_relaxed);
+        lock->lock();
+    }
+}
+constexpr size_t kQueueCapacity = 4096;
+constexpr size_t kDrainBatch = 1024;
+constexpr auto kWriterIdleSleep = std::chrono::milliseconds(1);
+
+enum class Channel : uint8_t {
+    Log,
+    Device
+};
+
+// Bounded multi-producer queue of fixed-size message fragments (Vyukov's
+// sequence-number ring); the writer thread is the only consumer. Messages
+// longer than one slot are split into fragments whose slots are reserved in
+// one step, so fragments of different producers never interleave; `more`
+// marks every fragment but the last.
+class MessageQueue {
+public:
+    static constexpr size_t kSlotText = 240;
+
+    struct Slot {
+        std::atomic<size_t> seq{0};
+        Channel channel = Channel::Log;
+        bool more = false;
+        uint16_t length = 0;
+        char text[kSlotText];
+    };
+
+    MessageQueue() : mSlots(new Slot[kQueueCapacity]) {
+        for (size_t i = 0; i < kQueueCapacity; ++i) {
+            mSlots[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // Returns the number of fragments queued; waits for room when full.
+    // Longer messages are cut to what fits in the ring.
+    size_t push(Channel channel, const char* text, size_t length,
+        std::atomic<uint64_t>* stalls) {
+        length = std::min(length, kQueueCapacity * kSlotText);
+        size_t fragments = std::max<size_t>(1, (length + kSlotText - 1) / kSlotText);
+        size_t pos = 0;
+        if (!tryReserve(fragments, &pos)) {
+            stalls->fetch_add(1, std::memory_order_relaxed);
+            while (!tryReserve(fragments, &pos)) {
+                std::this_thread::yield();
+            }
+        }
+        for (size_t i = 0; i < fragments; ++i) {
+            Slot& slot = mSlots[(pos + i) & (kQueueCapacity - 1)];
+            size_t part = std::min(length, kSlotText);
+            slot.channel = channel;
+            slot.more = i + 1 < fragments;
+            slot.length = static_cast<uint16_t>(part);
+            std::memcpy(slot.text, text, part);
+            slot.seq.store(pos + i + 1, std::memory_order_release);
+            text += part;
+            length -= part;
+        }
+        return fragments;
+    }
+
+    template <typename Fn>
+    size_t drain(size_t maxCount, Fn&& fn) {
+        size_t count = 0;
+        while (count < maxCount) {
+            Slot& slot = mSlots[mDequeuePos & (kQueueCapacity - 1)];
+            if (slot.seq.load(std::memory_order_acquire) != mDequeuePos + 1) {
+                return count;
+            }
+            fn(slot.channel, slot.text, slot.length, slot.more);
+            slot.seq.store(mDequeuePos + kQueueCapacity, std::memory_order_release);
+            ++mDequeuePos;
+            ++count;
+        }
+        return count;
+    }
+
+private:
+    // Claims `count` consecutive slots starting at *start. The consumer frees
+    // slots in order, so the last one being free means all of them are.
+    bool tryReserve(size_t count, size_t* start) {
+        size_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            size_t last = pos + count - 1;
+            size_t seq = mSlots[last & (kQueueCapacity - 1)].seq.load(std::memory_order_acquire);
+            auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(last);
+            if (diff == 0) {
+                if (mEnqueuePos.compare_exchange_weak(pos, pos + count,
+                        std::memory_order_relaxed)) {
+                    *start = pos;
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = mEnqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    std::unique_ptr<Slot[]> mSlots;
+    alignas(64) std::atomic<size_t> mEnqueuePos{0};
+    alignas(64) size_t mDequeuePos = 0;
+};
+
 struct Output {
     FILE* mFile = nullptr;
     bool mOwnsFile = false;
@@ -54,14 +168,93 @@ struct Output {
             std::fflush(mFile);
         }
     }
+
+    // Async path: handlers still see every message, file output is batched.
+    void append(const char* str, std::string* batch) {
+        if (mHandler) {
+            mHandler(str);
+        }
+        if (mFile && mOwnsFile) {
+            batch->append(str);
+        }
+    }
+
+    void writeBatch(std::string* batch, bool flush) {
+        if (mFile && mOwnsFile && !batch->empty()) {
+            std::fwrite(batch->data(), 1, batch->size(), mFile);
+        }
+        batch->clear();
+        if (flush && mFile && mOwnsFile) {
+            std::fflush(mFile);
+        }
+    }
 };
 
+const char* levelToString(logging::Level level) {
+    switch (level) {
+        case logging::Level::Trace: return "TRACE";
+        case logging::Level::Debug: return "DEBUG";
+        case logging::Level::Info:  return "INFO ";
+        case logging::Level::Warn:  return "WARN ";
+        case logging::Level::Error: return "ERROR";
+    }
+    return "UNKNOWN";
+}
+
+const char* extractFilename(const char* path) {
+    const char* result = path;
+    for (const char* p = path; *p; ++p) {
+        if (*p == '/' || *p == '\\') {
+            result = p + 1;
+        }
+    }
+    return result;
+}
+
+thread_local logging::Context* tCurrent = nullptr;
+
+// "HH:MM:SS" for the current second. Each thread formats it once per second
+// instead of calling localtime and strftime for every message.
+const char* timestamp() {
+    thread_local time_t cachedSecond = -1;
+    thread_local char cachedText[16] = "";
+    time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    if (now != cachedSecond) {
+        struct tm localNow {};
+        localtime_r(&now, &localNow);
+        std::strftime(cachedText, sizeof(cachedText), "%H:%M:%S", &localNow);
+        cachedSecond = now;
+    }
+    return cachedText;
+}
+
+} // namespace
+
+namespace logging {
+
 class Backend {
 public:
     std::mutex mMutex;
     Output mDevice;
     Output mLog;
-    logging::Level mLevel = logging::Level::Info;
+
+    std::atomic<bool> mAsync{false};
+    MessageQueue mQueue;
+    std::thread mWriter;
+    std::atomic<bool> mStopWriter{false};
+    std::atomic<uint64_t> mPushed{0};
+    std::atomic<uint64_t> mWritten{0};
+    std::chrono::milliseconds mFlushInterval{50};
+    size_t mFlushBytes = 64 * 1024;
+
+    std::atomic<uint64_t> mMessages{0};
+    std::atomic<uint64_t> mContended{0};
+    std::atomic<uint64_t> mQueueStalls{0};
+
+    ~Backend() {
+        stopWriter();
+        reset();
+    }
 
     void reset() {
         mDevice.close();
@@ -69,126 +262,281 @@ public:
     }
 
     void initialize(const logging::Config& config) {
+        stopWriter();
         std::lock_guard<std::mutex> lock(mMutex);
         reset();
 
-        mLevel = config.level;
-
         mDevice.open(config.mDeviceFile);
         mLog.open(config.mFile);
 
         mLog.mHandler = config.mOnMessage;
         mDevice.mHandler = config.mOnDeviceMessage;
+
+        mFlushInterval = std::chrono::milliseconds(config.mFlushIntervalMs);
+        mFlushBytes = config.mFlushBytes;
+        if (config.mAsync) {
+            mStopWriter.store(false, std::memory_order_relaxed);
+            mAsync.store(true, std::memory_order_release);
+            mWriter = std::thread(&Backend::writerLoop, this);
+        }
     }
-};
 
-Backend gBackend;
+    void enqueue(Channel channel, const char* text) {
+        size_t fragments = mQueue.push(channel, text, std::strlen(text), &mQueueStalls);
+        mPushed.fetch_add(fragments, std::memory_order_release);
+    }
 
-const char* levelToString(logging::Level level) {
-    switch (level) {
-        case logging::Level::Trace: return "TRACE";
-        case logging::Level::Debug: return "DEBUG";
-        case logging::Level::Info:  return "INFO ";
-        case logging::Level::Warn:  return "WARN ";
-        case logging::Level::Error: return "ERROR";
+    void stopWriter() {
+        if (!mWriter.joinable()) {
+            return;
+        }
+        mStopWriter.store(true, std::memory_order_release);
+        mWriter.join();
+        mAsync.store(false, std::memory_order_release);
     }
-    return "UNKNOWN";
-}
 
-const char* extractFilename(const char* path) {
-    const char* result = path;
-    for (const char* p = path; *p; ++p) {
-        if (*p == '/' || *p == '\\') {
-            result = p + 1;
+    void waitWritten() {
+        if (!mAsync.load(std::memory_order_acquire)) {
+            return;
+        }
+        uint64_t target = mPushed.load(std::memory_order_acquire);
+        while (mWritten.load(std::memory_order_acquire) < target && mWriter.joinable()) {
+            std::this_thread::sleep_for(kWriterIdleSleep);
         }
     }
-    return result;
+
+    // Formats on the caller's stack without holding the lock; only the
+    // write is serialized.
+    void log(Level level, const char* file, int line, const char* fmt, va_list args) {
+        mMessages.fetch_add(1, std::memory_order_relaxed);
+
+        char buffer[kBufferSize];
+        int pos = std::snprintf(buffer, sizeof(buffer), "[%s] [%s] %s:%d: ",
+                                timestamp(), ::levelToString(level),
+                                extractFilename(file), line);
+        size_t length = 0;
+        if (pos > 0 && static_cast<size_t>(pos) < sizeof(buffer)) {
+            int body = std::vsnprintf(buffer + pos, sizeof(buffer) - pos, fmt, args);
+            length = static_cast<size_t>(pos) + static_cast<size_t>(std::max(body, 0));
+        }
+        // Leave room for the newline when the message was truncated.
+        length = std::min(length, sizeof(buffer) - 2);
+        buffer[length] = '\n';
+        buffer[length + 1] = '\0';
+
+        if (mAsync.load(std::memory_order_acquire)) {
+            enqueue(Channel::Log, buffer);
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mMutex, std::defer_lock);
+        lockCounted(&lock, &mContended);
+        mLog.write(buffer);
+    }
+
+    void write(Channel channel, const char* text) {
+        mMessages.fetch_add(1, std::memory_order_relaxed);
+        if (mAsync.load(std::memory_order_acquire)) {
+            enqueue(channel, text);
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mMutex, std::defer_lock);
+        lockCounted(&lock, &mContended);
+        (channel == Channel::Log ? mLog : mDevice).write(text);
+    }
+
+private:
+    void writerLoop() {
+        std::string logBatch;
+        std::string deviceBatch;
+        std::string message;
+        uint64_t pending = 0;
+        auto lastFlush = std::chrono::steady_clock::now();
+        for (;;) {
+            bool stopping = mStopWriter.load(std::memory_order_acquire);
+            size_t drained = 0;
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                // A message's fragments are consecutive; handlers see it
+                // once it is complete, which may be in a later drain.
+                drained = mQueue.drain(kDrainBatch, [&](Channel channel, const char* text,
+                        size_t length, bool more) {
+                    message.append(text, length);
+                    if (more) {
+                        return;
+                    }
+                    if (channel == Channel::Log) {
+                        mLog.append(message.c_str(), &logBatch);
+                    } else {
+                        mDevice.append(message.c_str(), &deviceBatch);
+                    }
+                    message.clear();
+                });
+                pending += drained;
+                auto now = std::chrono::steady_clock::now();
+                bool due = now - lastFlush >= mFlushInterval || drained < kDrainBatch ||
+                    stopping;
+                if (due || logBatch.size() + deviceBatch.size() >= mFlushBytes) {
+                    mLog.writeBatch(&logBatch, due);
+                    mDevice.writeBatch(&deviceBatch, due);
+                    if (due) {
+                        lastFlush = now;
+                    }
+                }
+            }
+            if (pending > 0 && logBatch.empty() && deviceBatch.empty()) {
+                mWritten.fetch_add(pending, std::memory_order_release);
+                pending = 0;
+            }
+            if (stopping && drained == 0) {
+                return;
+            }
+            if (drained < kDrainBatch) {
+                std::this_thread::sleep_for(kWriterIdleSleep);
+            }
+        }
+    }
+};
+
+Context::Context() : mBackend(std::make_unique<Backend>()) {}
+
+Context::Context(const Config& config) : Context() {
+    init(config);
 }
 
-void formatMessage(logging::Level level, const char* file, int line,
-                    const char* fmt, va_list args) {
-    if (level < gBackend.mLevel) return;
+Context::~Context() {
+    if (tCurrent == this) {
+        tCurrent = nullptr;
+    }
+}
 
-    std::lock_guard<std::mutex> lock(gBackend.mMutex);
+Context& Context::process() {
+    static Context context;
+    return context;
+}
 
-    time_t now = time(nullptr);
-    char timeBuf[64];
-    strftime(timeBuf, sizeof(timeBuf), "%H:%M:%S", localtime(&now));
+void Context::init(const Config& config) {
+    mBackend->initialize(config);
+    mLevel.store(config.level, std::memory_order_relaxed);
+}
 
-    char buffer[kBufferSize];
-    int pos = std::snprintf(buffer, sizeof(buffer),
-                            "[%s] [%s] %s:%d: ",
-                            timeBuf, ::levelToString(level),
-                            extractFilename(file), line);
+void Context::flush() {
+    mBackend->waitWritten();
+}
+
+void Context::shutdown() {
+    mBackend->stopWriter();
+}
 
+void Context::setLevel(Level newLevel) {
+    mLevel.store(newLevel, std::memory_order_relaxed);
+}
 
-    std::string lineFmt = std::string(fmt) + "\n";
-    if (pos > 0 && static_cast<size_t>(pos) < sizeof(buffer)) {
-        std::vsnprintf(buffer + pos, sizeof(buffer) - pos, lineFmt.c_str(), args);
+Stats Context::getStats() const {
+    Stats stats;
+    stats.messages = mBackend->mMessages.load(std::memory_order_relaxed);
+    stats.contended = mBackend->mContended.load(std::memory_order_relaxed);
+    stats.queueStalls = mBackend->mQueueStalls.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void Context::setOutputHandler(std::function<void(const char*)> logHandler,
+                                std::function<void(const char*)> deviceHandler) {
+    std::lock_guard<std::mutex> lock(mBackend->mMutex);
+    mBackend->mLog.mHandler = std::move(logHandler);
+    mBackend->mDevice.mHandler = std::move(deviceHandler);
+}
+
+void Context::log(Level level, const char* file, int line, const char* fmt, va_list args) {
+    if (enabled(level)) {
+        mBackend->log(level, file, line, fmt, args);
     }
+}
 
-    buffer[sizeof(buffer) - 1] = '\0';
-    gBackend.mLog.write(buffer);
+void Context::raw(const char* text) {
+    mBackend->write(Channel::Log, text);
 }
 
-} // namespace
+void Context::device(const char* text) {
+    mBackend->write(Channel::Device, text);
+}
 
-namespace logging {
+Context& current() {
+    return tCurrent != nullptr ? *tCurrent : Context::process();
+}
+
+bool enabled(Level level) {
+    return current().enabled(level);
+}
+
+ScopedContext::ScopedContext(Context* context) : mPrevious(tCurrent) {
+    tCurrent = context;
+}
+
+ScopedContext::~ScopedContext() {
+    tCurrent = mPrevious;
+}
 
 void init(const Config& config) {
-    gBackend.initialize(config);
+    current().init(config);
+}
+
+void flush() {
+    current().flush();
+}
+
+void shutdown() {
+    current().shutdown();
 }
 
 void level(Level newLevel) {
-    std::lock_guard<std::mutex> lock(gBackend.mMutex);
-    gBackend.mLevel = newLevel;
+    current().setLevel(newLevel);
+}
+
+Stats getStats() {
+    return current().getStats();
 }
 
 void setOutputHandler(std::function<void(const char*)> logHandler,
                         std::function<void(const char*)> deviceHandler) {
-    std::lock_guard<std::mutex> lock(gBackend.mMutex);
-    gBackend.mLog.mHandler = std::move(logHandler);
-    gBackend.mDevice.mHandler = std::move(deviceHandler);
+    current().setOutputHandler(std::move(logHandler), std::move(deviceHandler));
 }
 
 void info(const char* file, int line, const char* fmt, ...) {
     va_list args;
     va_start(args, fmt);
-    formatMessage(Level::Info, file, line, fmt, args);
+    current().log(Level::Info, file, line, fmt, args);
     va_end(args);
 }
 
 void debug(const char* file, int line, const char* fmt, ...) {
     va_list args;
     va_start(args, fmt);
-    formatMessage(Level::Debug, file, line, fmt, args);
+    current().log(Level::Debug, file, line, fmt, args);
     va_end(args);
 }
 
 void warn(const char* file, int line, const char* fmt, ...) {
     va_list args;
     va_start(args, fmt);
-    formatMessage(Level::Warn, file, line, fmt, args);
+    current().log(Level::Warn, file, line, fmt, args);
     va_end(args);
 }
 
 void error(const char* file, int line, const char* fmt, ...) {
     va_list args;
     va_start(args, fmt);
-    formatMessage(Level::Error, file, line, fmt, args);
+    current().log(Level::Error, file, line, fmt, args);
     va_end(args);
 }
 
 void trace(const char* file, int line, const char* fmt, ...) {
     va_list args;
     va_start(args, fmt);
-    formatMessage(Level::Trace, file, line, fmt, args);
+    current().log(Level::Trace, file, line, fmt, args);
     va_end(args);
 }
 
 void raw(const char* fmt, ...) {
-    std::lock_guard<std::mutex> lock(gBackend.mMutex);
-
     char buffer[kBufferSize];
     va_list args;
     va_start(args, fmt);
@@ -196,12 +544,10 @@ void raw(const char* fmt, ...) {
     va_end(args);
 
     buffer[sizeof(buffer) - 1] = '\0';
-    gBackend.mLog.write(buffer);
+    current().raw(buffer);
 }
 
 void device(const char* fmt, ...) {
-    std::lock_guard<std::mutex> lock(gBackend.mMutex);
-
     char buffer[kBufferSize];
     va_list args;
     va_start(args, fmt);
@@ -209,7 +555,7 @@ void device(const char* fmt, ...) {
     va_end(args);
 
     buffer[sizeof(buffer) - 1] = '\0';
-    gBackend.mDevice.write(buffer);
+    current().device(buffer);
 }
 
 const char* levelToString(Level level) {
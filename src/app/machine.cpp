@@ -0,0 +1,414 @@
+#include "emulator/app/machine.h"
+
+#include "emulator/app/utils.h"
+#include "emulator/device/elf.h"
+#include "emulator/logging/logger.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <unordered_set>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+namespace {
+std::string upperName(SocDeviceType type) {
+    if (type == SocDeviceType::Display) {
+        return "SDL";
+    }
+    std::string name = socDeviceTypeName(type);
+    for (char& ch : name) {
+        ch = static_cast<char>(std::toupper(static_cast<unsigned char>(ch)));
+    }
+    return name;
+}
+
+// An ELF ROM covers its segments that no RAM bank holds, from its base to
+// the end of the last one.
+bool elfRomSize(const SocDevice& rom, const std::vector<SocDevice>& devices,
+    const ElfImage& image, uint64_t* size) {
+    uint64_t end = rom.base;
+    for (const auto& segment : image.segments) {
+        bool inRam = false;
+        for (const auto& device : devices) {
+            inRam = inRam || (device.type == SocDeviceType::Ram &&
+                segment.address >= device.base && segment.address - device.base < device.size);
+        }
+        if (!inRam && segment.address >= rom.base) {
+            end = std::max(end, segment.address + segment.memorySize);
+        }
+    }
+    uint64_t span = std::max<uint64_t>(end - rom.base, 1);
+    *size = (span + MemoryDevice::kPageSize - 1) & ~(MemoryDevice::kPageSize - 1);
+    return *size >= span;
+}
+
+SocDevice defaultDevice(SocDeviceType type, uint64_t base, uint64_t size = 0) {
+    SocDevice device;
+    device.type = type;
+    device.base = base;
+    device.hasBase = true;
+    device.size = size;
+    return device;
+}
+} // namespace
+
+bool describeMachine(const EmulatorConfig& config, std::vector<SocDevice>* devices,
+    std::string* error) {
+    auto fail = [error](const std::string& message) {
+        if (error != nullptr) *error = message;
+        return false;
+    };
+    if (!config.soc.empty()) {
+        *devices = config.soc;
+    } else {
+        *devices = {
+            defaultDevice(SocDeviceType::Rom, config.romBase),
+            defaultDevice(SocDeviceType::Uart, config.uartBase),
+            defaultDevice(SocDeviceType::Timer, config.timerBase),
+            defaultDevice(SocDeviceType::Dma, config.dmaBase),
+            defaultDevice(SocDeviceType::Intc, config.intcBase),
+            defaultDevice(SocDeviceType::Display, config.sdlBase),
+            defaultDevice(SocDeviceType::Ram, config.ramBase, config.ramSize),
+        };
+        // The default machine keeps its historic "Invalid mapping: RAM".
+        if (config.ramSize == 0) {
+            return fail("Invalid mapping: RAM");
+        }
+    }
+
+    constexpr size_t kTypeCount = static_cast<size_t>(SocDeviceType::Display) + 1;
+    size_t counts[kTypeCount] = {};
+    for (const auto& device : *devices) {
+        ++counts[static_cast<size_t>(device.type)];
+    }
+    if (counts[static_cast<size_t>(SocDeviceType::Rom)] == 0) {
+        return fail("Machine description has no rom");
+    }
+    for (SocDeviceType type : {SocDeviceType::Timer, SocDeviceType::Dma, SocDeviceType::Intc,
+        SocDeviceType::Display}) {
+        if (counts[static_cast<size_t>(type)] > 1) {
+            return fail(std::string("Machine description has more than one ") +
+                socDeviceTypeName(type));
+        }
+    }
+    bool hasIntc = counts[static_cast<size_t>(SocDeviceType::Intc)] != 0;
+    if (counts[static_cast<size_t>(SocDeviceType::Display)] != 0 &&
+        (config.width == 0 || config.height == 0)) {
+        return fail("SDL width/height must be non-zero");
+    }
+
+    size_t seen[kTypeCount] = {};
+    std::unordered_set<std::string> names;
+    std::vector<MemoryRegion> regions;
+    regions.reserve(devices->size());
+    for (auto& device : *devices) {
+        size_t index = seen[static_cast<size_t>(device.type)]++;
+        if (device.name.empty()) {
+            device.name = upperName(device.type) + (index == 0 ? "" : std::to_string(index));
+        }
+        if (!names.insert(device.name).second) {
+            return fail("Duplicate device name: " + device.name);
+        }
+        if (device.type == SocDeviceType::Rom && !device.hasBase) {
+            device.base = config.romBase;
+            device.hasBase = true;
+        }
+        if (!device.hasBase) {
+            return fail(device.name + " needs a base address");
+        }
+        if (device.hasIrq && device.irq >= 0 && !hasIntc) {
+            return fail(device.name + " has an irq but the machine has no intc");
+        }
+        switch (device.type) {
+            case SocDeviceType::Rom: {
+                if (device.image.empty() && index == 0) {
+                    device.image = config.romPath;
+                }
+                if (device.image.empty()) {
+                    return fail(index == 0 ? "ROM path is required" :
+                        device.name + " needs an image");
+                }
+                if (isElfFile(device.image)) {
+                    ElfImage image;
+                    if (!readElfImage(device.image, &image, error)) {
+                        return false;
+                    }
+                    if (device.size == 0 && !elfRomSize(device, *devices, image, &device.size)) {
+                        return fail("ELF image does not fit above " + device.name);
+                    }
+                    break;
+                }
+                // Flat images start executing at their first byte.
+                if (index == 0 && device.base != kDefaultRomBase) {
+                    return fail("ROM base must be 0x00000000");
+                }
+                uint64_t imageSize = 0;
+                if (!getFileSize(device.image, &imageSize) || imageSize == 0) {
+                    return fail("failed to read ROM file size: " + device.image);
+                }
+                if (device.size == 0) {
+                    device.size = imageSize;
+                }
+                break;
+            }
+            case SocDeviceType::Ram:
+                if (device.size == 0) {
+                    return fail(device.name + " needs a size");
+                }
+                break;
+            case SocDeviceType::Uart:
+                if (device.size == 0) device.size = kUartSize;
+                if (index == 0 && device.output.empty()) device.output = config.uartOutput;
+                if (index == 0 && !device.hasIrq && hasIntc) device.irq = kUartIrqLine;
+                break;
+            case SocDeviceType::Timer:
+                if (device.size == 0) device.size = kTimerSize;
+                if (!device.hasIrq && hasIntc) device.irq = kTimerIrqLine;
+                break;
+            case SocDeviceType::Dma:
+                if (device.size == 0) device.size = kDmaSize;
+                break;
+            case SocDeviceType::Intc:
+                if (device.size == 0) device.size = kIntcSize;
+                break;
+            case SocDeviceType::Display: {
+                uint64_t fbSize = 0;
+                if (!computeFramebufferSize(config.width, config.height, &fbSize)) {
+                    return fail("invalid SDL size");
+                }
+                uint64_t sdlSize = SdlDisplayDevice::kControlRegionSize + fbSize;
+                if (sdlSize < fbSize) {
+                    return fail("SDL mapping size overflow");
+                }
+                if (device.size != 0 && device.size != sdlSize) {
+                    return fail(device.name + " size follows width and height");
+                }
+                device.size = sdlSize;
+                if (!device.hasIrq && hasIntc) device.irq = kDisplayIrqLine;
+                break;
+            }
+        }
+        regions.push_back({device.name.c_str(), device.base, device.size});
+    }
+    return validateMappings(regions, error);
+}
+
+bool Machine::build(const EmulatorConfig& config, ICpuExecutor* cpu, std::string* error) {
+    auto fail = [error](const std::string& message) {
+        if (error != nullptr) *error = message;
+        return false;
+    };
+    if (cpu == nullptr) {
+        return fail("No CPU executor");
+    }
+    std::vector<SocDevice> devices;
+    if (!describeMachine(config, &devices, error)) {
+        return false;
+    }
+
+    // Devices come first and the bus takes the whole map in one go; the DMA
+    // engine needs the bus, which only has to exist, not be populated.
+    std::vector<DeviceRegistration> map;
+    map.reserve(devices.size());
+    std::vector<std::string> elfImages;
+    std::string bootElf;
+    uint64_t bootPc = 0;
+    bool hasRom = false;
+    bool hasIntc = false;
+    bool hasDisplay = false;
+    for (const auto& device : devices) {
+        Device* mapped = nullptr;
+        Device* irqSource = nullptr;
+        switch (device.type) {
+            case SocDeviceType::Rom:
+            case SocDeviceType::Ram: {
+                bool rom = device.type == SocDeviceType::Rom;
+                auto& memory = mMemories.emplace_back(
+                    std::make_unique<MemoryDevice>(device.size, rom, config.memoryBacking));
+                std::string mapError;
+                if (rom && isElfFile(device.image)) {
+                    elfImages.push_back(device.image);
+                } else if (rom && !memory->mapImage(device.image, &mapError)) {
+                    return fail("failed to load ROM image: " + mapError);
+                }
+                if (rom && !hasRom) {
+                    bootPc = device.base;
+                    bootElf = elfImages.empty() ? "" : elfImages.back();
+                    hasRom = true;
+                }
+                mapped = memory.get();
+                break;
+            }
+            case SocDeviceType::Uart: {
+                auto& uart = mUarts.emplace_back(std::make_unique<UartDevice>());
+                if (!device.output.empty() && device.output != "stdout") {
+                    auto& file = mUartFiles.emplace_back(
+                        std::fopen(device.output.c_str(), "wb"), &std::fclose);
+                    if (!file) {
+                        return fail("failed to open UART output: " + device.output);
+                    }
+                    uart->setOutputFd(fileno(file.get()));
+                } else if (device.output == "stdout") {
+                    uart->setOutputFd(STDOUT_FILENO);
+                }
+                mapped = irqSource = uart.get();
+                break;
+            }
+            case SocDeviceType::Timer:
+                mapped = irqSource = &mTimer;
+                break;
+            case SocDeviceType::Dma:
+                mDma = std::make_unique<DmaDevice>(&mBus);
+                mapped = mDma.get();
+                break;
+            case SocDeviceType::Intc:
+                mapped = &mIntc;
+                hasIntc = true;
+                break;
+            case SocDeviceType::Display:
+                // A replay must not see keys from a window.
+                if (config.headless || !config.inputReplay.empty()) {
+                    if (!mSdl.initHeadless(config.width, config.height)) {
+                        return fail("SDL headless initialization failed");
+                    }
+                } else if (!mSdl.init(config.width, config.height, config.windowTitle.c_str())) {
+                    return fail("SDL initialization failed");
+                }
+                if (!config.frameOutput.empty()) {
+                    std::unique_ptr<FrameSink> sink = CreateFrameSink(config.frameOutput, error);
+                    if (!sink) {
+                        return false;
+                    }
+                    mSdl.setFrameSink(std::move(sink), config.frameEvery);
+                }
+                mSdl.setVsyncInterval(config.cpuFrequency / mSdl.getUpdateFrequency());
+                mapped = irqSource = &mSdl;
+                hasDisplay = true;
+                break;
+        }
+        if (irqSource != nullptr && device.irq >= 0) {
+            irqSource->setInterruptHandler(mIntc.lineHandler(static_cast<uint32_t>(device.irq)));
+        }
+        map.push_back({mapped, device.base, device.size, device.name});
+    }
+    mBus.registerDevices(map);
+
+    // ELF segments go to whichever ROM or RAM holds their load address, so
+    // an image can place .data and .bss in RAM. The boot ROM's entry point
+    // replaces its base as the reset PC.
+    for (const std::string& path : elfImages) {
+        ElfImage image;
+        if (!readElfImage(path, &image, error)) {
+            return false;
+        }
+        for (const auto& segment : image.segments) {
+            const DeviceRegistration* target = nullptr;
+            for (const auto& entry : map) {
+                if (entry.device->getType() != DeviceType::Rom &&
+                    entry.device->getType() != DeviceType::Ram) {
+                    continue;
+                }
+                uint64_t offset = segment.address - entry.base;
+                if (segment.address >= entry.base && offset < entry.size &&
+                    segment.memorySize <= entry.size - offset) {
+                    target = &entry;
+                    break;
+                }
+            }
+            char where[32];
+            std::snprintf(where, sizeof(where), "0x%llx", (unsigned long long)segment.address);
+            if (target == nullptr) {
+                return fail("ELF segment at " + std::string(where) + " is outside ROM and RAM");
+            }
+            auto* memory = static_cast<MemoryDevice*>(target->device);
+            if (!memory->mapFileRange(path, segment.fileOffset, segment.address - target->base,
+                segment.fileSize, error)) {
+                return false;
+            }
+        }
+        if (path == bootElf) {
+            bootPc = image.entry;
+        }
+    }
+
+    for (uint32_t hartId = 1; hartId < config.harts; ++hartId) {
+        ICpuExecutor* hart = cpu->createHart(hartId);
+        if (hart == nullptr) {
+            return fail("CPU does not support " + std::to_string(config.harts) + " harts");
+        }
+        mExtraHarts.emplace_back(hart);
+    }
+    mHarts = {cpu};
+    for (auto& hart : mExtraHarts) {
+        mHarts.push_back(hart.get());
+    }
+
+    mDebugger = std::make_unique<Debugger>(cpu, &mBus);
+    Debugger& debugger = *mDebugger;
+    for (auto& hart : mExtraHarts) {
+        debugger.addHart(hart.get());
+    }
+    debugger.setHartQuantum(config.hartQuantum);
+    debugger.setCheckpointInterval(config.checkpointInterval);
+    debugger.setCheckpointBudget(config.checkpointBudgetMiB << 20);
+    debugger.setRegisterCount(cpu->getRegisterCount());
+    debugger.setCpuFrequency(config.cpuFrequency);
+    debugger.setPacing(config.pacing);
+    debugger.setPerfDumpInterval(config.perfIntervalMs);
+    debugger.setCycleLimit(config.maxCycles);
+    if (!config.symbolsPath.empty() && !debugger.loadSymbols(config.symbolsPath, error)) {
+        return false;
+    }
+    std::string symbolError;
+    if (config.symbolsPath.empty() && !bootElf.empty() &&
+        !debugger.loadSymbols(bootElf, &symbolError)) {
+        DEBUG("No symbols from %s: %s", bootElf.c_str(), symbolError.c_str());
+    }
+    if (!config.inputRecord.empty() && !config.inputReplay.empty()) {
+        return fail("Cannot record and replay input in the same run");
+    }
+    if (!config.inputRecord.empty() && !debugger.recordInput(config.inputRecord, error)) {
+        return false;
+    }
+    if (!config.inputReplay.empty() && !debugger.replayInput(config.inputReplay, error)) {
+        return false;
+    }
+    if (!config.profileOutput.empty()) {
+        debugger.profiler().start(config.profilePeriod);
+    }
+    if (!config.heatmapOutput.empty()) {
+        debugger.setHeatmapEnabled(true);
+    }
+    debugger.setSdl(hasDisplay ? &mSdl : nullptr);
+    if (hasIntc) {
+        debugger.setInterruptController(&mIntc);
+    }
+
+    TraceOptions traceOpts;
+    traceOpts.logInstruction = config.iTrace;
+    traceOpts.logMemEvents = config.mTrace;
+    traceOpts.logBranchPrediction = config.bpTrace;
+    traceOpts.filter = config.traceFilter;
+    debugger.configureTrace(traceOpts);
+    if (!config.traceFile.empty() && !debugger.openBinaryTrace(config.traceFile,
+        config.traceCompress, error)) {
+        return false;
+    }
+
+    mBus.setDebugger(&debugger);
+    for (ICpuExecutor* hart : mHarts) {
+        hart->setDebugger(&debugger);
+        hart->reset();
+        hart->setPc(bootPc);
+        if (!hart->setExecutionEngine(config.engine)) {
+            if (hart == cpu) {
+                WARN("CPU does not support the requested engine, using interpreter");
+            }
+            hart->setExecutionEngine(ExecutionEngine::Interpreter);
+        }
+    }
+    return true;
+}
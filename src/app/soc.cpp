@@ -0,0 +1,110 @@
+#include "emulator/app/soc.h"
+
+#include "emulator/app/utils.h"
+
+namespace {
+struct SocTypeName {
+    const char* name;
+    SocDeviceType type;
+};
+
+constexpr SocTypeName kSocTypeNames[] = {
+    {"rom", SocDeviceType::Rom},
+    {"ram", SocDeviceType::Ram},
+    {"uart", SocDeviceType::Uart},
+    {"timer", SocDeviceType::Timer},
+    {"dma", SocDeviceType::Dma},
+    {"intc", SocDeviceType::Intc},
+    {"display", SocDeviceType::Display},
+};
+} // namespace
+
+bool parseSocDeviceType(const std::string& value, SocDeviceType* type) {
+    std::string lowered = toLower(value);
+    if (lowered == "sdl") {
+        lowered = "display";
+    }
+    for (const auto& entry : kSocTypeNames) {
+        if (lowered == entry.name) {
+            *type = entry.type;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* socDeviceTypeName(SocDeviceType type) {
+    for (const auto& entry : kSocTypeNames) {
+        if (entry.type == type) {
+            return entry.name;
+        }
+    }
+    return "unknown";
+}
+
+bool parseSocSection(const std::string& header, SocDevice* device, std::string* error) {
+    std::string text = header;
+    trimInPlace(&text);
+    size_t space = text.find_first_of(" \t");
+    std::string type = text.substr(0, space);
+    std::string name = space == std::string::npos ? std::string() : text.substr(space + 1);
+    trimInPlace(&name);
+    *device = SocDevice{};
+    if (!parseSocDeviceType(type, &device->type)) {
+        if (error != nullptr) *error = "Unknown device type: " + type;
+        return false;
+    }
+    if (name.find_first_of(" \t") != std::string::npos) {
+        if (error != nullptr) *error = "Invalid device name: " + name;
+        return false;
+    }
+    device->name = name;
+    return true;
+}
+
+bool applySocDeviceValue(SocDevice* device, const std::string& key, const std::string& value,
+    std::string* error) {
+    if (key == "base") {
+        if (!parseU64(value, &device->base)) {
+            if (error != nullptr) *error = "Invalid base value: " + value;
+            return false;
+        }
+        device->hasBase = true;
+        return true;
+    }
+    if (key == "size") {
+        if (!parseU64(value, &device->size) || device->size == 0) {
+            if (error != nullptr) *error = "Invalid size value: " + value;
+            return false;
+        }
+        return true;
+    }
+    // Only these raise interrupts; Machine::build has no line to wire for the rest.
+    bool raisesIrq = device->type == SocDeviceType::Uart || device->type == SocDeviceType::Timer ||
+        device->type == SocDeviceType::Display;
+    if (key == "irq" && raisesIrq) {
+        uint64_t parsed = 0;
+        if (toLower(value) == "none") {
+            device->irq = -1;
+        } else if (parseU64(value, &parsed) && parsed < 32) {
+            device->irq = static_cast<int32_t>(parsed);
+        } else {
+            if (error != nullptr) *error = "Invalid irq value: " + value;
+            return false;
+        }
+        device->hasIrq = true;
+        return true;
+    }
+    if (key == "image" && device->type == SocDeviceType::Rom) {
+        device->image = value;
+        return true;
+    }
+    if (key == "output" && device->type == SocDeviceType::Uart) {
+        device->output = value;
+        return true;
+    }
+    if (error != nullptr) {
+        *error = "Unknown " + std::string(socDeviceTypeName(device->type)) + " key: " + key;
+    }
+    return false;
+}
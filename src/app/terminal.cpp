@@ -186,6 +186,9 @@ void Terminal::runCursesInputLoop() {
             : wgetch(mDebugWin);
 
         if (ch == ERR) {
+            if (mOnIdle) {
+                mOnIdle();
+            }
         }
         else if (ch == KEY_MOUSE) {
             MEVENT event;
@@ -1,8 +1,76 @@
 #include "emulator/bus/bus.h"
 #include "emulator/device/device.h"
+#include "emulator/device/wide_copy.h"
 #include "emulator/debugger/debugger.h"
 
 #include <algorithm>
+#include <cstring>
+#include <unordered_set>
+
+namespace {
+MemResponse handlerRead(Device* device, const MemAccess& access) {
+    return device->read(access);
+}
+
+MemResponse handlerWrite(Device* device, const MemAccess& access) {
+    return device->write(access);
+}
+
+MemResponse handlerAtomic(Device* device, const MemAccess& access) {
+    return device->atomic(access);
+}
+
+// Whether a successful atomic changed memory: LR never stores, and a failed
+// SC or compare-exchange leaves memory as it was.
+bool atomicStored(const MemAccess& access, const MemResponse& response) {
+    uint64_t mask = access.size >= 8 ? ~0ull : (1ull << (8 * access.size)) - 1;
+    switch (access.type) {
+        case MemAccessType::LoadReserved:
+            return false;
+        case MemAccessType::StoreConditional:
+            return response.data == 0;
+        case MemAccessType::CompareExchange:
+            return ((response.data ^ access.expected) & mask) == 0;
+        default:
+            return true;
+    }
+}
+} // namespace
+
+bool validateMappings(const std::vector<MemoryRegion>& mappings, std::string* error) {
+    for (const auto& mapping : mappings) {
+        uint64_t end = 0;
+        if (!computeRegionEnd(mapping.base, mapping.size, &end)) {
+            if (error != nullptr) {
+                *error = std::string("Invalid mapping: ") + mapping.name;
+            }
+            return false;
+        }
+    }
+    std::vector<const MemoryRegion*> sorted;
+    sorted.reserve(mappings.size());
+    for (const auto& mapping : mappings) {
+        sorted.push_back(&mapping);
+    }
+    std::sort(sorted.begin(), sorted.end(),
+        [](const MemoryRegion* a, const MemoryRegion* b) { return a->base < b->base; });
+    // Sorted by base, a region can only overlap one that starts before it, and
+    // the one reaching furthest is enough to check.
+    const MemoryRegion* reach = nullptr;
+    for (const MemoryRegion* mapping : sorted) {
+        if (reach != nullptr && mapping->base - reach->base < reach->size) {
+            if (error != nullptr) {
+                *error = std::string("Overlapping mappings: ") + reach->name + " and " +
+                    mapping->name;
+            }
+            return false;
+        }
+        if (reach == nullptr || mapping->base + mapping->size > reach->base + reach->size) {
+            reach = mapping;
+        }
+    }
+    return true;
+}
 
 void MemoryBus::registerDevice(Device* device, uint64_t base, uint64_t size, const std::string& name) {
     for (const auto& existing : mDevices) {
@@ -11,14 +79,12 @@ void MemoryBus::registerDevice(Device* device, uint64_t base, uint64_t size, con
         }
     }
 
-    DeviceMapping mapping;
-    mapping.name = name;
-    mapping.devicePtr = device;
-    mapping.base = base;
-    mapping.size = size;
-    mapping.end = base + size;
-    mDevices.push_back(mapping);
-    mLastHit = nullptr;
+    const DeviceMapping* stored = addMapping(device, base, size, name);
+    auto pos = std::upper_bound(mSorted.begin(), mSorted.end(), base,
+        [](uint64_t value, const DeviceMapping* entry) { return value < entry->base; });
+    mSorted.insert(pos, stored);
+    insertPages(stored);
+    flushTlb();
 
     bool found = false;
     for (auto* d : mUniqueDevices) {
@@ -26,7 +92,49 @@ void MemoryBus::registerDevice(Device* device, uint64_t base, uint64_t size, con
     }
     if (!found) {
         mUniqueDevices.push_back(device);
+        device->attachScheduler(mScheduler);
+    }
+}
+
+void MemoryBus::registerDevices(const std::vector<DeviceRegistration>& devices) {
+    size_t previous = mSorted.size();
+    std::unordered_set<Device*> known(mUniqueDevices.begin(), mUniqueDevices.end());
+    for (const auto& entry : devices) {
+        const DeviceMapping* stored = addMapping(entry.device, entry.base, entry.size,
+            entry.name);
+        mSorted.push_back(stored);
+        insertPages(stored);
+        if (known.insert(entry.device).second) {
+            mUniqueDevices.push_back(entry.device);
+            entry.device->attachScheduler(mScheduler);
+        }
+    }
+    auto byBase = [](const DeviceMapping* a, const DeviceMapping* b) { return a->base < b->base; };
+    auto middle = mSorted.begin() + static_cast<std::ptrdiff_t>(previous);
+    std::stable_sort(middle, mSorted.end(), byBase);
+    std::inplace_merge(mSorted.begin(), middle, mSorted.end(), byBase);
+    flushTlb();
+}
+
+const MemoryBus::DeviceMapping* MemoryBus::addMapping(Device* device, uint64_t base,
+    uint64_t size, const std::string& name) {
+    DeviceMapping& mapping = mDevices.emplace_back();
+    mapping.name = name;
+    mapping.devicePtr = device;
+    if (device != nullptr) {
+        const DeviceDispatch& dispatch = device->getDispatch();
+        mapping.read = dispatch.read != nullptr ? dispatch.read : &handlerRead;
+        mapping.write = dispatch.write != nullptr ? dispatch.write : &handlerWrite;
+        mapping.atomic = dispatch.atomic != nullptr ? dispatch.atomic : &handlerAtomic;
+    }
+    mapping.base = base;
+    mapping.size = size;
+    mapping.end = base + size;
+    if (device != nullptr && device->getDirectMemory(&mapping.direct)) {
+        mapping.direct.base = base;
+        mapping.direct.size = std::min(mapping.direct.size, size);
     }
+    return &mapping;
 }
 
 void MemoryBus::syncAll(uint64_t currentCycle) {
@@ -41,19 +149,258 @@ void MemoryBus::setDebugger(Debugger* debugger) {
     mDbg = debugger;
 }
 
-const MemoryBus::DeviceMapping* MemoryBus::findMapping(uint64_t address) const {
-    if (mLastHit != nullptr && address >= mLastHit->base && address < mLastHit->end) {
-        return mLastHit;
+uint32_t MemoryBus::addWriteListener(WriteListener listener) {
+    uint32_t id = mNextListenerId++;
+    mWriteListeners.emplace_back(id, std::move(listener));
+    return id;
+}
+
+void MemoryBus::removeWriteListener(uint32_t id) {
+    mWriteListeners.erase(std::remove_if(mWriteListeners.begin(), mWriteListeners.end(),
+        [id](const auto& entry) { return entry.first == id; }), mWriteListeners.end());
+}
+
+void MemoryBus::notifyWrite(uint64_t address, uint64_t size) const {
+    for (const auto& entry : mWriteListeners) {
+        entry.second(address, size);
     }
-    for (const auto& mapping : mDevices) {
-        if (address >= mapping.base && address < mapping.end) {
-            mLastHit = &mapping;
-            return &mapping;
+}
+
+void MemoryBus::mergeEntry(PageEntry* entry, const DeviceMapping* mapping) {
+    if (entry->empty()) {
+        entry->mapping = mapping;
+    } else if (entry->mapping != mapping) {
+        entry->mapping = nullptr;
+        entry->shared = true;
+    }
+}
+
+void MemoryBus::insertPages(const DeviceMapping* mapping) {
+    constexpr uint64_t kAddressLimit = 1ull << kAddressBits;
+    if (mapping->size == 0 || mapping->base >= kAddressLimit) {
+        return;
+    }
+    uint64_t last = mapping->base + (mapping->size - 1);
+    if (last < mapping->base || last >= kAddressLimit) {
+        last = kAddressLimit - 1;
+    }
+    if (!mPageTable) {
+        mPageTable = std::make_unique<TopTable>();
+    }
+
+    constexpr uint32_t kMidShift = kLevelBits;
+    constexpr uint32_t kTopShift = 2 * kLevelBits;
+    uint64_t firstPage = mapping->base >> kPageShift;
+    uint64_t lastPage = last >> kPageShift;
+
+    for (uint64_t top = firstPage >> kTopShift; top <= (lastPage >> kTopShift); ++top) {
+        uint64_t topFirst = top << kTopShift;
+        uint64_t topLast = topFirst + (1ull << kTopShift) - 1;
+        PageEntry& topBlock = mPageTable->blocks[top];
+        std::unique_ptr<MidTable>& mid = mPageTable->mids[top];
+        if (firstPage <= topFirst && lastPage >= topLast && !mid) {
+            mergeEntry(&topBlock, mapping);
+            continue;
         }
+        if (!mid) {
+            mid = std::make_unique<MidTable>();
+            if (!topBlock.empty()) {
+                mid->blocks.fill(topBlock);
+                topBlock = PageEntry{};
+            }
+        }
+
+        uint64_t midBegin = std::max(firstPage, topFirst);
+        uint64_t midEnd = std::min(lastPage, topLast);
+        for (uint64_t page = midBegin; page <= midEnd;) {
+            uint64_t midIndex = (page >> kMidShift) & (kLevelSize - 1);
+            uint64_t midFirst = page & ~((1ull << kMidShift) - 1);
+            uint64_t midLast = midFirst + (1ull << kMidShift) - 1;
+            PageEntry& midBlock = mid->blocks[midIndex];
+            std::unique_ptr<LeafTable>& leaf = mid->leaves[midIndex];
+            if (page == midFirst && midEnd >= midLast && !leaf) {
+                mergeEntry(&midBlock, mapping);
+            } else {
+                if (!leaf) {
+                    leaf = std::make_unique<LeafTable>();
+                    if (!midBlock.empty()) {
+                        leaf->pages.fill(midBlock);
+                        midBlock = PageEntry{};
+                    }
+                }
+                uint64_t leafEnd = std::min(midEnd, midLast);
+                for (uint64_t p = page; p <= leafEnd; ++p) {
+                    mergeEntry(&leaf->pages[p & (kLevelSize - 1)], mapping);
+                }
+            }
+            page = midLast + 1;
+        }
+    }
+}
+
+void MemoryBus::flushTlb() {
+    for (auto& tlb : mTlb) {
+        for (auto& slot : tlb) {
+            slot.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+}
+
+const MemoryBus::DeviceMapping* MemoryBus::searchSorted(uint64_t address) const {
+    auto it = std::upper_bound(mSorted.begin(), mSorted.end(), address,
+        [](uint64_t value, const DeviceMapping* entry) { return value < entry->base; });
+    if (it == mSorted.begin()) {
+        return nullptr;
+    }
+    const DeviceMapping* mapping = *(it - 1);
+    return address < mapping->end ? mapping : nullptr;
+}
+
+const MemoryBus::DeviceMapping* MemoryBus::resolveEntry(const PageEntry& entry,
+    uint64_t address) const {
+    if (entry.shared) {
+        return searchSorted(address);
+    }
+    const DeviceMapping* mapping = entry.mapping;
+    if (mapping != nullptr && address >= mapping->base && address < mapping->end) {
+        return mapping;
     }
     return nullptr;
 }
 
+const MemoryBus::DeviceMapping* MemoryBus::walkPageTable(uint64_t address) const {
+    if (!mPageTable || (address >> kAddressBits) != 0) {
+        return searchSorted(address);
+    }
+    uint64_t page = address >> kPageShift;
+    uint64_t topIndex = page >> (2 * kLevelBits);
+    const PageEntry& topBlock = mPageTable->blocks[topIndex];
+    if (!topBlock.empty()) {
+        return resolveEntry(topBlock, address);
+    }
+    const MidTable* mid = mPageTable->mids[topIndex].get();
+    if (mid == nullptr) {
+        return nullptr;
+    }
+    uint64_t midIndex = (page >> kLevelBits) & (kLevelSize - 1);
+    const PageEntry& midBlock = mid->blocks[midIndex];
+    if (!midBlock.empty()) {
+        return resolveEntry(midBlock, address);
+    }
+    const LeafTable* leaf = mid->leaves[midIndex].get();
+    if (leaf == nullptr) {
+        return nullptr;
+    }
+    return resolveEntry(leaf->pages[page & (kLevelSize - 1)], address);
+}
+
+const MemoryBus::DeviceMapping* MemoryBus::findMapping(uint64_t address,
+    MemAccessType type) const {
+    int kind = kTlbRead;
+    if (type == MemAccessType::Fetch) {
+        kind = kTlbFetch;
+    } else if (type == MemAccessType::Write) {
+        kind = kTlbWrite;
+    }
+    std::atomic<const DeviceMapping*>& slot =
+        mTlb[kind][(address >> kPageShift) & (kTlbEntries - 1)];
+    const DeviceMapping* mapping = slot.load(std::memory_order_relaxed);
+    if (mapping != nullptr && address >= mapping->base && address < mapping->end) {
+        mTlbHits.add();
+        return mapping;
+    }
+    mTlbMisses.add();
+    mapping = walkPageTable(address);
+    if (mapping != nullptr) {
+        slot.store(mapping, std::memory_order_relaxed);
+    }
+    return mapping;
+}
+
+BusStats MemoryBus::getStats() const {
+    BusStats stats;
+    stats.tlbHits = mTlbHits.load();
+    stats.tlbMisses = mTlbMisses.load();
+    for (const auto& mapping : mDevices) {
+        stats.mappings.push_back({mapping.name, mapping.reads.load(), mapping.writes.load()});
+    }
+    return stats;
+}
+
+void MemoryBus::setHeatmapEnabled(bool enabled) {
+    if (enabled) {
+        for (auto& mapping : mDevices) {
+            if (mapping.heat) {
+                continue;
+            }
+            mapping.heatShift = kPageShift;
+            while (((mapping.size - 1) >> mapping.heatShift) >= kMaxHeatCells) {
+                ++mapping.heatShift;
+            }
+            mapping.heatCells = ((mapping.size - 1) >> mapping.heatShift) + 1;
+            mapping.heat = std::make_unique<DeviceMapping::HeatCounters[]>(mapping.heatCells);
+        }
+    }
+    mHeatmap.store(enabled, std::memory_order_release);
+}
+
+void MemoryBus::clearHeatmap() {
+    for (auto& mapping : mDevices) {
+        for (uint64_t i = 0; i < mapping.heatCells; ++i) {
+            mapping.heat[i].reads.reset();
+            mapping.heat[i].writes.reset();
+            mapping.heat[i].fetches.reset();
+        }
+    }
+}
+
+std::vector<MappingHeat> MemoryBus::getHeatmap() const {
+    std::vector<MappingHeat> heatmap;
+    for (const auto& mapping : mDevices) {
+        MappingHeat heat;
+        heat.name = mapping.name;
+        heat.base = mapping.base;
+        heat.size = mapping.size;
+        heat.granuleShift = mapping.heatShift;
+        heat.totals.address = mapping.base;
+        for (uint64_t i = 0; i < mapping.heatCells; ++i) {
+            HeatCell cell;
+            cell.address = mapping.base + (i << mapping.heatShift);
+            cell.reads = mapping.heat[i].reads.load();
+            cell.writes = mapping.heat[i].writes.load();
+            cell.fetches = mapping.heat[i].fetches.load();
+            if (cell.total() == 0) {
+                continue;
+            }
+            heat.totals.reads += cell.reads;
+            heat.totals.writes += cell.writes;
+            heat.totals.fetches += cell.fetches;
+            heat.cells.push_back(cell);
+        }
+        heatmap.push_back(std::move(heat));
+    }
+    return heatmap;
+}
+
+void MemoryBus::recordHeat(const DeviceMapping& mapping, uint64_t address, uint64_t length,
+    MemAccessType type) const {
+    if (!mapping.heat || length == 0) {
+        return;
+    }
+    uint64_t first = (address - mapping.base) >> mapping.heatShift;
+    uint64_t last = (address + length - 1 - mapping.base) >> mapping.heatShift;
+    for (uint64_t i = first; i <= last && i < mapping.heatCells; ++i) {
+        DeviceMapping::HeatCounters& cell = mapping.heat[i];
+        if (type == MemAccessType::Fetch) {
+            cell.fetches.add();
+        } else if (type == MemAccessType::Read || type == MemAccessType::LoadReserved) {
+            cell.reads.add();
+        } else {
+            cell.writes.add();
+        }
+    }
+}
+
 Device* MemoryBus::getDevice(const std::string& name) const {
     if (name.empty()) {
         return nullptr;
@@ -71,8 +418,29 @@ Device* MemoryBus::findDevice(uint64_t address) const {
     return mapping ? mapping->devicePtr : nullptr;
 }
 
+bool MemoryBus::getDirectMemory(uint64_t address, DirectMemoryRange* range) const {
+    if (mHeatmap.load(std::memory_order_acquire)) {
+        return false;
+    }
+    const DeviceMapping* mapping = findMapping(address);
+    if (range == nullptr || mapping == nullptr || mapping->direct.host == nullptr) {
+        return false;
+    }
+    *range = mapping->direct;
+    return true;
+}
+
+bool MemoryBus::peekDirect(uint64_t address, void* out, uint64_t length) const {
+    const DeviceMapping* mapping = findMapping(address);
+    if (mapping == nullptr || !mapping->direct.contains(address, length)) {
+        return false;
+    }
+    std::memcpy(out, mapping->direct.host + (address - mapping->direct.base), length);
+    return true;
+}
+
 MemResponse MemoryBus::read(const MemAccess& access) {
-    const DeviceMapping* mapping = findMapping(access.address);
+    const DeviceMapping* mapping = findMapping(access.address, access.type);
     if (mapping == nullptr || mapping->devicePtr == nullptr) {
         MemResponse response;
         response.success = false;
@@ -81,14 +449,31 @@ MemResponse MemoryBus::read(const MemAccess& access) {
         response.error.size = access.size;
         return response;
     }
+    mapping->reads.add();
+    if (mHeatmap.load(std::memory_order_acquire)) {
+        recordHeat(*mapping, access.address, access.size, access.type);
+    }
+    if (access.size != 0 && access.size <= sizeof(uint64_t) &&
+        mapping->direct.contains(access.address, access.size)) {
+        MemResponse response;
+        response.data = mapping->direct.load(access.address, access.size);
+        return response;
+    }
+    if (access.size > sizeof(uint64_t) && isWideAccess(access) &&
+        mapping->direct.contains(access.address, access.size)) {
+        copyWide(access.wide, mapping->direct.host + (access.address - mapping->direct.base),
+            access.size);
+        return MemResponse{};
+    }
 
     MemAccess relativeAccess = access;
     relativeAccess.address = access.address - mapping->base;
-    return mapping->devicePtr->read(relativeAccess);
+    auto lock = mapping->direct.host != nullptr ? DeviceLock() : lockDevices();
+    return mapping->read(mapping->devicePtr, relativeAccess);
 }
 
 MemResponse MemoryBus::write(const MemAccess& access) {
-    const DeviceMapping* mapping = findMapping(access.address);
+    const DeviceMapping* mapping = findMapping(access.address, MemAccessType::Write);
     if (mapping == nullptr || mapping->devicePtr == nullptr) {
         MemResponse response;
         response.success = false;
@@ -97,8 +482,184 @@ MemResponse MemoryBus::write(const MemAccess& access) {
         response.error.size = access.size;
         return response;
     }
+    mapping->writes.add();
+    if (mHeatmap.load(std::memory_order_acquire)) {
+        recordHeat(*mapping, access.address, access.size, MemAccessType::Write);
+    }
+    if (mapping->direct.writable && access.size != 0 && access.size <= sizeof(uint64_t) &&
+        mapping->direct.contains(access.address, access.size)) {
+        mapping->direct.store(access.address, access.size, access.data);
+        notifyWrite(access.address, access.size);
+        return MemResponse{};
+    }
+    if (mapping->direct.writable && access.size > sizeof(uint64_t) && isWideAccess(access) &&
+        mapping->direct.contains(access.address, access.size)) {
+        const DirectMemoryRange& direct = mapping->direct;
+        if (direct.dirty != nullptr) {
+            direct.markDirty(access.address, access.size);
+        }
+        copyWide(direct.host + (access.address - direct.base), access.wide, access.size);
+        notifyWrite(access.address, access.size);
+        return MemResponse{};
+    }
+
+    MemAccess relativeAccess = access;
+    relativeAccess.address = access.address - mapping->base;
+    auto lock = mapping->direct.host != nullptr ? DeviceLock() : lockDevices();
+    return mapping->write(mapping->devicePtr, relativeAccess);
+}
+
+namespace {
+uint32_t blockAccessSize(uint64_t address, uint64_t remaining) {
+    if ((address & 3) == 0 && remaining >= 4) {
+        return 4;
+    }
+    if ((address & 1) == 0 && remaining >= 2) {
+        return 2;
+    }
+    return 1;
+}
+} // namespace
+
+bool MemoryBus::readBlock(uint64_t address, void* out, uint64_t length, uint64_t* done) {
+    uint8_t* dst = static_cast<uint8_t*>(out);
+    uint64_t copied = 0;
+    bool ok = true;
+    while (copied < length) {
+        uint64_t current = address + copied;
+        const DeviceMapping* mapping = findMapping(current);
+        if (mapping == nullptr || mapping->devicePtr == nullptr) {
+            ok = false;
+            break;
+        }
+        uint64_t chunk = std::min(length - copied, mapping->end - current);
+        mapping->reads.add();
+        if (mHeatmap.load(std::memory_order_acquire)) {
+            recordHeat(*mapping, current, chunk, MemAccessType::Read);
+        }
+        if (mapping->direct.contains(current, chunk)) {
+            std::memcpy(dst + copied, mapping->direct.host + (current - mapping->direct.base),
+                chunk);
+            copied += chunk;
+            continue;
+        }
+
+        uint64_t offset = current - mapping->base;
+        auto lock = lockDevices();
+        if (mapping->devicePtr->readBlock(offset, dst + copied, chunk)) {
+            copied += chunk;
+            continue;
+        }
+        uint64_t end = copied + chunk;
+        while (ok && copied < end) {
+            MemAccess access;
+            access.address = address + copied - mapping->base;
+            access.size = blockAccessSize(access.address, end - copied);
+            access.type = MemAccessType::Read;
+            MemResponse response = mapping->read(mapping->devicePtr, access);
+            if (!response.success) {
+                ok = false;
+                break;
+            }
+            for (uint32_t i = 0; i < access.size; ++i) {
+                dst[copied + i] = static_cast<uint8_t>(response.data >> (8 * i));
+            }
+            copied += access.size;
+        }
+        if (!ok) {
+            break;
+        }
+    }
+    if (done != nullptr) {
+        *done = copied;
+    }
+    return ok;
+}
+
+bool MemoryBus::writeBlock(uint64_t address, const void* data, uint64_t length,
+    uint64_t* done) {
+    const uint8_t* src = static_cast<const uint8_t*>(data);
+    uint64_t copied = 0;
+    bool ok = true;
+    while (copied < length) {
+        uint64_t current = address + copied;
+        const DeviceMapping* mapping = findMapping(current, MemAccessType::Write);
+        if (mapping == nullptr || mapping->devicePtr == nullptr) {
+            ok = false;
+            break;
+        }
+        uint64_t chunk = std::min(length - copied, mapping->end - current);
+        mapping->writes.add();
+        if (mHeatmap.load(std::memory_order_acquire)) {
+            recordHeat(*mapping, current, chunk, MemAccessType::Write);
+        }
+        if (mapping->direct.writable && mapping->direct.contains(current, chunk)) {
+            const DirectMemoryRange& direct = mapping->direct;
+            if (direct.dirty != nullptr) {
+                direct.markDirty(current, chunk);
+            }
+            std::memcpy(direct.host + (current - direct.base), src + copied, chunk);
+            notifyWrite(current, chunk);
+            copied += chunk;
+            continue;
+        }
+
+        uint64_t offset = current - mapping->base;
+        auto lock = lockDevices();
+        if (mapping->devicePtr->writeBlock(offset, src + copied, chunk)) {
+            copied += chunk;
+            continue;
+        }
+        uint64_t end = copied + chunk;
+        while (ok && copied < end) {
+            MemAccess access;
+            access.address = address + copied - mapping->base;
+            access.size = blockAccessSize(access.address, end - copied);
+            access.type = MemAccessType::Write;
+            for (uint32_t i = 0; i < access.size; ++i) {
+                access.data |= static_cast<uint64_t>(src[copied + i]) << (8 * i);
+            }
+            if (!mapping->write(mapping->devicePtr, access).success) {
+                ok = false;
+                break;
+            }
+            copied += access.size;
+        }
+        if (!ok) {
+            break;
+        }
+    }
+    if (done != nullptr) {
+        *done = copied;
+    }
+    return ok;
+}
+
+MemResponse MemoryBus::atomic(const MemAccess& access) {
+    const DeviceMapping* mapping = findMapping(access.address, MemAccessType::Write);
+    if (mapping == nullptr || mapping->devicePtr == nullptr || !isAtomicAccess(access.type)) {
+        MemResponse response;
+        response.success = false;
+        response.error.type = CpuErrorType::AccessFault;
+        response.error.address = access.address;
+        response.error.size = access.size;
+        return response;
+    }
 
+    mapping->writes.add();
+    if (mHeatmap.load(std::memory_order_acquire)) {
+        recordHeat(*mapping, access.address, access.size, access.type);
+    }
     MemAccess relativeAccess = access;
     relativeAccess.address = access.address - mapping->base;
-    return mapping->devicePtr->write(relativeAccess);
+    bool direct = mapping->direct.host != nullptr;
+    MemResponse response;
+    {
+        auto lock = direct ? DeviceLock() : lockDevices();
+        response = mapping->atomic(mapping->devicePtr, relativeAccess);
+    }
+    if (direct && response.success && atomicStored(access, response)) {
+        notifyWrite(access.address, access.size);
+    }
+    return response;
 }
@@ -0,0 +1,62 @@
+#include "emulator/bus/event_scheduler.h"
+
+#include <algorithm>
+
+EventScheduler::EventId EventScheduler::schedule(uint64_t cycle, Callback callback) {
+    EventId id = mNextId++;
+    mCallbacks.emplace(id, std::move(callback));
+    mHeap.push_back(Entry{cycle, id});
+    std::push_heap(mHeap.begin(), mHeap.end(), later);
+    return id;
+}
+
+EventScheduler::EventId EventScheduler::scheduleIn(uint64_t delay, Callback callback) {
+    uint64_t cycle = (delay > kNoEvent - mNow) ? kNoEvent : mNow + delay;
+    return schedule(cycle, std::move(callback));
+}
+
+bool EventScheduler::cancel(EventId id) {
+    // The heap entry is dropped lazily once it reaches the top.
+    return mCallbacks.erase(id) > 0;
+}
+
+void EventScheduler::dropCancelled() const {
+    while (!mHeap.empty() && mCallbacks.find(mHeap.front().id) == mCallbacks.end()) {
+        std::pop_heap(mHeap.begin(), mHeap.end(), later);
+        mHeap.pop_back();
+    }
+}
+
+uint64_t EventScheduler::nextEventCycle() const {
+    dropCancelled();
+    return mHeap.empty() ? kNoEvent : mHeap.front().cycle;
+}
+
+size_t EventScheduler::runDue(uint64_t now) {
+    mNow = std::max(mNow, now);
+    size_t ran = 0;
+    for (;;) {
+        dropCancelled();
+        if (mHeap.empty() || mHeap.front().cycle > mNow) {
+            break;
+        }
+        EventId id = mHeap.front().id;
+        std::pop_heap(mHeap.begin(), mHeap.end(), later);
+        mHeap.pop_back();
+        auto it = mCallbacks.find(id);
+        Callback callback = std::move(it->second);
+        mCallbacks.erase(it);
+        callback(mNow);
+        ++ran;
+    }
+    return ran;
+}
+
+uint64_t EventScheduler::currentCycle() const {
+    return mClock ? std::max(mNow, mClock()) : mNow;
+}
+
+void EventScheduler::clear() {
+    mHeap.clear();
+    mCallbacks.clear();
+}
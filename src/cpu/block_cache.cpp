@@ -0,0 +1,22 @@
+#include "emulator/cpu/block_cache.h"
+
+void CodePageIndex::add(uint64_t page, uint64_t blockPc) {
+    uint64_t bit = page & (kFilterBits - 1);
+    mFilter[bit / 64] |= 1ull << (bit % 64);
+    mPages[page].push_back(blockPc);
+}
+
+std::vector<uint64_t> CodePageIndex::take(uint64_t page) {
+    auto it = mPages.find(page);
+    if (it == mPages.end()) {
+        return {};
+    }
+    std::vector<uint64_t> blocks = std::move(it->second);
+    mPages.erase(it);
+    return blocks;
+}
+
+void CodePageIndex::clear() {
+    mFilter.fill(0);
+    mPages.clear();
+}
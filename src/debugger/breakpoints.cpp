@@ -0,0 +1,211 @@
+#include "emulator/debugger/breakpoints.h"
+
+#include <algorithm>
+
+namespace {
+    constexpr uint32_t kPageShift = PageFilter::kPageShift;
+    constexpr uint64_t kLastPage = ~uint64_t{0};
+
+    uint64_t lastByte(uint64_t address, uint64_t size) {
+        uint64_t span = size == 0 ? 0 : size - 1;
+        return address > ~0ull - span ? ~0ull : address + span;
+    }
+}
+
+bool BreakpointSet::Table::findExact(uint64_t address,
+    const CompiledExpression** condition) const {
+    auto it = std::lower_bound(addresses.begin(), addresses.end(), address);
+    if (it == addresses.end() || *it != address) {
+        return false;
+    }
+    if (condition != nullptr) {
+        *condition = conditions[static_cast<size_t>(it - addresses.begin())].get();
+    }
+    return true;
+}
+
+bool BreakpointSet::add(uint64_t address, std::shared_ptr<const CompiledExpression> condition) {
+    auto lock = mTable.lock();
+    const Table* table = mTable.get();
+    std::vector<uint64_t> addresses = table != nullptr ? table->addresses : std::vector<uint64_t>();
+    std::vector<std::shared_ptr<const CompiledExpression>> conditions;
+    if (table != nullptr) {
+        conditions = table->conditions;
+    }
+    auto it = std::lower_bound(addresses.begin(), addresses.end(), address);
+    size_t index = static_cast<size_t>(it - addresses.begin());
+    bool added = it == addresses.end() || *it != address;
+    if (added) {
+        addresses.insert(it, address);
+        conditions.insert(conditions.begin() + static_cast<std::ptrdiff_t>(index), nullptr);
+    } else if (conditions[index] == condition) {
+        return false;
+    }
+    conditions[index] = std::move(condition);
+    publish(std::move(addresses), std::move(conditions));
+    return added;
+}
+
+bool BreakpointSet::remove(uint64_t address) {
+    auto lock = mTable.lock();
+    const Table* table = mTable.get();
+    if (table == nullptr || !table->findExact(address, nullptr)) {
+        return false;
+    }
+    std::vector<uint64_t> addresses = table->addresses;
+    std::vector<std::shared_ptr<const CompiledExpression>> conditions = table->conditions;
+    auto it = std::lower_bound(addresses.begin(), addresses.end(), address);
+    conditions.erase(conditions.begin() + (it - addresses.begin()));
+    addresses.erase(it);
+    publish(std::move(addresses), std::move(conditions));
+    return true;
+}
+
+std::vector<uint64_t> BreakpointSet::list(
+    std::vector<std::shared_ptr<const CompiledExpression>>* conditions) const {
+    auto lock = mTable.lock();
+    const Table* table = mTable.get();
+    if (conditions != nullptr) {
+        *conditions = table != nullptr ? table->conditions :
+            std::vector<std::shared_ptr<const CompiledExpression>>();
+    }
+    return table != nullptr ? table->addresses : std::vector<uint64_t>();
+}
+
+void BreakpointSet::publish(std::vector<uint64_t> addresses,
+    std::vector<std::shared_ptr<const CompiledExpression>> conditions) {
+    auto table = std::make_unique<Table>();
+    for (uint64_t address : addresses) {
+        table->filter.add(address >> kPageShift, address >> kPageShift);
+    }
+    table->addresses = std::move(addresses);
+    table->conditions = std::move(conditions);
+    mCount.store(table->addresses.size(), std::memory_order_relaxed);
+    mTable.publish(std::move(table));
+}
+
+bool WatchpointSet::add(const Watchpoint& watch) {
+    if (watch.size == 0) {
+        return false;
+    }
+    auto lock = mTable.lock();
+    const Table* table = mTable.get();
+    std::vector<Watchpoint> watches = table != nullptr ? table->watches : std::vector<Watchpoint>();
+    auto it = std::find_if(watches.begin(), watches.end(),
+        [&](const Watchpoint& existing) { return existing.address == watch.address; });
+    if (it != watches.end()) {
+        *it = watch;
+    } else {
+        watches.push_back(watch);
+    }
+    publish(std::move(watches));
+    return true;
+}
+
+bool WatchpointSet::remove(uint64_t address) {
+    auto lock = mTable.lock();
+    const Table* table = mTable.get();
+    if (table == nullptr) {
+        return false;
+    }
+    std::vector<Watchpoint> watches = table->watches;
+    auto it = std::find_if(watches.begin(), watches.end(),
+        [address](const Watchpoint& watch) { return watch.address == address; });
+    if (it == watches.end()) {
+        return false;
+    }
+    watches.erase(it);
+    publish(std::move(watches));
+    return true;
+}
+
+std::vector<Watchpoint> WatchpointSet::list() const {
+    auto lock = mTable.lock();
+    const Table* table = mTable.get();
+    return table != nullptr ? table->watches : std::vector<Watchpoint>();
+}
+
+bool WatchpointSet::match(uint64_t address, uint64_t size, bool write, Watchpoint* hit) const {
+    const Table* table = mTable.get();
+    if (table == nullptr || table->watches.empty()) {
+        return false;
+    }
+    uint64_t last = lastByte(address, size);
+    if (!table->filter.mayContain(address >> kPageShift) &&
+        !table->filter.mayContain(last >> kPageShift)) {
+        return false;
+    }
+    WatchKind wanted = write ? WatchKind::Write : WatchKind::Read;
+    for (const Watchpoint& watch : table->watches) {
+        if ((static_cast<uint8_t>(watch.kind) & static_cast<uint8_t>(wanted)) == 0) {
+            continue;
+        }
+        if (address <= lastByte(watch.address, watch.size) && watch.address <= last) {
+            if (hit != nullptr) {
+                *hit = watch;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+bool WatchpointSet::isPageWatched(uint64_t page) const {
+    const Table* table = mTable.get();
+    if (table == nullptr || !table->filter.mayContain(page)) {
+        return false;
+    }
+    auto it = std::upper_bound(table->pages.begin(), table->pages.end(),
+        std::make_pair(page, kLastPage));
+    return it != table->pages.begin() && std::prev(it)->second >= page;
+}
+
+bool WatchpointSet::clipDirect(uint64_t address, DirectMemoryRange* range) const {
+    const Table* table = mTable.get();
+    if (table == nullptr || table->pages.empty()) {
+        return true;
+    }
+    uint64_t page = address >> kPageShift;
+    if (isPageWatched(page)) {
+        return false;
+    }
+    uint64_t begin = range->base;
+    uint64_t end = range->base + range->size;
+    auto next = std::upper_bound(table->pages.begin(), table->pages.end(),
+        std::make_pair(page, kLastPage));
+    if (next != table->pages.end()) {
+        end = std::min(end, next->first << kPageShift);
+    }
+    if (next != table->pages.begin()) {
+        begin = std::max(begin, (std::prev(next)->second + 1) << kPageShift);
+    }
+    uint64_t skipped = begin - range->base;
+    range->host += skipped;
+    range->dirtyOffset += skipped;
+    range->base = begin;
+    range->size = end - begin;
+    return true;
+}
+
+void WatchpointSet::publish(std::vector<Watchpoint> watches) {
+    auto table = std::make_unique<Table>();
+    for (const Watchpoint& watch : watches) {
+        uint64_t first = watch.address >> kPageShift;
+        uint64_t last = lastByte(watch.address, watch.size) >> kPageShift;
+        table->pages.emplace_back(first, last);
+        table->filter.add(first, last);
+    }
+    std::sort(table->pages.begin(), table->pages.end());
+    std::vector<std::pair<uint64_t, uint64_t>> merged;
+    for (const auto& span : table->pages) {
+        if (!merged.empty() && span.first <= merged.back().second + 1) {
+            merged.back().second = std::max(merged.back().second, span.second);
+        } else {
+            merged.push_back(span);
+        }
+    }
+    table->pages = std::move(merged);
+    table->watches = std::move(watches);
+    mCount.store(table->watches.size(), std::memory_order_relaxed);
+    mTable.publish(std::move(table));
+}
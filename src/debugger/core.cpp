@@ -2,9 +2,11 @@
 #include "emulator/device/device.h"
 #include "emulator/device/uart.h"
 #include "emulator/device/display.h"
+#include "emulator/device/interrupt_controller.h"
 #include "emulator/app/app.h"
 #include "emulator/app/utils.h"
 #include "emulator/debugger/expression_parser.h"
+#include "emulator/debugger/trace_buffer.h"
 #include "emulator/logging/logger.h"
 
 #include "emulator/app/terminal.h"
@@ -13,84 +15,94 @@
 #include <cctype>
 #include <cstdio>
 #include <cstring>
+#include <limits>
 #include <sstream>
 #include <iostream>
 #include <thread>
 #include <chrono>
 #include <atomic>
+#include <optional>
+#include <utility>
 #include <termios.h>
 #include <unistd.h>
 #include <poll.h>
 #include <iomanip>
 
 namespace {
-
-std::string formatAccessType(MemAccessType type) {
-    switch (type) {
-    case MemAccessType::Read:
-        return "R";
-    case MemAccessType::Write:
-        return "W";
-    case MemAccessType::Fetch:
-        return "F";
-    }
-    return "?";
-}
-
-std::string defaultFormatter(const TraceRecord& record, const TraceOptions& options) {
-    std::stringstream ss;
-
-    if (options.logInstruction) {
-        ss << "PC:0x" << std::hex << std::setw(8) << std::setfill('0') << record.pc << " ";
-        ss << "Inst:0x" << std::hex << std::setw(8) << std::setfill('0') << record.inst << " ";
-        if (!record.decoded.empty()) {
-            ss << "(" << record.decoded << ")";
-        }
-        ss << " ";
-    }
-
-    if (options.logBranchPrediction && record.isBranch) {
-        ss << "BP:(T:" << (record.branch.taken ? "1" : "0") << " "
-           << "P:" << (record.branch.predictedTaken ? "1" : "0") << " "
-           << "Target:0x" << std::hex << record.branch.target << " "
-           << "PTarget:0x" << std::hex << record.branch.predictedTarget << ")";
-        ss << " ";
+    constexpr size_t kReadBufferSize = 64;
+    constexpr int kPollTimeoutMs = 10;
+    constexpr uint64_t kNoHorizon = ~0ull;
+
+    constexpr uint64_t kNoAddress = ~0ull;
+    constexpr uint64_t kNoCycleLimit = ~0ull;
+
+    // Index of the hart driven by the calling thread, -1 off hart threads.
+    thread_local int tCurrentHart = -1;
+    // Breakpoint the current batch resumes from; its first check is ignored.
+    thread_local uint64_t tSkipBreakpoint = kNoAddress;
+    // Set by a watchpoint hit until the batch ends.
+    thread_local bool tWatchHit = false;
+    // Set when isBreakpoint() stops the core, until the batch ends.
+    thread_local bool tBreakpointHit = false;
+
+    uint64_t elapsedNs(std::chrono::steady_clock::time_point start) {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count());
     }
 
-    if (options.logMemEvents && !record.memEvents.empty()) {
-        ss << "Mem:[";
-        bool first = true;
-        for (const auto& event : record.memEvents) {
-            if (event.type == MemAccessType::Fetch) continue;
-
-            if (!first) ss << ", ";
-            ss << formatAccessType(event.type) << ":0x" << std::hex << event.address
-               << "=" << event.data;
-            first = false;
+    const char* watchKindName(WatchKind kind) {
+        switch (kind) {
+            case WatchKind::Read: return "r";
+            case WatchKind::Write: return "w";
+            case WatchKind::Access: return "rw";
         }
-        ss << "]";
-        ss << " ";
+        return "?";
     }
-
-    return ss.str();
-}
-
-} // namespace
-
-namespace {
-    constexpr size_t kReadBufferSize = 64;
-    constexpr int kPollTimeoutMs = 10;
 }
 
+constexpr size_t kMaxPendingInvalidations = 32;
 constexpr uint32_t kInstructionsPerBatch = 1000;
 constexpr auto kPresentInterval = std::chrono::milliseconds(16);
+constexpr auto kStatusRefreshInterval = std::chrono::milliseconds(100);
+// Backstop for a wakeup notified without the control mutex held.
+constexpr auto kSleepRecheck = std::chrono::milliseconds(10);
 
 Debugger::Debugger(ICpuExecutor* cpu, MemoryBus* bus)
-    : mCpu(cpu), mBus(bus), mTraceFormatter(defaultFormatter) {
+    : mBus(bus), mTraceFormatter(formatTraceRecord) {
     registerCommands();
+    if (cpu != nullptr) {
+        addHart(cpu);
+    }
+    if (mBus != nullptr) {
+        mWriteListenerId = mBus->addWriteListener([this](uint64_t address, uint64_t size) {
+            invalidateHarts(address, size);
+        });
+        // A hart thread reads its own core's counter, which already includes
+        // the instruction making the access; other threads see the timekeeper.
+        mBus->scheduler().setClock([this]() -> uint64_t {
+            if (tCurrentHart >= 0) {
+                return mHarts[tCurrentHart]->cpu->getCycle();
+            }
+            return mHarts.empty() ? 0 :
+                mHarts[timekeeperIndex()]->cycle.load(std::memory_order_acquire);
+        });
+    }
 }
 
-Debugger::~Debugger() = default;
+Debugger::~Debugger() {
+    if (mInterrupts != nullptr) {
+        mInterrupts->setListener(nullptr);
+    }
+    if (mCodePages != nullptr) {
+        for (const auto& hart : mHarts) {
+            hart->cpu->shareCodePages(nullptr, 0);
+        }
+    }
+    if (mBus != nullptr) {
+        mBus->removeWriteListener(mWriteListenerId);
+        mBus->scheduler().setClock(nullptr);
+    }
+}
 
 void Debugger::registerCommands() {
     mCommands = {
@@ -99,17 +111,37 @@ void Debugger::registerCommands() {
         {"pause", "Pause execution", &Debugger::cmdPause},
         {"quit", "Exit the emulator", &Debugger::cmdQuit},
         {"exit", "Exit the emulator", &Debugger::cmdQuit},
-        {"regs", "Print register values", &Debugger::cmdRegs},
-        {"mem", "Dump memory (mem <addr> <len>)", &Debugger::cmdMem},
-        {"eval", "Evaluate an expression (eval <expr>)", &Debugger::cmdEval},
-        {"bp", "Manage breakpoints (bp list|add <addr>|del <addr>)", &Debugger::cmdBp},
+        {"regs", "Print register values", &Debugger::cmdRegs, true},
+        {"mem", "Dump memory (mem <addr> <len>)", &Debugger::cmdMem, true},
+        {"eval", "Evaluate an expression (eval <expr>)", &Debugger::cmdEval, true},
+        {"bp", "Manage breakpoints (bp list|add <addr> [if <expr>]|del <addr>)", &Debugger::cmdBp},
+        {"watch", "Manage watchpoints (watch list|add <addr> [len] [r|w|rw]|del <addr>)",
+            &Debugger::cmdWatch},
         {"log", "Set log level (log trace|debug|info|warn|error)", &Debugger::cmdLog},
+        {"trace", "Show or change tracing (trace [inst|mem|branch on|off]|pc <ranges>|"
+            "data <ranges>|cycles <range>|after <n>|sample <n>|clear)", &Debugger::cmdTrace},
+        {"batch", "Show adaptive CPU batch size counters", &Debugger::cmdBatch},
+        {"pace", "Show pacing drift, or switch mode (pace [realtime|max])", &Debugger::cmdPace},
+        {"perf", "Show hot-path performance counters (perf [reset|json])", &Debugger::cmdPerf},
+        {"profile", "PC sampling profiler (profile start [cycles]|stop|clear|report [n]|"
+            "export <path>|symbols <path>)", &Debugger::cmdProfile},
+        {"heat", "Memory access heatmap (heat on|off|clear|report [n]|export <path>)",
+            &Debugger::cmdHeat},
+        {"hart", "Manage harts (hart list|<id>|pause <id>|run <id>)", &Debugger::cmdHart},
+        {"snap", "Machine snapshots (snap list|save <name>|load <name>|del <name>)",
+            &Debugger::cmdSnap},
+        {"rstep", "Step backwards (rstep [count])", &Debugger::cmdRstep},
+        {"rcontinue", "Run backwards to the previous breakpoint hit", &Debugger::cmdRcontinue},
+        {"until", "Fast-forward to an instruction count (until [cycle] <n> [snapshot])",
+            &Debugger::cmdUntil},
         {"help", "Show this help message", &Debugger::cmdHelp}
     };
 }
 
 void Debugger::setCpuFrequency(uint32_t cpuFreq) {
     mCpuFrequency = cpuFreq;
+    mPacer.setFrequency(cpuFreq);
+    mPacingSliceCycles = std::max(1u, cpuFreq / 1000);
     uint32_t minThreshold = 0xFFFFFFFF;
     bool anyDevice = false;
 
@@ -141,6 +173,39 @@ void Debugger::setCpuFrequency(uint32_t cpuFreq) {
 
 void Debugger::configureTrace(const TraceOptions& options) {
     mTraceOptions = options;
+    if (mTraceOptions.filter.sampleEvery == 0) {
+        mTraceOptions.filter.sampleEvery = 1;
+    }
+    for (auto& hart : mHarts) {
+        hart->traceSeen = 0;
+        hart->traceMatched = 0;
+        hart->cpu->onTraceOptionsChanged(mTraceOptions);
+    }
+}
+
+bool Debugger::updateTrace(const TraceOptions& options, std::string* error) {
+    std::unique_lock<std::mutex> lock(mControl.mutex);
+    if (!waitForHartsIdle(lock, error)) {
+        return false;
+    }
+    configureTrace(options);
+    return true;
+}
+
+bool Debugger::shouldTrace(uint64_t pc, uint64_t cycle) {
+    if (mReplaying.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    const TraceFilter& filter = mTraceOptions.filter;
+    Hart& hart = *mHarts[tCurrentHart >= 0 ? static_cast<size_t>(tCurrentHart) : 0];
+    if (hart.traceSeen < filter.skipInstructions) {
+        ++hart.traceSeen;
+        return false;
+    }
+    if (!filter.inWindow(cycle) || !filter.matchesPc(pc)) {
+        return false;
+    }
+    return hart.traceMatched++ % filter.sampleEvery == 0;
 }
 
 void Debugger::setTraceFormatter(TraceFormatter formatter) {
@@ -148,6 +213,15 @@ void Debugger::setTraceFormatter(TraceFormatter formatter) {
 }
 
 void Debugger::logTrace(const TraceRecord& record) {
+    if (mReplaying.load(std::memory_order_relaxed)) {
+        return;
+    }
+    // Repeats the stateless checks for cores that do not ask shouldTrace().
+    const TraceFilter& filter = mTraceOptions.filter;
+    if (!filter.inWindow(record.cycleBegin) || !filter.matchesPc(record.pc) ||
+        !filter.matchesData(record.memEvents)) {
+        return;
+    }
     bool logIt = false;
 
     if (mTraceOptions.logBranchPrediction && record.isBranch) {
@@ -168,17 +242,44 @@ void Debugger::logTrace(const TraceRecord& record) {
     if (!logIt) {
         return;
     }
+    mTraceRecords.add();
+
+    if (mBinaryTrace) {
+        BinaryTraceRecord binary;
+        encodeTraceRecord(record, mTraceOptions, &binary);
+        mBinaryTrace->push(tCurrentHart > 0 ? static_cast<uint32_t>(tCurrentHart) : 0, binary);
+        return;
+    }
 
     std::string line;
     if (mTraceFormatter) {
         line = mTraceFormatter(record, mTraceOptions);
     } else {
-        line = defaultFormatter(record, mTraceOptions);
+        line = formatTraceRecord(record, mTraceOptions);
+    }
+
+    // Asked-for instruction traces bypass the compile-time level floor.
+    if (!line.empty() && logging::enabled(logging::Level::Trace)) {
+        logging::trace(__FILE__, __LINE__, "%s", line.c_str());
     }
+}
+
+bool Debugger::openBinaryTrace(const std::string& path, bool compress, std::string* error) {
+    auto writer = std::make_unique<BinaryTraceWriter>();
+    uint32_t rings = std::max<uint32_t>(1, getHartCount());
+    if (!writer->open(path, rings, compress, error)) {
+        return false;
+    }
+    mBinaryTrace = std::move(writer);
+    return true;
+}
 
-    if (!line.empty()) {
-        TRACE("%s", line.c_str());
+void Debugger::closeBinaryTrace() {
+    std::string error;
+    if (mBinaryTrace && !mBinaryTrace->close(&error)) {
+        WARN("%s", error.c_str());
     }
+    mBinaryTrace.reset();
 }
 
 const TraceOptions& Debugger::getTraceOptions() const {
@@ -188,7 +289,14 @@ const TraceOptions& Debugger::getTraceOptions() const {
 MemResponse Debugger::busRead(const MemAccess& access) {
     MemResponse response{};
     if (mBus) {
-        response = mBus->read(access);
+        MemAccess tagged = access;
+        if (tCurrentHart >= 0) {
+            tagged.hartId = static_cast<uint32_t>(tCurrentHart);
+        }
+        if (!mWatchpoints.empty()) {
+            checkWatchpoint(tagged, false);
+        }
+        response = mBus->read(tagged);
     } else {
         response.success = false;
     }
@@ -198,55 +306,149 @@ MemResponse Debugger::busRead(const MemAccess& access) {
 MemResponse Debugger::busWrite(const MemAccess& access) {
     MemResponse response{};
     if (mBus) {
-        response = mBus->write(access);
+        MemAccess tagged = access;
+        if (tCurrentHart >= 0) {
+            tagged.hartId = static_cast<uint32_t>(tCurrentHart);
+        }
+        if (!mWatchpoints.empty()) {
+            checkWatchpoint(tagged, true);
+        }
+        response = mBus->write(tagged);
     } else {
         response.success = false;
     }
     return response;
 }
 
+MemResponse Debugger::busAtomic(const MemAccess& access) {
+    MemResponse response{};
+    if (mBus) {
+        MemAccess tagged = access;
+        if (tCurrentHart >= 0) {
+            tagged.hartId = static_cast<uint32_t>(tCurrentHart);
+        }
+        if (!mWatchpoints.empty()) {
+            checkWatchpoint(tagged, true);
+        }
+        response = mBus->atomic(tagged);
+    } else {
+        response.success = false;
+    }
+    return response;
+}
+
+bool Debugger::getDirectMemory(uint64_t address, DirectMemoryRange* range) {
+    if (mBus == nullptr || !mBus->getDirectMemory(address, range)) {
+        return false;
+    }
+    return mWatchpoints.empty() || mWatchpoints.clipDirect(address, range);
+}
+
+// Only accesses made by a hart count; debugger commands reading memory do not.
+void Debugger::checkWatchpoint(const MemAccess& access, bool write) {
+    if (tCurrentHart < 0 || mReplaying.load(std::memory_order_relaxed)) {
+        return;
+    }
+    Watchpoint hit;
+    if (!mWatchpoints.match(access.address, access.size, write, &hit)) {
+        return;
+    }
+    tWatchHit = true;
+    INFO("Watchpoint 0x%llx hit: %s of %u bytes at 0x%llx (hart %d)",
+        (unsigned long long)hit.address, write ? "write" : "read", access.size,
+        (unsigned long long)access.address, tCurrentHart);
+}
+
+void Debugger::setPacing(PacingMode mode) {
+    mPacerRebase.store(true, std::memory_order_release);
+    mPacing.store(mode, std::memory_order_release);
+    mControl.cv.notify_all();
+}
+
+PacingMode Debugger::getPacing() const {
+    return mPacing.load(std::memory_order_acquire);
+}
+
+PacingStats Debugger::getPacingStats() const {
+    return mPacer.getStats();
+}
+
 void Debugger::setSdl(SdlDisplayDevice* sdl) {
     mSdl = sdl;
 }
 
+// The listener can run under the bus device lock, so it only notifies and
+// never takes the control mutex; sleeping harts also recheck periodically.
+void Debugger::setInterruptController(InterruptController* controller) {
+    if (mInterrupts != nullptr) {
+        mInterrupts->setListener(nullptr);
+    }
+    mInterrupts = controller;
+    if (mInterrupts != nullptr) {
+        mInterrupts->setListener([this]() {
+            requestAttention();
+            mControl.cv.notify_all();
+        });
+    }
+}
+
 void Debugger::setRegisterCount(uint32_t count) {
     mRegisterCount = count;
 }
 
 void Debugger::run(bool interactive) {
     mIsInteractive = interactive;
-    mState.state.store(interactive ? CpuState::Pause : CpuState::Running, std::memory_order_release);
+    mState.state.store(interactive || mStartPaused ? CpuState::Pause : CpuState::Running,
+        std::memory_order_release);
 
     if (interactive) {
         mTerminal = std::make_unique<Terminal>();
 
         mTerminal->setOnCommand([this](const std::string& cmd) {
-            std::lock_guard<std::mutex> lock(mMutex);
+            requestAttention();
             mLastCommandSuccess = this->processCommand(cmd);
             this->updateStatusDisplay();
         });
 
+        mTerminal->setOnIdle([this]() {
+            refreshStatusDisplay();
+        });
+
         mTerminal->setOnInput([this](const std::string& data) {
-            if (!mBus) return;
-            UartDevice* uart = static_cast<UartDevice*>(mBus->getDevice("UART"));
-            if (uart) {
-                for (char c : data) {
-                    uart->pushRx(static_cast<uint8_t>(c));
-                }
-            }
+            injectUartInput(reinterpret_cast<const uint8_t*>(data.data()), data.size());
         });
         
         updateStatusDisplay();
         setTerminalLogHandler();
-    } else {
+    } else if (mHostInput) {
         setDefaultLogHandler();
     }
 
-    std::thread cpuThread(&Debugger::cpuThreadLoop, this);
+    if (mSdl != nullptr && mInputMode != InputMode::Live) {
+        mSdl->setKeyHandler([this](uint32_t key) { injectKey(key); });
+    }
+    if (mInputMode == InputMode::Replay && mBus != nullptr) {
+        auto devices = mBus->lockDevices();
+        deliverReplayInput(mBus->scheduler().now());
+    }
+
+    std::vector<std::thread> hartThreads;
+    for (uint32_t i = 0; i < mHarts.size(); ++i) {
+        publishStatus(*mHarts[i]);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mControl.mutex);
+        mLiveHartThreads = static_cast<uint32_t>(mHarts.size());
+    }
+    for (uint32_t i = 0; i < mHarts.size(); ++i) {
+        hartThreads.push_back(logging::startThread([this, i]() { hartThreadLoop(i); }));
+    }
     std::thread sdlThread;
 
-    if (mSdl) {
-        sdlThread = std::thread(&Debugger::sdlThreadLoop, this);
+    // A replay takes no input from the window, so it only needs the thread
+    // to hand frames to a sink.
+    if (mSdl && (mInputMode != InputMode::Replay || mSdl->hasFrameSink())) {
+        sdlThread = logging::startThread([this]() { sdlThreadLoop(); });
     }
 
     if (interactive) {
@@ -258,13 +460,26 @@ void Debugger::run(bool interactive) {
     mState.shouldExit.store(true, std::memory_order_release);
     mControl.cv.notify_all();
 
-    if (cpuThread.joinable()) cpuThread.join();
+    for (auto& thread : hartThreads) {
+        if (thread.joinable()) thread.join();
+    }
     if (sdlThread.joinable()) sdlThread.join();
+    if (mSdl != nullptr) {
+        mSdl->setKeyHandler(nullptr);
+    }
+    if (!interactive && mPerfDumpIntervalMs > 0) {
+        dumpPerf();
+    }
 
     if (mSdl) {
         mSdl->shutdown();
     }
 
+    if (mTerminal) {
+        // Queued messages must not reach the terminal's handlers after it is gone.
+        logging::flush();
+        setDefaultLogHandler();
+    }
     mTerminal.reset();
 }
 
@@ -295,67 +510,684 @@ void Debugger::setDefaultLogHandler() {
     logging::setOutputHandler(logHandler, deviceHandler);
 }
 
-void Debugger::cpuThreadLoop() {
-    if (mCpu == nullptr || mBus == nullptr) {
+uint32_t Debugger::addHart(ICpuExecutor* cpu) {
+    auto hart = std::make_unique<Hart>();
+    hart->cpu = cpu;
+    publishStatus(*hart);
+    mHarts.push_back(std::move(hart));
+    if (mHarts.size() > 1 && mBus != nullptr) {
+        mBus->setConcurrent(true);
+    }
+    if (mHarts.size() > 1) {
+        if (mCodePages == nullptr) {
+            mCodePages = std::make_unique<SharedCodePages>();
+        }
+        for (uint32_t i = 0; i < mHarts.size(); ++i) {
+            mHarts[i]->sharesCodePages = mHarts[i]->cpu->shareCodePages(mCodePages.get(), i);
+        }
+    }
+    cpu->onTraceOptionsChanged(mTraceOptions);
+    return static_cast<uint32_t>(mHarts.size() - 1);
+}
+
+void Debugger::setHartQuantum(uint64_t cycles) {
+    mHartQuantumCycles = std::max<uint64_t>(1, cycles);
+}
+
+bool Debugger::selectHart(uint32_t id) {
+    if (id >= mHarts.size()) {
+        return false;
+    }
+    mSelectedHart.store(id, std::memory_order_release);
+    return true;
+}
+
+bool Debugger::pauseHart(uint32_t id) {
+    if (id >= mHarts.size()) {
+        return false;
+    }
+    mHarts[id]->paused.store(true, std::memory_order_release);
+    // Harts waiting on this one's progress may run ahead now.
+    mControl.cv.notify_all();
+    return true;
+}
+
+bool Debugger::resumeHart(uint32_t id) {
+    if (id >= mHarts.size()) {
+        return false;
+    }
+    mHarts[id]->paused.store(false, std::memory_order_release);
+    mControl.cv.notify_all();
+    return true;
+}
+
+HartStatus Debugger::getHartStatus(uint32_t id) const {
+    HartStatus status;
+    if (id >= mHarts.size()) {
+        return status;
+    }
+    const Hart& hart = *mHarts[id];
+    status.id = id;
+    status.paused = hart.paused.load(std::memory_order_acquire);
+    status.halted = hart.halted.load(std::memory_order_acquire);
+    status.pc = hart.cpu->getPc();
+    status.cycle = hart.cycle.load(std::memory_order_acquire);
+    status.instructions = hart.instructions.load(std::memory_order_acquire);
+    status.breakpoint = hart.breakpointStop.load(std::memory_order_relaxed);
+    if (status.halted) {
+        status.error = hart.cpu->getLastError().type;
+    }
+    return status;
+}
+
+ICpuExecutor* Debugger::currentCpu() const {
+    uint32_t id = mSelectedHart.load(std::memory_order_acquire);
+    return id < mHarts.size() ? mHarts[id]->cpu : nullptr;
+}
+
+bool Debugger::isHartActive(const Hart& hart) const {
+    return mState.state.load(std::memory_order_acquire) == CpuState::Running &&
+        !hart.paused.load(std::memory_order_acquire) &&
+        !hart.halted.load(std::memory_order_acquire);
+}
+
+// The cycle a hart may run up to: the quantum past the slowest other running
+// hart. Paused, halted and sleeping harts do not hold the others back.
+uint64_t Debugger::skewHorizon(uint32_t index) const {
+    uint64_t slowest = kNoHorizon;
+    for (uint32_t i = 0; i < mHarts.size(); ++i) {
+        if (i != index && isHartActive(*mHarts[i]) &&
+            !mHarts[i]->sleeping.load(std::memory_order_acquire)) {
+            slowest = std::min(slowest, mHarts[i]->cycle.load(std::memory_order_acquire));
+        }
+    }
+    if (slowest == kNoHorizon || slowest > kNoHorizon - mHartQuantumCycles) {
+        return kNoHorizon;
+    }
+    return slowest + mHartQuantumCycles;
+}
+
+bool Debugger::interruptAsserted(uint32_t index) const {
+    return mInterrupts != nullptr && mInterrupts->isAsserted(index);
+}
+
+// Device events run on the clock of the lowest-numbered live hart.
+uint32_t Debugger::timekeeperIndex() const {
+    for (uint32_t i = 0; i < mHarts.size(); ++i) {
+        if (!mHarts[i]->halted.load(std::memory_order_acquire)) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+// A hart's decode caches are only touched by its own thread; writes from
+// elsewhere are queued and applied at the start of its next batch. Only harts
+// that may have decoded code from the range hear about it.
+void Debugger::invalidateHarts(uint64_t address, uint64_t size) {
+    if (mHarts.size() == 1) {
+        mHarts[0]->cpu->invalidateCode(address, size);
+        return;
+    }
+    uint64_t decoded = mCodePages->harts(address, size);
+    for (uint32_t i = 0; i < mHarts.size(); ++i) {
+        Hart& hart = *mHarts[i];
+        if (tCurrentHart == static_cast<int>(i)) {
+            hart.cpu->invalidateCode(address, size);
+        } else if (!hart.sharesCodePages || (decoded >> i) & 1u) {
+            queueInvalidation(hart, address, size);
+        }
+    }
+}
+
+void Debugger::onCodeWritten(uint64_t address, uint64_t size, uint64_t harts) {
+    for (uint32_t i = 0; i < mHarts.size(); ++i) {
+        if ((harts >> i) & 1u && tCurrentHart != static_cast<int>(i)) {
+            queueInvalidation(*mHarts[i], address, size);
+        }
+    }
+}
+
+// A hart asleep in WFI may collect writes for a long time; past the cap it
+// drops all of its decoded code instead.
+void Debugger::queueInvalidation(Hart& hart, uint64_t address, uint64_t size) {
+    std::lock_guard<std::mutex> lock(hart.invalidateMutex);
+    if (!hart.invalidateAll) {
+        if (hart.pendingInvalidations.size() < kMaxPendingInvalidations) {
+            hart.pendingInvalidations.emplace_back(address, size);
+        } else {
+            hart.pendingInvalidations.clear();
+            hart.invalidateAll = true;
+        }
+    }
+    hart.invalidatePending.store(true, std::memory_order_release);
+}
+
+void Debugger::applyPendingInvalidations(uint32_t index) {
+    Hart& hart = *mHarts[index];
+    if (!hart.invalidatePending.load(std::memory_order_acquire)) {
+        return;
+    }
+    std::vector<std::pair<uint64_t, uint64_t>> ranges;
+    bool all = false;
+    {
+        std::lock_guard<std::mutex> lock(hart.invalidateMutex);
+        ranges.swap(hart.pendingInvalidations);
+        all = hart.invalidateAll;
+        hart.invalidateAll = false;
+        hart.invalidatePending.store(false, std::memory_order_release);
+    }
+    if (all) {
+        // Forgotten first, so a store racing the flush is still reported.
+        if (hart.sharesCodePages) {
+            mCodePages->forget(index);
+        }
+        hart.cpu->invalidateCode(0, std::numeric_limits<uint64_t>::max());
+        return;
+    }
+    for (const auto& range : ranges) {
+        hart.cpu->invalidateCode(range.first, range.second);
+    }
+}
+
+// A fault on any hart stops the machine; a clean halt only stops that hart
+// until every hart has halted.
+void Debugger::onHartHalted(uint32_t index) {
+    Hart& hart = *mHarts[index];
+    hart.halted.store(true, std::memory_order_release);
+    // The next live hart takes over as timekeeper from its own clock.
+    mPacerRebase.store(true, std::memory_order_release);
+    CpuErrorDetail error = hart.cpu->getLastError();
+    if (mHarts.size() == 1) {
+        INFO("CPU Halted at 0x%llx", (unsigned long long)hart.cpu->getPc());
+    } else {
+        INFO("Hart %u halted at 0x%llx", index, (unsigned long long)hart.cpu->getPc());
+    }
+    if (error.type != CpuErrorType::None) {
+        ERROR("Last error: Type=%d Addr=0x%llx Size=%u",
+                    static_cast<int>(error.type),
+                    (unsigned long long)error.address,
+                    error.size);
+    }
+
+    bool allHalted = std::all_of(mHarts.begin(), mHarts.end(), [](const auto& h) {
+        return h->halted.load(std::memory_order_acquire);
+    });
+    if (allHalted || error.type != CpuErrorType::None) {
+        mState.state.store(CpuState::Halted, std::memory_order_release);
+    }
+    mControl.cv.notify_all();
+}
+
+std::vector<ICpuExecutor*> Debugger::hartCpus() const {
+    std::vector<ICpuExecutor*> cpus;
+    for (const auto& hart : mHarts) {
+        cpus.push_back(hart->cpu);
+    }
+    return cpus;
+}
+
+bool Debugger::waitForHartsIdle(std::unique_lock<std::mutex>& lock, std::string* error) {
+    if (mState.state.load(std::memory_order_acquire) == CpuState::Running) {
+        if (error != nullptr) *error = "Pause the machine first";
+        return false;
+    }
+    mControl.cv.wait(lock, [&]() {
+        return std::none_of(mHarts.begin(), mHarts.end(), [](const auto& hart) {
+            return hart->executing;
+        });
+    });
+    reclaimRetiredTables();
+    return true;
+}
+
+// Harts consult breakpoint and watchpoint tables only inside a batch, and
+// fast-forward and replay run under this lock, so with mControl.mutex held
+// and no hart executing nobody can hold a retired table.
+void Debugger::reclaimRetiredTables() {
+    bool busy = std::any_of(mHarts.begin(), mHarts.end(), [](const auto& hart) {
+        return hart->executing;
+    });
+    if (!busy) {
+        mBreakpoints.reclaim();
+        mWatchpoints.reclaim();
+    }
+}
+
+bool Debugger::takeSnapshot(MachineSnapshot* out, std::string* error) {
+    std::unique_lock<std::mutex> lock(mControl.mutex);
+    if (!waitForHartsIdle(lock, error)) {
+        return false;
+    }
+    return takeMachineSnapshot(hartCpus(), mBus, out, error);
+}
+
+bool Debugger::restoreSnapshot(const MachineSnapshot& snapshot, std::string* error) {
+    std::unique_lock<std::mutex> lock(mControl.mutex);
+    if (!waitForHartsIdle(lock, error)) {
+        return false;
+    }
+    {
+        auto devices = mBus != nullptr ? mBus->lockDevices() : MemoryBus::DeviceLock();
+        if (!restoreMachineSnapshot(hartCpus(), mBus, snapshot, error)) {
+            return false;
+        }
+        rewindInputReplay(snapshot.schedulerNow);
+    }
+    for (auto& hart : mHarts) {
+        hart->halted.store(false, std::memory_order_release);
+        publishStatus(*hart);
+        hart->batchInstructions = 0;
+    }
+    if (mState.state.load(std::memory_order_acquire) == CpuState::Halted) {
+        mState.state.store(CpuState::Pause, std::memory_order_release);
+    }
+    // Checkpoints from the old timeline cannot be replayed into this one.
+    resetCheckpoints();
+    return true;
+}
+
+bool Debugger::runUntil(uint64_t target, RunUntilUnit unit, std::string* error) {
+    std::unique_lock<std::mutex> lock(mControl.mutex);
+    if (!waitForHartsIdle(lock, error)) {
+        return false;
+    }
+    if (mBus == nullptr || mHarts.size() != 1) {
+        if (error != nullptr) *error = "Fast-forward needs a single hart";
+        return false;
+    }
+    Hart& hart = *mHarts[0];
+    ICpuExecutor* cpu = hart.cpu;
+    if (hart.halted.load(std::memory_order_acquire)) {
+        if (error != nullptr) *error = "The hart has halted";
+        return false;
+    }
+    bool byCycles = unit == RunUntilUnit::Cycles;
+    uint64_t retired = hart.instructions.load(std::memory_order_acquire);
+    if ((byCycles ? cpu->getCycle() : retired) > target) {
+        if (error != nullptr) *error = "Already past the target";
+        return false;
+    }
+
+    applyPendingInvalidations(0);
+    if (hart.directInvalidatePending.exchange(false, std::memory_order_acq_rel)) {
+        cpu->invalidateDirectMemory();
+    }
+    TraceOptions untraced;
+    untraced.logInstruction = false;
+    untraced.logMemEvents = false;
+    untraced.logBranchPrediction = false;
+    cpu->onTraceOptionsChanged(untraced);
+    // Borrow the replay switch that silences traces and breakpoints, and run
+    // as the hart so device handlers read its exact cycle.
+    mReplaying.store(true, std::memory_order_relaxed);
+    int previousHart = tCurrentHart;
+    tCurrentHart = 0;
+    // Chunks run without the lock so pause(), exit and control tasks get
+    // through. The hart counts as executing, which keeps waitForHartsIdle()
+    // callers out, and hart threads stay parked until it is done.
+    mState.pauseRequested.store(false, std::memory_order_release);
+    mFastForwarding = true;
+    hart.executing = true;
+    lock.unlock();
+
+    EventScheduler& events = mBus->scheduler();
+    bool ok = true;
+    for (;;) {
+        uint64_t cycle = cpu->getCycle();
+        if (byCycles ? cycle >= target : retired >= target) {
+            break;
+        }
+        uint64_t nextEvent = EventScheduler::kNoEvent;
+        {
+            auto devices = mBus->lockDevices();
+            nextEvent = events.nextEventCycle();
+        }
+        uint64_t stop = byCycles ? std::min(nextEvent, target) : nextEvent;
+        bool interrupt = interruptAsserted(0);
+        if (stop == EventScheduler::kNoEvent && cpu->isWaitingForInterrupt() && !interrupt) {
+            if (error != nullptr) *error = "The hart waits for an interrupt with nothing scheduled";
+            ok = false;
+            break;
+        }
+        uint64_t cycleBudget = kNoCycleLimit;
+        if (stop != EventScheduler::kNoEvent) {
+            cycleBudget = stop > cycle ? stop - cycle : 1;
+        }
+        cpu->setInterruptLine(interrupt);
+        uint64_t chunk = kMaxInstructionsPerBatch;
+        if (!byCycles) {
+            chunk = std::min(chunk, target - retired);
+        }
+        StepResult result = cpu->step(chunk, cycleBudget);
+        retired += result.instructionsExecuted;
+        {
+            auto devices = mBus->lockDevices();
+            mEventsRun.add(events.runDue(cpu->getCycle()));
+            syncInput(cpu->getCycle());
+        }
+        if (!result.success) {
+            onHartHalted(0);
+            if (error != nullptr) *error = "The hart halted before reaching the target";
+            ok = false;
+            break;
+        }
+        if (mControlTasksPending.load(std::memory_order_acquire)) {
+            hart.instructions.store(retired, std::memory_order_release);
+            publishStatus(hart);
+            lock.lock();
+            hart.executing = false;
+            runControlTasks(lock);
+            hart.executing = true;
+            lock.unlock();
+            // A task may have restored a snapshot.
+            retired = hart.instructions.load(std::memory_order_acquire);
+        }
+        if (mState.shouldExit.load(std::memory_order_acquire) ||
+            mState.pauseRequested.load(std::memory_order_acquire) ||
+            mState.state.load(std::memory_order_acquire) == CpuState::Running ||
+            hart.stepsPending.load(std::memory_order_acquire) > 0 ||
+            hart.halted.load(std::memory_order_acquire)) {
+            if (error != nullptr) *error = "Interrupted before reaching the target";
+            ok = false;
+            break;
+        }
+    }
+
+    lock.lock();
+    hart.executing = false;
+    mFastForwarding = false;
+    tCurrentHart = previousHart;
+    mReplaying.store(false, std::memory_order_relaxed);
+    cpu->onTraceOptionsChanged(mTraceOptions);
+    hart.instructions.store(retired, std::memory_order_release);
+    hart.batchInstructions = 0;
+    publishStatus(hart);
+    // Nothing recorded the batches; start the history here.
+    resetCheckpoints();
+    mControl.cv.notify_all();
+    return ok;
+}
+
+void Debugger::hartThreadLoop(uint32_t index) {
+    if (mBus == nullptr) {
         return;
     }
+    tCurrentHart = static_cast<int>(index);
+    Hart& hart = *mHarts[index];
+    ICpuExecutor* cpu = hart.cpu;
+    bool smp = mHarts.size() > 1;
+    bool checkpointing = checkpointsEnabled();
+    if (checkpointing) {
+        std::lock_guard<std::mutex> lock(mControl.mutex);
+        if (mCheckpoints.empty()) {
+            pushCheckpoint();
+        }
+    }
 
     while (!mState.shouldExit.load(std::memory_order_acquire)) {
         uint32_t steps = 0;
         bool stepping = false;
         {
             std::unique_lock<std::mutex> lock(mControl.mutex);
-            mControl.cv.wait(lock, [&]() {
-                CpuState current = mState.state.load(std::memory_order_acquire);
-                uint32_t pending = mState.stepsPending.load(std::memory_order_acquire);
-                bool shouldExit = mState.shouldExit.load(std::memory_order_acquire);
-                return shouldExit ||
-                    current == CpuState::Running ||
-                    pending > 0;
-            });
+            // Time spent paused must not count as lag once the hart resumes.
+            if (!isHartActive(hart)) {
+                mPacerRebase.store(true, std::memory_order_release);
+            }
+            auto ready = [&]() {
+                if (mState.shouldExit.load(std::memory_order_acquire)) {
+                    return true;
+                }
+                if (mFastForwarding) {
+                    return false;
+                }
+                if (hart.halted.load(std::memory_order_acquire)) {
+                    return false;
+                }
+                if (hart.stepsPending.load(std::memory_order_acquire) > 0) {
+                    return true;
+                }
+                // A restore, register write or switch to pacing also ends it.
+                // Recorded input waits for a sync point, so it wakes the hart.
+                if (hart.sleeping.load(std::memory_order_acquire) && !interruptAsserted(index) &&
+                    !mInputPending.load(std::memory_order_acquire) &&
+                    cpu->isWaitingForInterrupt() &&
+                    mPacing.load(std::memory_order_acquire) != PacingMode::Realtime) {
+                    return false;
+                }
+                return isHartActive(hart) &&
+                    hart.cycle.load(std::memory_order_acquire) < skewHorizon(index);
+            };
+            while (!ready()) {
+                if (mControlTasksPending.load(std::memory_order_acquire) && !mFastForwarding) {
+                    runControlTasks(lock);
+                    continue;
+                }
+                if (hart.sleeping.load(std::memory_order_acquire)) {
+                    mControl.cv.wait_for(lock, kSleepRecheck);
+                } else {
+                    mControl.cv.wait(lock);
+                }
+            }
+            hart.sleeping.store(false, std::memory_order_release);
             if (mState.shouldExit.load(std::memory_order_acquire)) {
                 break;
             }
-            uint32_t pending = mState.stepsPending.load(std::memory_order_acquire);
+            uint32_t pending = hart.stepsPending.exchange(0, std::memory_order_acq_rel);
             if (pending > 0) {
                 steps = pending;
-                mState.stepsPending.store(0, std::memory_order_release);
                 stepping = true;
-                if (mState.state.load(std::memory_order_acquire) != CpuState::Running) {
-                    mState.state.store(CpuState::Running, std::memory_order_release);
+            } else if (isHartActive(hart)) {
+                if (hart.batchInstructions == 0) {
+                    hart.batchInstructions = kInstructionsPerBatch;
                 }
-            } else if (mState.state.load(std::memory_order_acquire) == CpuState::Running) {
-                steps = kInstructionsPerBatch;
+                steps = hart.batchInstructions;
             }
+            hart.executing = steps > 0;
         }
         if (steps == 0) {
             continue;
         }
 
-        StepResult result = mCpu->step(steps, mSyncThresholdCycles);
+        applyPendingInvalidations(index);
+        if (hart.directInvalidatePending.exchange(false, std::memory_order_acq_rel)) {
+            cpu->invalidateDirectMemory();
+        }
+        // A batch that resumes from a breakpoint executes it first.
+        bool resumeBreakpoint = hart.breakpointStop.exchange(false, std::memory_order_relaxed);
+        tSkipBreakpoint = (stepping || resumeBreakpoint) ? cpu->getPc() : kNoAddress;
+
+        // Run exactly up to the next device event; with nothing scheduled the
+        // sync threshold only bounds how long a batch can take. Other harts
+        // additionally stop at the skew horizon, a lone hart at its next
+        // checkpoint.
+        bool timekeeper = index == timekeeperIndex();
+        EventScheduler& events = mBus->scheduler();
+        uint64_t cycle = cpu->getCycle();
+        uint64_t nextEvent = EventScheduler::kNoEvent;
+        if (timekeeper) {
+            auto lock = mBus->lockDevices();
+            nextEvent = events.nextEventCycle();
+        }
+        uint64_t cycleBudget = mSyncThresholdCycles;
+        if (nextEvent != EventScheduler::kNoEvent) {
+            cycleBudget = nextEvent > cycle ? nextEvent - cycle : 1;
+        }
+        bool pacing = timekeeper && mPacing.load(std::memory_order_acquire) == PacingMode::Realtime;
+        if (pacing) {
+            cycleBudget = std::min<uint64_t>(cycleBudget, mPacingSliceCycles);
+        }
+        bool horizonLimited = false;
+        if (checkpointing && mNextCheckpointCycle > cycle &&
+            mNextCheckpointCycle - cycle < cycleBudget) {
+            cycleBudget = mNextCheckpointCycle - cycle;
+            horizonLimited = true;
+        }
+        if (smp && !stepping) {
+            uint64_t horizon = skewHorizon(index);
+            if (horizon != kNoHorizon) {
+                uint64_t allowed = horizon > cycle ? horizon - cycle : 1;
+                if (allowed < cycleBudget) {
+                    cycleBudget = allowed;
+                    horizonLimited = true;
+                }
+            }
+        }
+        // The batch ends on the next sample point, which is not a reason for
+        // a waiting core to stay awake.
+        bool profiling = mProfiler.isRunning();
+        bool sampleLimited = false;
+        if (profiling) {
+            uint64_t generation = mProfiler.getGeneration();
+            if (hart.profileGeneration != generation) {
+                hart.profileGeneration = generation;
+                hart.nextSampleCycle = cycle + mProfiler.getPeriod();
+            }
+            if (!stepping && hart.nextSampleCycle > cycle &&
+                hart.nextSampleCycle - cycle < cycleBudget) {
+                cycleBudget = hart.nextSampleCycle - cycle;
+                sampleLimited = true;
+            }
+        }
+
+        cpu->setInterruptLine(interruptAsserted(index));
+        auto stepStart = std::chrono::steady_clock::now();
+        StepResult result = cpu->step(steps, cycleBudget);
+        hart.stepNs.add(elapsedNs(stepStart));
+        tSkipBreakpoint = kNoAddress;
+        bool breakpointHit = std::exchange(tBreakpointHit, false);
+
+        hart.instructions.fetch_add(result.instructionsExecuted, std::memory_order_relaxed);
+        publishStatus(hart);
+        if (profiling && cpu->getCycle() >= hart.nextSampleCycle) {
+            mProfiler.record(index, cpu->getPc());
+            hart.nextSampleCycle = cpu->getCycle() + mProfiler.getPeriod();
+        }
 
-        mTotalInstructions += result.instructionsExecuted;
+        // The core returns early in front of a breakpoint or behind a
+        // watchpoint access; either pauses the whole machine.
+        if (tWatchHit) {
+            tWatchHit = false;
+            pause();
+        } else if (result.success && result.instructionsExecuted < steps &&
+            result.cyclesExecuted < cycleBudget && breakpointHit) {
+            hart.breakpointStop.store(true, std::memory_order_relaxed);
+            if (smp) {
+                INFO("Breakpoint hit at 0x%llx (hart %u)", (unsigned long long)cpu->getPc(),
+                    index);
+            } else {
+                INFO("Breakpoint hit at 0x%llx", (unsigned long long)cpu->getPc());
+            }
+            pause();
+        }
 
         if (!result.success) {
-            mState.state.store(CpuState::Halted, std::memory_order_release);
-            mControl.cv.notify_all();
-            INFO("CPU Halted at 0x%llx", (unsigned long long)mCpu->getPc());
-            if (mCpu->getLastError().type != CpuErrorType::None) {
-                ERROR("Last error: Type=%d Addr=0x%llx Size=%u",
-                            static_cast<int>(mCpu->getLastError().type),
-                            (unsigned long long)mCpu->getLastError().address,
-                            mCpu->getLastError().size);
+            onHartHalted(index);
+        }
+
+        bool eventsPending = false;
+        if (timekeeper) {
+            auto syncStart = std::chrono::steady_clock::now();
+            auto lock = mBus->lockDevices();
+            mEventsRun.add(events.runDue(cpu->getCycle()));
+            syncInput(cpu->getCycle());
+            eventsPending = events.nextEventCycle() != EventScheduler::kNoEvent;
+            mSyncs.add();
+            hart.syncNs.add(elapsedNs(syncStart));
+        }
+
+        if (pacing && !stepping) {
+            if (mPacerRebase.exchange(false, std::memory_order_acq_rel)) {
+                mPacer.rebase(cpu->getCycle(), Pacer::Clock::now());
+            } else {
+                mPacer.pace(cpu->getCycle());
             }
         }
 
-        mBus->syncAll(mCpu->getCycle());
+        if (checkpointing) {
+            recordBatch(result.instructionsExecuted);
+            if (cpu->getCycle() >= mNextCheckpointCycle) {
+                pushCheckpoint();
+            }
+        }
 
-        if (stepping && !mState.shouldExit.load(std::memory_order_acquire)) {
-            mState.state.store(CpuState::Pause, std::memory_order_release);
+        if (!stepping) {
+            bool eventLimited = (nextEvent != EventScheduler::kNoEvent || horizonLimited ||
+                sampleLimited) && result.cyclesExecuted >= cycleBudget;
+            hart.batchInstructions = nextBatchSize(hart, result, steps, eventLimited);
         }
-        
-        updateStatusDisplay();
+
+        // A waiting core already skipped ahead to the next event or horizon.
+        // With neither left it parks until an interrupt, a step request or
+        // exit instead of spinning through empty batches. A paced core keeps
+        // going so guest time follows host time, sleeping in the pacer.
+        bool idle = result.success && result.instructionsExecuted == 0 &&
+            cpu->isWaitingForInterrupt() && !eventsPending && !horizonLimited && !pacing;
+
+        // Wake harts waiting for this one to catch up, and snapshot requests
+        // waiting for the batch to end.
+        {
+            std::lock_guard<std::mutex> lock(mControl.mutex);
+            hart.executing = false;
+            if (idle && !interruptAsserted(index)) {
+                hart.sleeping.store(true, std::memory_order_release);
+            }
+        }
+        mControl.cv.notify_all();
+
+        if (mControlTasksPending.load(std::memory_order_acquire)) {
+            std::unique_lock<std::mutex> lock(mControl.mutex);
+            runControlTasks(lock);
+        }
+    }
+    tCurrentHart = -1;
+
+    // The last thread out runs whatever was queued while the others exited.
+    std::unique_lock<std::mutex> lock(mControl.mutex);
+    --mLiveHartThreads;
+    runControlTasks(lock);
+}
+
+void Debugger::runOnMachine(const std::function<void()>& task) {
+    std::unique_lock<std::mutex> lock(mControl.mutex);
+    if (mLiveHartThreads == 0 && !mFastForwarding) {
+        lock.unlock();
+        task();
+        return;
     }
+    ControlTask entry;
+    entry.run = &task;
+    mControlTasks.push_back(&entry);
+    mControlTasksPending.store(true, std::memory_order_release);
+    requestAttention();
+    mControl.cv.notify_all();
+    mControl.cv.wait(lock, [&]() { return entry.done; });
+}
+
+void Debugger::runControlTasks(std::unique_lock<std::mutex>& lock) {
+    // Tasks act for the debugger, not for this hart: no watchpoint hits.
+    int hart = tCurrentHart;
+    tCurrentHart = -1;
+    while (!mControlTasks.empty()) {
+        ControlTask* task = mControlTasks.front();
+        mControlTasks.pop_front();
+        lock.unlock();
+        (*task->run)();
+        lock.lock();
+        task->done = true;
+    }
+    mControlTasksPending.store(false, std::memory_order_release);
+    tCurrentHart = hart;
+    mControl.cv.notify_all();
+}
+
+void Debugger::publishStatus(Hart& hart) {
+    HartSnapshot snapshot;
+    snapshot.pc = hart.cpu->getPc();
+    snapshot.cycle = hart.cpu->getCycle();
+    snapshot.instructions = hart.instructions.load(std::memory_order_relaxed);
+    hart.cycle.store(snapshot.cycle, std::memory_order_release);
+    hart.snapshot.store(snapshot);
 }
 
 void Debugger::sdlThreadLoop() {
@@ -364,7 +1196,7 @@ void Debugger::sdlThreadLoop() {
     }
     auto lastPresent = std::chrono::steady_clock::now();
     while (!mState.shouldExit.load(std::memory_order_acquire)) {
-        bool shouldWait = !mSdl->isDirty() && !mSdl->isPresentRequested();
+        bool shouldWait = !mSdl->hasPendingFrame() && !mSdl->isPresentRequested();
         mSdl->pollEvents(shouldWait ? 8u : 0u);
         if (mSdl->isQuitRequested()) {
             mState.shouldExit.store(true, std::memory_order_release);
@@ -375,13 +1207,125 @@ void Debugger::sdlThreadLoop() {
         if (mSdl->consumePresentRequest()) {
             mSdl->present();
             lastPresent = now;
-        } else if (mSdl->isDirty() && now - lastPresent >= kPresentInterval) {
+        } else if (mSdl->hasPendingFrame() && now - lastPresent >= kPresentInterval) {
             mSdl->present();
             lastPresent = now;
         }
     }
 }
 
+void Debugger::requestAttention() {
+    mState.attention.fetch_add(1, std::memory_order_acq_rel);
+}
+
+// Doubles the batch while a whole batch runs without anything needing the
+// loop's attention; drops to the minimum as soon as a command, input or step
+// request is pending, and to what fit before the next device event.
+uint32_t Debugger::nextBatchSize(Hart& hart, const StepResult& result, uint32_t steps,
+    bool eventLimited) {
+    uint32_t next = steps;
+    uint64_t seen = mState.attention.load(std::memory_order_acquire);
+    bool attention = seen != hart.attentionSeen ||
+        hart.stepsPending.load(std::memory_order_acquire) > 0;
+    hart.attentionSeen = seen;
+    if (attention) {
+        next = kMinInstructionsPerBatch;
+    } else if (eventLimited) {
+        mBatchEventLimited.fetch_add(1, std::memory_order_relaxed);
+        next = static_cast<uint32_t>(std::clamp<uint64_t>(result.instructionsExecuted,
+            kMinInstructionsPerBatch, steps));
+    } else if (result.instructionsExecuted >= steps) {
+        next = std::min(steps * 2, kMaxInstructionsPerBatch);
+    }
+
+    if (next > steps) {
+        mBatchGrows.fetch_add(1, std::memory_order_relaxed);
+    } else if (next < steps) {
+        mBatchShrinks.fetch_add(1, std::memory_order_relaxed);
+    }
+    uint64_t batches = mBatchCount.fetch_add(1, std::memory_order_relaxed);
+    uint32_t smallest = mBatchSmallest.load(std::memory_order_relaxed);
+    if (batches == 0 || steps < smallest) {
+        mBatchSmallest.store(steps, std::memory_order_relaxed);
+    }
+    if (steps > mBatchLargest.load(std::memory_order_relaxed)) {
+        mBatchLargest.store(steps, std::memory_order_relaxed);
+    }
+    mBatchCurrent.store(next, std::memory_order_relaxed);
+    return next;
+}
+
+BatchStats Debugger::getBatchStats() const {
+    BatchStats stats;
+    stats.batches = mBatchCount.load(std::memory_order_relaxed);
+    stats.grows = mBatchGrows.load(std::memory_order_relaxed);
+    stats.shrinks = mBatchShrinks.load(std::memory_order_relaxed);
+    stats.eventLimited = mBatchEventLimited.load(std::memory_order_relaxed);
+    stats.current = mBatchCurrent.load(std::memory_order_relaxed);
+    stats.smallest = mBatchSmallest.load(std::memory_order_relaxed);
+    stats.largest = mBatchLargest.load(std::memory_order_relaxed);
+    return stats;
+}
+
+PerfReport Debugger::collectPerfTotals() const {
+    PerfReport report;
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+        mPerfEpoch).count();
+    for (const auto& hart : mHarts) {
+        report.instructions += hart->instructions.load(std::memory_order_relaxed);
+        report.stepNs += hart->stepNs.load();
+        report.syncNs += hart->syncNs.load();
+    }
+    report.batches = mBatchCount.load(std::memory_order_relaxed);
+    report.syncs = mSyncs.load();
+    report.events = mEventsRun.load();
+    report.traceRecords = mTraceRecords.load();
+    if (mBus != nullptr) {
+        BusStats bus = mBus->getStats();
+        report.tlbHits = bus.tlbHits;
+        report.tlbMisses = bus.tlbMisses;
+        report.mappings = std::move(bus.mappings);
+        Device* device = mBus->getDevice("UART");
+        if (device != nullptr && device->getType() == DeviceType::Uart) {
+            UartStats uart = static_cast<UartDevice*>(device)->getStats();
+            report.uartTxStalls = uart.txStalls;
+            report.uartRxContended = uart.rxContended;
+        }
+    }
+    logging::Stats log = logging::getStats();
+    report.logMessages = log.messages;
+    report.logContended = log.contended;
+    report.logQueueStalls = log.queueStalls;
+    return report;
+}
+
+PerfReport Debugger::getPerfReport() {
+    std::lock_guard<std::mutex> lock(mPerfMutex);
+    return diffPerfReports(collectPerfTotals(), mPerfBaseline);
+}
+
+void Debugger::resetPerfCounters() {
+    std::lock_guard<std::mutex> lock(mPerfMutex);
+    mPerfBaseline = collectPerfTotals();
+}
+
+void Debugger::setPerfDumpInterval(uint32_t milliseconds) {
+    mPerfDumpIntervalMs = milliseconds;
+}
+
+bool Debugger::loadSymbols(const std::string& path, std::string* error) {
+    SymbolMap symbols;
+    if (!symbols.load(path, error)) {
+        return false;
+    }
+    mSymbols = std::move(symbols);
+    return true;
+}
+
+void Debugger::dumpPerf() {
+    logging::raw("%s\n", formatPerfJson(getPerfReport()).c_str());
+}
+
 void Debugger::runPlainInputLoop() {
     if (mBus == nullptr) {
         ERROR("Memory bus not initialized");
@@ -395,7 +1339,8 @@ void Debugger::runPlainInputLoop() {
     }
 
     struct termios originalSettings{};
-    bool isTty = isatty(STDIN_FILENO);
+    bool hostInput = mHostInput && mInputMode != InputMode::Replay;
+    bool isTty = hostInput && isatty(STDIN_FILENO);
 
     if (isTty && tcgetattr(STDIN_FILENO, &originalSettings) != 0) {
         ERROR("Failed to get terminal attributes: %s", strerror(errno));
@@ -405,15 +1350,38 @@ void Debugger::runPlainInputLoop() {
     struct termios newSettings = originalSettings;
     newSettings.c_lflag &= ~(ICANON | ECHO);
 
-    TermiosGuard guard(STDIN_FILENO, newSettings);
-    if (!guard.isValid()) {
-        return;
+    std::optional<TermiosGuard> guard;
+    if (isTty) {
+        guard.emplace(STDIN_FILENO, newSettings);
+        if (!guard->isValid()) {
+            return;
+        }
     }
 
+    // Piped or redirected input can end while the guest keeps running; after
+    // that the loop only waits for the guest to halt.
+    bool inputOpen = hostInput;
+    auto dumpInterval = std::chrono::milliseconds(mPerfDumpIntervalMs);
+    auto nextDump = std::chrono::steady_clock::now() + dumpInterval;
     while (!mState.shouldExit.load(std::memory_order_acquire)) {
-        if (mState.state.load(std::memory_order_acquire) == CpuState::Halted) {
+        if (mState.state.load(std::memory_order_acquire) == CpuState::Halted && !mHoldOnHalt) {
             break;
         }
+        if (mCycleLimit > 0 && std::any_of(mHarts.begin(), mHarts.end(), [this](const auto& h) {
+            return h->snapshot.load().cycle >= mCycleLimit;
+        })) {
+            mCycleLimitReached = true;
+            break;
+        }
+        if (mPerfDumpIntervalMs > 0 && std::chrono::steady_clock::now() >= nextDump) {
+            dumpPerf();
+            nextDump += dumpInterval;
+        }
+
+        if (!inputOpen) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(kPollTimeoutMs));
+            continue;
+        }
 
         struct pollfd pfd;
         pfd.fd = STDIN_FILENO;
@@ -444,12 +1412,19 @@ void Debugger::runPlainInputLoop() {
                 ERROR("Read failed: %s", strerror(errno));
                 break;
             }
-
-            for (ssize_t i = 0; i < bytesRead; ++i) {
-                uart->pushRx(static_cast<uint8_t>(buffer[i]));
+            if (bytesRead == 0 && !isTty) {
+                inputOpen = false;
+                continue;
             }
+
+            injectUartInput(reinterpret_cast<const uint8_t*>(buffer.data()),
+                static_cast<size_t>(bytesRead));
         }
 
+        if (!isTty && (pfd.revents & POLLHUP)) {
+            inputOpen = false;
+            continue;
+        }
         if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
             ERROR("Terminal error event: 0x%x", pfd.revents);
             break;
@@ -462,34 +1437,73 @@ std::vector<uint8_t> Debugger::scanMemory(uint64_t address, uint32_t length) {
     if (mBus == nullptr || length == 0) {
         return data;
     }
-
-    data.resize(length);
-    for (uint32_t i = 0; i < length; ++i) {
-        MemAccess access;
-        access.address = address + i;
-        access.size = 1;
-        access.type = MemAccessType::Read;
-        MemResponse response = mBus->read(access);
-        if (response.success) {
-            data[i] = static_cast<uint8_t>(response.data & 0xff);
+
+    // Unreadable bytes show as zero, so keep going past a failing address.
+    data.assign(length, 0);
+    uint64_t offset = 0;
+    while (offset < length) {
+        uint64_t done = 0;
+        if (mBus->readBlock(address + offset, data.data() + offset, length - offset, &done)) {
+            break;
+        }
+        offset += done + 1;
+    }
+    return data;
+}
+
+bool Debugger::readMemory(uint64_t address, void* out, uint64_t length, uint64_t* done) {
+    if (mBus == nullptr) {
+        return false;
+    }
+    bool ok = false;
+    runOnMachine([&]() { ok = mBus->readBlock(address, out, length, done); });
+    return ok;
+}
+
+bool Debugger::writeMemory(uint64_t address, const void* data, uint64_t length,
+    uint64_t* done) {
+    if (mBus == nullptr) {
+        return false;
+    }
+    bool ok = false;
+    runOnMachine([&]() { ok = mBus->writeBlock(address, data, length, done); });
+    return ok;
+}
+
+bool Debugger::writeRegister(uint32_t regId, uint64_t value) {
+    uint32_t id = mSelectedHart.load(std::memory_order_acquire);
+    if (id >= mHarts.size() || regId > mHarts[id]->cpu->getRegisterCount()) {
+        return false;
+    }
+    Hart& hart = *mHarts[id];
+    runOnMachine([&]() {
+        if (regId == hart.cpu->getRegisterCount()) {
+            hart.cpu->setPc(value);
         } else {
-            data[i] = 0;
+            hart.cpu->setRegister(regId, value);
         }
-    }
-    return data;
+        publishStatus(hart);
+    });
+    return true;
+}
+
+uint32_t Debugger::getRegisterCount() const {
+    uint32_t id = mSelectedHart.load(std::memory_order_acquire);
+    return id < mHarts.size() ? mHarts[id]->cpu->getRegisterCount() : 0;
 }
 
 std::vector<uint64_t> Debugger::readRegisters() {
     std::vector<uint64_t> regs;
-    if (mCpu == nullptr) {
+    ICpuExecutor* cpu = currentCpu();
+    if (cpu == nullptr) {
         return regs;
     }
     if (mRegisterCount == 0) {
-        mRegisterCount = mCpu->getRegisterCount();
+        mRegisterCount = cpu->getRegisterCount();
     }
     regs.resize(mRegisterCount);
     for (uint32_t regId = 0; regId < mRegisterCount; ++regId) {
-        regs[regId] = mCpu->getRegister(regId);
+        regs[regId] = cpu->getRegister(regId);
     }
     return regs;
 }
@@ -503,32 +1517,128 @@ void Debugger::printRegisters() {
 
 uint64_t Debugger::evalExpression(const std::string& expression) {
     if (expression.empty()) return 0;
-    ExpressionParser parser(mCpu, mBus, expression);
+    ExpressionParser parser(currentCpu(), mBus, expression);
     return parser.parse();
 }
 
 void Debugger::addBreakpoint(uint64_t address) {
-    std::lock_guard<std::mutex> lock(mMutex);
-    if (std::find(mBreakpoints.begin(), mBreakpoints.end(), address) == mBreakpoints.end()) {
-        mBreakpoints.push_back(address);
+    mBreakpoints.add(address);
+    std::lock_guard<std::mutex> lock(mControl.mutex);
+    reclaimRetiredTables();
+}
+
+bool Debugger::addBreakpoint(uint64_t address, const std::string& condition,
+    std::string* error) {
+    auto compiled = std::make_shared<CompiledExpression>();
+    if (!ExpressionParser::compile(condition, compiled.get(), error)) {
+        return false;
+    }
+    mBreakpoints.add(address, std::move(compiled));
+    std::lock_guard<std::mutex> lock(mControl.mutex);
+    reclaimRetiredTables();
+    return true;
+}
+
+bool Debugger::breakpointFires(ICpuExecutor* cpu, uint64_t address) const {
+    const CompiledExpression* condition = nullptr;
+    if (!mBreakpoints.find(address, &condition)) {
+        return false;
     }
+    return condition == nullptr || condition->evaluate(cpu, mBus) != 0;
 }
 
 void Debugger::removeBreakpoint(uint64_t address) {
-    std::lock_guard<std::mutex> lock(mMutex);
-    mBreakpoints.erase(
-        std::remove(mBreakpoints.begin(), mBreakpoints.end(), address),
-        mBreakpoints.end());
+    mBreakpoints.remove(address);
+    std::lock_guard<std::mutex> lock(mControl.mutex);
+    reclaimRetiredTables();
 }
 
 bool Debugger::isBreakpoint(uint64_t address) {
-    std::lock_guard<std::mutex> lock(mMutex);
-    return std::find(mBreakpoints.begin(), mBreakpoints.end(), address) != mBreakpoints.end();
+    if (mReplaying.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    if (tWatchHit) {
+        return true;
+    }
+    if (address == tSkipBreakpoint) {
+        tSkipBreakpoint = kNoAddress;
+        return false;
+    }
+    ICpuExecutor* cpu = tCurrentHart >= 0 ? mHarts[tCurrentHart]->cpu : currentCpu();
+    if (!breakpointFires(cpu, address)) {
+        return false;
+    }
+    tBreakpointHit = true;
+    return true;
 }
 
 bool Debugger::hasBreakpoints() {
-    std::lock_guard<std::mutex> lock(mMutex);
-    return !mBreakpoints.empty();
+    if (mReplaying.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    return !mBreakpoints.empty() || !mWatchpoints.empty();
+}
+
+bool Debugger::addWatchpoint(const Watchpoint& watch) {
+    if (!mWatchpoints.add(watch)) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mControl.mutex);
+    for (auto& hart : mHarts) {
+        hart->directInvalidatePending.store(true, std::memory_order_release);
+    }
+    reclaimRetiredTables();
+    return true;
+}
+
+bool Debugger::removeWatchpoint(uint64_t address) {
+    if (!mWatchpoints.remove(address)) {
+        return false;
+    }
+    // Let the harts pick up the wider direct ranges again.
+    std::lock_guard<std::mutex> lock(mControl.mutex);
+    for (auto& hart : mHarts) {
+        hart->directInvalidatePending.store(true, std::memory_order_release);
+    }
+    reclaimRetiredTables();
+    return true;
+}
+
+void Debugger::setHeatmapEnabled(bool enabled) {
+    if (mBus == nullptr) {
+        return;
+    }
+    mBus->setHeatmapEnabled(enabled);
+    // Cached direct ranges would bypass the counters; drop them, or pick them
+    // up again once counting stops.
+    for (auto& hart : mHarts) {
+        hart->directInvalidatePending.store(true, std::memory_order_release);
+    }
+}
+
+bool Debugger::exportHeatmap(const std::string& path, std::string* error) const {
+    if (mBus == nullptr) {
+        if (error != nullptr) *error = "No bus attached";
+        return false;
+    }
+    FILE* file = std::fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        if (error != nullptr) *error = "Cannot open " + path;
+        return false;
+    }
+    std::fprintf(file, "mapping,address,reads,writes,fetches\n");
+    for (const MappingHeat& mapping : mBus->getHeatmap()) {
+        for (const HeatCell& cell : mapping.cells) {
+            std::fprintf(file, "%s,0x%llx,%llu,%llu,%llu\n", mapping.name.c_str(),
+                (unsigned long long)cell.address, (unsigned long long)cell.reads,
+                (unsigned long long)cell.writes, (unsigned long long)cell.fetches);
+        }
+    }
+    bool ok = std::fclose(file) == 0;
+    if (!ok && error != nullptr) {
+        *error = "Failed to write " + path;
+    }
+    return ok;
 }
 
 bool Debugger::processCommand(const std::string& command) {
@@ -543,30 +1653,78 @@ bool Debugger::processCommand(const std::string& command) {
     stream >> verb;
 
     for (const auto& cmd : mCommands) {
-        if (cmd.name == verb) {
+        if (cmd.name != verb) {
+            continue;
+        }
+        if (!cmd.onMachine) {
             return (this->*cmd.Handler)(stream);
         }
+        bool ok = false;
+        runOnMachine([&]() { ok = (this->*cmd.Handler)(stream); });
+        return ok;
     }
 
     return false;
 }
 
-bool Debugger::cmdRun(std::istringstream& args) {
-    (void)args;
+bool Debugger::resume(std::string* error) {
     if (mState.state.load(std::memory_order_acquire) == CpuState::Halted) {
-        INFO("CPU is halted. Cannot run.");
+        if (error != nullptr) *error = "CPU is halted. Cannot run.";
         return false;
     }
+    for (auto& hart : mHarts) {
+        hart->paused.store(false, std::memory_order_release);
+    }
     mState.state.store(CpuState::Running, std::memory_order_release);
     mControl.cv.notify_all();
     return true;
 }
 
-bool Debugger::cmdStep(std::istringstream& args) {
+bool Debugger::step(uint32_t count, std::string* error) {
     if (mState.state.load(std::memory_order_acquire) == CpuState::Halted) {
-        INFO("CPU is halted. Cannot step.");
+        if (error != nullptr) *error = "CPU is halted. Cannot step.";
+        return false;
+    }
+    uint32_t id = mSelectedHart.load(std::memory_order_acquire);
+    if (id >= mHarts.size() || mHarts[id]->halted.load(std::memory_order_acquire)) {
+        if (error != nullptr) *error = "Hart " + std::to_string(id) + " is halted. Cannot step.";
+        return false;
+    }
+    // Stepping pauses the machine and runs only the selected hart.
+    mState.state.store(CpuState::Pause, std::memory_order_release);
+    mHarts[id]->stepsPending.fetch_add(std::max<uint32_t>(1, count), std::memory_order_release);
+    mControl.cv.notify_all();
+    return true;
+}
+
+void Debugger::pause() {
+    CpuState running = CpuState::Running;
+    mState.state.compare_exchange_strong(running, CpuState::Pause, std::memory_order_acq_rel);
+    mState.pauseRequested.store(true, std::memory_order_release);
+    requestAttention();
+}
+
+bool Debugger::isStopped() {
+    if (mState.state.load(std::memory_order_acquire) == CpuState::Running) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mControl.mutex);
+    return std::none_of(mHarts.begin(), mHarts.end(), [](const auto& hart) {
+        return hart->executing || hart->stepsPending.load(std::memory_order_acquire) > 0;
+    });
+}
+
+bool Debugger::cmdRun(std::istringstream& args) {
+    (void)args;
+    std::string error;
+    if (!resume(&error)) {
+        INFO("%s", error.c_str());
         return false;
     }
+    return true;
+}
+
+bool Debugger::cmdStep(std::istringstream& args) {
     uint32_t steps = 1;
     std::string arg;
     if (args >> arg) {
@@ -575,9 +1733,11 @@ bool Debugger::cmdStep(std::istringstream& args) {
             steps = static_cast<uint32_t>(val);
         }
     }
-    mState.stepsPending.fetch_add(steps, std::memory_order_release);
-    mState.state.store(CpuState::Running, std::memory_order_release);
-    mControl.cv.notify_all();
+    std::string error;
+    if (!step(steps, &error)) {
+        INFO("%s", error.c_str());
+        return false;
+    }
     return true;
 }
 
@@ -645,12 +1805,18 @@ bool Debugger::cmdMem(std::istringstream& args) {
 bool Debugger::cmdEval(std::istringstream& args) {
     std::string expr;
     std::getline(args, expr);
-    if (!expr.empty()) {
-        uint64_t value = evalExpression(expr);
-        INFO("0x%llx (%llu)", (unsigned long long)value, (unsigned long long)value);
-        return true;
+    if (expr.empty()) {
+        return false;
     }
-    return false;
+    CompiledExpression compiled;
+    std::string error;
+    if (!ExpressionParser::compile(expr, &compiled, &error)) {
+        INFO("eval failed: %s", error.c_str());
+        return false;
+    }
+    uint64_t value = compiled.evaluate(currentCpu(), mBus);
+    INFO("0x%llx (%llu)", (unsigned long long)value, (unsigned long long)value);
+    return true;
 }
 
 bool Debugger::cmdBp(std::istringstream& args) {
@@ -659,13 +1825,20 @@ bool Debugger::cmdBp(std::istringstream& args) {
     args >> action;
 
     if (action == "list" || action.empty()) {
-        std::lock_guard<std::mutex> lock(mMutex);
-        if (mBreakpoints.empty()) {
+        std::vector<std::shared_ptr<const CompiledExpression>> conditions;
+        std::vector<uint64_t> breakpoints = mBreakpoints.list(&conditions);
+        if (breakpoints.empty()) {
             INFO("No breakpoints.");
         } else {
             INFO("Breakpoints:");
-            for (uint64_t bp : mBreakpoints) {
-                INFO("  0x%llx", (unsigned long long)bp);
+            for (size_t i = 0; i < breakpoints.size(); ++i) {
+                uint64_t bp = breakpoints[i];
+                if (conditions[i] != nullptr) {
+                    INFO("  0x%llx if %s", (unsigned long long)bp,
+                        conditions[i]->text().c_str());
+                } else {
+                    INFO("  0x%llx", (unsigned long long)bp);
+                }
             }
         }
         return true;
@@ -673,7 +1846,19 @@ bool Debugger::cmdBp(std::istringstream& args) {
 
     args >> addrStr;
     if (action == "add" && !addrStr.empty()) {
-        addBreakpoint(evalExpression(addrStr));
+        std::string keyword;
+        args >> keyword;
+        if (keyword.empty()) {
+            addBreakpoint(evalExpression(addrStr));
+            return true;
+        }
+        std::string condition;
+        std::getline(args, condition);
+        std::string error;
+        if (keyword != "if" || !addBreakpoint(evalExpression(addrStr), condition, &error)) {
+            INFO("bp add failed: %s", keyword != "if" ? "Expected 'if <expr>'" : error.c_str());
+            return false;
+        }
         return true;
     }
     if (action == "del" && !addrStr.empty()) {
@@ -683,6 +1868,53 @@ bool Debugger::cmdBp(std::istringstream& args) {
     return false;
 }
 
+bool Debugger::cmdWatch(std::istringstream& args) {
+    std::string action;
+    args >> action;
+
+    if (action == "list" || action.empty()) {
+        std::vector<Watchpoint> watches = mWatchpoints.list();
+        if (watches.empty()) {
+            INFO("No watchpoints.");
+        } else {
+            INFO("Watchpoints:");
+            for (const Watchpoint& watch : watches) {
+                INFO("  0x%llx +%llu %s", (unsigned long long)watch.address,
+                    (unsigned long long)watch.size, watchKindName(watch.kind));
+            }
+        }
+        return true;
+    }
+
+    std::string addrStr;
+    args >> addrStr;
+    if (addrStr.empty()) {
+        return false;
+    }
+    if (action == "del") {
+        return removeWatchpoint(evalExpression(addrStr));
+    }
+    if (action != "add") {
+        return false;
+    }
+
+    Watchpoint watch;
+    watch.address = evalExpression(addrStr);
+    std::string token;
+    while (args >> token) {
+        if (token == "r") {
+            watch.kind = WatchKind::Read;
+        } else if (token == "w") {
+            watch.kind = WatchKind::Write;
+        } else if (token == "rw") {
+            watch.kind = WatchKind::Access;
+        } else {
+            watch.size = evalExpression(token);
+        }
+    }
+    return addWatchpoint(watch);
+}
+
 bool Debugger::cmdLog(std::istringstream& args) {
     std::string levelStr;
     args >> levelStr;
@@ -708,6 +1940,377 @@ bool Debugger::cmdLog(std::istringstream& args) {
     return true;
 }
 
+bool Debugger::cmdTrace(std::istringstream& args) {
+    std::string action;
+    std::string value;
+    args >> action >> value;
+    TraceOptions options = mTraceOptions;
+    TraceFilter& filter = options.filter;
+
+    if (action.empty() || action == "show") {
+        auto ranges = [](const std::vector<TraceRange>& list) {
+            if (list.empty()) {
+                return std::string("any");
+            }
+            return formatTraceRanges(list);
+        };
+        INFO("Trace: inst=%s mem=%s branch=%s", options.logInstruction ? "on" : "off",
+            options.logMemEvents ? "on" : "off", options.logBranchPrediction ? "on" : "off");
+        INFO("  pc=%s data=%s", ranges(filter.pcRanges).c_str(),
+            ranges(filter.dataRanges).c_str());
+        INFO("  cycles=%s after=%llu sample=1/%llu",
+            ranges({{filter.cycleBegin, filter.cycleEnd}}).c_str(),
+            (unsigned long long)filter.skipInstructions,
+            (unsigned long long)filter.sampleEvery);
+        return true;
+    }
+
+    bool valid = true;
+    if (action == "inst" || action == "mem" || action == "branch") {
+        bool flag = false;
+        valid = parseBool(value, &flag);
+        bool& target = action == "inst" ? options.logInstruction :
+            action == "mem" ? options.logMemEvents : options.logBranchPrediction;
+        target = flag;
+    } else if (action == "pc" || action == "data") {
+        valid = parseTraceRanges(value, action == "pc" ? &filter.pcRanges : &filter.dataRanges);
+    } else if (action == "cycles") {
+        std::vector<TraceRange> window;
+        valid = parseTraceRanges(value, &window) && window.size() == 1;
+        if (valid) {
+            filter.cycleBegin = window[0].begin;
+            filter.cycleEnd = window[0].end;
+        }
+    } else if (action == "after") {
+        valid = parseU64(value, &filter.skipInstructions);
+    } else if (action == "sample") {
+        valid = parseU64(value, &filter.sampleEvery) && filter.sampleEvery > 0;
+    } else if (action == "clear") {
+        filter = TraceFilter{};
+    } else {
+        valid = false;
+    }
+    if (!valid) {
+        return false;
+    }
+
+    std::string error;
+    if (!updateTrace(options, &error)) {
+        INFO("%s", error.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool Debugger::cmdBatch(std::istringstream& args) {
+    (void)args;
+    BatchStats stats = getBatchStats();
+    INFO("Batches: %llu current=%u min=%u max=%u grows=%llu shrinks=%llu event-limited=%llu",
+        (unsigned long long)stats.batches, stats.current, stats.smallest, stats.largest,
+        (unsigned long long)stats.grows, (unsigned long long)stats.shrinks,
+        (unsigned long long)stats.eventLimited);
+    return true;
+}
+
+bool Debugger::cmdPace(std::istringstream& args) {
+    std::string mode;
+    args >> mode;
+    if (mode == "realtime") {
+        setPacing(PacingMode::Realtime);
+    } else if (mode == "max") {
+        setPacing(PacingMode::MaxSpeed);
+    } else if (!mode.empty()) {
+        return false;
+    }
+    PacingStats stats = getPacingStats();
+    INFO("Pacing: %s drift=%lldus max-drift=%lluus waits=%llu slips=%llu slipped=%llums",
+        getPacing() == PacingMode::Realtime ? "realtime" : "max",
+        (long long)(stats.driftNs / 1000), (unsigned long long)(stats.maxDriftNs / 1000),
+        (unsigned long long)stats.waits, (unsigned long long)stats.slips,
+        (unsigned long long)(stats.slippedNs / 1000000));
+    return true;
+}
+
+bool Debugger::cmdPerf(std::istringstream& args) {
+    std::string action;
+    args >> action;
+    if (action == "reset") {
+        resetPerfCounters();
+        INFO("Performance counters reset.");
+        return true;
+    }
+    if (action == "json") {
+        INFO("%s", formatPerfJson(getPerfReport()).c_str());
+        return true;
+    }
+    if (!action.empty()) {
+        return false;
+    }
+    for (const std::string& line : formatPerfSummary(getPerfReport())) {
+        INFO("%s", line.c_str());
+    }
+    return true;
+}
+
+bool Debugger::cmdProfile(std::istringstream& args) {
+    std::string action;
+    args >> action;
+    if (action == "start") {
+        uint64_t period = PcProfiler::kDefaultPeriod;
+        std::string periodStr;
+        if (args >> periodStr) {
+            period = evalExpression(periodStr);
+        }
+        mProfiler.start(period);
+        INFO("Profiling every %llu cycles.", (unsigned long long)mProfiler.getPeriod());
+        return true;
+    }
+    if (action == "stop") {
+        mProfiler.stop();
+        INFO("Profiling stopped with %llu samples.",
+            (unsigned long long)mProfiler.getSampleCount());
+        return true;
+    }
+    if (action == "clear") {
+        mProfiler.clear();
+        return true;
+    }
+    std::string error;
+    if (action == "export" || action == "symbols") {
+        std::string path;
+        args >> path;
+        if (path.empty()) {
+            return false;
+        }
+        bool ok = action == "export" ? mProfiler.exportFolded(path, mSymbols, &error) :
+            loadSymbols(path, &error);
+        if (!ok) {
+            INFO("%s", error.c_str());
+        } else if (action == "symbols") {
+            INFO("Loaded %zu symbols.", mSymbols.size());
+        }
+        return ok;
+    }
+    if (action != "report" && !action.empty()) {
+        return false;
+    }
+    size_t limit = 20;
+    std::string limitStr;
+    if (args >> limitStr) {
+        limit = static_cast<size_t>(evalExpression(limitStr));
+    }
+    uint64_t total = mProfiler.getSampleCount();
+    INFO("Profile: %llu samples, one every %llu cycles (%s)", (unsigned long long)total,
+        (unsigned long long)mProfiler.getPeriod(), mProfiler.isRunning() ? "running" : "stopped");
+    for (const ProfileHotspot& spot : mProfiler.hotspots(mSymbols, limit)) {
+        INFO("  %6.2f%% %10llu  %s", total > 0 ? 100.0 * spot.samples / total : 0.0,
+            (unsigned long long)spot.samples, spot.name.c_str());
+    }
+    return true;
+}
+
+bool Debugger::cmdHeat(std::istringstream& args) {
+    if (mBus == nullptr) {
+        return false;
+    }
+    std::string action;
+    args >> action;
+    if (action == "on" || action == "off") {
+        setHeatmapEnabled(action == "on");
+        INFO("Heatmap %s.", action == "on" ? "enabled" : "disabled");
+        return true;
+    }
+    if (action == "clear") {
+        mBus->clearHeatmap();
+        return true;
+    }
+    if (action == "export") {
+        std::string path;
+        std::string error;
+        args >> path;
+        if (path.empty()) {
+            return false;
+        }
+        if (!exportHeatmap(path, &error)) {
+            INFO("%s", error.c_str());
+            return false;
+        }
+        return true;
+    }
+    if (action != "report" && !action.empty()) {
+        return false;
+    }
+    size_t limit = 16;
+    std::string limitStr;
+    if (args >> limitStr) {
+        limit = static_cast<size_t>(evalExpression(limitStr));
+    }
+
+    struct HotCell {
+        const MappingHeat* mapping;
+        HeatCell cell;
+    };
+    std::vector<MappingHeat> heatmap = mBus->getHeatmap();
+    std::vector<HotCell> hottest;
+    INFO("Heatmap (%s):", mBus->isHeatmapEnabled() ? "on" : "off");
+    for (const MappingHeat& mapping : heatmap) {
+        if (mapping.totals.total() == 0) {
+            continue;
+        }
+        INFO("  %-12s reads=%llu writes=%llu fetches=%llu", mapping.name.c_str(),
+            (unsigned long long)mapping.totals.reads, (unsigned long long)mapping.totals.writes,
+            (unsigned long long)mapping.totals.fetches);
+        for (const HeatCell& cell : mapping.cells) {
+            hottest.push_back({&mapping, cell});
+        }
+    }
+    std::sort(hottest.begin(), hottest.end(), [](const HotCell& a, const HotCell& b) {
+        return a.cell.total() != b.cell.total() ? a.cell.total() > b.cell.total() :
+            a.cell.address < b.cell.address;
+    });
+    if (hottest.size() > limit) {
+        hottest.resize(limit);
+    }
+    // Bars are scaled to the hottest cell.
+    constexpr int kBarWidth = 24;
+    uint64_t peak = hottest.empty() ? 0 : hottest.front().cell.total();
+    for (const HotCell& hot : hottest) {
+        int width = static_cast<int>((hot.cell.total() * kBarWidth + peak - 1) / peak);
+        INFO("  0x%08llx %-12s +%-6llu r=%-8llu w=%-8llu x=%-8llu %s",
+            (unsigned long long)hot.cell.address, hot.mapping->name.c_str(),
+            (unsigned long long)(1ull << hot.mapping->granuleShift),
+            (unsigned long long)hot.cell.reads, (unsigned long long)hot.cell.writes,
+            (unsigned long long)hot.cell.fetches, std::string(width, '#').c_str());
+    }
+    return true;
+}
+
+bool Debugger::cmdHart(std::istringstream& args) {
+    std::string action;
+    std::string idStr;
+    args >> action;
+
+    if (action == "list" || action.empty()) {
+        uint32_t selected = mSelectedHart.load(std::memory_order_acquire);
+        for (uint32_t i = 0; i < mHarts.size(); ++i) {
+            HartStatus status = getHartStatus(i);
+            const char* state = status.halted ? "halted" : status.paused ? "paused" : "ready";
+            INFO("%c hart %u: %s pc=0x%llx cycles=%llu instrs=%llu",
+                i == selected ? '*' : ' ', i, state, (unsigned long long)status.pc,
+                (unsigned long long)status.cycle, (unsigned long long)status.instructions);
+        }
+        return true;
+    }
+
+    if (action == "pause" || action == "run") {
+        args >> idStr;
+        if (idStr.empty()) {
+            return false;
+        }
+        uint32_t id = static_cast<uint32_t>(evalExpression(idStr));
+        bool ok = action == "pause" ? pauseHart(id) : resumeHart(id);
+        if (!ok) {
+            INFO("No hart %u.", id);
+        }
+        return ok;
+    }
+
+    uint32_t id = static_cast<uint32_t>(evalExpression(action));
+    if (!selectHart(id)) {
+        INFO("No hart %u.", id);
+        return false;
+    }
+    INFO("Selected hart %u.", id);
+    return true;
+}
+
+bool Debugger::cmdSnap(std::istringstream& args) {
+    std::string action;
+    std::string name;
+    args >> action >> name;
+
+    if (action == "list" || action.empty()) {
+        if (mSnapshots.empty()) {
+            INFO("No snapshots.");
+        }
+        for (const auto& entry : mSnapshots) {
+            INFO("  %s", entry.first.c_str());
+        }
+        return true;
+    }
+    if (name.empty()) {
+        return false;
+    }
+
+    std::string error;
+    if (action == "save") {
+        MachineSnapshot snapshot;
+        if (!takeSnapshot(&snapshot, &error)) {
+            INFO("Snapshot failed: %s", error.c_str());
+            return false;
+        }
+        mSnapshots[name] = std::move(snapshot);
+        return true;
+    }
+    auto it = mSnapshots.find(name);
+    if (it == mSnapshots.end()) {
+        INFO("No snapshot named %s.", name.c_str());
+        return false;
+    }
+    if (action == "load") {
+        if (!restoreSnapshot(it->second, &error)) {
+            INFO("Restore failed: %s", error.c_str());
+            return false;
+        }
+        return true;
+    }
+    if (action == "del") {
+        mSnapshots.erase(it);
+        return true;
+    }
+    return false;
+}
+
+bool Debugger::cmdUntil(std::istringstream& args) {
+    RunUntilUnit unit = RunUntilUnit::Instructions;
+    std::string arg;
+    args >> arg;
+    if (arg == "cycle") {
+        unit = RunUntilUnit::Cycles;
+        arg.clear();
+        args >> arg;
+    }
+    if (arg.empty()) {
+        INFO("Usage: until [cycle] <n> [snapshot]");
+        return false;
+    }
+    uint64_t target = evalExpression(arg);
+    std::string name;
+    args >> name;
+
+    std::string error;
+    auto start = std::chrono::steady_clock::now();
+    if (!runUntil(target, unit, &error)) {
+        INFO("until failed: %s", error.c_str());
+        return false;
+    }
+    double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    HartStatus status = getHartStatus(0);
+    INFO("At instruction %llu, cycle %llu, PC 0x%llx (%.3f s)",
+        (unsigned long long)status.instructions, (unsigned long long)status.cycle,
+        (unsigned long long)status.pc, seconds);
+    if (!name.empty()) {
+        MachineSnapshot snapshot;
+        if (!takeSnapshot(&snapshot, &error)) {
+            INFO("Snapshot failed: %s", error.c_str());
+            return false;
+        }
+        mSnapshots[name] = std::move(snapshot);
+    }
+    return true;
+}
+
 bool Debugger::cmdHelp(std::istringstream& args) {
     (void)args;
     INFO("Available commands:");
@@ -726,8 +2329,15 @@ bool Debugger::cmdHelp(std::istringstream& args) {
     return true;
 }
 
+void Debugger::refreshStatusDisplay() {
+    if (std::chrono::steady_clock::now() - mLastStatusTime >= kStatusRefreshInterval) {
+        updateStatusDisplay();
+    }
+}
+
 void Debugger::updateStatusDisplay() {
     if (!mTerminal) return;
+    mLastStatusTime = std::chrono::steady_clock::now();
 
     std::string stateStr;
     CpuState s = mState.state.load(std::memory_order_acquire);
@@ -737,9 +2347,12 @@ void Debugger::updateStatusDisplay() {
         case CpuState::Halted:  stateStr = "HALTED "; break;
     }
 
-    uint64_t cycles = mCpu ? mCpu->getCycle() : 0;
-    uint64_t instrs = mTotalInstructions;
-    uint64_t pc = mCpu ? mCpu->getPc() : 0;
+    uint32_t selected = std::min<uint32_t>(mSelectedHart.load(std::memory_order_acquire),
+        static_cast<uint32_t>(mHarts.size() - 1));
+    HartSnapshot hart = mHarts[selected]->snapshot.load();
+    uint64_t cycles = hart.cycle;
+    uint64_t instrs = hart.instructions;
+    uint64_t pc = hart.pc;
 
     char buffer[256];
 
@@ -769,8 +2382,15 @@ void Debugger::updateStatusDisplay() {
 
     const char* cmdStatus = mLastCommandSuccess ? "OK" : "ERR";
 
-    snprintf(buffer, sizeof(buffer), "CPU: %s | PC: 0x%llx | Cycles: %llu | Instrs: %llu | IPC: %.2f | CPS: %s | CMD: %s",
+    char hartBuf[32] = "";
+    if (mHarts.size() > 1) {
+        snprintf(hartBuf, sizeof(hartBuf), " | Hart: %u/%u", selected,
+                 static_cast<uint32_t>(mHarts.size()));
+    }
+
+    snprintf(buffer, sizeof(buffer), "CPU: %s%s | PC: 0x%llx | Cycles: %llu | Instrs: %llu | IPC: %.2f | CPS: %s | CMD: %s",
              stateStr.c_str(),
+             hartBuf,
              (unsigned long long)pc,
              (unsigned long long)cycles,
              (unsigned long long)instrs,
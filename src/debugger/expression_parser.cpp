@@ -7,20 +7,160 @@
 #include <algorithm>
 #include <string>
 
-ExpressionParser::ExpressionParser(ICpuExecutor* cpu, MemoryBus* bus, const std::string& expr) 
+namespace {
+    // Recursion limit for parentheses, brackets and unary operators.
+    constexpr uint32_t kMaxNesting = 64;
+
+    // RAM and ROM only: device registers read as 0 so that evaluating an
+    // expression never pops a FIFO or acknowledges an interrupt.
+    uint64_t readWord(MemoryBus* bus, uint64_t address, DirectMemoryRange* direct) {
+        if (bus == nullptr) return 0;
+        if (direct->contains(address, 4) ||
+            (bus->getDirectMemory(address, direct) && direct->contains(address, 4))) {
+            return direct->load(address, 4);
+        }
+        uint8_t bytes[4] = {};
+        if (!bus->peekDirect(address, bytes, sizeof(bytes))) return 0;
+        return static_cast<uint64_t>(bytes[0]) | (static_cast<uint64_t>(bytes[1]) << 8) |
+            (static_cast<uint64_t>(bytes[2]) << 16) | (static_cast<uint64_t>(bytes[3]) << 24);
+    }
+}
+
+uint64_t CompiledExpression::evaluate(ICpuExecutor* cpu, MemoryBus* bus) const {
+    uint64_t stack[kMaxStack];
+    uint32_t top = 0;
+    DirectMemoryRange direct;
+    for (size_t pc = 0; pc < mCode.size(); ++pc) {
+        const Insn& insn = mCode[pc];
+        switch (insn.op) {
+            case Op::Const:
+                stack[top++] = insn.operand;
+                break;
+            case Op::Pc:
+                stack[top++] = cpu != nullptr ? cpu->getPc() : 0;
+                break;
+            case Op::Register: {
+                uint32_t id = static_cast<uint32_t>(insn.operand);
+                stack[top++] = cpu != nullptr && id < cpu->getRegisterCount() ?
+                    cpu->getRegister(id) : 0;
+                break;
+            }
+            case Op::Load:
+                stack[top - 1] = readWord(bus, stack[top - 1], &direct);
+                break;
+            case Op::Negate:
+                stack[top - 1] = -stack[top - 1];
+                break;
+            case Op::Not:
+                stack[top - 1] = stack[top - 1] == 0;
+                break;
+            case Op::Bool:
+                stack[top - 1] = stack[top - 1] != 0;
+                break;
+            case Op::JumpIfZero:
+            case Op::JumpIfNonZero:
+                // A deciding left operand stays on the stack for the Bool at
+                // the target; otherwise the right operand replaces it.
+                if ((stack[top - 1] == 0) == (insn.op == Op::JumpIfZero)) {
+                    pc = insn.operand - 1;
+                } else {
+                    --top;
+                }
+                break;
+            default: {
+                uint64_t rhs = stack[--top];
+                uint64_t& lhs = stack[top - 1];
+                switch (insn.op) {
+                    case Op::Add: lhs += rhs; break;
+                    case Op::Sub: lhs -= rhs; break;
+                    case Op::Mul: lhs *= rhs; break;
+                    case Op::Div: if (rhs != 0) lhs /= rhs; break;
+                    case Op::Eq: lhs = lhs == rhs; break;
+                    case Op::Ne: lhs = lhs != rhs; break;
+                    case Op::Lt: lhs = lhs < rhs; break;
+                    case Op::Le: lhs = lhs <= rhs; break;
+                    case Op::Gt: lhs = lhs > rhs; break;
+                    case Op::Ge: lhs = lhs >= rhs; break;
+                    default: break;
+                }
+                break;
+            }
+        }
+    }
+    return top > 0 ? stack[top - 1] : 0;
+}
+
+ExpressionParser::ExpressionParser(ICpuExecutor* cpu, MemoryBus* bus, const std::string& expr)
     : mCpu(cpu), mBus(bus), mExpr(expr), mPos(0) {
     nextToken();
 }
 
 uint64_t ExpressionParser::parse() {
-    return parseExpr();
+    CompiledExpression compiled;
+    if (!compileInto(&compiled, nullptr)) return 0;
+    return compiled.evaluate(mCpu, mBus);
+}
+
+bool ExpressionParser::compile(const std::string& expr, CompiledExpression* out,
+    std::string* error) {
+    ExpressionParser parser(nullptr, nullptr, expr);
+    return parser.compileInto(out, error);
+}
+
+bool ExpressionParser::compileInto(CompiledExpression* out, std::string* error) {
+    std::vector<CompiledExpression::Insn> code;
+    mCode = &code;
+    mError.clear();
+    if (mCurr.type == TokenType::End) {
+        fail("Empty expression");
+    } else {
+        parseOr();
+        if (mCurr.type != TokenType::End) {
+            fail("Unexpected input at position " + std::to_string(mPos));
+        }
+    }
+    mCode = nullptr;
+    if (!mError.empty()) {
+        if (error != nullptr) *error = mError;
+        return false;
+    }
+    out->mCode = std::move(code);
+    out->mText = mExpr;
+    return true;
+}
+
+void ExpressionParser::emit(Op op, uint64_t operand) {
+    switch (op) {
+        case Op::Const: case Op::Pc: case Op::Register:
+            ++mDepth;
+            break;
+        case Op::Load: case Op::Negate: case Op::Not: case Op::Bool:
+            break;
+        default:
+            // Binary operators and the fall-through side of a jump pop one.
+            --mDepth;
+            break;
+    }
+    mMaxDepth = std::max(mMaxDepth, mDepth);
+    if (mMaxDepth > CompiledExpression::kMaxStack) {
+        fail("Expression is too complex");
+    }
+    mCode->push_back({op, operand});
+}
+
+void ExpressionParser::fail(const std::string& message) {
+    if (mError.empty()) {
+        mError = message;
+    }
+    mCurr.type = TokenType::End;
+    mPos = mExpr.size();
 }
 
 void ExpressionParser::nextToken() {
     while (mPos < mExpr.size() && std::isspace(static_cast<unsigned char>(mExpr[mPos]))) {
         mPos++;
     }
-    
+
     if (mPos >= mExpr.size()) {
         mCurr.type = TokenType::End;
         return;
@@ -28,21 +168,17 @@ void ExpressionParser::nextToken() {
 
     char c = mExpr[mPos];
     if (std::isdigit(static_cast<unsigned char>(c))) {
-        size_t nextPos = mPos;
+        size_t nextPos = 0;
         uint64_t val = 0;
-        if (mPos + 2 <= mExpr.size() && mExpr[mPos] == '0' && (mExpr[mPos+1] == 'x' || mExpr[mPos+1] == 'X')) {
-            std::string sub = mExpr.substr(mPos);
-            try {
-                val = std::stoull(sub, &nextPos, 16);
-            } catch (...) { val = 0; }
-            mPos += nextPos;
-        } else {
-            std::string sub = mExpr.substr(mPos);
-            try {
-                val = std::stoull(sub, &nextPos, 10);
-            } catch (...) { val = 0; }
-            mPos += nextPos;
+        bool hex = mPos + 2 <= mExpr.size() && mExpr[mPos] == '0' &&
+            (mExpr[mPos+1] == 'x' || mExpr[mPos+1] == 'X');
+        try {
+            val = std::stoull(mExpr.substr(mPos), &nextPos, hex ? 16 : 10);
+        } catch (...) {
+            mCurr.type = TokenType::Error;
+            return;
         }
+        mPos += nextPos;
         mCurr.type = TokenType::Number;
         mCurr.value = val;
     } else if (c == '$') {
@@ -55,6 +191,14 @@ void ExpressionParser::nextToken() {
         mCurr.text = mExpr.substr(start, mPos - start);
     } else {
         mPos++;
+        char next = mPos < mExpr.size() ? mExpr[mPos] : '\0';
+        auto pair = [&](char second, TokenType matched, TokenType single) {
+            if (next == second) {
+                mPos++;
+                return matched;
+            }
+            return single;
+        };
         switch (c) {
             case '+': mCurr.type = TokenType::Plus; break;
             case '-': mCurr.type = TokenType::Minus; break;
@@ -64,97 +208,154 @@ void ExpressionParser::nextToken() {
             case ')': mCurr.type = TokenType::RParen; break;
             case '[': mCurr.type = TokenType::LBracket; break;
             case ']': mCurr.type = TokenType::RBracket; break;
+            case '!': mCurr.type = pair('=', TokenType::Ne, TokenType::Not); break;
+            case '=': mCurr.type = pair('=', TokenType::Eq, TokenType::Error); break;
+            case '<': mCurr.type = pair('=', TokenType::Le, TokenType::Lt); break;
+            case '>': mCurr.type = pair('=', TokenType::Ge, TokenType::Gt); break;
+            case '&': mCurr.type = pair('&', TokenType::AndAnd, TokenType::Error); break;
+            case '|': mCurr.type = pair('|', TokenType::OrOr, TokenType::Error); break;
             default: mCurr.type = TokenType::Error; break;
         }
     }
 }
 
-uint64_t ExpressionParser::parseExpr() {
-    uint64_t val = parseTerm();
-    while (mCurr.type == TokenType::Plus || mCurr.type == TokenType::Minus) {
-        TokenType op = mCurr.type;
+void ExpressionParser::parseOr() {
+    parseAnd();
+    while (mCurr.type == TokenType::OrOr) {
         nextToken();
-        uint64_t rhs = parseTerm();
-        if (op == TokenType::Plus) val += rhs;
-        else val -= rhs;
+        size_t jump = mCode->size();
+        emit(Op::JumpIfNonZero);
+        parseAnd();
+        (*mCode)[jump].operand = mCode->size();
+        emit(Op::Bool);
     }
-    return val;
 }
 
-uint64_t ExpressionParser::parseTerm() {
-    uint64_t val = parseFactor();
-    while (mCurr.type == TokenType::Multiply || mCurr.type == TokenType::Divide) {
-        TokenType op = mCurr.type;
+void ExpressionParser::parseAnd() {
+    parseCompare();
+    while (mCurr.type == TokenType::AndAnd) {
         nextToken();
-        uint64_t rhs = parseFactor();
-        if (op == TokenType::Multiply) val *= rhs;
-        else if (rhs != 0) val /= rhs;
+        size_t jump = mCode->size();
+        emit(Op::JumpIfZero);
+        parseCompare();
+        (*mCode)[jump].operand = mCode->size();
+        emit(Op::Bool);
     }
-    return val;
 }
 
-uint64_t ExpressionParser::parseFactor() {
-    if (mCurr.type == TokenType::Number) {
-        uint64_t val = mCurr.value;
-        nextToken();
-        return val;
-    }
-    if (mCurr.type == TokenType::Register) {
-        uint64_t val = getRegisterValue(mCurr.text);
-        nextToken();
-        return val;
-    }
-    if (mCurr.type == TokenType::LParen) {
-        nextToken();
-        uint64_t val = parseExpr();
-        if (mCurr.type == TokenType::RParen) nextToken();
-        return val;
-    }
-    if (mCurr.type == TokenType::LBracket) {
+void ExpressionParser::parseCompare() {
+    parseExpr();
+    for (;;) {
+        Op op;
+        switch (mCurr.type) {
+            case TokenType::Eq: op = Op::Eq; break;
+            case TokenType::Ne: op = Op::Ne; break;
+            case TokenType::Lt: op = Op::Lt; break;
+            case TokenType::Le: op = Op::Le; break;
+            case TokenType::Gt: op = Op::Gt; break;
+            case TokenType::Ge: op = Op::Ge; break;
+            default: return;
+        }
         nextToken();
-        uint64_t addr = parseExpr();
-        if (mCurr.type == TokenType::RBracket) nextToken();
-        return readMemory(addr);
+        parseExpr();
+        emit(op);
     }
-    if (mCurr.type == TokenType::Minus) {
+}
+
+void ExpressionParser::parseExpr() {
+    parseTerm();
+    while (mCurr.type == TokenType::Plus || mCurr.type == TokenType::Minus) {
+        Op op = mCurr.type == TokenType::Plus ? Op::Add : Op::Sub;
         nextToken();
-        return -parseFactor();
+        parseTerm();
+        emit(op);
     }
-    if (mCurr.type == TokenType::Plus) {
+}
+
+void ExpressionParser::parseTerm() {
+    parseFactor();
+    while (mCurr.type == TokenType::Multiply || mCurr.type == TokenType::Divide) {
+        Op op = mCurr.type == TokenType::Multiply ? Op::Mul : Op::Div;
         nextToken();
-        return parseFactor();
+        parseFactor();
+        emit(op);
     }
-    return 0;
 }
 
-uint64_t ExpressionParser::readMemory(uint64_t addr) {
-    if (!mBus) return 0;
-    MemAccess access;
-    access.address = addr;
-    access.size = 4;
-    access.type = MemAccessType::Read;
-    auto resp = mBus->read(access); 
-    if (resp.success) return resp.data;
-    return 0;
+void ExpressionParser::parseFactor() {
+    if (++mNesting > kMaxNesting) {
+        fail("Expression is too deeply nested");
+    }
+    switch (mCurr.type) {
+        case TokenType::Number:
+            emit(Op::Const, mCurr.value);
+            nextToken();
+            break;
+        case TokenType::Register: {
+            Op op = Op::Pc;
+            uint64_t id = 0;
+            if (!resolveRegister(mCurr.text, &op, &id)) {
+                fail("Unknown register: $" + mCurr.text);
+                break;
+            }
+            emit(op, id);
+            nextToken();
+            break;
+        }
+        case TokenType::LParen:
+        case TokenType::LBracket: {
+            TokenType close = mCurr.type == TokenType::LParen ? TokenType::RParen :
+                TokenType::RBracket;
+            nextToken();
+            parseOr();
+            if (mCurr.type != close) {
+                fail(close == TokenType::RParen ? "Missing ')'" : "Missing ']'");
+                break;
+            }
+            nextToken();
+            if (close == TokenType::RBracket) {
+                emit(Op::Load);
+            }
+            break;
+        }
+        case TokenType::Minus:
+        case TokenType::Not: {
+            Op op = mCurr.type == TokenType::Minus ? Op::Negate : Op::Not;
+            nextToken();
+            parseFactor();
+            emit(op);
+            break;
+        }
+        case TokenType::Plus:
+            nextToken();
+            parseFactor();
+            break;
+        case TokenType::End:
+            fail("Unexpected end of expression");
+            break;
+        default:
+            fail("Unexpected input at position " + std::to_string(mPos));
+            break;
+    }
+    --mNesting;
 }
 
-uint64_t ExpressionParser::getRegisterValue(const std::string& name) {
-    if (!mCpu) return 0;
-    
+bool ExpressionParser::resolveRegister(const std::string& name, Op* op, uint64_t* id) {
     if (name == "pc" || name == "PC") {
-        return mCpu->getPc();
+        *op = Op::Pc;
+        return true;
     }
 
     std::string numPart = name;
     if (numPart.size() > 1 && (numPart[0] == 'r' || numPart[0] == 'R')) {
         numPart = numPart.substr(1);
     }
-    
-    try {
-        size_t idx = 0;
-        uint32_t regId = std::stoul(numPart, &idx);
-        return mCpu->getRegister(regId);
-    } catch (...) {
-        return 0;
+    if (numPart.empty() || numPart.size() > 9 ||
+        !std::all_of(numPart.begin(), numPart.end(),
+            [](char c) { return std::isdigit(static_cast<unsigned char>(c)) != 0; })) {
+        return false;
     }
+    *op = Op::Register;
+    *id = std::stoul(numPart);
+    return true;
 }
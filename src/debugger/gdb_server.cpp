@@ -0,0 +1,589 @@
+#include "emulator/debugger/gdb_server.h"
+
+#include "emulator/debugger/debugger.h"
+#include "emulator/logging/logger.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+    constexpr int kIdlePollMs = 10;
+    // Polled faster while a step or continue is in flight, so single steps
+    // are answered promptly.
+    constexpr int kWaitPollMs = 1;
+    constexpr char kInterrupt = 0x03;
+
+    // GDB signal numbers used in stop replies.
+    constexpr int kSigIll = 4;
+    constexpr int kSigTrap = 5;
+    constexpr int kSigBus = 7;
+    constexpr int kSigSegv = 11;
+
+    const char kHexDigits[] = "0123456789abcdef";
+
+    int hexValue(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+    bool parseHexU64(const std::string& text, uint64_t* value) {
+        if (text.empty() || text.size() > 16) {
+            return false;
+        }
+        uint64_t result = 0;
+        for (char c : text) {
+            int digit = hexValue(c);
+            if (digit < 0) {
+                return false;
+            }
+            result = (result << 4) | static_cast<uint64_t>(digit);
+        }
+        *value = result;
+        return true;
+    }
+
+    std::string hexEncode(const uint8_t* data, size_t length) {
+        std::string text;
+        text.reserve(length * 2);
+        for (size_t i = 0; i < length; ++i) {
+            text.push_back(kHexDigits[data[i] >> 4]);
+            text.push_back(kHexDigits[data[i] & 0xf]);
+        }
+        return text;
+    }
+
+    bool hexDecode(const std::string& text, std::vector<uint8_t>* out) {
+        if (text.size() % 2 != 0) {
+            return false;
+        }
+        out->clear();
+        for (size_t i = 0; i < text.size(); i += 2) {
+            int high = hexValue(text[i]);
+            int low = hexValue(text[i + 1]);
+            if (high < 0 || low < 0) {
+                return false;
+            }
+            out->push_back(static_cast<uint8_t>((high << 4) | low));
+        }
+        return true;
+    }
+
+    std::string hexU64(uint64_t value) {
+        char buffer[24];
+        std::snprintf(buffer, sizeof(buffer), "%llx", (unsigned long long)value);
+        return buffer;
+    }
+
+    // Register values go over the wire in target (little-endian) byte order.
+    std::string encodeRegister(uint64_t value, uint32_t bytes) {
+        uint8_t raw[8] = {};
+        for (uint32_t i = 0; i < bytes && i < sizeof(raw); ++i) {
+            raw[i] = static_cast<uint8_t>(value >> (8 * i));
+        }
+        return hexEncode(raw, bytes);
+    }
+
+    bool decodeRegister(const std::string& text, uint64_t* value) {
+        std::vector<uint8_t> raw;
+        if (!hexDecode(text, &raw) || raw.empty() || raw.size() > 8) {
+            return false;
+        }
+        uint64_t result = 0;
+        for (size_t i = 0; i < raw.size(); ++i) {
+            result |= static_cast<uint64_t>(raw[i]) << (8 * i);
+        }
+        *value = result;
+        return true;
+    }
+
+    // "addr,len" as sent by m, M, X and Z packets.
+    bool parseAddressLength(const std::string& text, uint64_t* address, uint64_t* length) {
+        size_t comma = text.find(',');
+        return comma != std::string::npos && parseHexU64(text.substr(0, comma), address) &&
+            parseHexU64(text.substr(comma + 1), length);
+    }
+
+    uint8_t checksum(const std::string& data) {
+        uint8_t sum = 0;
+        for (char c : data) {
+            sum = static_cast<uint8_t>(sum + static_cast<uint8_t>(c));
+        }
+        return sum;
+    }
+}
+
+GdbServer::GdbServer(Debugger* debugger) : mDbg(debugger) {}
+
+GdbServer::~GdbServer() {
+    stop();
+}
+
+bool GdbServer::start(uint16_t port, bool anyAddress, std::string* error) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        if (error != nullptr) *error = std::string("socket failed: ") + std::strerror(errno);
+        return false;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(anyAddress ? INADDR_ANY : INADDR_LOOPBACK);
+    if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(fd, 1) != 0) {
+        if (error != nullptr) {
+            *error = "Cannot listen on port " + std::to_string(port) + ": " +
+                std::strerror(errno);
+        }
+        close(fd);
+        return false;
+    }
+    socklen_t length = sizeof(address);
+    getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    mListenFd = fd;
+    mPort = ntohs(address.sin_port);
+    mStop.store(false, std::memory_order_release);
+    mThread = logging::startThread([this]() { serverLoop(); });
+    return true;
+}
+
+void GdbServer::stop() {
+    mStop.store(true, std::memory_order_release);
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+    if (mClientFd >= 0 && mWaiting) {
+        sendPacket(stopReply());
+        mWaiting = false;
+    }
+    closeClient();
+    if (mListenFd >= 0) {
+        close(mListenFd);
+        mListenFd = -1;
+    }
+}
+
+void GdbServer::serverLoop() {
+    while (!mStop.load(std::memory_order_acquire)) {
+        if (mClientFd >= 0) {
+            serveClient();
+            continue;
+        }
+        pollfd pfd{mListenFd, POLLIN, 0};
+        if (poll(&pfd, 1, kIdlePollMs) <= 0) {
+            continue;
+        }
+        int fd = accept(mListenFd, nullptr, nullptr);
+        if (fd < 0) {
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        mClientFd = fd;
+        mNoAck = false;
+        mWaiting = false;
+        mInput.clear();
+        INFO("GDB client connected");
+    }
+}
+
+void GdbServer::serveClient() {
+    pollfd pfd{mClientFd, POLLIN, 0};
+    int ready = poll(&pfd, 1, mWaiting ? kWaitPollMs : kIdlePollMs);
+    if (ready > 0) {
+        char buffer[4096];
+        ssize_t count = read(mClientFd, buffer, sizeof(buffer));
+        if (count == 0 || (count < 0 && errno != EAGAIN && errno != EINTR)) {
+            INFO("GDB client disconnected");
+            closeClient();
+            return;
+        }
+        if (count > 0) {
+            mInput.append(buffer, static_cast<size_t>(count));
+        }
+    }
+
+    while (!mInput.empty() && mClientFd >= 0) {
+        char lead = mInput[0];
+        if (lead == kInterrupt) {
+            mInput.erase(0, 1);
+            mDbg->pause();
+            continue;
+        }
+        if (lead != '$') {
+            // Acks, and noise between packets.
+            mInput.erase(0, 1);
+            continue;
+        }
+        size_t hash = mInput.find('#');
+        if (hash == std::string::npos || hash + 2 >= mInput.size()) {
+            break;
+        }
+        std::string raw = mInput.substr(1, hash - 1);
+        uint64_t sum = 0;
+        bool valid = parseHexU64(mInput.substr(hash + 1, 2), &sum) && sum == checksum(raw);
+        mInput.erase(0, hash + 3);
+        if (!mNoAck) {
+            sendRaw(valid ? "+" : "-");
+        }
+        if (!valid) {
+            continue;
+        }
+        std::string payload;
+        payload.reserve(raw.size());
+        for (size_t i = 0; i < raw.size(); ++i) {
+            if (raw[i] == '}' && i + 1 < raw.size()) {
+                payload.push_back(static_cast<char>(raw[++i] ^ 0x20));
+            } else {
+                payload.push_back(raw[i]);
+            }
+        }
+
+        if (payload == "k" || payload == "vKill") {
+            mDbg->processCommand("quit");
+            closeClient();
+            return;
+        }
+        std::string reply;
+        if (handlePacket(payload, &reply)) {
+            sendPacket(reply);
+        } else {
+            mWaiting = true;
+        }
+        if (payload[0] == 'D') {
+            closeClient();
+            return;
+        }
+    }
+
+    if (mWaiting && mDbg->isStopped()) {
+        mWaiting = false;
+        sendPacket(stopReply());
+    }
+}
+
+bool GdbServer::handlePacket(const std::string& payload, std::string* reply) {
+    reply->clear();
+    if (payload.empty()) {
+        return true;
+    }
+    std::string args = payload.substr(1);
+    switch (payload[0]) {
+        case '?':
+            *reply = stopReply();
+            return true;
+        case 'g':
+            *reply = readRegisters();
+            return true;
+        case 'G': {
+            uint32_t count = mDbg->getRegisterCount() + 1;
+            size_t width = mRegisterBytes * 2;
+            for (uint32_t reg = 0; reg < count && (reg + 1) * width <= args.size(); ++reg) {
+                uint64_t value = 0;
+                if (!decodeRegister(args.substr(reg * width, width), &value)) {
+                    *reply = "E01";
+                    return true;
+                }
+                mDbg->writeRegister(reg, value);
+            }
+            *reply = "OK";
+            return true;
+        }
+        case 'p': {
+            uint64_t reg = 0;
+            if (!parseHexU64(args, &reg) || reg > mDbg->getRegisterCount()) {
+                *reply = "E01";
+                return true;
+            }
+            *reply = readRegisters().substr(reg * mRegisterBytes * 2, mRegisterBytes * 2);
+            return true;
+        }
+        case 'P': {
+            size_t equals = args.find('=');
+            uint64_t reg = 0;
+            uint64_t value = 0;
+            bool ok = equals != std::string::npos && parseHexU64(args.substr(0, equals), &reg) &&
+                decodeRegister(args.substr(equals + 1), &value) &&
+                mDbg->writeRegister(static_cast<uint32_t>(reg), value);
+            *reply = ok ? "OK" : "E01";
+            return true;
+        }
+        case 'm':
+            if (!readMemory(args, reply)) {
+                *reply = "E14";
+            }
+            return true;
+        case 'M':
+        case 'X': {
+            size_t colon = args.find(':');
+            bool ok = colon != std::string::npos &&
+                writeMemory(args.substr(0, colon), args.substr(colon + 1), payload[0] == 'X');
+            *reply = ok ? "OK" : "E14";
+            return true;
+        }
+        case 'c':
+        case 's': {
+            uint64_t pc = 0;
+            if (!args.empty() && parseHexU64(args, &pc)) {
+                mDbg->writeRegister(mDbg->getRegisterCount(), pc);
+            }
+            if (resume(payload[0] == 's')) {
+                return false;
+            }
+            *reply = stopReply();
+            return true;
+        }
+        case 'Z':
+        case 'z':
+            *reply = setPoint(args, payload[0] == 'Z');
+            return true;
+        case 'H': {
+            if (args.empty()) {
+                *reply = "E01";
+                return true;
+            }
+            long long thread = std::strtoll(args.c_str() + 1, nullptr, 16);
+            bool ok = args[0] != 'g' || thread <= 0 ||
+                mDbg->selectHart(static_cast<uint32_t>(thread - 1));
+            *reply = ok ? "OK" : "E01";
+            return true;
+        }
+        case 'T': {
+            long long thread = std::strtoll(args.c_str(), nullptr, 16);
+            bool alive = thread > 0 && thread <= static_cast<long long>(mDbg->getHartCount()) &&
+                !mDbg->getHartStatus(static_cast<uint32_t>(thread - 1)).halted;
+            *reply = alive ? "OK" : "E01";
+            return true;
+        }
+        case 'D':
+            // Leave the machine running once the client is gone.
+            if (mDbg->getState() != CpuState::Halted) {
+                mDbg->resume(nullptr);
+            }
+            *reply = "OK";
+            return true;
+        default:
+            break;
+    }
+
+    if (payload.rfind("qSupported", 0) == 0) {
+        *reply = "PacketSize=" + hexU64(kMaxPacketSize) + ";QStartNoAckMode+;swbreak+;hwbreak+";
+    } else if (payload == "QStartNoAckMode") {
+        mNoAck = true;
+        *reply = "OK";
+    } else if (payload == "qAttached") {
+        *reply = "1";
+    } else if (payload == "qC") {
+        *reply = "QC" + hexU64(mDbg->getSelectedHart() + 1);
+    } else if (payload == "qfThreadInfo") {
+        *reply = "m";
+        for (uint32_t i = 0; i < mDbg->getHartCount(); ++i) {
+            *reply += (i > 0 ? "," : "") + hexU64(i + 1);
+        }
+    } else if (payload == "qsThreadInfo") {
+        *reply = "l";
+    } else if (payload == "qSymbol::") {
+        *reply = "OK";
+    } else if (payload == "vCont?") {
+        *reply = "vCont;c;C;s;S";
+    } else if (payload.rfind("vCont;", 0) == 0) {
+        // Only the first action matters: one hart steps or all continue.
+        char action = payload.size() > 6 ? payload[6] : 'c';
+        size_t colon = payload.find(':');
+        if (colon != std::string::npos) {
+            long long thread = std::strtoll(payload.c_str() + colon + 1, nullptr, 16);
+            if (thread > 0) {
+                mDbg->selectHart(static_cast<uint32_t>(thread - 1));
+            }
+        }
+        if (resume(action == 's' || action == 'S')) {
+            return false;
+        }
+        *reply = stopReply();
+    }
+    return true;
+}
+
+std::string GdbServer::stopReply() {
+    uint32_t selected = mDbg->getSelectedHart();
+    std::string thread = "thread:" + hexU64(selected + 1) + ";";
+    char buffer[8];
+    if (mDbg->getState() == CpuState::Halted) {
+        CpuErrorType error = mDbg->getHartStatus(selected).error;
+        int signal = 0;
+        switch (error) {
+            case CpuErrorType::InvalidOp: signal = kSigIll; break;
+            case CpuErrorType::AccessFault: signal = kSigSegv; break;
+            case CpuErrorType::DeviceFault: signal = kSigBus; break;
+            default: break;
+        }
+        if (signal == 0) {
+            return "W00";
+        }
+        std::snprintf(buffer, sizeof(buffer), "T%02x", signal);
+        return buffer + thread;
+    }
+    std::snprintf(buffer, sizeof(buffer), "T%02x", kSigTrap);
+    // The client asked for swbreak/hwbreak in qSupported; the PC already sits
+    // on the breakpoint, so it must not adjust it.
+    HartStatus status = mDbg->getHartStatus(selected);
+    if (status.breakpoint) {
+        return buffer + std::string(mHardwareBreakpoints.count(status.pc) != 0 ? "hwbreak:;" :
+            "swbreak:;") + thread;
+    }
+    return buffer + thread;
+}
+
+std::string GdbServer::readRegisters() {
+    std::vector<uint64_t> regs;
+    uint64_t pc = 0;
+    mDbg->runOnMachine([&]() {
+        regs = mDbg->readRegisters();
+        pc = mDbg->getHartStatus(mDbg->getSelectedHart()).pc;
+    });
+    std::string text;
+    for (uint64_t value : regs) {
+        text += encodeRegister(value, mRegisterBytes);
+    }
+    return text + encodeRegister(pc, mRegisterBytes);
+}
+
+bool GdbServer::readMemory(const std::string& args, std::string* reply) {
+    uint64_t address = 0;
+    uint64_t length = 0;
+    if (!parseAddressLength(args, &address, &length)) {
+        return false;
+    }
+    length = std::min<uint64_t>(length, kMaxPacketSize / 2);
+    std::vector<uint8_t> data(length);
+    uint64_t done = 0;
+    if (!mDbg->readMemory(address, data.data(), length, &done) && done == 0 && length > 0) {
+        return false;
+    }
+    *reply = hexEncode(data.data(), done);
+    return true;
+}
+
+bool GdbServer::writeMemory(const std::string& args, const std::string& data, bool binary) {
+    uint64_t address = 0;
+    uint64_t length = 0;
+    if (!parseAddressLength(args, &address, &length)) {
+        return false;
+    }
+    std::vector<uint8_t> bytes;
+    if (binary) {
+        bytes.assign(data.begin(), data.end());
+    } else if (!hexDecode(data, &bytes)) {
+        return false;
+    }
+    if (bytes.size() != length) {
+        return false;
+    }
+    uint64_t done = 0;
+    return length == 0 || mDbg->writeMemory(address, bytes.data(), length, &done);
+}
+
+std::string GdbServer::setPoint(const std::string& args, bool insert) {
+    size_t comma = args.find(',');
+    uint64_t address = 0;
+    uint64_t kind = 0;
+    if (comma == std::string::npos || comma == 0 ||
+        !parseAddressLength(args.substr(comma + 1), &address, &kind)) {
+        return "E01";
+    }
+    char type = args[0];
+    if (type == '0' || type == '1') {
+        if (insert) {
+            mDbg->addBreakpoint(address);
+        } else {
+            mDbg->removeBreakpoint(address);
+        }
+        if (insert && type == '1') {
+            mHardwareBreakpoints.insert(address);
+        } else {
+            mHardwareBreakpoints.erase(address);
+        }
+        return "OK";
+    }
+    if (type < '2' || type > '4') {
+        return "";
+    }
+    if (!insert) {
+        return mDbg->removeWatchpoint(address) ? "OK" : "E01";
+    }
+    Watchpoint watch;
+    watch.address = address;
+    watch.size = std::max<uint64_t>(1, kind);
+    watch.kind = type == '2' ? WatchKind::Write : type == '3' ? WatchKind::Read :
+        WatchKind::Access;
+    return mDbg->addWatchpoint(watch) ? "OK" : "E01";
+}
+
+bool GdbServer::resume(bool stepping) {
+    return stepping ? mDbg->step(1, nullptr) : mDbg->resume(nullptr);
+}
+
+bool GdbServer::sendPacket(const std::string& payload) {
+    std::string escaped;
+    escaped.reserve(payload.size());
+    for (char c : payload) {
+        if (c == '$' || c == '#' || c == '}' || c == '*') {
+            escaped.push_back('}');
+            escaped.push_back(static_cast<char>(c ^ 0x20));
+        } else {
+            escaped.push_back(c);
+        }
+    }
+    char trailer[4];
+    std::snprintf(trailer, sizeof(trailer), "#%02x", checksum(escaped));
+    return sendRaw("$" + escaped + trailer);
+}
+
+bool GdbServer::sendRaw(const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size() && mClientFd >= 0) {
+        // MSG_NOSIGNAL: a client that went away must not SIGPIPE the emulator.
+        ssize_t count = send(mClientFd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (count > 0) {
+            sent += static_cast<size_t>(count);
+            continue;
+        }
+        if (count < 0 && (errno == EAGAIN || errno == EINTR)) {
+            pollfd pfd{mClientFd, POLLOUT, 0};
+            poll(&pfd, 1, kIdlePollMs);
+            continue;
+        }
+        if (count < 0 && (errno == EPIPE || errno == ECONNRESET)) {
+            INFO("GDB client disconnected");
+        }
+        closeClient();
+        return false;
+    }
+    return sent == data.size();
+}
+
+void GdbServer::closeClient() {
+    if (mClientFd >= 0) {
+        close(mClientFd);
+        mClientFd = -1;
+    }
+    mInput.clear();
+    mWaiting = false;
+}
@@ -0,0 +1,147 @@
+#include "emulator/debugger/debugger.h"
+#include "emulator/device/display.h"
+#include "emulator/device/uart.h"
+#include "emulator/logging/logger.h"
+
+#include <algorithm>
+
+void Debugger::injectUartInput(const uint8_t* data, size_t length) {
+    if (mBus == nullptr || length == 0) {
+        return;
+    }
+    if (mInputMode == InputMode::Live) {
+        UartDevice* uart = static_cast<UartDevice*>(mBus->getDevice("UART"));
+        if (uart != nullptr) {
+            uart->pushRx(data, length);
+            requestAttention();
+        }
+        return;
+    }
+    if (mInputMode == InputMode::Record) {
+        InputEvent event;
+        event.kind = InputEventKind::Uart;
+        event.bytes.assign(data, data + length);
+        {
+            std::lock_guard<std::mutex> lock(mPendingInputMutex);
+            mPendingInput.push_back(std::move(event));
+            mInputPending.store(true, std::memory_order_release);
+        }
+        requestAttention();
+        mControl.cv.notify_all();
+    }
+}
+
+void Debugger::injectKey(uint32_t key) {
+    if (mSdl == nullptr) {
+        return;
+    }
+    if (mInputMode == InputMode::Live) {
+        mSdl->pushKey(key);
+        return;
+    }
+    if (mInputMode == InputMode::Record) {
+        InputEvent event;
+        event.kind = InputEventKind::Key;
+        event.key = key;
+        {
+            std::lock_guard<std::mutex> lock(mPendingInputMutex);
+            mPendingInput.push_back(std::move(event));
+            mInputPending.store(true, std::memory_order_release);
+        }
+        requestAttention();
+        mControl.cv.notify_all();
+    }
+}
+
+bool Debugger::recordInput(const std::string& path, std::string* error) {
+    if (!mInputLog.open(path, error)) {
+        return false;
+    }
+    mInputMode = InputMode::Record;
+    return true;
+}
+
+bool Debugger::replayInput(const std::string& path, std::string* error) {
+    std::vector<InputEvent> events;
+    if (!readInputLog(path, &events, error)) {
+        return false;
+    }
+    mInputLog.close();
+    mReplayInput = std::move(events);
+    mReplayNext = 0;
+    mReplayArmedCycle = EventScheduler::kNoEvent;
+    mInputMode = InputMode::Replay;
+    if (mHarts.size() > 1) {
+        WARN("Input replay is only exact on single-hart machines");
+    }
+    return true;
+}
+
+void Debugger::syncInput(uint64_t cycle) {
+    if (mInputMode == InputMode::Replay) {
+        deliverReplayInput(cycle);
+        return;
+    }
+    if (mInputMode != InputMode::Record || !mInputPending.load(std::memory_order_acquire)) {
+        return;
+    }
+    // Taken out of the queue first: the terminal and SDL threads hold their
+    // own locks while they queue, the devices below take theirs again.
+    std::vector<InputEvent> pending;
+    {
+        std::lock_guard<std::mutex> lock(mPendingInputMutex);
+        pending.swap(mPendingInput);
+        mInputPending.store(false, std::memory_order_release);
+    }
+    for (InputEvent& event : pending) {
+        size_t taken = deliverInput(event);
+        if (taken == 0) {
+            continue;
+        }
+        // A full receive FIFO drops the rest, and a replay must drop it too.
+        if (event.kind == InputEventKind::Uart) {
+            event.bytes.resize(taken);
+        }
+        event.cycle = cycle;
+        mInputLog.append(event);
+    }
+}
+
+void Debugger::deliverReplayInput(uint64_t cycle) {
+    while (mReplayNext < mReplayInput.size() && mReplayInput[mReplayNext].cycle <= cycle) {
+        deliverInput(mReplayInput[mReplayNext]);
+        ++mReplayNext;
+    }
+    if (mReplayNext < mReplayInput.size()) {
+        uint64_t next = mReplayInput[mReplayNext].cycle;
+        if (next != mReplayArmedCycle) {
+            mReplayArmedCycle = next;
+            mBus->scheduler().schedule(next, [](uint64_t) {});
+        }
+    }
+}
+
+size_t Debugger::deliverInput(const InputEvent& event) {
+    if (event.kind == InputEventKind::Key) {
+        if (mSdl == nullptr) {
+            return 0;
+        }
+        mSdl->pushKey(event.key);
+        return 1;
+    }
+    UartDevice* uart = static_cast<UartDevice*>(mBus->getDevice("UART"));
+    return uart != nullptr ? uart->pushRx(event.bytes.data(), event.bytes.size()) : 0;
+}
+
+void Debugger::rewindInputReplay(uint64_t cycle) {
+    if (mInputMode != InputMode::Replay) {
+        return;
+    }
+    mReplayNext = static_cast<size_t>(std::upper_bound(mReplayInput.begin(),
+        mReplayInput.end(), cycle, [](uint64_t value, const InputEvent& event) {
+            return value < event.cycle;
+        }) - mReplayInput.begin());
+    // The restore dropped the scheduled wakeup with the rest of the events.
+    mReplayArmedCycle = EventScheduler::kNoEvent;
+    deliverReplayInput(cycle);
+}
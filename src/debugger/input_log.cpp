@@ -0,0 +1,130 @@
+#include "emulator/debugger/input_log.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+
+namespace {
+
+void putVarint(std::vector<uint8_t>* out, uint64_t value) {
+    while (value >= 0x80) {
+        out->push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out->push_back(static_cast<uint8_t>(value));
+}
+
+bool getVarint(const std::vector<uint8_t>& data, size_t* offset, uint64_t* value) {
+    uint64_t result = 0;
+    for (uint32_t shift = 0; shift < 64 && *offset < data.size(); shift += 7) {
+        uint8_t byte = data[(*offset)++];
+        result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+InputLogWriter::~InputLogWriter() {
+    close();
+}
+
+bool InputLogWriter::open(const std::string& path, std::string* error) {
+    close();
+    mFile = std::fopen(path.c_str(), "wb");
+    if (mFile == nullptr) {
+        if (error != nullptr) {
+            *error = "Failed to open input log: " + path;
+        }
+        return false;
+    }
+    InputLogHeader header;
+    if (std::fwrite(&header, sizeof(header), 1, mFile) != 1) {
+        if (error != nullptr) {
+            *error = "Failed to write input log header: " + path;
+        }
+        std::fclose(mFile);
+        mFile = nullptr;
+        return false;
+    }
+    mLastCycle = 0;
+    return true;
+}
+
+void InputLogWriter::append(const InputEvent& event) {
+    if (mFile == nullptr) {
+        return;
+    }
+    mEncoded.clear();
+    putVarint(&mEncoded, event.cycle - mLastCycle);
+    if (event.kind == InputEventKind::Key) {
+        putVarint(&mEncoded, (static_cast<uint64_t>(event.key) << 1) | 1);
+    } else {
+        putVarint(&mEncoded, static_cast<uint64_t>(event.bytes.size()) << 1);
+        mEncoded.insert(mEncoded.end(), event.bytes.begin(), event.bytes.end());
+    }
+    mLastCycle = event.cycle;
+    std::fwrite(mEncoded.data(), 1, mEncoded.size(), mFile);
+    // Whatever was typed before a crash is what a replay needs most.
+    std::fflush(mFile);
+}
+
+void InputLogWriter::close() {
+    if (mFile != nullptr) {
+        std::fclose(mFile);
+        mFile = nullptr;
+    }
+}
+
+bool readInputLog(const std::string& path, std::vector<InputEvent>* events, std::string* error) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        if (error != nullptr) *error = "Failed to open input log: " + path;
+        return false;
+    }
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)),
+        std::istreambuf_iterator<char>());
+    InputLogHeader header;
+    InputLogHeader expected;
+    if (data.size() < sizeof(header)) {
+        if (error != nullptr) *error = "Not an input log: " + path;
+        return false;
+    }
+    std::copy(data.begin(), data.begin() + sizeof(header), reinterpret_cast<uint8_t*>(&header));
+    if (header.magic != expected.magic || header.version != expected.version) {
+        if (error != nullptr) *error = "Not an input log: " + path;
+        return false;
+    }
+
+    events->clear();
+    size_t offset = sizeof(header);
+    uint64_t cycle = 0;
+    while (offset < data.size()) {
+        uint64_t delta = 0;
+        uint64_t tag = 0;
+        if (!getVarint(data, &offset, &delta) || !getVarint(data, &offset, &tag)) {
+            break;
+        }
+        InputEvent event;
+        event.cycle = cycle + delta;
+        if ((tag & 1) != 0) {
+            event.kind = InputEventKind::Key;
+            event.key = static_cast<uint32_t>(tag >> 1);
+        } else {
+            uint64_t length = tag >> 1;
+            if (length > data.size() - offset) {
+                break;
+            }
+            event.bytes.assign(data.begin() + static_cast<std::ptrdiff_t>(offset),
+                data.begin() + static_cast<std::ptrdiff_t>(offset + length));
+            offset += static_cast<size_t>(length);
+        }
+        cycle = event.cycle;
+        events->push_back(std::move(event));
+    }
+    return true;
+}
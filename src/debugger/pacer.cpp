@@ -0,0 +1,79 @@
+#include "emulator/debugger/pacer.h"
+
+#include <algorithm>
+#include <thread>
+
+void Pacer::setFrequency(uint64_t cyclesPerSecond) {
+    mFrequency = std::max<uint64_t>(cyclesPerSecond, 1);
+    mBased = false;
+}
+
+void Pacer::rebase(uint64_t cycle, Clock::time_point now) {
+    mBaseCycle = cycle;
+    mBaseTime = now;
+    mBased = true;
+}
+
+int64_t Pacer::guestNanos(uint64_t cycles) const {
+    // Split so cycles * 1e9 cannot overflow.
+    uint64_t seconds = cycles / mFrequency;
+    uint64_t rest = cycles % mFrequency;
+    return static_cast<int64_t>(seconds * 1000000000ull + rest * 1000000000ull / mFrequency);
+}
+
+Pacer::Clock::duration Pacer::update(uint64_t cycle, Clock::time_point now) {
+    if (!mBased || cycle < mBaseCycle) {
+        rebase(cycle, now);
+        return Clock::duration::zero();
+    }
+    auto target = mBaseTime + std::chrono::nanoseconds(guestNanos(cycle - mBaseCycle));
+    int64_t drift = std::chrono::duration_cast<std::chrono::nanoseconds>(now - target).count();
+    mDriftNs.store(drift, std::memory_order_relaxed);
+    if (drift > 0) {
+        uint64_t behind = static_cast<uint64_t>(drift);
+        if (behind > mMaxDriftNs.load(std::memory_order_relaxed)) {
+            mMaxDriftNs.store(behind, std::memory_order_relaxed);
+        }
+        if (std::chrono::nanoseconds(drift) > kMaxLag) {
+            mSlips.fetch_add(1, std::memory_order_relaxed);
+            mSlippedNs.fetch_add(behind, std::memory_order_relaxed);
+            rebase(cycle, now);
+        }
+        return Clock::duration::zero();
+    }
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(-drift));
+}
+
+void Pacer::pace(uint64_t cycle) {
+    Clock::time_point now = Clock::now();
+    Clock::duration wait = update(cycle, now);
+    if (wait <= Clock::duration::zero()) {
+        return;
+    }
+    mWaits.fetch_add(1, std::memory_order_relaxed);
+    Clock::time_point deadline = now + wait;
+    if (wait > kSpinWindow) {
+        std::this_thread::sleep_for(wait - kSpinWindow);
+    }
+    while (Clock::now() < deadline) {
+        std::this_thread::yield();
+    }
+}
+
+PacingStats Pacer::getStats() const {
+    PacingStats stats;
+    stats.waits = mWaits.load(std::memory_order_relaxed);
+    stats.slips = mSlips.load(std::memory_order_relaxed);
+    stats.slippedNs = mSlippedNs.load(std::memory_order_relaxed);
+    stats.driftNs = mDriftNs.load(std::memory_order_relaxed);
+    stats.maxDriftNs = mMaxDriftNs.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void Pacer::resetStats() {
+    mWaits.store(0, std::memory_order_relaxed);
+    mSlips.store(0, std::memory_order_relaxed);
+    mSlippedNs.store(0, std::memory_order_relaxed);
+    mDriftNs.store(0, std::memory_order_relaxed);
+    mMaxDriftNs.store(0, std::memory_order_relaxed);
+}
@@ -0,0 +1,116 @@
+#include "emulator/debugger/perf_report.h"
+
+#include <cstdarg>
+#include <cstdio>
+
+namespace {
+
+std::string format(const char* fmt, ...) {
+    char buffer[512];
+    va_list args;
+    va_start(args, fmt);
+    std::vsnprintf(buffer, sizeof(buffer), fmt, args);
+    va_end(args);
+    return buffer;
+}
+
+double perSecond(uint64_t count, double seconds) {
+    return seconds > 0.0 ? static_cast<double>(count) / seconds : 0.0;
+}
+
+double percent(uint64_t part, uint64_t whole) {
+    return whole > 0 ? 100.0 * static_cast<double>(part) / static_cast<double>(whole) : 0.0;
+}
+
+uint64_t minus(uint64_t later, uint64_t earlier) {
+    return later >= earlier ? later - earlier : 0;
+}
+
+} // namespace
+
+PerfReport diffPerfReports(const PerfReport& later, const PerfReport& earlier) {
+    PerfReport diff;
+    diff.seconds = later.seconds - earlier.seconds;
+    diff.instructions = minus(later.instructions, earlier.instructions);
+    diff.batches = minus(later.batches, earlier.batches);
+    diff.stepNs = minus(later.stepNs, earlier.stepNs);
+    diff.syncNs = minus(later.syncNs, earlier.syncNs);
+    diff.syncs = minus(later.syncs, earlier.syncs);
+    diff.events = minus(later.events, earlier.events);
+    diff.traceRecords = minus(later.traceRecords, earlier.traceRecords);
+    diff.tlbHits = minus(later.tlbHits, earlier.tlbHits);
+    diff.tlbMisses = minus(later.tlbMisses, earlier.tlbMisses);
+    for (const auto& mapping : later.mappings) {
+        BusMappingStats entry = mapping;
+        for (const auto& old : earlier.mappings) {
+            if (old.name == mapping.name) {
+                entry.reads = minus(mapping.reads, old.reads);
+                entry.writes = minus(mapping.writes, old.writes);
+                break;
+            }
+        }
+        diff.mappings.push_back(entry);
+    }
+    diff.uartTxStalls = minus(later.uartTxStalls, earlier.uartTxStalls);
+    diff.uartRxContended = minus(later.uartRxContended, earlier.uartRxContended);
+    diff.logMessages = minus(later.logMessages, earlier.logMessages);
+    diff.logContended = minus(later.logContended, earlier.logContended);
+    diff.logQueueStalls = minus(later.logQueueStalls, earlier.logQueueStalls);
+    return diff;
+}
+
+std::string formatPerfJson(const PerfReport& r) {
+    std::string json = format("{\"seconds\":%.3f,\"instructions\":%llu,\"batches\":%llu,"
+        "\"step_ns\":%llu,\"sync_ns\":%llu,\"syncs\":%llu,\"events\":%llu,"
+        "\"trace_records\":%llu,\"tlb_hits\":%llu,\"tlb_misses\":%llu,",
+        r.seconds, (unsigned long long)r.instructions, (unsigned long long)r.batches,
+        (unsigned long long)r.stepNs, (unsigned long long)r.syncNs,
+        (unsigned long long)r.syncs, (unsigned long long)r.events,
+        (unsigned long long)r.traceRecords, (unsigned long long)r.tlbHits,
+        (unsigned long long)r.tlbMisses);
+    json += "\"bus\":{";
+    for (size_t i = 0; i < r.mappings.size(); ++i) {
+        const BusMappingStats& mapping = r.mappings[i];
+        json += format("%s\"%s\":{\"reads\":%llu,\"writes\":%llu}", i > 0 ? "," : "",
+            mapping.name.c_str(), (unsigned long long)mapping.reads,
+            (unsigned long long)mapping.writes);
+    }
+    json += format("},\"uart_tx_stalls\":%llu,\"uart_rx_contended\":%llu,"
+        "\"log_messages\":%llu,\"log_contended\":%llu,\"log_queue_stalls\":%llu}",
+        (unsigned long long)r.uartTxStalls, (unsigned long long)r.uartRxContended,
+        (unsigned long long)r.logMessages, (unsigned long long)r.logContended,
+        (unsigned long long)r.logQueueStalls);
+    return json;
+}
+
+std::vector<std::string> formatPerfSummary(const PerfReport& r) {
+    std::vector<std::string> lines;
+    uint64_t hartNs = r.stepNs + r.syncNs;
+    lines.push_back(format("Perf over %.2fs: %.2f MIPS, step %.2fs, sync %.2fs (%.1f%% of "
+        "hart time)", r.seconds, perSecond(r.instructions, r.seconds) / 1e6, r.stepNs / 1e9,
+        r.syncNs / 1e9, percent(r.syncNs, hartNs)));
+    lines.push_back(format("Batches: %llu avg=%.0f instrs; syncs: %llu (%.0f/s) events=%llu",
+        (unsigned long long)r.batches,
+        r.batches > 0 ? static_cast<double>(r.instructions) / r.batches : 0.0,
+        (unsigned long long)r.syncs, perSecond(r.syncs, r.seconds),
+        (unsigned long long)r.events));
+    uint64_t lookups = r.tlbHits + r.tlbMisses;
+    lines.push_back(format("Bus lookups: %llu, cache hit rate %.2f%%",
+        (unsigned long long)lookups, percent(r.tlbHits, lookups)));
+    for (const auto& mapping : r.mappings) {
+        if (mapping.reads == 0 && mapping.writes == 0) {
+            continue;
+        }
+        lines.push_back(format("  %-8s reads=%llu (%.0f/s) writes=%llu (%.0f/s)",
+            mapping.name.empty() ? "?" : mapping.name.c_str(),
+            (unsigned long long)mapping.reads, perSecond(mapping.reads, r.seconds),
+            (unsigned long long)mapping.writes, perSecond(mapping.writes, r.seconds)));
+    }
+    lines.push_back(format("Trace records: %llu; UART tx-stalls=%llu rx-contended=%llu",
+        (unsigned long long)r.traceRecords, (unsigned long long)r.uartTxStalls,
+        (unsigned long long)r.uartRxContended));
+    lines.push_back(format("Logger: messages=%llu contended=%llu queue-stalls=%llu",
+        (unsigned long long)r.logMessages, (unsigned long long)r.logContended,
+        (unsigned long long)r.logQueueStalls));
+    return lines;
+}
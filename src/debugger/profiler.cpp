@@ -0,0 +1,107 @@
+#include "emulator/debugger/profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+
+namespace {
+    std::string symbolName(const SymbolMap& symbols, uint64_t pc, uint64_t* address) {
+        if (const Symbol* symbol = symbols.lookup(pc)) {
+            *address = symbol->address;
+            return symbol->name;
+        }
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "0x%llx", (unsigned long long)pc);
+        *address = pc;
+        return buffer;
+    }
+}
+
+void PcProfiler::start(uint64_t periodCycles) {
+    mPeriod.store(std::max<uint64_t>(1, periodCycles), std::memory_order_release);
+    mGeneration.fetch_add(1, std::memory_order_acq_rel);
+    mRunning.store(true, std::memory_order_release);
+}
+
+void PcProfiler::stop() {
+    mRunning.store(false, std::memory_order_release);
+}
+
+void PcProfiler::clear() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mHarts.clear();
+    mSamples = 0;
+}
+
+void PcProfiler::record(uint32_t hart, uint64_t pc) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (hart >= mHarts.size()) {
+        mHarts.resize(hart + 1);
+    }
+    ++mHarts[hart][pc];
+    ++mSamples;
+}
+
+uint64_t PcProfiler::getSampleCount() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mSamples;
+}
+
+std::vector<ProfileHotspot> PcProfiler::hotspots(const SymbolMap& symbols, size_t limit) const {
+    std::map<std::string, ProfileHotspot> byName;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (const auto& histogram : mHarts) {
+            for (const auto& entry : histogram) {
+                uint64_t address = 0;
+                std::string name = symbolName(symbols, entry.first, &address);
+                ProfileHotspot& spot = byName[name];
+                spot.name = name;
+                spot.address = address;
+                spot.samples += entry.second;
+            }
+        }
+    }
+    std::vector<ProfileHotspot> spots;
+    for (auto& entry : byName) {
+        spots.push_back(std::move(entry.second));
+    }
+    std::sort(spots.begin(), spots.end(), [](const ProfileHotspot& a, const ProfileHotspot& b) {
+        return a.samples != b.samples ? a.samples > b.samples : a.address < b.address;
+    });
+    if (spots.size() > limit) {
+        spots.resize(limit);
+    }
+    return spots;
+}
+
+bool PcProfiler::exportFolded(const std::string& path, const SymbolMap& symbols,
+    std::string* error) const {
+    std::vector<std::map<std::string, uint64_t>> folded;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        folded.resize(mHarts.size());
+        for (size_t hart = 0; hart < mHarts.size(); ++hart) {
+            for (const auto& entry : mHarts[hart]) {
+                uint64_t address = 0;
+                folded[hart][symbolName(symbols, entry.first, &address)] += entry.second;
+            }
+        }
+    }
+    FILE* file = std::fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        if (error != nullptr) *error = "Cannot open " + path;
+        return false;
+    }
+    for (size_t hart = 0; hart < folded.size(); ++hart) {
+        for (const auto& entry : folded[hart]) {
+            std::fprintf(file, "hart%zu;%s %llu\n", hart, entry.first.c_str(),
+                (unsigned long long)entry.second);
+        }
+    }
+    bool ok = std::fclose(file) == 0;
+    if (!ok && error != nullptr) {
+        *error = "Failed to write " + path;
+    }
+    return ok;
+}
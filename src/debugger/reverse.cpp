@@ -0,0 +1,265 @@
+#include "emulator/debugger/debugger.h"
+#include "emulator/logging/logger.h"
+
+#include <algorithm>
+
+namespace {
+    constexpr uint64_t kNoCycleLimit = ~0ull;
+    constexpr uint64_t kNoHit = ~0ull;
+}
+
+void Debugger::setCheckpointInterval(uint64_t cycles) {
+    mCheckpointInterval = cycles;
+}
+
+void Debugger::setCheckpointBudget(uint64_t bytes) {
+    mCheckpointBudget = bytes;
+}
+
+size_t Debugger::getCheckpointCount() {
+    std::lock_guard<std::mutex> lock(mControl.mutex);
+    return mCheckpoints.size();
+}
+
+// Replay is only deterministic with one hart; several harts interleave their
+// bus accesses differently on every run.
+bool Debugger::checkpointsEnabled() const {
+    return mCheckpointInterval > 0 && mHarts.size() == 1 && mBus != nullptr;
+}
+
+void Debugger::pushCheckpoint() {
+    Hart& hart = *mHarts[0];
+    Checkpoint checkpoint;
+    checkpoint.instructions = hart.instructions.load(std::memory_order_acquire);
+    std::string error;
+    {
+        auto devices = mBus->lockDevices();
+        if (!takeMachineSnapshot(hartCpus(), mBus, &checkpoint.snapshot, &error)) {
+            // Nothing to replay from; stop trying until the interval changes.
+            WARN("Checkpoints disabled: %s", error.c_str());
+            mCheckpointInterval = 0;
+            return;
+        }
+    }
+    checkpoint.bytes = checkpoint.snapshot.getSizeBytes();
+    mCheckpointBytes += checkpoint.bytes;
+    mCheckpoints.push_back(std::move(checkpoint));
+
+    // Later checkpoints share pages with earlier ones, so each one's size is
+    // only what it copied; dropping the oldest frees roughly that much.
+    while (mCheckpoints.size() > 1 && mCheckpointBytes > mCheckpointBudget) {
+        mCheckpointBytes -= mCheckpoints.front().bytes;
+        mCheckpoints.pop_front();
+    }
+    mNextCheckpointCycle = hart.cpu->getCycle() + mCheckpointInterval;
+}
+
+void Debugger::resetCheckpoints() {
+    mCheckpoints.clear();
+    mCheckpointBytes = 0;
+    if (checkpointsEnabled()) {
+        pushCheckpoint();
+    }
+}
+
+void Debugger::recordBatch(uint64_t instructions) {
+    if (instructions > 0 && !mCheckpoints.empty()) {
+        mCheckpoints.back().batches.push_back(instructions);
+    }
+}
+
+// Restores the checkpoint and re-runs its recorded batches up to `target`
+// retired instructions. Device events only run after complete batches, as
+// they did originally. With `breakpoints` set it single-steps and reports the
+// last instruction index before `target` that started on a breakpoint.
+bool Debugger::replayFrom(const Checkpoint& checkpoint, uint64_t target,
+    const std::vector<uint64_t>* breakpoints, uint64_t* lastHit, std::string* error) {
+    Hart& hart = *mHarts[0];
+    ICpuExecutor* cpu = hart.cpu;
+    EventScheduler& events = mBus->scheduler();
+    {
+        auto devices = mBus->lockDevices();
+        if (!restoreMachineSnapshot(hartCpus(), mBus, checkpoint.snapshot, error)) {
+            return false;
+        }
+        rewindInputReplay(checkpoint.snapshot.schedulerNow);
+    }
+
+    mReplaying.store(true, std::memory_order_relaxed);
+    uint64_t position = checkpoint.instructions;
+    bool ok = true;
+    for (size_t i = 0; ok && position < target; ++i) {
+        if (i >= checkpoint.batches.size()) {
+            if (error != nullptr) *error = "Target is past the recorded history";
+            ok = false;
+            break;
+        }
+        uint64_t batch = checkpoint.batches[i];
+        uint64_t count = std::min(batch, target - position);
+        uint64_t done = 0;
+        while (done < count) {
+            uint64_t chunk = count - done;
+            if (breakpoints != nullptr) {
+                chunk = 1;
+                uint64_t pc = cpu->getPc();
+                if (lastHit != nullptr &&
+                    std::find(breakpoints->begin(), breakpoints->end(), pc) != breakpoints->end() &&
+                    breakpointFires(cpu, pc)) {
+                    *lastHit = position + done;
+                }
+            }
+            StepResult result = cpu->step(chunk, kNoCycleLimit);
+            done += result.instructionsExecuted;
+            if (!result.success || result.instructionsExecuted == 0) {
+                if (error != nullptr) *error = "Replay diverged from the recorded run";
+                ok = false;
+                break;
+            }
+        }
+        position += done;
+        if (ok && count == batch) {
+            auto devices = mBus->lockDevices();
+            events.runDue(cpu->getCycle());
+            if (mInputMode == InputMode::Replay) {
+                deliverReplayInput(cpu->getCycle());
+            }
+        }
+    }
+    mReplaying.store(false, std::memory_order_relaxed);
+
+    hart.instructions.store(position, std::memory_order_release);
+    publishStatus(hart);
+    return ok;
+}
+
+bool Debugger::travelLocked(uint64_t target, std::string* error) {
+    if (!checkpointsEnabled()) {
+        if (error != nullptr) *error = "Reverse execution needs checkpoints and a single hart";
+        return false;
+    }
+    Hart& hart = *mHarts[0];
+    uint64_t recorded = 0;
+    if (!mCheckpoints.empty()) {
+        recorded = mCheckpoints.back().instructions;
+        for (uint64_t batch : mCheckpoints.back().batches) {
+            recorded += batch;
+        }
+    }
+    if (target > recorded) {
+        if (error != nullptr) *error = "Cannot travel past the recorded history";
+        return false;
+    }
+    auto it = std::find_if(mCheckpoints.rbegin(), mCheckpoints.rend(),
+        [target](const Checkpoint& checkpoint) { return checkpoint.instructions <= target; });
+    if (it == mCheckpoints.rend()) {
+        if (error != nullptr) *error = "No checkpoint that old is left within the budget";
+        return false;
+    }
+    if (!replayFrom(*it, target, nullptr, nullptr, error)) {
+        return false;
+    }
+
+    hart.halted.store(false, std::memory_order_release);
+    hart.batchInstructions = 0;
+    if (mState.state.load(std::memory_order_acquire) == CpuState::Halted) {
+        mState.state.store(CpuState::Pause, std::memory_order_release);
+    }
+    // Running on from here starts a new timeline: keep the history leading up
+    // to it and checkpoint the current point so later batches attach to it.
+    while (!mCheckpoints.empty() && mCheckpoints.back().instructions > target) {
+        mCheckpointBytes -= mCheckpoints.back().bytes;
+        mCheckpoints.pop_back();
+    }
+    if (mCheckpoints.empty() || mCheckpoints.back().instructions != target) {
+        pushCheckpoint();
+    } else {
+        mCheckpoints.back().batches.clear();
+        mNextCheckpointCycle = hart.cpu->getCycle() + mCheckpointInterval;
+    }
+    return true;
+}
+
+bool Debugger::travelTo(uint64_t instruction, std::string* error) {
+    std::unique_lock<std::mutex> lock(mControl.mutex);
+    if (!waitForHartsIdle(lock, error)) {
+        return false;
+    }
+    return travelLocked(instruction, error);
+}
+
+bool Debugger::cmdRstep(std::istringstream& args) {
+    uint64_t steps = 1;
+    std::string arg;
+    if (args >> arg) {
+        uint64_t val = evalExpression(arg);
+        if (val > 0) {
+            steps = val;
+        }
+    }
+
+    std::string error;
+    std::unique_lock<std::mutex> lock(mControl.mutex);
+    if (!waitForHartsIdle(lock, &error)) {
+        INFO("rstep failed: %s", error.c_str());
+        return false;
+    }
+    uint64_t current = mHarts.empty() ? 0 : mHarts[0]->instructions.load();
+    uint64_t target = current > steps ? current - steps : 0;
+    if (!travelLocked(target, &error)) {
+        INFO("rstep failed: %s", error.c_str());
+        return false;
+    }
+    INFO("At instruction %llu, PC 0x%llx", (unsigned long long)target,
+        (unsigned long long)mHarts[0]->cpu->getPc());
+    return true;
+}
+
+// Searches each checkpoint interval, newest first, for the last instruction
+// that started on a breakpoint, then travels there.
+bool Debugger::cmdRcontinue(std::istringstream& args) {
+    (void)args;
+    std::vector<uint64_t> breakpoints = mBreakpoints.list();
+    if (breakpoints.empty()) {
+        INFO("No breakpoints.");
+        return false;
+    }
+
+    std::string error;
+    std::unique_lock<std::mutex> lock(mControl.mutex);
+    if (!waitForHartsIdle(lock, &error)) {
+        INFO("rcontinue failed: %s", error.c_str());
+        return false;
+    }
+    if (!checkpointsEnabled()) {
+        INFO("rcontinue failed: Reverse execution needs checkpoints and a single hart");
+        return false;
+    }
+    uint64_t current = mHarts[0]->instructions.load(std::memory_order_acquire);
+    uint64_t end = current;
+    uint64_t hit = kNoHit;
+    for (size_t c = mCheckpoints.size(); c-- > 0 && hit == kNoHit;) {
+        const Checkpoint& checkpoint = mCheckpoints[c];
+        if (checkpoint.instructions >= end) {
+            continue;
+        }
+        if (!replayFrom(checkpoint, end, &breakpoints, &hit, &error)) {
+            break;
+        }
+        end = checkpoint.instructions;
+    }
+
+    if (hit == kNoHit) {
+        // Put the machine back where it was.
+        std::string restoreError;
+        travelLocked(current, &restoreError);
+        INFO("No earlier breakpoint hit%s%s", error.empty() ? "" : ": ", error.c_str());
+        return false;
+    }
+    if (!travelLocked(hit, &error)) {
+        INFO("rcontinue failed: %s", error.c_str());
+        return false;
+    }
+    INFO("At instruction %llu, PC 0x%llx", (unsigned long long)hit,
+        (unsigned long long)mHarts[0]->cpu->getPc());
+    return true;
+}
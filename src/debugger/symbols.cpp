@@ -0,0 +1,224 @@
+#include "emulator/debugger/symbols.h"
+
+#include "emulator/device/elf.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+namespace {
+    constexpr uint32_t kShtSymtab = 2;
+    constexpr uint32_t kShtDynsym = 11;
+    constexpr uint8_t kSttNotype = 0;
+    constexpr uint8_t kSttFunc = 2;
+
+    // Offsets of the header, section and symbol fields read below; `word`
+    // is the width of address-sized fields.
+    struct ElfLayout {
+        uint32_t word;
+        uint64_t shoff, shentsize, shnum;
+        uint64_t shType, shOffset, shSize, shLink, shEntsize;
+        uint64_t stName, stValue, stSize, stInfo, stShndx;
+    };
+    constexpr ElfLayout kElf32 = {4, 0x20, 0x2E, 0x30, 0x04, 0x10, 0x14, 0x18, 0x24,
+        0, 4, 8, 12, 14};
+    constexpr ElfLayout kElf64 = {8, 0x28, 0x3A, 0x3C, 0x04, 0x18, 0x20, 0x28, 0x38,
+        0, 8, 16, 4, 6};
+
+    struct SectionHeader {
+        uint64_t type = 0;
+        uint64_t offset = 0;
+        uint64_t size = 0;
+        uint64_t link = 0;
+        uint64_t entrySize = 0;
+    };
+
+    bool parseHex(const std::string& text, uint64_t* value) {
+        std::string digits = text;
+        if (digits.size() > 2 && digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X')) {
+            digits = digits.substr(2);
+        }
+        if (digits.empty() || digits.size() > 16) {
+            return false;
+        }
+        uint64_t result = 0;
+        for (char c : digits) {
+            int digit = 0;
+            if (c >= '0' && c <= '9') {
+                digit = c - '0';
+            } else if (c >= 'a' && c <= 'f') {
+                digit = c - 'a' + 10;
+            } else if (c >= 'A' && c <= 'F') {
+                digit = c - 'A' + 10;
+            } else {
+                return false;
+            }
+            result = (result << 4) | static_cast<uint64_t>(digit);
+        }
+        *value = result;
+        return true;
+    }
+}
+
+bool SymbolMap::load(const std::string& path, std::string* error) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        if (error != nullptr) *error = "Cannot open symbol file: " + path;
+        return false;
+    }
+    std::vector<uint8_t> image((std::istreambuf_iterator<char>(file)),
+        std::istreambuf_iterator<char>());
+    bool ok = image.size() >= 4 && std::memcmp(image.data(), "\x7f" "ELF", 4) == 0 ?
+        loadElf(image, error) : loadText(image, error);
+    if (ok) {
+        sort();
+    }
+    return ok;
+}
+
+void SymbolMap::add(const Symbol& symbol) {
+    mSymbols.push_back(symbol);
+    sort();
+}
+
+void SymbolMap::clear() {
+    mSymbols.clear();
+}
+
+const Symbol* SymbolMap::lookup(uint64_t address) const {
+    auto it = std::upper_bound(mSymbols.begin(), mSymbols.end(), address,
+        [](uint64_t value, const Symbol& symbol) { return value < symbol.address; });
+    if (it == mSymbols.begin()) {
+        return nullptr;
+    }
+    const Symbol& symbol = *(it - 1);
+    if (symbol.size != 0 && address - symbol.address >= symbol.size) {
+        return nullptr;
+    }
+    return &symbol;
+}
+
+void SymbolMap::sort() {
+    std::stable_sort(mSymbols.begin(), mSymbols.end(),
+        [](const Symbol& a, const Symbol& b) { return a.address < b.address; });
+    mSymbols.erase(std::unique(mSymbols.begin(), mSymbols.end(),
+        [](const Symbol& a, const Symbol& b) { return a.address == b.address; }),
+        mSymbols.end());
+}
+
+// Function and untyped symbols from .symtab, or .dynsym when stripped;
+// untyped ones cover labels in assembly sources.
+bool SymbolMap::loadElf(const std::vector<uint8_t>& image, std::string* error) {
+    if (image.size() < 0x34 || (image[4] != 1 && image[4] != 2) ||
+        (image[5] != 1 && image[5] != 2)) {
+        if (error != nullptr) *error = "Unsupported ELF header";
+        return false;
+    }
+    const ElfLayout& layout = image[4] == 2 ? kElf64 : kElf32;
+    uint32_t word = layout.word;
+    ElfReader elf(image, image[5] == 2);
+    uint64_t shoff = 0;
+    uint64_t shentsize = 0;
+    uint64_t shnum = 0;
+    if (!elf.read(layout.shoff, word, &shoff) || !elf.read(layout.shentsize, 2, &shentsize) ||
+        !elf.read(layout.shnum, 2, &shnum) || shoff == 0 || shnum == 0) {
+        if (error != nullptr) *error = "ELF file has no section headers";
+        return false;
+    }
+
+    std::vector<SectionHeader> sections(shnum);
+    for (uint64_t i = 0; i < shnum; ++i) {
+        uint64_t base = shoff + i * shentsize;
+        SectionHeader& section = sections[i];
+        if (!elf.read(base + layout.shType, 4, &section.type) ||
+            !elf.read(base + layout.shOffset, word, &section.offset) ||
+            !elf.read(base + layout.shSize, word, &section.size) ||
+            !elf.read(base + layout.shLink, 4, &section.link) ||
+            !elf.read(base + layout.shEntsize, word, &section.entrySize)) {
+            if (error != nullptr) *error = "Truncated ELF section headers";
+            return false;
+        }
+    }
+
+    const SectionHeader* symtab = nullptr;
+    for (uint32_t wanted : {kShtSymtab, kShtDynsym}) {
+        for (const auto& section : sections) {
+            if (symtab == nullptr && section.type == wanted) {
+                symtab = &section;
+            }
+        }
+    }
+    if (symtab == nullptr || symtab->link >= sections.size() || symtab->entrySize == 0) {
+        if (error != nullptr) *error = "ELF file has no symbol table";
+        return false;
+    }
+    const SectionHeader& strtab = sections[symtab->link];
+
+    for (uint64_t entry = 0; entry + symtab->entrySize <= symtab->size;
+        entry += symtab->entrySize) {
+        uint64_t base = symtab->offset + entry;
+        uint64_t nameOffset = 0;
+        uint64_t info = 0;
+        uint64_t shndx = 0;
+        Symbol symbol;
+        if (!elf.read(base + layout.stName, 4, &nameOffset) ||
+            !elf.read(base + layout.stValue, word, &symbol.address) ||
+            !elf.read(base + layout.stSize, word, &symbol.size) ||
+            !elf.read(base + layout.stInfo, 1, &info) ||
+            !elf.read(base + layout.stShndx, 2, &shndx)) {
+            break;
+        }
+        uint8_t type = static_cast<uint8_t>(info & 0xf);
+        if ((type != kSttFunc && type != kSttNotype) || shndx == 0 || nameOffset == 0) {
+            continue;
+        }
+        symbol.name = elf.string(strtab.offset + nameOffset, strtab.offset + strtab.size);
+        // Mapping symbols ($a, $x, ...) and local assembler labels are noise.
+        if (symbol.name.empty() || symbol.name[0] == '$' || symbol.name.rfind(".L", 0) == 0) {
+            continue;
+        }
+        mSymbols.push_back(std::move(symbol));
+    }
+    return true;
+}
+
+bool SymbolMap::loadText(const std::vector<uint8_t>& image, std::string* error) {
+    std::istringstream input(std::string(image.begin(), image.end()));
+    std::string line;
+    size_t lineNumber = 0;
+    while (std::getline(input, line)) {
+        ++lineNumber;
+        std::istringstream fields(line);
+        std::vector<std::string> tokens;
+        for (std::string token; fields >> token;) {
+            tokens.push_back(token);
+        }
+        // nm lists undefined symbols as "<type> <name>" without an address.
+        if (tokens.empty() || tokens[0][0] == '#' ||
+            (tokens.size() == 2 && tokens[0].size() == 1)) {
+            continue;
+        }
+        Symbol symbol;
+        if (tokens.size() < 2 || !parseHex(tokens[0], &symbol.address)) {
+            if (error != nullptr) {
+                *error = "Bad symbol map line " + std::to_string(lineNumber);
+            }
+            return false;
+        }
+        size_t next = 1;
+        if (tokens.size() >= 4 && parseHex(tokens[1], &symbol.size)) {
+            ++next;
+        }
+        if (tokens.size() > next + 1 && tokens[next].size() == 1) {
+            if (tokens[next] == "U") {
+                continue;
+            }
+            ++next;
+        }
+        symbol.name = tokens[next];
+        mSymbols.push_back(std::move(symbol));
+    }
+    return true;
+}
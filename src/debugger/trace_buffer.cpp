@@ -0,0 +1,258 @@
+#include "emulator/debugger/trace_buffer.h"
+#include "emulator/debugger/trace_file.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+namespace {
+
+constexpr size_t kDrainBatch = 256;
+constexpr auto kDrainIdleSleep = std::chrono::milliseconds(1);
+
+std::string formatAccessType(MemAccessType type) {
+    switch (type) {
+    case MemAccessType::Read:
+        return "R";
+    case MemAccessType::Write:
+        return "W";
+    case MemAccessType::Fetch:
+        return "F";
+    case MemAccessType::AtomicRmw:
+        return "A";
+    case MemAccessType::CompareExchange:
+        return "C";
+    case MemAccessType::LoadReserved:
+        return "LR";
+    case MemAccessType::StoreConditional:
+        return "SC";
+    }
+    return "?";
+}
+
+size_t roundUpPow2(size_t value) {
+    size_t out = 1;
+    while (out < value) {
+        out <<= 1;
+    }
+    return out;
+}
+
+} // namespace
+
+void encodeTraceRecord(const TraceRecord& record, const TraceOptions& options,
+    BinaryTraceRecord* out) {
+    std::memset(out, 0, sizeof(*out));
+    out->pc = record.pc;
+    out->cycleBegin = record.cycleBegin;
+    out->cycleEnd = record.cycleEnd;
+    out->inst = record.inst;
+    if (record.isBranch) {
+        out->flags |= BinaryTraceRecord::kBranch;
+        if (record.branch.taken) {
+            out->flags |= BinaryTraceRecord::kTaken;
+        }
+        if (record.branch.predictedTaken) {
+            out->flags |= BinaryTraceRecord::kPredictedTaken;
+        }
+        out->branchTarget = record.branch.target;
+        out->predictedTarget = record.branch.predictedTarget;
+    }
+    if (options.logInstruction) {
+        out->options |= BinaryTraceRecord::kOptInstruction;
+    }
+    if (options.logMemEvents) {
+        out->options |= BinaryTraceRecord::kOptMemEvents;
+    }
+    if (options.logBranchPrediction) {
+        out->options |= BinaryTraceRecord::kOptBranchPrediction;
+    }
+
+    size_t count = std::min(record.memEvents.size(), kTraceMaxMemEvents);
+    out->memCount = static_cast<uint8_t>(count);
+    for (size_t i = 0; i < count; ++i) {
+        const MemAccessEvent& event = record.memEvents[i];
+        out->mem[i].address = event.address;
+        out->mem[i].data = event.data;
+        out->mem[i].latencyCycles = event.latencyCycles;
+        out->mem[i].size = static_cast<uint16_t>(event.size);
+        out->mem[i].type = static_cast<uint8_t>(event.type);
+    }
+
+    size_t length = std::min(record.decoded.size(), kTraceDecodedSize - 1);
+    std::memcpy(out->decoded, record.decoded.data(), length);
+    out->decodedLength = static_cast<uint8_t>(length);
+}
+
+void decodeTraceRecord(const BinaryTraceRecord& in, TraceRecord* record, TraceOptions* options) {
+    *record = TraceRecord{};
+    record->pc = in.pc;
+    record->inst = in.inst;
+    record->cycleBegin = in.cycleBegin;
+    record->cycleEnd = in.cycleEnd;
+    record->isBranch = (in.flags & BinaryTraceRecord::kBranch) != 0;
+    record->branch.taken = (in.flags & BinaryTraceRecord::kTaken) != 0;
+    record->branch.predictedTaken = (in.flags & BinaryTraceRecord::kPredictedTaken) != 0;
+    record->branch.target = in.branchTarget;
+    record->branch.predictedTarget = in.predictedTarget;
+    size_t count = std::min<size_t>(in.memCount, kTraceMaxMemEvents);
+    for (size_t i = 0; i < count; ++i) {
+        MemAccessEvent event;
+        event.type = static_cast<MemAccessType>(in.mem[i].type);
+        event.address = in.mem[i].address;
+        event.data = in.mem[i].data;
+        event.size = in.mem[i].size;
+        event.latencyCycles = in.mem[i].latencyCycles;
+        record->memEvents.push_back(event);
+    }
+    size_t length = std::min<size_t>(in.decodedLength, kTraceDecodedSize - 1);
+    record->decoded.assign(in.decoded, length);
+    if (options != nullptr) {
+        options->logInstruction = (in.options & BinaryTraceRecord::kOptInstruction) != 0;
+        options->logMemEvents = (in.options & BinaryTraceRecord::kOptMemEvents) != 0;
+        options->logBranchPrediction =
+            (in.options & BinaryTraceRecord::kOptBranchPrediction) != 0;
+    }
+}
+
+std::string formatTraceRecord(const TraceRecord& record, const TraceOptions& options) {
+    std::stringstream ss;
+
+    if (options.logInstruction) {
+        ss << "PC:0x" << std::hex << std::setw(8) << std::setfill('0') << record.pc << " ";
+        ss << "Inst:0x" << std::hex << std::setw(8) << std::setfill('0') << record.inst << " ";
+        if (!record.decoded.empty()) {
+            ss << "(" << record.decoded << ")";
+        }
+        ss << " ";
+    }
+
+    if (options.logBranchPrediction && record.isBranch) {
+        ss << "BP:(T:" << (record.branch.taken ? "1" : "0") << " "
+           << "P:" << (record.branch.predictedTaken ? "1" : "0") << " "
+           << "Target:0x" << std::hex << record.branch.target << " "
+           << "PTarget:0x" << std::hex << record.branch.predictedTarget << ")";
+        ss << " ";
+    }
+
+    if (options.logMemEvents && !record.memEvents.empty()) {
+        ss << "Mem:[";
+        bool first = true;
+        for (const auto& event : record.memEvents) {
+            if (event.type == MemAccessType::Fetch) continue;
+
+            if (!first) ss << ", ";
+            ss << formatAccessType(event.type) << ":0x" << std::hex << event.address
+               << "=" << event.data;
+            first = false;
+        }
+        ss << "]";
+        ss << " ";
+    }
+
+    return ss.str();
+}
+
+TraceRing::TraceRing(size_t capacity) {
+    size_t size = roundUpPow2(std::max<size_t>(capacity, 2));
+    mSlots.resize(size);
+    mMask = size - 1;
+}
+
+bool TraceRing::tryPush(const BinaryTraceRecord& record) {
+    uint64_t head = mHead.load(std::memory_order_relaxed);
+    uint64_t tail = mTail.load(std::memory_order_acquire);
+    if (head - tail >= mSlots.size()) {
+        return false;
+    }
+    mSlots[head & mMask] = record;
+    mHead.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+size_t TraceRing::pop(BinaryTraceRecord* out, size_t maxRecords) {
+    uint64_t tail = mTail.load(std::memory_order_relaxed);
+    uint64_t head = mHead.load(std::memory_order_acquire);
+    size_t count = static_cast<size_t>(std::min<uint64_t>(head - tail, maxRecords));
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = mSlots[(tail + i) & mMask];
+    }
+    mTail.store(tail + count, std::memory_order_release);
+    return count;
+}
+
+bool TraceRing::empty() const {
+    return mHead.load(std::memory_order_acquire) == mTail.load(std::memory_order_acquire);
+}
+
+BinaryTraceWriter::BinaryTraceWriter() : mFile(std::make_unique<TraceFileWriter>()) {
+}
+
+BinaryTraceWriter::~BinaryTraceWriter() {
+    close();
+}
+
+bool BinaryTraceWriter::open(const std::string& path, size_t ringCount, bool compress,
+    std::string* error, size_t ringCapacity) {
+    close();
+    if (!mFile->open(path, compress, error)) {
+        return false;
+    }
+    mRings.clear();
+    for (size_t i = 0; i < std::max<size_t>(ringCount, 1); ++i) {
+        mRings.push_back(std::make_unique<TraceRing>(ringCapacity));
+    }
+    mWritten.store(0, std::memory_order_relaxed);
+    mStop.store(false, std::memory_order_relaxed);
+    mOpen = true;
+    mThread = std::thread(&BinaryTraceWriter::drainLoop, this);
+    return true;
+}
+
+bool BinaryTraceWriter::close(std::string* error) {
+    if (!mOpen) {
+        return true;
+    }
+    mStop.store(true, std::memory_order_release);
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+    bool ok = mFile->close(error);
+    mOpen = false;
+    mRings.clear();
+    return ok;
+}
+
+void BinaryTraceWriter::push(size_t ring, const BinaryTraceRecord& record) {
+    TraceRing* target = mRings[ring].get();
+    while (!target->tryPush(record)) {
+        std::this_thread::yield();
+    }
+}
+
+size_t BinaryTraceWriter::drainOnce(BinaryTraceRecord* scratch, size_t scratchSize) {
+    size_t total = 0;
+    for (auto& ring : mRings) {
+        size_t count = 0;
+        while ((count = ring->pop(scratch, scratchSize)) > 0) {
+            mFile->append(scratch, count);
+            total += count;
+        }
+    }
+    if (total > 0) {
+        mWritten.fetch_add(total, std::memory_order_relaxed);
+    }
+    return total;
+}
+
+void BinaryTraceWriter::drainLoop() {
+    std::vector<BinaryTraceRecord> scratch(kDrainBatch);
+    while (!mStop.load(std::memory_order_acquire)) {
+        if (drainOnce(scratch.data(), scratch.size()) == 0) {
+            std::this_thread::sleep_for(kDrainIdleSleep);
+        }
+    }
+    drainOnce(scratch.data(), scratch.size());
+}
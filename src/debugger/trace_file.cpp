@@ -0,0 +1,492 @@
+#include "emulator/debugger/trace_file.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// Trace records are mostly zero padding (unused memory slots, short decoded
+// text), so a zero-run encoding is cheap and effective: a zero byte is
+// followed by the run length, every other byte is literal.
+void encodeZeroRle(const uint8_t* data, size_t size, std::vector<uint8_t>* out) {
+    out->clear();
+    size_t i = 0;
+    while (i < size) {
+        if (data[i] != 0) {
+            out->push_back(data[i++]);
+            continue;
+        }
+        size_t run = 1;
+        while (i + run < size && data[i + run] == 0 && run < 255) {
+            ++run;
+        }
+        out->push_back(0);
+        out->push_back(static_cast<uint8_t>(run));
+        i += run;
+    }
+}
+
+bool decodeZeroRle(const uint8_t* data, size_t size, uint8_t* out, size_t outSize) {
+    size_t pos = 0;
+    for (size_t i = 0; i < size; ++i) {
+        if (data[i] != 0) {
+            if (pos >= outSize) {
+                return false;
+            }
+            out[pos++] = data[i];
+            continue;
+        }
+        if (i + 1 >= size || pos + data[i + 1] > outSize) {
+            return false;
+        }
+        std::memset(out + pos, 0, data[i + 1]);
+        pos += data[i + 1];
+        ++i;
+    }
+    return pos == outSize;
+}
+
+uint64_t alignPayload(uint64_t size) {
+    return (size + 7) & ~uint64_t{7};
+}
+
+} // namespace
+
+TraceFileWriter::~TraceFileWriter() {
+    close();
+}
+
+bool TraceFileWriter::open(const std::string& path, bool compress, std::string* error,
+    uint32_t chunkRecords) {
+    close();
+    mFile = std::fopen(path.c_str(), "wb");
+    if (mFile == nullptr) {
+        if (error != nullptr) {
+            *error = "Failed to open trace file: " + path;
+        }
+        return false;
+    }
+    mPath = path;
+    mFailed = false;
+    mCompress = compress;
+    mChunkRecords = std::max<uint32_t>(chunkRecords, 1);
+    TraceFileHeader header;
+    header.recordSize = sizeof(BinaryTraceRecord);
+    header.chunkRecords = mChunkRecords;
+    if (std::fwrite(&header, sizeof(header), 1, mFile) != 1) {
+        if (error != nullptr) {
+            *error = "Failed to write trace file header: " + path;
+        }
+        std::fclose(mFile);
+        mFile = nullptr;
+        return false;
+    }
+    mOffset = sizeof(header);
+    mRecordCount = 0;
+    mPending.clear();
+    mPending.reserve(mChunkRecords);
+    mChunks.clear();
+    mPcs.clear();
+    return true;
+}
+
+bool TraceFileWriter::append(const BinaryTraceRecord* records, size_t count) {
+    if (mFile == nullptr || mFailed) {
+        return false;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        mPending.push_back(records[i]);
+        if (mPending.size() >= mChunkRecords && !flushChunk()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool TraceFileWriter::write(const void* data, size_t size) {
+    if (!mFailed && size > 0 && std::fwrite(data, 1, size, mFile) != size) {
+        mFailed = true;
+    }
+    return !mFailed;
+}
+
+bool TraceFileWriter::flushChunk() {
+    if (mPending.empty()) {
+        return true;
+    }
+    TraceChunkHeader header;
+    header.recordCount = static_cast<uint32_t>(mPending.size());
+    header.firstCycle = mPending.front().cycleBegin;
+    header.lastCycle = mPending.front().cycleBegin;
+    for (const auto& record : mPending) {
+        header.firstCycle = std::min(header.firstCycle, record.cycleBegin);
+        header.lastCycle = std::max(header.lastCycle, record.cycleBegin);
+    }
+
+    const uint8_t* payload = reinterpret_cast<const uint8_t*>(mPending.data());
+    size_t payloadSize = mPending.size() * sizeof(BinaryTraceRecord);
+    header.encoding = static_cast<uint32_t>(TraceChunkEncoding::Raw);
+    if (mCompress) {
+        encodeZeroRle(payload, payloadSize, &mEncoded);
+        if (mEncoded.size() < payloadSize) {
+            header.encoding = static_cast<uint32_t>(TraceChunkEncoding::ZeroRle);
+            payload = mEncoded.data();
+            payloadSize = mEncoded.size();
+        }
+    }
+    header.payloadSize = static_cast<uint32_t>(payloadSize);
+
+    TraceChunkIndexEntry entry;
+    entry.offset = mOffset;
+    entry.firstRecord = mRecordCount;
+    entry.firstCycle = header.firstCycle;
+    entry.lastCycle = header.lastCycle;
+    entry.recordCount = header.recordCount;
+    entry.encoding = header.encoding;
+
+    // Pad so the next chunk (and raw records read in place) stay 8-byte aligned.
+    static const uint8_t kPadding[8] = {};
+    uint64_t padded = alignPayload(payloadSize);
+    if (!write(&header, sizeof(header)) || !write(payload, payloadSize) ||
+        !write(kPadding, padded - payloadSize)) {
+        mPending.clear();
+        return false;
+    }
+    mOffset += sizeof(header) + padded;
+    mRecordCount += header.recordCount;
+
+    uint64_t chunk = mChunks.size();
+    size_t pcStart = mPcs.size();
+    for (const auto& record : mPending) {
+        mPcs.push_back(TracePcIndexEntry{record.pc, chunk});
+    }
+    auto byPc = [](const TracePcIndexEntry& a, const TracePcIndexEntry& b) {
+        return a.pc < b.pc;
+    };
+    auto samePc = [](const TracePcIndexEntry& a, const TracePcIndexEntry& b) {
+        return a.pc == b.pc;
+    };
+    std::sort(mPcs.begin() + pcStart, mPcs.end(), byPc);
+    mPcs.erase(std::unique(mPcs.begin() + pcStart, mPcs.end(), samePc), mPcs.end());
+
+    mChunks.push_back(entry);
+    mPending.clear();
+    return true;
+}
+
+bool TraceFileWriter::close(std::string* error) {
+    if (mFile == nullptr) {
+        return true;
+    }
+    flushChunk();
+    std::stable_sort(mPcs.begin(), mPcs.end(),
+        [](const TracePcIndexEntry& a, const TracePcIndexEntry& b) { return a.pc < b.pc; });
+
+    TraceFileFooter footer;
+    footer.chunkIndexOffset = mOffset;
+    footer.chunkCount = mChunks.size();
+    footer.pcIndexOffset = mOffset + mChunks.size() * sizeof(TraceChunkIndexEntry);
+    footer.pcCount = mPcs.size();
+    footer.recordCount = mRecordCount;
+    write(mChunks.data(), mChunks.size() * sizeof(TraceChunkIndexEntry));
+    write(mPcs.data(), mPcs.size() * sizeof(TracePcIndexEntry));
+    write(&footer, sizeof(footer));
+    if (std::fclose(mFile) != 0) {
+        mFailed = true;
+    }
+    mFile = nullptr;
+    mChunks.clear();
+    mPcs.clear();
+    if (mFailed && error != nullptr) {
+        *error = "Failed to write trace file: " + mPath;
+    }
+    return !mFailed;
+}
+
+TraceFileView::~TraceFileView() {
+    close();
+}
+
+bool TraceFileView::open(const std::string& path, std::string* error) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        if (error != nullptr) {
+            *error = "Failed to open trace file: " + path;
+        }
+        return false;
+    }
+    struct stat st {};
+    if (::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(TraceFileHeader))) {
+        ::close(fd);
+        if (error != nullptr) {
+            *error = "Not a compatible trace file: " + path;
+        }
+        return false;
+    }
+    void* base = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) {
+        if (error != nullptr) {
+            *error = "Failed to map trace file: " + path;
+        }
+        return false;
+    }
+    mBase = static_cast<uint8_t*>(base);
+    mSize = static_cast<size_t>(st.st_size);
+
+    TraceFileHeader header;
+    std::memcpy(&header, mBase, sizeof(header));
+    if (header.magic != kTraceFileMagic || header.version != kTraceFileVersion ||
+        header.recordSize != sizeof(BinaryTraceRecord)) {
+        close();
+        if (error != nullptr) {
+            *error = "Not a compatible trace file: " + path;
+        }
+        return false;
+    }
+
+    TraceFileFooter footer;
+    bool haveFooter = false;
+    if (mSize >= sizeof(header) + sizeof(footer)) {
+        std::memcpy(&footer, mBase + mSize - sizeof(footer), sizeof(footer));
+        uint64_t indexBytes = mSize - sizeof(footer);
+        haveFooter = footer.magic == kTraceFooterMagic &&
+            footer.chunkCount <= indexBytes / sizeof(TraceChunkIndexEntry) &&
+            footer.pcCount <= indexBytes / sizeof(TracePcIndexEntry) &&
+            footer.chunkIndexOffset >= sizeof(header) &&
+            footer.chunkIndexOffset <= indexBytes &&
+            footer.chunkIndexOffset + footer.chunkCount * sizeof(TraceChunkIndexEntry) ==
+                footer.pcIndexOffset &&
+            footer.pcIndexOffset <= indexBytes &&
+            footer.pcIndexOffset + footer.pcCount * sizeof(TracePcIndexEntry) == indexBytes;
+    }
+    // A footer whose index does not match the chunks is as good as none.
+    if (haveFooter && loadFooterIndex(footer)) {
+        return true;
+    }
+    mChunks.clear();
+    if (!rebuildChunkIndex()) {
+        close();
+        if (error != nullptr) {
+            *error = "Corrupt trace file: " + path;
+        }
+        return false;
+    }
+    return true;
+}
+
+// Whether `entry` describes a well-formed chunk that lies before `end`: the
+// header matches the entry and the payload fits the encoding.
+bool TraceFileView::checkChunk(const TraceChunkIndexEntry& entry, uint64_t end) const {
+    if (entry.offset < sizeof(TraceFileHeader) || entry.offset % 8 != 0 || entry.offset > end ||
+        end - entry.offset < sizeof(TraceChunkHeader)) {
+        return false;
+    }
+    TraceChunkHeader header;
+    std::memcpy(&header, mBase + entry.offset, sizeof(header));
+    uint64_t rawSize = static_cast<uint64_t>(header.recordCount) * sizeof(BinaryTraceRecord);
+    auto encoding = static_cast<TraceChunkEncoding>(header.encoding);
+    return header.magic == kTraceChunkMagic && header.recordCount == entry.recordCount &&
+        header.encoding == entry.encoding && header.recordCount > 0 &&
+        header.firstCycle == entry.firstCycle && header.lastCycle == entry.lastCycle &&
+        header.firstCycle <= header.lastCycle &&
+        alignPayload(header.payloadSize) <= end - entry.offset - sizeof(header) &&
+        ((encoding == TraceChunkEncoding::Raw && header.payloadSize == rawSize) ||
+            (encoding == TraceChunkEncoding::ZeroRle && header.payloadSize < rawSize));
+}
+
+bool TraceFileView::loadFooterIndex(const TraceFileFooter& footer) {
+    const auto* chunks =
+        reinterpret_cast<const TraceChunkIndexEntry*>(mBase + footer.chunkIndexOffset);
+    uint64_t records = 0;
+    uint64_t chunkEnd = sizeof(TraceFileHeader);
+    for (uint64_t i = 0; i < footer.chunkCount; ++i) {
+        const TraceChunkIndexEntry& entry = chunks[i];
+        if (entry.offset < chunkEnd || entry.firstRecord != records ||
+            !checkChunk(entry, footer.chunkIndexOffset)) {
+            return false;
+        }
+        TraceChunkHeader header;
+        std::memcpy(&header, mBase + entry.offset, sizeof(header));
+        chunkEnd = entry.offset + sizeof(header) + alignPayload(header.payloadSize);
+        records += entry.recordCount;
+    }
+    const auto* pcs = reinterpret_cast<const TracePcIndexEntry*>(mBase + footer.pcIndexOffset);
+    for (uint64_t i = 0; i < footer.pcCount; ++i) {
+        if (pcs[i].chunk >= footer.chunkCount || (i > 0 && pcs[i].pc < pcs[i - 1].pc)) {
+            return false;
+        }
+    }
+    if (records != footer.recordCount) {
+        return false;
+    }
+    mChunks.assign(chunks, chunks + footer.chunkCount);
+    mPcs = pcs;
+    mPcCount = footer.pcCount;
+    mRecordCount = footer.recordCount;
+    mCyclesSorted = std::is_sorted(mChunks.begin(), mChunks.end(),
+        [](const TraceChunkIndexEntry& a, const TraceChunkIndexEntry& b) {
+            return a.lastCycle < b.lastCycle;
+        });
+    return true;
+}
+
+// Walks chunk headers from the start. The walk ends at the first offset
+// without a chunk header (the index of a partly written footer, or garbage
+// after a crash) or at a chunk cut short by the end of the file; a chunk
+// header that is whole but inconsistent makes the file corrupt.
+bool TraceFileView::rebuildChunkIndex() {
+    uint64_t offset = sizeof(TraceFileHeader);
+    mRecordCount = 0;
+    while (offset + sizeof(TraceChunkHeader) <= mSize) {
+        TraceChunkHeader header;
+        std::memcpy(&header, mBase + offset, sizeof(header));
+        uint64_t padded = alignPayload(header.payloadSize);
+        if (header.magic != kTraceChunkMagic || offset + sizeof(header) + padded > mSize) {
+            break;
+        }
+        TraceChunkIndexEntry entry;
+        entry.offset = offset;
+        entry.firstRecord = mRecordCount;
+        entry.firstCycle = header.firstCycle;
+        entry.lastCycle = header.lastCycle;
+        entry.recordCount = header.recordCount;
+        entry.encoding = header.encoding;
+        if (!checkChunk(entry, mSize)) {
+            return false;
+        }
+        mChunks.push_back(entry);
+        mRecordCount += header.recordCount;
+        offset += sizeof(header) + padded;
+    }
+    mCyclesSorted = std::is_sorted(mChunks.begin(), mChunks.end(),
+        [](const TraceChunkIndexEntry& a, const TraceChunkIndexEntry& b) {
+            return a.lastCycle < b.lastCycle;
+        });
+    return true;
+}
+
+void TraceFileView::close() {
+    if (mBase != nullptr) {
+        ::munmap(mBase, mSize);
+    }
+    mBase = nullptr;
+    mSize = 0;
+    mRecordCount = 0;
+    mChunks.clear();
+    mCyclesSorted = true;
+    mPcs = nullptr;
+    mPcCount = 0;
+    mCachedChunk = SIZE_MAX;
+    mCache.clear();
+}
+
+const BinaryTraceRecord* TraceFileView::chunkRecords(size_t chunk) {
+    const TraceChunkIndexEntry& entry = mChunks[chunk];
+    const uint8_t* payload = mBase + entry.offset + sizeof(TraceChunkHeader);
+    TraceChunkHeader header;
+    std::memcpy(&header, mBase + entry.offset, sizeof(header));
+    auto encoding = static_cast<TraceChunkEncoding>(entry.encoding);
+    if (encoding == TraceChunkEncoding::Raw) {
+        return reinterpret_cast<const BinaryTraceRecord*>(payload);
+    }
+    if (encoding != TraceChunkEncoding::ZeroRle) {
+        return nullptr;
+    }
+    if (mCachedChunk != chunk) {
+        mCache.resize(entry.recordCount);
+        if (!decodeZeroRle(payload, header.payloadSize, reinterpret_cast<uint8_t*>(mCache.data()),
+                mCache.size() * sizeof(BinaryTraceRecord))) {
+            mCachedChunk = SIZE_MAX;
+            return nullptr;
+        }
+        mCachedChunk = chunk;
+    }
+    return mCache.data();
+}
+
+size_t TraceFileView::chunkForRecord(uint64_t index) const {
+    auto it = std::upper_bound(mChunks.begin(), mChunks.end(), index,
+        [](uint64_t value, const TraceChunkIndexEntry& entry) {
+            return value < entry.firstRecord;
+        });
+    return static_cast<size_t>(it - mChunks.begin()) - 1;
+}
+
+bool TraceFileView::readRecord(uint64_t index, BinaryTraceRecord* out) {
+    if (index >= mRecordCount) {
+        return false;
+    }
+    size_t chunk = chunkForRecord(index);
+    const BinaryTraceRecord* records = chunkRecords(chunk);
+    if (records == nullptr) {
+        return false;
+    }
+    std::memcpy(out, &records[index - mChunks[chunk].firstRecord], sizeof(*out));
+    return true;
+}
+
+uint64_t TraceFileView::findCycle(uint64_t cycle) {
+    // Chunks before the first one reaching `cycle` hold no match. With
+    // ordered chunks that one is found by bisection; otherwise (harts
+    // interleaved out of cycle order) every chunk is a candidate.
+    auto it = mChunks.begin();
+    if (mCyclesSorted) {
+        it = std::lower_bound(mChunks.begin(), mChunks.end(), cycle,
+            [](const TraceChunkIndexEntry& entry, uint64_t value) {
+                return entry.lastCycle < value;
+            });
+    }
+    for (; it != mChunks.end(); ++it) {
+        if (it->lastCycle < cycle) {
+            continue;
+        }
+        const BinaryTraceRecord* records = chunkRecords(static_cast<size_t>(it - mChunks.begin()));
+        if (records == nullptr) {
+            continue;
+        }
+        for (uint32_t i = 0; i < it->recordCount; ++i) {
+            if (records[i].cycleBegin >= cycle) {
+                return it->firstRecord + i;
+            }
+        }
+    }
+    return mRecordCount;
+}
+
+std::vector<uint64_t> TraceFileView::findPc(uint64_t pc) {
+    std::vector<size_t> chunks;
+    if (mPcs != nullptr) {
+        const TracePcIndexEntry* end = mPcs + mPcCount;
+        const TracePcIndexEntry* it = std::lower_bound(mPcs, end, pc,
+            [](const TracePcIndexEntry& entry, uint64_t value) { return entry.pc < value; });
+        for (; it != end && it->pc == pc; ++it) {
+            chunks.push_back(static_cast<size_t>(it->chunk));
+        }
+    } else {
+        for (size_t i = 0; i < mChunks.size(); ++i) {
+            chunks.push_back(i);
+        }
+    }
+
+    std::vector<uint64_t> hits;
+    for (size_t chunk : chunks) {
+        const BinaryTraceRecord* records = chunkRecords(chunk);
+        if (records == nullptr) {
+            continue;
+        }
+        const TraceChunkIndexEntry& entry = mChunks[chunk];
+        for (uint32_t i = 0; i < entry.recordCount; ++i) {
+            if (records[i].pc == pc) {
+                hits.push_back(entry.firstRecord + i);
+            }
+        }
+    }
+    return hits;
+}
@@ -1,8 +1,20 @@
 #include "emulator/device/device.h"
 
+#include <algorithm>
+#include <utility>
+
 Device::Device() = default;
 
+Device::~Device() {
+    if (mScheduler && mSyncEvent != 0) {
+        mScheduler->cancel(mSyncEvent);
+    }
+}
+
 MemResponse Device::read(const MemAccess& access) {
+    if (mDispatch.read != nullptr) {
+        return mDispatch.read(this, access);
+    }
     if (mReadHandler) {
         return mReadHandler(access);
     }
@@ -15,6 +27,9 @@ MemResponse Device::read(const MemAccess& access) {
 }
 
 MemResponse Device::write(const MemAccess& access) {
+    if (mDispatch.write != nullptr) {
+        return mDispatch.write(this, access);
+    }
     if (mWriteHandler) {
         return mWriteHandler(access);
     }
@@ -26,8 +41,51 @@ MemResponse Device::write(const MemAccess& access) {
     return response;
 }
 
+MemResponse Device::atomic(const MemAccess& access) {
+    if (mDispatch.atomic != nullptr) {
+        return mDispatch.atomic(this, access);
+    }
+    if (mAtomicHandler) {
+        return mAtomicHandler(access);
+    }
+    bool emulated = access.type == MemAccessType::AtomicRmw ||
+        access.type == MemAccessType::CompareExchange;
+    if (!emulated) {
+        MemResponse response;
+        response.success = false;
+        response.error.type = CpuErrorType::DeviceFault;
+        response.error.address = access.address;
+        response.error.size = access.size;
+        return response;
+    }
+
+    MemAccess load = access;
+    load.type = MemAccessType::Read;
+    MemResponse old = read(load);
+    if (!old.success) {
+        return old;
+    }
+    uint64_t value = access.data;
+    if (access.type == MemAccessType::AtomicRmw) {
+        value = applyAtomicOp(access.atomicOp, old.data, access.data, access.size);
+    } else if (old.data != access.expected) {
+        return old;
+    }
+    MemAccess store = access;
+    store.type = MemAccessType::Write;
+    store.data = value;
+    MemResponse written = write(store);
+    if (!written.success) {
+        return written;
+    }
+    old.latencyCycles += written.latencyCycles;
+    return old;
+}
+
 void Device::tick(uint64_t cycles) {
-    if (mTickHandler) {
+    if (mDispatch.tick != nullptr) {
+        mDispatch.tick(this, cycles);
+    } else if (mTickHandler) {
         mTickHandler(cycles);
     }
 }
@@ -48,6 +106,10 @@ DeviceType Device::getType() const {
     return mType;
 }
 
+void Device::setAtomicHandler(AtomicHandler handler) {
+    mAtomicHandler = std::move(handler);
+}
+
 void Device::setReadHandler(ReadHandler handler) {
     mReadHandler = std::move(handler);
 }
@@ -58,6 +120,22 @@ void Device::setWriteHandler(WriteHandler handler) {
 
 void Device::setTickHandler(TickHandler handler) {
     mTickHandler = std::move(handler);
+    scheduleSync();
+}
+
+void Device::setInterruptHandler(InterruptHandler handler) {
+    mInterruptHandler = std::move(handler);
+}
+
+bool Device::getInterruptLevel() const {
+    return mInterruptLevel.load(std::memory_order_acquire);
+}
+
+void Device::setInterruptLevel(bool asserted) {
+    if (mInterruptLevel.exchange(asserted, std::memory_order_acq_rel) != asserted &&
+        mInterruptHandler) {
+        mInterruptHandler(asserted);
+    }
 }
 
 void Device::setType(DeviceType type) {
@@ -66,4 +144,50 @@ void Device::setType(DeviceType type) {
 
 void Device::setSyncThreshold(uint64_t threshold) {
     mSyncThreshold = threshold;
+    scheduleSync();
+}
+
+void Device::attachScheduler(std::shared_ptr<EventScheduler> scheduler) {
+    if (mScheduler && mSyncEvent != 0) {
+        mScheduler->cancel(mSyncEvent);
+        mSyncEvent = 0;
+    }
+    mScheduler = std::move(scheduler);
+    scheduleSync();
+}
+
+DeviceSnapshot Device::snapshot() {
+    DeviceSnapshot out;
+    out.lastSyncCycle = mLastSyncCycle;
+    out.state = saveState();
+    return out;
+}
+
+bool Device::restore(const DeviceSnapshot& snapshot) {
+    if (!restoreState(snapshot.state)) {
+        return false;
+    }
+    mLastSyncCycle = snapshot.lastSyncCycle;
+    mSyncEvent = 0;
+    scheduleSync();
+    return true;
+}
+
+void Device::scheduleSync() {
+    if (!mScheduler) {
+        return;
+    }
+    if (mSyncEvent != 0) {
+        mScheduler->cancel(mSyncEvent);
+        mSyncEvent = 0;
+    }
+    if (!mTickHandler && mDispatch.tick == nullptr) {
+        return;
+    }
+    uint64_t due = mLastSyncCycle + std::max<uint64_t>(mSyncThreshold, 1);
+    mSyncEvent = mScheduler->schedule(due, [this](uint64_t now) {
+        mSyncEvent = 0;
+        sync(now);
+        scheduleSync();
+    });
 }
@@ -1,9 +1,15 @@
 #include "emulator/device/display.h"
+#include "emulator/device/wide_copy.h"
+#include "emulator/logging/logger.h"
 
+#include <algorithm>
+#include <bit>
 #include <cstring>
 
 #include <SDL2/SDL.h>
+#include <chrono>
 #include <mutex>
+#include <thread>
 
 struct SdlDisplayDevice::SdlDisplayState {
     SDL_Window* window = nullptr;
@@ -25,6 +31,20 @@ constexpr uint64_t kRegStatus = 0x10;
 constexpr uint64_t kRegKeyData = 0x20;
 constexpr uint64_t kRegKeyStatus = 0x24;
 constexpr uint64_t kRegKeyLast = 0x28;
+// Blitter: the parameters are plain registers, a command write runs it.
+constexpr uint64_t kRegBlitDstX = 0x40;
+constexpr uint64_t kRegBlitColor = 0x58;
+constexpr uint64_t kRegBlitCmd = 0x5c;
+constexpr uint64_t kBlitDstX = 0;
+constexpr uint64_t kBlitDstY = 1;
+constexpr uint64_t kBlitSrcX = 2;
+constexpr uint64_t kBlitSrcY = 3;
+constexpr uint64_t kBlitWidth = 4;
+constexpr uint64_t kBlitHeight = 5;
+constexpr uint64_t kBlitColor = 6;
+constexpr uint64_t kBlitCmdFill = 1;
+constexpr uint64_t kBlitCmdCopy = 2;
+constexpr uint32_t kBytesPerPixel = 4;
 
 constexpr uint64_t kStatusReady = 1ull << 0;
 constexpr uint64_t kStatusDirty = 1ull << 1;
@@ -35,8 +55,6 @@ constexpr uint32_t kKeyStatusReady = 1u << 0;
 SdlDisplayDevice::SdlDisplayDevice()
     : mState(new SdlDisplayState()) {
     setType(DeviceType::Display);
-    setReadHandler([this](const MemAccess& access) { return handleRead(access); });
-    setWriteHandler([this](const MemAccess& access) { return handleWrite(access); });
 }
 
 SdlDisplayDevice::~SdlDisplayDevice() {
@@ -74,7 +92,7 @@ bool SdlDisplayDevice::init(uint32_t width, uint32_t height, const char* title)
     std::memset(mState->frameBuffer, 0, static_cast<size_t>(width) * height * 4);
     mState->ready = true;
     mState->headless = false;
-    mDirty.store(true, std::memory_order_release);
+    resetFrames();
     return true;
 }
 
@@ -89,7 +107,7 @@ bool SdlDisplayDevice::initHeadless(uint32_t width, uint32_t height) {
     std::memset(mState->frameBuffer, 0, static_cast<size_t>(width) * height * 4);
     mState->ready = true;
     mState->headless = true;
-    mDirty.store(true, std::memory_order_release);
+    resetFrames();
     return true;
 }
 
@@ -115,6 +133,14 @@ void SdlDisplayDevice::shutdown() {
     mState->width = 0;
     mState->height = 0;
     mState->ready = false;
+    if (mScheduler != nullptr && mVsyncEvent != 0) {
+        mScheduler->cancel(mVsyncEvent);
+    }
+    mVsyncEvent = 0;
+    mDirtyRows.clear();
+    for (FrameSlot& slot : mSlots) {
+        slot = FrameSlot();
+    }
     mDirty.store(false, std::memory_order_release);
     mPresentRequested.store(false, std::memory_order_release);
 }
@@ -128,33 +154,48 @@ void SdlDisplayDevice::pollEvents(uint32_t timeoutMs) {
         return;
     }
     if (mState->headless) {
+        // Nothing to poll; wait as the SDL path would so the caller's loop
+        // does not spin.
+        if (timeoutMs > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+        }
         return;
     }
     SDL_Event event;
     if (timeoutMs > 0) {
         if (SDL_WaitEventTimeout(&event, static_cast<int>(timeoutMs)) != 0) {
-            std::lock_guard<std::mutex> lock(mInputMutex);
             if (event.type == SDL_QUIT) {
+                std::lock_guard<std::mutex> lock(mInputMutex);
                 mQuitRequested = true;
             }
             if (event.type == SDL_KEYDOWN) {
-                mLastKey = static_cast<uint32_t>(event.key.keysym.sym);
-                mKeyQueue.push_back(mLastKey);
+                deliverHostKey(static_cast<uint32_t>(event.key.keysym.sym));
             }
         }
     }
     while (SDL_PollEvent(&event)) {
-        std::lock_guard<std::mutex> lock(mInputMutex);
         if (event.type == SDL_QUIT) {
+            std::lock_guard<std::mutex> lock(mInputMutex);
             mQuitRequested = true;
         }
         if (event.type == SDL_KEYDOWN) {
-            mLastKey = static_cast<uint32_t>(event.key.keysym.sym);
-            mKeyQueue.push_back(mLastKey);
+            deliverHostKey(static_cast<uint32_t>(event.key.keysym.sym));
         }
     }
 }
 
+void SdlDisplayDevice::deliverHostKey(uint32_t key) {
+    if (mKeyHandler) {
+        mKeyHandler(key);
+    } else {
+        pushKey(key);
+    }
+}
+
+void SdlDisplayDevice::setKeyHandler(std::function<void(uint32_t)> handler) {
+    mKeyHandler = std::move(handler);
+}
+
 bool SdlDisplayDevice::isQuitRequested() const {
     std::lock_guard<std::mutex> lock(mInputMutex);
     return mQuitRequested;
@@ -201,21 +242,231 @@ bool SdlDisplayDevice::consumePresentRequest() {
     return mPresentRequested.exchange(false, std::memory_order_acq_rel);
 }
 
+void SdlDisplayDevice::resetFrames() {
+    size_t fbSize = static_cast<size_t>(getFrameBufferSize());
+    size_t words = (getHeight() + 63) / 64;
+    for (uint32_t i = 0; i < kFrameSlots; ++i) {
+        mSlots[i].pixels.assign(fbSize, 0);
+        mSlots[i].rows.assign(words, 0);
+        mSlots[i].sequence = 0;
+        mStaleRows[i].assign(words, 0);
+    }
+    mBackSlot = 0;
+    mReadySlot.store(1, std::memory_order_release);
+    mFrontSlot = 2;
+    mPublishedSequence = 0;
+    mPresentedSequence = 0;
+    markAllRowsDirty();
+}
+
+void SdlDisplayDevice::markRowsDirty(uint64_t fbOffset, uint64_t length) {
+    uint64_t pitch = getPitch();
+    if (pitch == 0 || length == 0) {
+        return;
+    }
+    uint64_t first = fbOffset / pitch;
+    uint64_t last = (fbOffset + length - 1) / pitch;
+    for (uint64_t row = first; row <= last && (row >> 6) < mDirtyRows.size(); ++row) {
+        mDirtyRows[row >> 6] |= 1ull << (row & 63);
+    }
+    mDirty.store(true, std::memory_order_release);
+    armVsync();
+}
+
+void SdlDisplayDevice::markAllRowsDirty() {
+    uint32_t height = getHeight();
+    mDirtyRows.assign((height + 63) / 64, ~0ull);
+    if (height % 64 != 0) {
+        mDirtyRows.back() = (1ull << (height % 64)) - 1;
+    }
+    mDirty.store(true, std::memory_order_release);
+    armVsync();
+}
+
+void SdlDisplayDevice::setVsyncInterval(uint64_t cycles) {
+    mVsyncInterval = cycles;
+}
+
+// Vsync is only armed while rows are dirty, so an idle display adds no
+// events that would cut CPU batches short.
+void SdlDisplayDevice::armVsync() {
+    if (mVsyncInterval == 0 || mScheduler == nullptr || mVsyncEvent != 0) {
+        return;
+    }
+    uint64_t next = (mScheduler->now() / mVsyncInterval + 1) * mVsyncInterval;
+    mVsyncEvent = mScheduler->schedule(next, [this](uint64_t) {
+        mVsyncEvent = 0;
+        publishFrame();
+    });
+}
+
+std::vector<SdlDisplayDevice::DirtyBand> SdlDisplayDevice::collectBands(
+    const std::vector<uint64_t>& rows, uint32_t height) {
+    std::vector<DirtyBand> bands;
+    for (uint32_t row = 0; row < height && (row >> 6) < rows.size(); ++row) {
+        if (((rows[row >> 6] >> (row & 63)) & 1u) == 0) {
+            continue;
+        }
+        if (!bands.empty() && bands.back().firstRow + bands.back().rowCount == row) {
+            ++bands.back().rowCount;
+        } else {
+            bands.push_back(DirtyBand{row, 1});
+        }
+    }
+    return bands;
+}
+
+std::vector<SdlDisplayDevice::DirtyBand> SdlDisplayDevice::getDirtyBands() const {
+    return collectBands(mDirtyRows, getHeight());
+}
+
+bool SdlDisplayDevice::publishFrame() {
+    if (mState == nullptr || mState->frameBuffer == nullptr ||
+        !mDirty.load(std::memory_order_acquire)) {
+        return false;
+    }
+    for (auto& stale : mStaleRows) {
+        for (size_t i = 0; i < stale.size(); ++i) {
+            stale[i] |= mDirtyRows[i];
+        }
+    }
+    FrameSlot& back = mSlots[mBackSlot];
+    size_t pitch = getPitch();
+    for (const DirtyBand& band : collectBands(mStaleRows[mBackSlot], getHeight())) {
+        size_t offset = static_cast<size_t>(band.firstRow) * pitch;
+        std::memcpy(back.pixels.data() + offset, mState->frameBuffer + offset,
+            static_cast<size_t>(band.rowCount) * pitch);
+    }
+    std::fill(mStaleRows[mBackSlot].begin(), mStaleRows[mBackSlot].end(), 0);
+    back.rows = mDirtyRows;
+    back.sequence = ++mPublishedSequence;
+    std::fill(mDirtyRows.begin(), mDirtyRows.end(), 0);
+    mDirty.store(false, std::memory_order_release);
+
+    uint32_t previous = mReadySlot.exchange(mBackSlot | kSlotFresh, std::memory_order_acq_rel);
+    mBackSlot = previous & ~kSlotFresh;
+    // The vsync interrupt is an edge per published frame.
+    setInterruptLevel(true);
+    setInterruptLevel(false);
+    return true;
+}
+
+bool SdlDisplayDevice::hasPendingFrame() const {
+    return (mReadySlot.load(std::memory_order_acquire) & kSlotFresh) != 0;
+}
+
 void SdlDisplayDevice::present() {
-    if (mState == nullptr || !mState->ready) {
+    if (mState == nullptr || !mState->ready || !hasPendingFrame()) {
         return;
     }
+    uint32_t previous = mReadySlot.exchange(mFrontSlot, std::memory_order_acq_rel);
+    mFrontSlot = previous & ~kSlotFresh;
+    const FrameSlot& frame = mSlots[mFrontSlot];
+    bool dropped = frame.sequence != mPresentedSequence + 1;
+    mPresentedSequence = frame.sequence;
+    if (mFrameSink != nullptr && mFramesPresented++ % mFrameEvery == 0) {
+        FrameView view;
+        view.pixels = frame.pixels.data();
+        view.width = mState->width;
+        view.height = mState->height;
+        view.pitch = getPitch();
+        view.sequence = frame.sequence;
+        std::string error;
+        if (!mFrameSink->write(view, &error)) {
+            WARN("Frame output stopped: %s", error.c_str());
+            mFrameSink.reset();
+        }
+    }
     if (mState->headless) {
-        mDirty.store(false, std::memory_order_release);
         return;
     }
-    std::lock_guard<std::mutex> lock(mFrameMutex);
-    SDL_UpdateTexture(mState->texture, nullptr, mState->frameBuffer,
-        static_cast<int>(mState->width) * 4);
+    int pitch = static_cast<int>(getPitch());
+    std::vector<DirtyBand> bands = dropped ?
+        std::vector<DirtyBand>{DirtyBand{0, mState->height}} :
+        collectBands(frame.rows, mState->height);
+    for (const DirtyBand& band : bands) {
+        SDL_Rect rect{0, static_cast<int>(band.firstRow), static_cast<int>(mState->width),
+            static_cast<int>(band.rowCount)};
+        SDL_UpdateTexture(mState->texture, &rect,
+            frame.pixels.data() + static_cast<size_t>(band.firstRow) * pitch, pitch);
+    }
     SDL_RenderClear(mState->renderer);
     SDL_RenderCopy(mState->renderer, mState->texture, nullptr, nullptr);
     SDL_RenderPresent(mState->renderer);
-    mDirty.store(false, std::memory_order_release);
+}
+
+void SdlDisplayDevice::setFrameSink(std::unique_ptr<FrameSink> sink, uint32_t every) {
+    mFrameSink = std::move(sink);
+    mFrameEvery = every == 0 ? 1 : every;
+    mFramesPresented = 0;
+}
+
+// Window and renderer handles are host state and stay as they are; a restore
+// marks every row dirty so the restored contents get published.
+std::shared_ptr<const DeviceState> SdlDisplayDevice::saveState() {
+    StateWriter out;
+    {
+        std::lock_guard<std::mutex> lock(mInputMutex);
+        out.put<uint32_t>(mLastKey);
+        out.put<uint64_t>(mKeyQueue.size());
+        for (uint32_t key : mKeyQueue) {
+            out.put(key);
+        }
+    }
+    out.put(mBlit);
+    uint64_t fbSize = mState != nullptr && mState->frameBuffer != nullptr ?
+        getFrameBufferSize() : 0;
+    out.put<uint64_t>(fbSize);
+    if (fbSize > 0) {
+        out.putBytes(mState->frameBuffer, static_cast<size_t>(fbSize));
+    }
+    auto state = std::make_shared<ByteState>();
+    state->bytes = out.take();
+    return state;
+}
+
+bool SdlDisplayDevice::restoreState(const std::shared_ptr<const DeviceState>& state) {
+    auto bytes = std::dynamic_pointer_cast<const ByteState>(state);
+    if (!bytes) {
+        return false;
+    }
+    StateReader in(bytes->bytes);
+    uint32_t lastKey = 0;
+    uint64_t count = 0;
+    if (!in.get(&lastKey) || !in.get(&count)) {
+        return false;
+    }
+    std::deque<uint32_t> keys;
+    for (uint64_t i = 0; i < count; ++i) {
+        uint32_t key = 0;
+        if (!in.get(&key)) {
+            return false;
+        }
+        keys.push_back(key);
+    }
+    std::array<uint32_t, kBlitRegisters> blit{};
+    if (!in.get(&blit)) {
+        return false;
+    }
+    uint64_t fbSize = 0;
+    uint64_t expected = mState != nullptr && mState->frameBuffer != nullptr ?
+        getFrameBufferSize() : 0;
+    if (!in.get(&fbSize) || fbSize != expected) {
+        return false;
+    }
+    if (fbSize > 0 && !in.getBytes(mState->frameBuffer, static_cast<size_t>(fbSize))) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mInputMutex);
+        mLastKey = lastKey;
+        mKeyQueue.swap(keys);
+    }
+    mBlit = blit;
+    // The scheduler was cleared by the restore, taking the vsync event along.
+    mVsyncEvent = 0;
+    markAllRowsDirty();
+    return true;
 }
 
 uint32_t SdlDisplayDevice::getUpdateFrequency() const {
@@ -258,12 +509,21 @@ bool SdlDisplayDevice::readRegister(uint64_t offset, uint64_t* value) {
         *value = getPitch();
         return true;
     }
+    if (offset >= kRegBlitDstX && offset <= kRegBlitColor && (offset & 3) == 0) {
+        *value = mBlit[(offset - kRegBlitDstX) / 4];
+        return true;
+    }
+    if (offset == kRegBlitCmd) {
+        // Commands finish before the write returns.
+        *value = 0;
+        return true;
+    }
     if (offset == kRegStatus) {
         uint64_t status = 0;
         if (isReady()) {
             status |= kStatusReady;
         }
-        if (mDirty.load(std::memory_order_acquire)) {
+        if (mDirty.load(std::memory_order_acquire) || hasPendingFrame()) {
             status |= kStatusDirty;
         }
         *value = status;
@@ -275,10 +535,18 @@ bool SdlDisplayDevice::readRegister(uint64_t offset, uint64_t* value) {
 bool SdlDisplayDevice::writeRegister(uint64_t offset, uint64_t value) {
     if (offset == kRegCtrl) {
         if ((value & 1u) != 0) {
+            publishFrame();
             mPresentRequested.store(true, std::memory_order_release);
         }
         return true;
     }
+    if (offset >= kRegBlitDstX && offset <= kRegBlitColor && (offset & 3) == 0) {
+        mBlit[(offset - kRegBlitDstX) / 4] = static_cast<uint32_t>(value);
+        return true;
+    }
+    if (offset == kRegBlitCmd) {
+        return runBlit(value);
+    }
     if (offset == kRegKeyStatus) {
         std::lock_guard<std::mutex> lock(mInputMutex);
         (void)value;
@@ -289,9 +557,76 @@ bool SdlDisplayDevice::writeRegister(uint64_t offset, uint64_t value) {
     return false;
 }
 
+// Both rectangles are clipped to the screen, and a copy to the overlapping
+// part of the two. Overlapping copies move rows and pixels as if through a
+// temporary buffer.
+bool SdlDisplayDevice::runBlit(uint64_t command) {
+    if (command != kBlitCmdFill && command != kBlitCmdCopy) {
+        return false;
+    }
+    if (mState == nullptr || mState->frameBuffer == nullptr) {
+        return true;
+    }
+    bool copy = command == kBlitCmdCopy;
+    uint32_t screenWidth = getWidth();
+    uint32_t screenHeight = getHeight();
+    uint32_t dstX = mBlit[kBlitDstX];
+    uint32_t dstY = mBlit[kBlitDstY];
+    uint32_t srcX = copy ? mBlit[kBlitSrcX] : 0;
+    uint32_t srcY = copy ? mBlit[kBlitSrcY] : 0;
+    if (dstX >= screenWidth || dstY >= screenHeight || srcX >= screenWidth ||
+        srcY >= screenHeight) {
+        return true;
+    }
+    uint32_t width = std::min({mBlit[kBlitWidth], screenWidth - dstX, screenWidth - srcX});
+    uint32_t height = std::min({mBlit[kBlitHeight], screenHeight - dstY, screenHeight - srcY});
+    if (width == 0 || height == 0) {
+        return true;
+    }
+
+    size_t pitch = getPitch();
+    uint8_t* frameBuffer = mState->frameBuffer;
+    size_t rowBytes = static_cast<size_t>(width) * kBytesPerPixel;
+    for (uint32_t i = 0; i < height; ++i) {
+        // Bottom-up when moving down, so no source row is overwritten first.
+        uint32_t row = copy && dstY > srcY ? height - 1 - i : i;
+        uint8_t* dst = frameBuffer + (dstY + row) * pitch + dstX * kBytesPerPixel;
+        if (copy) {
+            std::memmove(dst, frameBuffer + (srcY + row) * pitch + srcX * kBytesPerPixel,
+                rowBytes);
+        } else {
+            fillPixels(dst, mBlit[kBlitColor], width);
+        }
+    }
+    markRowsDirty(static_cast<uint64_t>(dstY) * pitch, static_cast<uint64_t>(height) * pitch);
+    return true;
+}
+
+bool SdlDisplayDevice::readBlock(uint64_t offset, uint8_t* out, uint64_t length) {
+    uint64_t mappedSize = getMappedSize();
+    if (mState == nullptr || mState->frameBuffer == nullptr || offset < kFrameBufferOffset ||
+        offset >= mappedSize || length > mappedSize - offset) {
+        return false;
+    }
+    std::memcpy(out, mState->frameBuffer + (offset - kFrameBufferOffset), length);
+    return true;
+}
+
+bool SdlDisplayDevice::writeBlock(uint64_t offset, const uint8_t* data, uint64_t length) {
+    uint64_t mappedSize = getMappedSize();
+    if (mState == nullptr || mState->frameBuffer == nullptr || offset < kFrameBufferOffset ||
+        offset >= mappedSize || length > mappedSize - offset) {
+        return false;
+    }
+    std::memcpy(mState->frameBuffer + (offset - kFrameBufferOffset), data, length);
+    markRowsDirty(offset - kFrameBufferOffset, length);
+    return true;
+}
+
 MemResponse SdlDisplayDevice::handleRead(const MemAccess& access) {
     MemResponse response;
-    if (mState == nullptr || access.size == 0 || access.size > sizeof(uint64_t)) {
+    if (mState == nullptr || access.size == 0 ||
+        (access.size > sizeof(uint64_t) && !isWideAccess(access))) {
         response.success = false;
         response.error.type = CpuErrorType::AccessFault;
         response.error.address = access.address;
@@ -308,7 +643,7 @@ MemResponse SdlDisplayDevice::handleRead(const MemAccess& access) {
     }
     if (access.address < kFrameBufferOffset) {
         uint64_t value = 0;
-        if (!readRegister(access.address, &value)) {
+        if (access.size > sizeof(uint64_t) || !readRegister(access.address, &value)) {
             response.success = false;
             response.error.type = CpuErrorType::AccessFault;
             response.error.address = access.address;
@@ -320,11 +655,19 @@ MemResponse SdlDisplayDevice::handleRead(const MemAccess& access) {
         return response;
     }
     uint64_t fbOffset = access.address - kFrameBufferOffset;
-    std::lock_guard<std::mutex> lock(mFrameMutex);
+    const uint8_t* src = mState->frameBuffer + static_cast<size_t>(fbOffset);
+    if (access.size > sizeof(uint64_t)) {
+        copyWide(access.wide, src, access.size);
+        response.success = true;
+        return response;
+    }
     uint64_t value = 0;
-    for (uint32_t i = 0; i < access.size; ++i) {
-        value |= static_cast<uint64_t>(mState->frameBuffer[static_cast<size_t>(fbOffset + i)])
-            << (8 * i);
+    if constexpr (std::endian::native == std::endian::little) {
+        std::memcpy(&value, src, access.size);
+    } else {
+        for (uint32_t i = 0; i < access.size; ++i) {
+            value |= static_cast<uint64_t>(src[i]) << (8 * i);
+        }
     }
     response.success = true;
     response.data = value;
@@ -333,7 +676,8 @@ MemResponse SdlDisplayDevice::handleRead(const MemAccess& access) {
 
 MemResponse SdlDisplayDevice::handleWrite(const MemAccess& access) {
     MemResponse response;
-    if (mState == nullptr || access.size == 0 || access.size > sizeof(uint64_t)) {
+    if (mState == nullptr || access.size == 0 ||
+        (access.size > sizeof(uint64_t) && !isWideAccess(access))) {
         response.success = false;
         response.error.type = CpuErrorType::AccessFault;
         response.error.address = access.address;
@@ -349,7 +693,7 @@ MemResponse SdlDisplayDevice::handleWrite(const MemAccess& access) {
         return response;
     }
     if (access.address < kFrameBufferOffset) {
-        if (!writeRegister(access.address, access.data)) {
+        if (access.size > sizeof(uint64_t) || !writeRegister(access.address, access.data)) {
             response.success = false;
             response.error.type = CpuErrorType::AccessFault;
             response.error.address = access.address;
@@ -360,14 +704,19 @@ MemResponse SdlDisplayDevice::handleWrite(const MemAccess& access) {
         return response;
     }
     uint64_t fbOffset = access.address - kFrameBufferOffset;
-    std::lock_guard<std::mutex> lock(mFrameMutex);
+    uint8_t* dst = mState->frameBuffer + static_cast<size_t>(fbOffset);
     uint64_t value = access.data;
-    for (uint32_t i = 0; i < access.size; ++i) {
-        mState->frameBuffer[static_cast<size_t>(fbOffset + i)] =
-            static_cast<uint8_t>(value & 0xff);
-        value >>= 8;
+    if (access.size > sizeof(uint64_t)) {
+        copyWide(dst, access.wide, access.size);
+    } else if constexpr (std::endian::native == std::endian::little) {
+        std::memcpy(dst, &value, access.size);
+    } else {
+        for (uint32_t i = 0; i < access.size; ++i) {
+            dst[i] = static_cast<uint8_t>(value & 0xff);
+            value >>= 8;
+        }
     }
-    mDirty.store(true, std::memory_order_release);
+    markRowsDirty(fbOffset, access.size);
     response.success = true;
     return response;
 }
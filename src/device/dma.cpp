@@ -0,0 +1,214 @@
+#include "emulator/device/dma.h"
+
+#include <algorithm>
+
+#include "emulator/bus/bus.h"
+
+namespace {
+constexpr uint64_t kDmaSrcLowOffset = 0x00;
+constexpr uint64_t kDmaSrcHighOffset = 0x04;
+constexpr uint64_t kDmaDstLowOffset = 0x08;
+constexpr uint64_t kDmaDstHighOffset = 0x0C;
+constexpr uint64_t kDmaLenOffset = 0x10;
+constexpr uint64_t kDmaCtrlOffset = 0x14;
+constexpr uint64_t kDmaStatusOffset = 0x18;
+constexpr uint64_t kDmaDescLowOffset = 0x1C;
+constexpr uint64_t kDmaDescHighOffset = 0x20;
+constexpr uint32_t kDmaRegSize = 4;
+
+constexpr uint32_t kCtrlStart = 1u << 0;
+constexpr uint32_t kCtrlChain = 1u << 1;
+
+constexpr uint32_t kStatusBusy = 1u << 0;
+constexpr uint32_t kStatusDone = 1u << 1;
+constexpr uint32_t kStatusError = 1u << 2;
+
+// Large transfers are copied through a bounded staging buffer.
+constexpr uint64_t kChunkBytes = 64 * 1024;
+
+MemResponse makeFault(const MemAccess& access) {
+    MemResponse response;
+    response.success = false;
+    response.error.type = CpuErrorType::AccessFault;
+    response.error.address = access.address;
+    response.error.size = access.size;
+    return response;
+}
+
+uint64_t readLe64(const uint8_t* bytes) {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; --i) {
+        value = (value << 8) | bytes[i];
+    }
+    return value;
+}
+
+void setLow(uint64_t* reg, uint32_t value) {
+    *reg = (*reg & ~0xffffffffull) | value;
+}
+
+void setHigh(uint64_t* reg, uint32_t value) {
+    *reg = (*reg & 0xffffffffull) | (static_cast<uint64_t>(value) << 32);
+}
+}
+
+DmaDevice::DmaDevice(MemoryBus* bus) : mBus(bus) {
+    setType(DeviceType::Dma);
+}
+
+DmaDevice::~DmaDevice() {
+    if (mScheduler && mEvent != 0) {
+        mScheduler->cancel(mEvent);
+    }
+}
+
+uint64_t DmaDevice::transferCycles(uint64_t length) {
+    return kSetupCycles + length / kBytesPerCycle + (length % kBytesPerCycle != 0 ? 1 : 0);
+}
+
+std::shared_ptr<const DeviceState> DmaDevice::saveState() {
+    StateWriter out;
+    out.put(mSource);
+    out.put(mDestination);
+    out.put(mLength);
+    out.put(mDescriptor);
+    out.put(mStatus);
+    out.put(mCurrent);
+    out.put(mDueCycle);
+    auto state = std::make_shared<ByteState>();
+    state->bytes = out.take();
+    return state;
+}
+
+bool DmaDevice::restoreState(const std::shared_ptr<const DeviceState>& state) {
+    auto bytes = std::dynamic_pointer_cast<const ByteState>(state);
+    if (!bytes) {
+        return false;
+    }
+    StateReader in(bytes->bytes);
+    if (!in.get(&mSource) || !in.get(&mDestination) || !in.get(&mLength) ||
+        !in.get(&mDescriptor) || !in.get(&mStatus) || !in.get(&mCurrent) ||
+        !in.get(&mDueCycle)) {
+        return false;
+    }
+    // The scheduler was cleared by the restore; re-arm an in-flight transfer.
+    mEvent = 0;
+    if ((mStatus & kStatusBusy) != 0) {
+        arm(mDueCycle);
+    }
+    return true;
+}
+
+void DmaDevice::start(bool chained) {
+    if ((mStatus & kStatusBusy) != 0 || mScheduler == nullptr || mBus == nullptr) {
+        return;
+    }
+    mStatus = kStatusBusy;
+    if (chained) {
+        if (!loadDescriptor(mDescriptor)) {
+            finish(false);
+            return;
+        }
+    } else {
+        mCurrent = Transfer{mSource, mDestination, mLength, 0};
+    }
+    arm(mScheduler->currentCycle() + transferCycles(mCurrent.length));
+}
+
+bool DmaDevice::loadDescriptor(uint64_t address) {
+    uint8_t bytes[kDescriptorSize];
+    if (!mBus->readBlock(address, bytes, sizeof(bytes))) {
+        return false;
+    }
+    mCurrent.source = readLe64(bytes);
+    mCurrent.destination = readLe64(bytes + 8);
+    mCurrent.length = readLe64(bytes + 16);
+    mCurrent.next = readLe64(bytes + 24);
+    return true;
+}
+
+void DmaDevice::arm(uint64_t cycle) {
+    mDueCycle = cycle;
+    mEvent = mScheduler->schedule(cycle, [this](uint64_t) {
+        mEvent = 0;
+        complete();
+    });
+}
+
+void DmaDevice::complete() {
+    if (!copy(mCurrent)) {
+        finish(false);
+        return;
+    }
+    if (mCurrent.next == 0) {
+        finish(true);
+        return;
+    }
+    if (!loadDescriptor(mCurrent.next)) {
+        finish(false);
+        return;
+    }
+    // Chain from the cycle this transfer was due, not from when runDue got to
+    // it, so the timing does not depend on the CPU batch length.
+    arm(mDueCycle + transferCycles(mCurrent.length));
+}
+
+bool DmaDevice::copy(const Transfer& transfer) {
+    mBuffer.resize(static_cast<size_t>(std::min(transfer.length, kChunkBytes)));
+    for (uint64_t offset = 0; offset < transfer.length; offset += kChunkBytes) {
+        uint64_t chunk = std::min(kChunkBytes, transfer.length - offset);
+        if (!mBus->readBlock(transfer.source + offset, mBuffer.data(), chunk) ||
+            !mBus->writeBlock(transfer.destination + offset, mBuffer.data(), chunk)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void DmaDevice::finish(bool ok) {
+    mStatus = ok ? kStatusDone : kStatusError;
+}
+
+MemResponse DmaDevice::handleRead(const MemAccess& access) {
+    if (access.size != kDmaRegSize) {
+        return makeFault(access);
+    }
+    MemResponse response;
+    switch (access.address) {
+        case kDmaSrcLowOffset: response.data = static_cast<uint32_t>(mSource); break;
+        case kDmaSrcHighOffset: response.data = static_cast<uint32_t>(mSource >> 32); break;
+        case kDmaDstLowOffset: response.data = static_cast<uint32_t>(mDestination); break;
+        case kDmaDstHighOffset: response.data = static_cast<uint32_t>(mDestination >> 32); break;
+        case kDmaLenOffset: response.data = mLength; break;
+        case kDmaCtrlOffset: response.data = 0; break;
+        case kDmaStatusOffset: response.data = mStatus; break;
+        case kDmaDescLowOffset: response.data = static_cast<uint32_t>(mDescriptor); break;
+        case kDmaDescHighOffset: response.data = static_cast<uint32_t>(mDescriptor >> 32); break;
+        default: return makeFault(access);
+    }
+    return response;
+}
+
+MemResponse DmaDevice::handleWrite(const MemAccess& access) {
+    if (access.size != kDmaRegSize) {
+        return makeFault(access);
+    }
+    uint32_t value = static_cast<uint32_t>(access.data);
+    switch (access.address) {
+        case kDmaSrcLowOffset: setLow(&mSource, value); break;
+        case kDmaSrcHighOffset: setHigh(&mSource, value); break;
+        case kDmaDstLowOffset: setLow(&mDestination, value); break;
+        case kDmaDstHighOffset: setHigh(&mDestination, value); break;
+        case kDmaLenOffset: mLength = value; break;
+        case kDmaCtrlOffset:
+            if ((value & (kCtrlStart | kCtrlChain)) != 0) {
+                start((value & kCtrlChain) != 0);
+            }
+            break;
+        case kDmaStatusOffset: mStatus &= ~(value & (kStatusDone | kStatusError)); break;
+        case kDmaDescLowOffset: setLow(&mDescriptor, value); break;
+        case kDmaDescHighOffset: setHigh(&mDescriptor, value); break;
+        default: return makeFault(access);
+    }
+    return MemResponse{};
+}
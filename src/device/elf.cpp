@@ -0,0 +1,108 @@
+#include "emulator/device/elf.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace {
+    constexpr uint64_t kPtLoad = 1;
+    constexpr uint64_t kPfExecute = 1;
+    constexpr uint64_t kPfWrite = 2;
+    // Program header tables sit near the start of the file; anything past
+    // this is a corrupt header rather than a real image.
+    constexpr uint64_t kMaxHeaderBytes = 1ull << 20;
+
+    // Offsets of the header and program header fields read below; `word` is
+    // the width of address-sized fields.
+    struct ElfProgramLayout {
+        uint32_t word;
+        uint64_t entry, phoff, phentsize, phnum;
+        uint64_t pType, pFlags, pOffset, pPaddr, pFilesz, pMemsz;
+    };
+    constexpr ElfProgramLayout kElf32 = {4, 0x18, 0x1C, 0x2A, 0x2C, 0, 24, 4, 12, 16, 20};
+    constexpr ElfProgramLayout kElf64 = {8, 0x18, 0x20, 0x36, 0x38, 0, 4, 8, 24, 32, 40};
+
+    bool readBytes(std::ifstream& file, uint64_t length, std::vector<uint8_t>* bytes) {
+        bytes->resize(length);
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(bytes->data()), static_cast<std::streamsize>(length));
+        return static_cast<uint64_t>(file.gcount()) == length;
+    }
+}
+
+bool isElfFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    char magic[4] = {};
+    return file.read(magic, sizeof(magic)) && std::memcmp(magic, "\x7f" "ELF", 4) == 0;
+}
+
+bool readElfImage(const std::string& path, ElfImage* image, std::string* error) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        if (error != nullptr) *error = "Cannot open ELF file: " + path;
+        return false;
+    }
+    uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+    std::vector<uint8_t> header;
+    if (!readBytes(file, std::min<uint64_t>(fileSize, 0x40), &header) || header.size() < 0x34 ||
+        std::memcmp(header.data(), "\x7f" "ELF", 4) != 0 || (header[4] != 1 && header[4] != 2) ||
+        (header[5] != 1 && header[5] != 2)) {
+        if (error != nullptr) *error = "Unsupported ELF header: " + path;
+        return false;
+    }
+    const ElfProgramLayout& layout = header[4] == 2 ? kElf64 : kElf32;
+    uint32_t word = layout.word;
+    bool bigEndian = header[5] == 2;
+    uint64_t phoff = 0;
+    uint64_t phentsize = 0;
+    uint64_t phnum = 0;
+    {
+        ElfReader elf(header, bigEndian);
+        if (!elf.read(layout.entry, word, &image->entry) ||
+            !elf.read(layout.phoff, word, &phoff) || !elf.read(layout.phentsize, 2, &phentsize) ||
+            !elf.read(layout.phnum, 2, &phnum) || phoff == 0 || phnum == 0) {
+            if (error != nullptr) *error = "ELF file has no program headers: " + path;
+            return false;
+        }
+    }
+    uint64_t tableEnd = phoff + phnum * phentsize;
+    if (tableEnd > kMaxHeaderBytes || tableEnd > fileSize || !readBytes(file, tableEnd, &header)) {
+        if (error != nullptr) *error = "Truncated ELF program headers: " + path;
+        return false;
+    }
+
+    ElfReader elf(header, bigEndian);
+    image->segments.clear();
+    for (uint64_t i = 0; i < phnum; ++i) {
+        uint64_t base = phoff + i * phentsize;
+        uint64_t type = 0;
+        uint64_t flags = 0;
+        ElfSegment segment;
+        if (!elf.read(base + layout.pType, 4, &type) ||
+            !elf.read(base + layout.pFlags, 4, &flags) ||
+            !elf.read(base + layout.pOffset, word, &segment.fileOffset) ||
+            !elf.read(base + layout.pPaddr, word, &segment.address) ||
+            !elf.read(base + layout.pFilesz, word, &segment.fileSize) ||
+            !elf.read(base + layout.pMemsz, word, &segment.memorySize)) {
+            if (error != nullptr) *error = "Truncated ELF program headers: " + path;
+            return false;
+        }
+        if (type != kPtLoad || segment.memorySize == 0) {
+            continue;
+        }
+        if (segment.fileSize > segment.memorySize || segment.fileOffset > fileSize ||
+            segment.fileSize > fileSize - segment.fileOffset ||
+            segment.address + segment.memorySize < segment.address) {
+            if (error != nullptr) *error = "Invalid ELF segment in " + path;
+            return false;
+        }
+        segment.writable = (flags & kPfWrite) != 0;
+        segment.executable = (flags & kPfExecute) != 0;
+        image->segments.push_back(segment);
+    }
+    if (image->segments.empty()) {
+        if (error != nullptr) *error = "ELF file has no loadable segments: " + path;
+        return false;
+    }
+    return true;
+}
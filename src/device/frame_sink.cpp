@@ -0,0 +1,103 @@
+#include "emulator/device/frame_sink.h"
+
+#include <csignal>
+#include <cstdio>
+#include <vector>
+
+namespace {
+constexpr const char* kFilePrefix = "file:";
+constexpr const char* kPipePrefix = "pipe:";
+
+bool startsWith(const std::string& value, const char* prefix) {
+    return value.rfind(prefix, 0) == 0;
+}
+
+class FileSequenceSink : public FrameSink {
+public:
+    explicit FileSequenceSink(std::string prefix) : mPrefix(std::move(prefix)) {}
+
+    bool write(const FrameView& frame, std::string* error) override {
+        std::string path = mPrefix + "_" + formatSequence(frame.sequence) + ".ppm";
+        FILE* file = std::fopen(path.c_str(), "wb");
+        if (file == nullptr) {
+            if (error != nullptr) *error = "Cannot open " + path;
+            return false;
+        }
+        std::fprintf(file, "P6\n%u %u\n255\n", frame.width, frame.height);
+        mRow.resize(static_cast<size_t>(frame.width) * 3);
+        bool ok = true;
+        for (uint32_t y = 0; y < frame.height && ok; ++y) {
+            const uint8_t* src = frame.pixels + static_cast<size_t>(y) * frame.pitch;
+            for (uint32_t x = 0; x < frame.width; ++x) {
+                mRow[x * 3 + 0] = src[x * 4 + 2];
+                mRow[x * 3 + 1] = src[x * 4 + 1];
+                mRow[x * 3 + 2] = src[x * 4 + 0];
+            }
+            ok = std::fwrite(mRow.data(), 1, mRow.size(), file) == mRow.size();
+        }
+        ok = std::fclose(file) == 0 && ok;
+        if (!ok && error != nullptr) {
+            *error = "Failed to write " + path;
+        }
+        return ok;
+    }
+
+private:
+    static std::string formatSequence(uint64_t sequence) {
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "%06llu", static_cast<unsigned long long>(sequence));
+        return buffer;
+    }
+
+    std::string mPrefix;
+    std::vector<uint8_t> mRow;
+};
+
+class PipeSink : public FrameSink {
+public:
+    explicit PipeSink(FILE* pipe) : mPipe(pipe) {}
+    ~PipeSink() override { pclose(mPipe); }
+
+    bool write(const FrameView& frame, std::string* error) override {
+        size_t rowBytes = static_cast<size_t>(frame.width) * 4;
+        for (uint32_t y = 0; y < frame.height; ++y) {
+            const uint8_t* row = frame.pixels + static_cast<size_t>(y) * frame.pitch;
+            if (std::fwrite(row, 1, rowBytes, mPipe) != rowBytes) {
+                if (error != nullptr) *error = "Frame pipe closed";
+                return false;
+            }
+        }
+        std::fflush(mPipe);
+        return true;
+    }
+
+private:
+    FILE* mPipe = nullptr;
+};
+}
+
+std::unique_ptr<FrameSink> CreateFrameSink(const std::string& spec, std::string* error) {
+    if (startsWith(spec, kFilePrefix)) {
+        std::string prefix = spec.substr(std::char_traits<char>::length(kFilePrefix));
+        if (prefix.empty()) {
+            if (error != nullptr) *error = "Frame output file prefix is empty";
+            return nullptr;
+        }
+        return std::make_unique<FileSequenceSink>(prefix);
+    }
+    if (startsWith(spec, kPipePrefix)) {
+        std::string command = spec.substr(std::char_traits<char>::length(kPipePrefix));
+        // An encoder that exits early must fail the write, not kill the process.
+        std::signal(SIGPIPE, SIG_IGN);
+        FILE* pipe = command.empty() ? nullptr : popen(command.c_str(), "w");
+        if (pipe == nullptr) {
+            if (error != nullptr) *error = "Cannot start frame output command: " + command;
+            return nullptr;
+        }
+        return std::make_unique<PipeSink>(pipe);
+    }
+    if (error != nullptr) {
+        *error = "Unknown frame output (use file:<prefix> or pipe:<command>): " + spec;
+    }
+    return nullptr;
+}
@@ -0,0 +1,132 @@
+#include "emulator/device/interrupt_controller.h"
+
+#include <utility>
+
+namespace {
+constexpr uint64_t kIntcPendingOffset = 0x0;
+constexpr uint64_t kIntcEnableOffset = 0x4;
+constexpr uint64_t kIntcAckOffset = 0x8;
+constexpr uint64_t kIntcTargetOffset = 0xC;
+constexpr uint32_t kIntcRegSize = 4;
+
+MemResponse makeFault(const MemAccess& access) {
+    MemResponse response;
+    response.success = false;
+    response.error.type = CpuErrorType::AccessFault;
+    response.error.address = access.address;
+    response.error.size = access.size;
+    return response;
+}
+}
+
+InterruptController::InterruptController() {
+    setType(DeviceType::InterruptController);
+}
+
+void InterruptController::setLine(uint32_t line, bool asserted) {
+    if (line >= kLineCount) {
+        return;
+    }
+    uint32_t bit = 1u << line;
+    if (!asserted) {
+        mLevels.fetch_and(~bit, std::memory_order_acq_rel);
+        return;
+    }
+    if ((mLevels.fetch_or(bit, std::memory_order_acq_rel) & bit) == 0) {
+        mLatched.fetch_or(bit, std::memory_order_acq_rel);
+    }
+    notify();
+}
+
+Device::InterruptHandler InterruptController::lineHandler(uint32_t line) {
+    return [this, line](bool asserted) { setLine(line, asserted); };
+}
+
+uint32_t InterruptController::getPending() const {
+    return mLevels.load(std::memory_order_acquire) | mLatched.load(std::memory_order_acquire);
+}
+
+bool InterruptController::isAsserted(uint32_t hartId) const {
+    return mTarget.load(std::memory_order_acquire) == hartId &&
+        (getPending() & mEnable.load(std::memory_order_acquire)) != 0;
+}
+
+void InterruptController::setListener(Listener listener) {
+    std::lock_guard<std::mutex> lock(mListenerMutex);
+    mListener = std::move(listener);
+}
+
+void InterruptController::notify() {
+    if (!isAsserted(mTarget.load(std::memory_order_acquire))) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mListenerMutex);
+    if (mListener) {
+        mListener();
+    }
+}
+
+// Levels are saved too: sources only report changes, so a restored device
+// does not drive its line again.
+std::shared_ptr<const DeviceState> InterruptController::saveState() {
+    StateWriter out;
+    out.put<uint32_t>(mLevels.load(std::memory_order_acquire));
+    out.put<uint32_t>(mLatched.load(std::memory_order_acquire));
+    out.put<uint32_t>(mEnable.load(std::memory_order_acquire));
+    out.put<uint32_t>(mTarget.load(std::memory_order_acquire));
+    auto state = std::make_shared<ByteState>();
+    state->bytes = out.take();
+    return state;
+}
+
+bool InterruptController::restoreState(const std::shared_ptr<const DeviceState>& state) {
+    auto bytes = std::dynamic_pointer_cast<const ByteState>(state);
+    if (!bytes) {
+        return false;
+    }
+    StateReader in(bytes->bytes);
+    uint32_t levels = 0;
+    uint32_t latched = 0;
+    uint32_t enable = 0;
+    uint32_t target = 0;
+    if (!in.get(&levels) || !in.get(&latched) || !in.get(&enable) || !in.get(&target)) {
+        return false;
+    }
+    mLevels.store(levels, std::memory_order_release);
+    mLatched.store(latched, std::memory_order_release);
+    mEnable.store(enable, std::memory_order_release);
+    mTarget.store(target, std::memory_order_release);
+    notify();
+    return true;
+}
+
+MemResponse InterruptController::handleRead(const MemAccess& access) {
+    if (access.size != kIntcRegSize) {
+        return makeFault(access);
+    }
+    MemResponse response;
+    switch (access.address) {
+        case kIntcPendingOffset: response.data = getPending(); break;
+        case kIntcEnableOffset: response.data = mEnable.load(std::memory_order_acquire); break;
+        case kIntcAckOffset: response.data = 0; break;
+        case kIntcTargetOffset: response.data = mTarget.load(std::memory_order_acquire); break;
+        default: return makeFault(access);
+    }
+    return response;
+}
+
+MemResponse InterruptController::handleWrite(const MemAccess& access) {
+    if (access.size != kIntcRegSize) {
+        return makeFault(access);
+    }
+    uint32_t value = static_cast<uint32_t>(access.data);
+    switch (access.address) {
+        case kIntcPendingOffset: break;
+        case kIntcEnableOffset: mEnable.store(value, std::memory_order_release); break;
+        case kIntcAckOffset: mLatched.fetch_and(~value, std::memory_order_acq_rel); break;
+        case kIntcTargetOffset: mTarget.store(value, std::memory_order_release); break;
+        default: return makeFault(access);
+    }
+    notify();
+    return MemResponse{};
+}
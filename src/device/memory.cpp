@@ -1,13 +1,31 @@
 #include "emulator/device/memory.h"
+#include "emulator/device/wide_copy.h"
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstring>
 #include <fstream>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define EMULATOR_HAS_MMAP 1
+#endif
+
+#if defined(__APPLE__)
+using ResidencyByte = char;
+#else
+using ResidencyByte = unsigned char;
+#endif
+
 namespace {
-bool isAccessValid(const std::vector<uint8_t>& storage, const MemAccess& access) {
-    if (access.size == 0 || access.size > sizeof(uint64_t)) {
+bool isAccessValid(uint64_t size, const MemAccess& access) {
+    if (access.size == 0 || (access.size > sizeof(uint64_t) && !isWideAccess(access))) {
         return false;
     }
-    uint64_t size = static_cast<uint64_t>(storage.size());
     if (access.address >= size) {
         return false;
     }
@@ -26,76 +44,430 @@ MemResponse makeFault(const MemAccess& access) {
     return response;
 }
 
-uint64_t readValue(const std::vector<uint8_t>& storage, const MemAccess& access) {
+uint64_t readValue(const uint8_t* data, const MemAccess& access) {
     uint64_t value = 0;
     for (uint32_t i = 0; i < access.size; ++i) {
-        value |= static_cast<uint64_t>(storage[static_cast<size_t>(access.address + i)])
-            << (8 * i);
+        value |= static_cast<uint64_t>(data[access.address + i]) << (8 * i);
     }
     return value;
 }
 
-void writeValue(std::vector<uint8_t>* storage, const MemAccess& access) {
-    if (storage == nullptr) {
-        return;
-    }
+void writeValue(uint8_t* data, const MemAccess& access) {
     uint64_t value = access.data;
     for (uint32_t i = 0; i < access.size; ++i) {
-        (*storage)[static_cast<size_t>(access.address + i)] =
-            static_cast<uint8_t>(value & 0xff);
+        data[access.address + i] = static_cast<uint8_t>(value & 0xff);
         value >>= 8;
     }
 }
 
 } // namespace
 
-MemoryDevice::MemoryDevice(uint64_t size, bool readOnly)
-    : mStorage(size, 0), mReadOnly(readOnly) {
+MemoryDevice::MemoryDevice(uint64_t size, bool readOnly, MemoryBacking backing)
+    : mSize(size), mReadOnly(readOnly), mBacking(backing) {
     setType(readOnly ? DeviceType::Rom : DeviceType::Ram);
-    setReadHandler([this](const MemAccess& access) { return handleRead(access); });
-    setWriteHandler([this](const MemAccess& access) { return handleWrite(access); });
+
+    uint64_t pages = (mSize + kPageSize - 1) / kPageSize;
+    mDirtyWords = static_cast<size_t>((pages + kPagesPerGroup - 1) / kPagesPerGroup);
+    mDirty = std::make_unique<std::atomic<uint64_t>[]>(mDirtyWords);
+
+#ifdef EMULATOR_HAS_MMAP
+    if (mBacking == MemoryBacking::Mapped && mSize > 0) {
+        void* mapped = mmap(nullptr, mSize, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mapped != MAP_FAILED) {
+            mData = static_cast<uint8_t*>(mapped);
+            mMappedSize = mSize;
+            return;
+        }
+    }
+#endif
+    mBacking = MemoryBacking::Heap;
+    mHeap.assign(mSize, 0);
+    mData = mHeap.data();
+}
+
+MemoryDevice::~MemoryDevice() {
+    releaseStorage();
+}
+
+void MemoryDevice::releaseStorage() {
+#ifdef EMULATOR_HAS_MMAP
+    if (mMappedSize > 0) {
+        munmap(mData, mMappedSize);
+    }
+#endif
+    mMappedSize = 0;
+    mData = nullptr;
+    mHeap.clear();
+    mHeap.shrink_to_fit();
 }
 
 bool MemoryDevice::loadImage(const std::string& path, uint64_t offset) {
-    if (offset >= mStorage.size()) {
+    if (offset >= mSize || mFileMapped) {
         return false;
     }
     std::ifstream input(path, std::ios::binary);
     if (!input.is_open()) {
         return false;
     }
-    input.read(reinterpret_cast<char*>(mStorage.data() + offset),
-        static_cast<std::streamsize>(mStorage.size() - offset));
+    input.read(reinterpret_cast<char*>(mData + offset),
+        static_cast<std::streamsize>(mSize - offset));
+    markDirty(offset, static_cast<uint64_t>(input.gcount()));
     return input.good() || input.eof();
 }
 
+bool MemoryDevice::mapImage(const std::string& path, std::string* error) {
+#ifdef EMULATOR_HAS_MMAP
+    if (mReadOnly && mBacking == MemoryBacking::Mapped && mSize > 0) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            if (error != nullptr) *error = "Failed to open image: " + path;
+            return false;
+        }
+        struct stat st{};
+        void* mapped = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && static_cast<uint64_t>(st.st_size) >= mSize) {
+            mapped = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if (mapped != MAP_FAILED) {
+            releaseStorage();
+            mData = static_cast<uint8_t*>(mapped);
+            mMappedSize = mSize;
+            mFileMapped = true;
+            return true;
+        }
+    }
+#endif
+    if (!loadImage(path)) {
+        if (error != nullptr) *error = "Failed to load image: " + path;
+        return false;
+    }
+    return true;
+}
+
+bool MemoryDevice::mapFileRange(const std::string& path, uint64_t fileOffset, uint64_t offset,
+    uint64_t length, std::string* error) {
+    if (mFileMapped || offset > mSize || length > mSize - offset) {
+        if (error != nullptr) *error = "Image range does not fit the device: " + path;
+        return false;
+    }
+    if (length == 0) {
+        return true;
+    }
+    std::ifstream input(path, std::ios::binary);
+    auto copy = [&](uint64_t from, uint64_t to, uint64_t bytes) {
+        input.seekg(static_cast<std::streamoff>(from));
+        input.read(reinterpret_cast<char*>(mData + to), static_cast<std::streamsize>(bytes));
+        return static_cast<uint64_t>(input.gcount()) == bytes;
+    };
+    if (!input.is_open()) {
+        if (error != nullptr) *error = "Failed to open image: " + path;
+        return false;
+    }
+    uint64_t head = 0;
+    uint64_t body = 0;
+#ifdef EMULATOR_HAS_MMAP
+    uint64_t hostPage = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    if (mMappedSize > 0 && fileOffset % hostPage == offset % hostPage) {
+        head = std::min(length, (hostPage - offset % hostPage) % hostPage);
+        body = (length - head) / hostPage * hostPage;
+    }
+    if (body > 0) {
+        int fd = open(path.c_str(), O_RDONLY);
+        void* mapped = MAP_FAILED;
+        if (fd >= 0) {
+            int protection = mReadOnly ? PROT_READ : PROT_READ | PROT_WRITE;
+            mapped = mmap(mData + offset + head, body, protection, MAP_PRIVATE | MAP_FIXED, fd,
+                static_cast<off_t>(fileOffset + head));
+            close(fd);
+        }
+        if (mapped == MAP_FAILED) {
+            head = 0;
+            body = 0;
+        }
+    }
+#endif
+    uint64_t tail = head + body;
+    bool copied = body == 0 ? copy(fileOffset, offset, length) :
+        (head == 0 || copy(fileOffset, offset, head)) &&
+        (tail == length || copy(fileOffset + tail, offset + tail, length - tail));
+    if (!copied) {
+        if (error != nullptr) *error = "Failed to load image: " + path;
+        return false;
+    }
+    // Read-only memory only changes while it is loaded, before any snapshot.
+    if (!mReadOnly) {
+        markDirty(offset, length);
+    }
+    return true;
+}
+
 uint64_t MemoryDevice::getSize() const {
-    return mStorage.size();
+    return mSize;
 }
 
 bool MemoryDevice::isReadOnly() const {
     return mReadOnly;
 }
 
+MemoryBacking MemoryDevice::getBacking() const {
+    return mBacking;
+}
+
+bool MemoryDevice::isFileMapped() const {
+    return mFileMapped;
+}
+
+uint64_t MemoryDevice::getResidentSize() const {
+#ifdef EMULATOR_HAS_MMAP
+    if (mMappedSize > 0) {
+        uint64_t pageSize = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+        uint64_t pages = (mMappedSize + pageSize - 1) / pageSize;
+        std::vector<ResidencyByte> residency(pages);
+        if (mincore(mData, mMappedSize, residency.data()) != 0) {
+            return mSize;
+        }
+        uint64_t resident = 0;
+        for (ResidencyByte page : residency) {
+            resident += (page & 1) ? pageSize : 0;
+        }
+        return std::min(resident, mSize);
+    }
+#endif
+    return mSize;
+}
+
+bool MemoryDevice::getDirectMemory(DirectMemoryRange* range) {
+    if (range == nullptr || mSize == 0) {
+        return false;
+    }
+    range->host = mData;
+    range->base = 0;
+    range->size = mSize;
+    range->writable = !mReadOnly;
+    range->dirty = mDirty.get();
+    return true;
+}
+
+void MemoryDevice::markDirty(uint64_t offset, uint64_t length) {
+    if (length == 0) {
+        return;
+    }
+    DirectMemoryRange range;
+    range.dirty = mDirty.get();
+    range.markDirty(offset, length);
+}
+
+uint64_t MemoryDevice::pageLength(uint64_t page) const {
+    return std::min(kPageSize, mSize - page * kPageSize);
+}
+
+uint64_t MemoryDevice::getDirtyPageCount() const {
+    uint64_t count = 0;
+    for (size_t i = 0; i < mDirtyWords; ++i) {
+        count += static_cast<uint64_t>(std::popcount(mDirty[i].load(std::memory_order_relaxed)));
+    }
+    return count;
+}
+
+std::shared_ptr<const DeviceState> MemoryDevice::saveState() {
+    auto snapshot = std::make_shared<Snapshot>();
+    if (mBase) {
+        snapshot->groups = mBase->groups;
+    } else {
+        snapshot->groups.resize(mDirtyWords);
+    }
+    snapshot->copiedBytes = snapshot->groups.size() * sizeof(snapshot->groups[0]);
+    for (size_t g = 0; g < mDirtyWords; ++g) {
+        uint64_t word = mDirty[g].exchange(0, std::memory_order_acq_rel);
+        if (word == 0) {
+            continue;
+        }
+        auto group = snapshot->groups[g] ? std::make_shared<PageGroup>(*snapshot->groups[g]) :
+            std::make_shared<PageGroup>();
+        while (word != 0) {
+            uint32_t bit = static_cast<uint32_t>(std::countr_zero(word));
+            word &= word - 1;
+            uint64_t page = g * kPagesPerGroup + bit;
+            auto copy = std::make_shared<Page>();
+            uint64_t length = pageLength(page);
+            std::memcpy(copy->bytes, mData + page * kPageSize, length);
+            std::memset(copy->bytes + length, 0, kPageSize - length);
+            group->pages[bit] = std::move(copy);
+            snapshot->copiedBytes += sizeof(Page);
+        }
+        snapshot->copiedBytes += sizeof(PageGroup);
+        snapshot->groups[g] = std::move(group);
+    }
+    mBase = snapshot;
+    return snapshot;
+}
+
+bool MemoryDevice::restoreState(const std::shared_ptr<const DeviceState>& state) {
+    auto target = std::dynamic_pointer_cast<const Snapshot>(state);
+    if (!target || target->groups.size() != mDirtyWords) {
+        return false;
+    }
+    if (mFileMapped || mReadOnly) {
+        // ROM cannot change once loaded, so there is nothing to write back;
+        // its pages may be mapped read-only from the image.
+        mBase = target;
+        return true;
+    }
+    for (size_t g = 0; g < mDirtyWords; ++g) {
+        uint64_t dirty = mDirty[g].exchange(0, std::memory_order_acq_rel);
+        const std::shared_ptr<const PageGroup>& to = target->groups[g];
+        const PageGroup* from = mBase ? mBase->groups[g].get() : nullptr;
+        if (to.get() == from && dirty == 0) {
+            continue;
+        }
+        for (uint32_t bit = 0; bit < kPagesPerGroup; ++bit) {
+            const Page* want = to ? to->pages[bit].get() : nullptr;
+            const Page* have = from ? from->pages[bit].get() : nullptr;
+            if (want == have && (dirty & (1ull << bit)) == 0) {
+                continue;
+            }
+            uint64_t page = g * kPagesPerGroup + bit;
+            if (page * kPageSize >= mSize) {
+                break;
+            }
+            uint64_t length = pageLength(page);
+            if (want != nullptr) {
+                std::memcpy(mData + page * kPageSize, want->bytes, length);
+            } else {
+#ifdef EMULATOR_HAS_MMAP
+                // Hand whole zero pages back to the kernel instead of touching them.
+                if (mMappedSize > 0 && length == kPageSize &&
+                    madvise(mData + page * kPageSize, kPageSize, MADV_DONTNEED) == 0) {
+                    continue;
+                }
+#endif
+                std::memset(mData + page * kPageSize, 0, length);
+            }
+        }
+    }
+    mBase = target;
+    return true;
+}
+
 MemResponse MemoryDevice::handleRead(const MemAccess& access) {
-    if (!::isAccessValid(mStorage, access)) {
+    if (!::isAccessValid(mSize, access)) {
         return makeFault(access);
     }
     MemResponse response;
     response.success = true;
-    response.data = readValue(mStorage, access);
+    if (access.size > sizeof(uint64_t)) {
+        copyWide(access.wide, mData + access.address, access.size);
+        return response;
+    }
+    response.data = readValue(mData, access);
     return response;
 }
 
 MemResponse MemoryDevice::handleWrite(const MemAccess& access) {
-    if (!::isAccessValid(mStorage, access)) {
+    if (!::isAccessValid(mSize, access)) {
         return makeFault(access);
     }
     if (mReadOnly) {
         return makeFault(access);
     }
-    writeValue(&mStorage, access);
+    markDirty(access.address, access.size);
+    if (access.size > sizeof(uint64_t)) {
+        copyWide(mData + access.address, access.wide, access.size);
+    } else {
+        writeValue(mData, access);
+    }
     MemResponse response;
     response.success = true;
     return response;
 }
+
+MemResponse MemoryDevice::handleAtomic(const MemAccess& access) {
+    if (!::isAccessValid(mSize, access) || access.hartId >= kMaxHarts) {
+        return makeFault(access);
+    }
+    // Atomics must be naturally aligned, as on the guest.
+    if ((access.address & (access.size - 1)) != 0) {
+        return makeFault(access);
+    }
+    if (mReadOnly && access.type != MemAccessType::LoadReserved) {
+        return makeFault(access);
+    }
+    if (access.type != MemAccessType::LoadReserved) {
+        markDirty(access.address, access.size);
+    }
+    switch (access.size) {
+        case 1: return atomicAccess<uint8_t>(access);
+        case 2: return atomicAccess<uint16_t>(access);
+        case 4: return atomicAccess<uint32_t>(access);
+        case 8: return atomicAccess<uint64_t>(access);
+        default: return makeFault(access);
+    }
+}
+
+// Operates on the backing storage in place, so harts never serialize on a
+// lock. Values are stored in host order, which matches the little-endian
+// layout of plain accesses on little-endian hosts. SC compares against the
+// value LR observed rather than tracking intervening stores.
+template <typename T>
+MemResponse MemoryDevice::atomicAccess(const MemAccess& access) {
+    T& cell = *reinterpret_cast<T*>(mData + access.address);
+    std::atomic_ref<T> ref(cell);
+    Reservation& reservation = mReservations[access.hartId];
+    MemResponse response;
+
+    switch (access.type) {
+        case MemAccessType::AtomicRmw: {
+            T operand = static_cast<T>(access.data);
+            T old = 0;
+            switch (access.atomicOp) {
+                case AtomicOp::Swap: old = ref.exchange(operand); break;
+                case AtomicOp::Add:  old = ref.fetch_add(operand); break;
+                case AtomicOp::And:  old = ref.fetch_and(operand); break;
+                case AtomicOp::Or:   old = ref.fetch_or(operand); break;
+                case AtomicOp::Xor:  old = ref.fetch_xor(operand); break;
+                default: {
+                    old = ref.load();
+                    T next = 0;
+                    do {
+                        next = static_cast<T>(applyAtomicOp(access.atomicOp, old, operand,
+                            sizeof(T)));
+                    } while (!ref.compare_exchange_weak(old, next));
+                    break;
+                }
+            }
+            response.data = old;
+            break;
+        }
+        case MemAccessType::CompareExchange: {
+            T expected = static_cast<T>(access.expected);
+            ref.compare_exchange_strong(expected, static_cast<T>(access.data));
+            response.data = expected;
+            break;
+        }
+        case MemAccessType::LoadReserved: {
+            T value = ref.load();
+            reservation.valid = true;
+            reservation.address = access.address;
+            reservation.size = access.size;
+            reservation.value = value;
+            response.data = value;
+            break;
+        }
+        case MemAccessType::StoreConditional: {
+            bool stored = false;
+            if (reservation.valid && reservation.address == access.address &&
+                reservation.size == access.size) {
+                T expected = static_cast<T>(reservation.value);
+                stored = ref.compare_exchange_strong(expected, static_cast<T>(access.data));
+            }
+            reservation.valid = false;
+            response.data = stored ? 0 : 1;
+            break;
+        }
+        default:
+            return makeFault(access);
+    }
+    return response;
+}
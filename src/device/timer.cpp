@@ -5,8 +5,17 @@ namespace {
 constexpr uint64_t kTimerLowOffset = 0x0;
 constexpr uint64_t kTimerHighOffset = 0x4;
 constexpr uint64_t kTimerCtrlOffset = 0x8;
+constexpr uint64_t kTimerCompareLowOffset = 0x10;
+constexpr uint64_t kTimerCompareHighOffset = 0x14;
+constexpr uint64_t kTimerAlarmCtrlOffset = 0x18;
+constexpr uint64_t kTimerPeriodOffset = 0x1C;
+constexpr uint64_t kTimerStatusOffset = 0x20;
 constexpr uint32_t kTimerRegSize = 4;
 
+constexpr uint32_t kAlarmEnable = 1u << 0;
+constexpr uint32_t kAlarmIrqEnable = 1u << 1;
+constexpr uint32_t kStatusFired = 1u << 0;
+
 bool isValidAccess(const MemAccess& access) {
     return access.size == kTimerRegSize;
 }
@@ -24,32 +33,107 @@ MemResponse makeFault(const MemAccess& access) {
 
 TimerDevice::TimerDevice() {
     setType(DeviceType::Timer);
-    setReadHandler([this](const MemAccess& access) { return handleRead(access); });
-    setWriteHandler([this](const MemAccess& access) { return handleWrite(access); });
-    setTickHandler([this](uint64_t cycles) { handleTick(cycles); });
+}
+
+TimerDevice::~TimerDevice() {
+    if (mScheduler && mAlarmEvent != 0) {
+        mScheduler->cancel(mAlarmEvent);
+    }
+}
+
+uint64_t TimerDevice::currentCycle() const {
+    return mScheduler ? mScheduler->currentCycle() : 0;
 }
 
 uint64_t TimerDevice::getCounterMicros() {
-    return mAccumulatedMicros;
+    return currentCycle() - mBaseCycle;
+}
+
+std::shared_ptr<const DeviceState> TimerDevice::saveState() {
+    StateWriter out;
+    out.put<uint64_t>(mBaseCycle);
+    out.put<uint64_t>(mCompare);
+    out.put<uint32_t>(mPeriod);
+    out.put<uint32_t>(mAlarmCtrl);
+    out.put<uint32_t>(mStatus);
+    auto state = std::make_shared<ByteState>();
+    state->bytes = out.take();
+    return state;
+}
+
+bool TimerDevice::restoreState(const std::shared_ptr<const DeviceState>& state) {
+    auto bytes = std::dynamic_pointer_cast<const ByteState>(state);
+    if (!bytes) {
+        return false;
+    }
+    StateReader in(bytes->bytes);
+    if (!in.get(&mBaseCycle) || !in.get(&mCompare) || !in.get(&mPeriod) ||
+        !in.get(&mAlarmCtrl) || !in.get(&mStatus)) {
+        return false;
+    }
+    // The scheduler was cleared by the restore; re-arm a pending alarm.
+    mAlarmEvent = 0;
+    armAlarm();
+    updateInterrupt();
+    return true;
+}
+
+// The alarm is due at an absolute cycle, so a compare value that has already
+// passed fires at the next event check.
+void TimerDevice::armAlarm() {
+    if (!mScheduler) {
+        return;
+    }
+    if (mAlarmEvent != 0) {
+        mScheduler->cancel(mAlarmEvent);
+        mAlarmEvent = 0;
+    }
+    if ((mAlarmCtrl & kAlarmEnable) == 0) {
+        return;
+    }
+    uint64_t due = mCompare > EventScheduler::kNoEvent - 1 - mBaseCycle
+        ? EventScheduler::kNoEvent - 1 : mBaseCycle + mCompare;
+    mAlarmEvent = mScheduler->schedule(due, [this](uint64_t) {
+        mAlarmEvent = 0;
+        fireAlarm();
+    });
+}
+
+void TimerDevice::fireAlarm() {
+    mStatus |= kStatusFired;
+    updateInterrupt();
+    // Periodic alarms advance from the compare value, not from when the
+    // event ran, so they do not drift with the batch length.
+    if (mPeriod != 0) {
+        mCompare += mPeriod;
+        armAlarm();
+    }
 }
 
-void TimerDevice::handleTick(uint64_t cycles) {
-    mAccumulatedMicros += cycles;
+void TimerDevice::updateInterrupt() {
+    setInterruptLevel((mStatus & kStatusFired) != 0 && (mAlarmCtrl & kAlarmIrqEnable) != 0);
 }
 
 MemResponse TimerDevice::handleRead(const MemAccess& access) {
     if (!isValidAccess(access)) {
         return makeFault(access);
     }
-    if (access.address != kTimerLowOffset && access.address != kTimerHighOffset) {
-        return makeFault(access);
-    }
-    uint64_t counter = getCounterMicros();
     MemResponse response;
     response.success = true;
-    response.data = (access.address == kTimerLowOffset)
-        ? static_cast<uint32_t>(counter & 0xffffffffu)
-        : static_cast<uint32_t>((counter >> 32) & 0xffffffffu);
+    switch (access.address) {
+        case kTimerLowOffset:
+            response.data = static_cast<uint32_t>(getCounterMicros() & 0xffffffffu);
+            break;
+        case kTimerHighOffset:
+            response.data = static_cast<uint32_t>((getCounterMicros() >> 32) & 0xffffffffu);
+            break;
+        case kTimerCompareLowOffset: response.data = static_cast<uint32_t>(mCompare); break;
+        case kTimerCompareHighOffset: response.data = static_cast<uint32_t>(mCompare >> 32); break;
+        case kTimerAlarmCtrlOffset: response.data = mAlarmCtrl; break;
+        case kTimerPeriodOffset: response.data = mPeriod; break;
+        case kTimerStatusOffset: response.data = mStatus; break;
+        default: return makeFault(access);
+    }
     return response;
 }
 
@@ -57,11 +141,33 @@ MemResponse TimerDevice::handleWrite(const MemAccess& access) {
     if (!isValidAccess(access)) {
         return makeFault(access);
     }
-    if (access.address == kTimerCtrlOffset) {
-        mAccumulatedMicros = 0;
-        MemResponse response;
-        response.success = true;
-        return response;
+    uint32_t value = static_cast<uint32_t>(access.data);
+    switch (access.address) {
+        case kTimerCtrlOffset:
+            mBaseCycle = currentCycle();
+            armAlarm();
+            break;
+        case kTimerCompareLowOffset:
+            mCompare = (mCompare & ~0xffffffffull) | value;
+            armAlarm();
+            break;
+        case kTimerCompareHighOffset:
+            mCompare = (mCompare & 0xffffffffull) | (static_cast<uint64_t>(value) << 32);
+            armAlarm();
+            break;
+        case kTimerAlarmCtrlOffset:
+            mAlarmCtrl = value & (kAlarmEnable | kAlarmIrqEnable);
+            armAlarm();
+            updateInterrupt();
+            break;
+        case kTimerPeriodOffset: mPeriod = value; break;
+        case kTimerStatusOffset:
+            mStatus &= ~(value & kStatusFired);
+            updateInterrupt();
+            break;
+        default: return makeFault(access);
     }
-    return makeFault(access);
+    MemResponse response;
+    response.success = true;
+    return response;
 }
@@ -1,18 +1,27 @@
 #include "emulator/device/uart.h"
 #include "emulator/logging/logger.h"
 
+#include <cerrno>
+#include <chrono>
 #include <cstdio>
 #include <string>
-#include <utility>
+#include <vector>
+
+#include <unistd.h>
 
 namespace {
 constexpr uint64_t kUartDataOffset = 0x0;
 constexpr uint64_t kUartStatusOffset = 0x4;
+constexpr uint64_t kUartCtrlOffset = 0x8;
+constexpr uint64_t kUartRxCountOffset = 0xC;
 constexpr uint32_t kUartStatusRxReady = 1u << 0;
 constexpr uint32_t kUartStatusTxReady = 1u << 1;
+constexpr uint32_t kUartStatusTxEmpty = 1u << 2;
+constexpr uint32_t kUartStatusIrq = 1u << 3;
+constexpr uint32_t kUartCtrlRxIrq = 1u << 0;
+constexpr uint32_t kUartCtrlTxEmptyIrq = 1u << 1;
 constexpr uint32_t kUartRegSize = 4;
-constexpr size_t kUartFlushThreshold = 256;
-constexpr uint32_t kUartFlushIdleThreshold = 10000;
+constexpr size_t kUartDrainChunk = 1024;
 
 bool isValidAccess(const MemAccess& access) {
     return access.size == kUartRegSize;
@@ -32,57 +41,191 @@ MemResponse makeFault(uint64_t address, uint32_t size) {
 }
 }
 
-UartDevice::UartDevice() {
+UartDevice::UartDevice(size_t fifoDepth) : mRx(fifoDepth), mTx(fifoDepth) {
     setType(DeviceType::Uart);
-    setReadHandler([this](const MemAccess& access) { return handleRead(access); });
-    setWriteHandler([this](const MemAccess& access) { return handleWrite(access); });
-    setTickHandler([this](uint64_t cycles) { handleTick(cycles); });
+    mDrainThread = logging::startThread([this]() { drainLoop(); });
 }
 
 UartDevice::~UartDevice() {
-    std::lock_guard<std::mutex> lock(mMutex);
-    flushTxLocked();
+    mStopDrain.store(true, std::memory_order_release);
+    mTxSignal.fetch_add(1, std::memory_order_release);
+    mTxSignal.notify_one();
+    mDrainThread.join();
 }
 
-void UartDevice::pushRx(uint8_t ch) {
-    std::lock_guard<std::mutex> lock(mMutex);
-    mRxBuffer.push_back(ch);
+size_t UartDevice::pushRx(const uint8_t* data, size_t length) {
+    size_t pushed = 0;
+    {
+        std::unique_lock<std::mutex> lock(mRxProducerMutex, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            mRxContended.add();
+            lock.lock();
+        }
+        pushed = mRx.push(data, length);
+    }
+    if (pushed > 0 && (mCtrl.load(std::memory_order_relaxed) & kUartCtrlRxIrq) != 0) {
+        updateInterrupt();
+    }
+    return pushed;
 }
 
 void UartDevice::flush() {
-    std::lock_guard<std::mutex> lock(mMutex);
-    flushTxLocked();
+    uint64_t target = mTxQueued.load(std::memory_order_acquire);
+    while (mTxWritten.load(std::memory_order_acquire) < target) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+void UartDevice::setOutputFd(int fd) {
+    flush();
+    mOutputFd = fd;
+}
+
+UartStats UartDevice::getStats() const {
+    UartStats stats;
+    stats.txBytes = mTxQueued.load(std::memory_order_relaxed);
+    stats.txStalls = mTxStalls.load();
+    stats.rxContended = mRxContended.load();
+    return stats;
+}
+
+// Pending output is flushed rather than saved, so restoring never prints it
+// a second time. Snapshots are taken with the harts idle, so the RX FIFO can
+// be read and refilled from here.
+std::shared_ptr<const DeviceState> UartDevice::saveState() {
+    flush();
+    StateWriter out;
+    out.put<uint32_t>(mCtrl.load(std::memory_order_relaxed));
+    std::vector<uint8_t> rx(mRx.size());
+    rx.resize(mRx.peek(rx.data(), rx.size()));
+    out.put<uint64_t>(rx.size());
+    out.putBytes(rx.data(), rx.size());
+    auto state = std::make_shared<ByteState>();
+    state->bytes = out.take();
+    return state;
+}
+
+bool UartDevice::restoreState(const std::shared_ptr<const DeviceState>& state) {
+    auto bytes = std::dynamic_pointer_cast<const ByteState>(state);
+    if (!bytes) {
+        return false;
+    }
+    StateReader in(bytes->bytes);
+    uint32_t ctrl = 0;
+    uint64_t count = 0;
+    if (!in.get(&ctrl) || !in.get(&count) || count > mRx.capacity()) {
+        return false;
+    }
+    std::vector<uint8_t> rx(static_cast<size_t>(count));
+    if (!in.getBytes(rx.data(), rx.size())) {
+        return false;
+    }
+    flush();
+    {
+        std::lock_guard<std::mutex> lock(mRxProducerMutex);
+        mRx.clear();
+        mRx.push(rx.data(), rx.size());
+    }
+    mCtrl.store(ctrl, std::memory_order_relaxed);
+    updateInterrupt();
+    return true;
 }
 
 uint32_t UartDevice::getStatus() const {
-    std::lock_guard<std::mutex> lock(mMutex);
-    uint32_t status = kUartStatusTxReady;
-    if (!mRxBuffer.empty()) {
+    uint32_t status = 0;
+    if (!mRx.empty()) {
         status |= kUartStatusRxReady;
     }
+    if (!mTx.full()) {
+        status |= kUartStatusTxReady;
+    }
+    if (mTx.empty()) {
+        status |= kUartStatusTxEmpty;
+    }
+    if (getInterruptLevel()) {
+        status |= kUartStatusIrq;
+    }
     return status;
 }
 
+void UartDevice::updateInterrupt() {
+    uint32_t ctrl = mCtrl.load(std::memory_order_relaxed);
+    bool level = ((ctrl & kUartCtrlRxIrq) != 0 && !mRx.empty()) ||
+        ((ctrl & kUartCtrlTxEmptyIrq) != 0 && mTx.empty());
+    setInterruptLevel(level);
+}
+
+void UartDevice::drainLoop() {
+    uint8_t buffer[kUartDrainChunk];
+    for (;;) {
+        uint64_t signal = mTxSignal.load(std::memory_order_acquire);
+        size_t count = mTx.pop(buffer, sizeof(buffer));
+        if (count > 0) {
+            writeOut(buffer, count);
+            mTxWritten.fetch_add(count, std::memory_order_release);
+            continue;
+        }
+        if ((mCtrl.load(std::memory_order_relaxed) & kUartCtrlTxEmptyIrq) != 0) {
+            updateInterrupt();
+        }
+        // Pairs with the fence in handleWrite: either the writer sees the
+        // drain idle and bumps the signal, or the drain sees the new bytes.
+        mDrainIdle.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!mTx.empty()) {
+            mDrainIdle.store(false, std::memory_order_relaxed);
+            continue;
+        }
+        if (mStopDrain.load(std::memory_order_acquire)) {
+            return;
+        }
+        mTxSignal.wait(signal, std::memory_order_acquire);
+        mDrainIdle.store(false, std::memory_order_relaxed);
+    }
+}
+
+void UartDevice::writeOut(const uint8_t* data, size_t length) {
+    if (mOutputFd < 0) {
+        logging::device("%.*s", static_cast<int>(length), reinterpret_cast<const char*>(data));
+        return;
+    }
+    while (length > 0) {
+        ssize_t written = ::write(mOutputFd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        data += written;
+        length -= static_cast<size_t>(written);
+    }
+}
+
 MemResponse UartDevice::handleRead(const MemAccess& access) {
     if (!isValidAccess(access)) {
         return makeFault(access.address, access.size);
     }
+    MemResponse response;
+    response.success = true;
     if (access.address == kUartStatusOffset) {
-        MemResponse response;
-        response.success = true;
         response.data = getStatus();
         return response;
     }
     if (access.address == kUartDataOffset) {
-        MemResponse response;
-        response.success = true;
-        std::lock_guard<std::mutex> lock(mMutex);
-        if (mRxBuffer.empty()) {
-            response.data = 0;
-        } else {
-            response.data = mRxBuffer.front();
-            mRxBuffer.pop_front();
+        uint8_t ch = 0;
+        if (mRx.pop(&ch, 1) > 0 && (mCtrl.load(std::memory_order_relaxed) & kUartCtrlRxIrq) != 0) {
+            updateInterrupt();
         }
+        response.data = ch;
+        return response;
+    }
+    if (access.address == kUartCtrlOffset) {
+        response.data = mCtrl.load(std::memory_order_relaxed);
+        return response;
+    }
+    if (access.address == kUartRxCountOffset) {
+        response.data = static_cast<uint32_t>(mRx.size());
         return response;
     }
     return makeFault(access.address, access.size);
@@ -94,36 +237,33 @@ MemResponse UartDevice::handleWrite(const MemAccess& access) {
     }
     if (access.address == kUartDataOffset) {
         uint8_t ch = extractByte(access.data);
-        std::lock_guard<std::mutex> lock(mMutex);
-        mTxBuffer.push_back(static_cast<char>(ch));
-        mIdleCycles = 0;
-        if (mTxBuffer.size() >= kUartFlushThreshold) {
-            flushTxLocked();
+        // A guest that ignores TX ready waits for the drain to make room.
+        if (mTx.push(&ch, 1) == 0) {
+            mTxStalls.add();
+            while (mTx.push(&ch, 1) == 0) {
+                std::this_thread::yield();
+            }
+        }
+        mTxQueued.fetch_add(1, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (mDrainIdle.load(std::memory_order_relaxed)) {
+            mTxSignal.fetch_add(1, std::memory_order_release);
+            mTxSignal.notify_one();
+        }
+        if ((mCtrl.load(std::memory_order_relaxed) & kUartCtrlTxEmptyIrq) != 0) {
+            updateInterrupt();
         }
         MemResponse response;
         response.success = true;
         return response;
     }
-    return makeFault(access.address, access.size);
-}
-
-void UartDevice::handleTick(uint64_t cycles) {
-    std::lock_guard<std::mutex> lock(mMutex);
-    if (mTxBuffer.empty()) {
-        mIdleCycles = 0;
-        return;
-    }
-    mIdleCycles += cycles;
-    if (mIdleCycles >= kUartFlushIdleThreshold) {
-        flushTxLocked();
-        mIdleCycles = 0;
-    }
-}
-
-void UartDevice::flushTxLocked() {
-    if (mTxBuffer.empty()) {
-        return;
+    if (access.address == kUartCtrlOffset) {
+        mCtrl.store(static_cast<uint32_t>(access.data) & (kUartCtrlRxIrq | kUartCtrlTxEmptyIrq),
+            std::memory_order_relaxed);
+        updateInterrupt();
+        MemResponse response;
+        response.success = true;
+        return response;
     }
-    logging::device("%s", mTxBuffer.c_str());
-    mTxBuffer.clear();
+    return makeFault(access.address, access.size);
 }
@@ -0,0 +1,57 @@
+#include "emulator/snapshot/snapshot.h"
+
+#include "emulator/bus/bus.h"
+#include "emulator/cpu/cpu.h"
+#include "emulator/device/device.h"
+
+bool takeMachineSnapshot(const std::vector<ICpuExecutor*>& harts, MemoryBus* bus,
+    MachineSnapshot* out, std::string* error) {
+    if (bus == nullptr || out == nullptr) {
+        if (error != nullptr) *error = "No machine to snapshot";
+        return false;
+    }
+    MachineSnapshot snapshot;
+    for (size_t i = 0; i < harts.size(); ++i) {
+        std::vector<uint8_t> state;
+        if (!harts[i]->saveState(&state)) {
+            if (error != nullptr) *error = "CPU does not support snapshots";
+            return false;
+        }
+        snapshot.harts.push_back(std::move(state));
+    }
+    for (Device* device : bus->getDevices()) {
+        snapshot.devices.push_back(device->snapshot());
+    }
+    snapshot.schedulerNow = bus->scheduler().now();
+    *out = std::move(snapshot);
+    return true;
+}
+
+bool restoreMachineSnapshot(const std::vector<ICpuExecutor*>& harts, MemoryBus* bus,
+    const MachineSnapshot& snapshot, std::string* error) {
+    if (bus == nullptr || snapshot.harts.size() != harts.size() ||
+        snapshot.devices.size() != bus->getDevices().size()) {
+        if (error != nullptr) *error = "Snapshot does not match this machine";
+        return false;
+    }
+
+    // Devices re-arm their own events while restoring.
+    EventScheduler& events = bus->scheduler();
+    events.clear();
+    events.setNow(snapshot.schedulerNow);
+
+    const std::vector<Device*>& devices = bus->getDevices();
+    for (size_t i = 0; i < devices.size(); ++i) {
+        if (!devices[i]->restore(snapshot.devices[i])) {
+            if (error != nullptr) *error = "Failed to restore device state";
+            return false;
+        }
+    }
+    for (size_t i = 0; i < harts.size(); ++i) {
+        if (!harts[i]->loadState(snapshot.harts[i])) {
+            if (error != nullptr) *error = "Failed to restore CPU state";
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,450 @@
+// Reproducible guest workloads for catching performance regressions in the
+// bus, the debugger's hart loop and the logger. Each workload runs on a fresh
+// machine through Debugger::run() and the results are printed as JSON.
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "emulator/app/utils.h"
+#include "emulator/debugger/debugger.h"
+#include "emulator/device/display.h"
+#include "emulator/device/memory.h"
+#include "emulator/device/timer.h"
+#include "emulator/device/uart.h"
+#include "emulator/logging/logger.h"
+
+#include "toy_cpu_executor.h"
+#include "toy_isa.h"
+
+namespace {
+
+std::atomic<uint64_t> g_allocations{0};
+
+} // namespace
+
+// Every heap allocation in the process is counted, so a workload's count
+// includes host threads started by the debugger and devices. The whole
+// replaceable set is defined, aligned and nothrow forms included, so no
+// allocation escapes the count and every delete frees what this new
+// returned. GCC flags the malloc/free pairing once these inline into
+// callers; it is the intended replacement.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+namespace {
+
+void* countedAlloc(std::size_t size, std::size_t alignment) noexcept {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (size == 0) {
+        size = 1;
+    }
+    if (alignment <= alignof(std::max_align_t)) {
+        return std::malloc(size);
+    }
+    // aligned_alloc wants the size to be a multiple of the alignment.
+    return std::aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1));
+}
+
+void* countedAllocOrThrow(std::size_t size, std::size_t alignment) {
+    if (void* p = countedAlloc(size, alignment)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+} // namespace
+
+void* operator new(std::size_t size) {
+    return countedAllocOrThrow(size, alignof(std::max_align_t));
+}
+
+void* operator new[](std::size_t size) {
+    return countedAllocOrThrow(size, alignof(std::max_align_t));
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    return countedAllocOrThrow(size, static_cast<std::size_t>(alignment));
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+    return countedAllocOrThrow(size, static_cast<std::size_t>(alignment));
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return countedAlloc(size, alignof(std::max_align_t));
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return countedAlloc(size, alignof(std::max_align_t));
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return countedAlloc(size, static_cast<std::size_t>(alignment));
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment,
+    const std::nothrow_t&) noexcept {
+    return countedAlloc(size, static_cast<std::size_t>(alignment));
+}
+
+// malloc and aligned_alloc memory are both released by free(), so every
+// delete form reduces to it.
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+namespace {
+
+constexpr uint64_t kRamSize = 16ull * 1024 * 1024;
+// Traced instructions per allocation a binary trace may not fall below.
+constexpr uint64_t kMaxTracedAllocationRatio = 1000;
+constexpr uint32_t kDataBase = 0x00100000u;
+constexpr uint32_t kUartBase = 0x20000000u;
+constexpr uint32_t kTimerBase = 0x20001000u;
+constexpr uint32_t kSdlBase = 0x30000000u;
+constexpr uint32_t kFbWidth = 320;
+constexpr uint32_t kFbHeight = 240;
+
+enum class TraceMode {
+    None,
+    Binary,
+    Text
+};
+
+struct Workload {
+    const char* name;
+    const char* description;
+    TraceMode trace;
+    std::function<std::vector<uint32_t>(uint32_t scale)> build;
+};
+
+struct Result {
+    std::string name;
+    uint64_t instructions = 0;
+    double seconds = 0.0;
+    uint64_t busAccesses = 0;
+    uint64_t allocations = 0;
+};
+
+void EmitLoad32(std::vector<uint32_t>* prog, uint8_t reg, uint32_t value) {
+    toy::Emit(prog, toy::Lui(reg, static_cast<uint16_t>(value >> 16)));
+    toy::Emit(prog, toy::Ori(reg, static_cast<uint16_t>(value & 0xffffu)));
+}
+
+// Runs `body` `count` times using r1 as the counter.
+void EmitLoop(std::vector<uint32_t>* prog, uint32_t count, const std::vector<uint32_t>& body) {
+    EmitLoad32(prog, 1, count);
+    for (uint32_t inst : body) {
+        toy::Emit(prog, inst);
+    }
+    toy::Emit(prog, toy::Addi(1, -1));
+    toy::Emit(prog, toy::Beq(1, 0, 1));
+    toy::Emit(prog, toy::Beq(0, 0, static_cast<int8_t>(-(static_cast<int>(body.size()) + 3))));
+}
+
+std::vector<uint32_t> AluLoop(uint32_t iterations) {
+    std::vector<uint32_t> prog;
+    EmitLoop(&prog, iterations, {toy::Addi(2, 1), toy::Ori(3, 0x55), toy::Addi(4, -3)});
+    toy::Emit(&prog, toy::Halt());
+    return prog;
+}
+
+std::vector<uint32_t> RamStream(uint32_t iterations) {
+    std::vector<uint32_t> prog;
+    EmitLoad32(&prog, 5, kDataBase);
+    EmitLoop(&prog, iterations, {toy::Sw(2, 5, 0), toy::Lw(3, 5, 4), toy::Addi(5, 8)});
+    toy::Emit(&prog, toy::Halt());
+    return prog;
+}
+
+std::vector<uint32_t> MmioPoll(uint32_t iterations) {
+    std::vector<uint32_t> prog;
+    EmitLoad32(&prog, 6, kTimerBase);
+    EmitLoop(&prog, iterations, {toy::Lw(3, 6, 0), toy::Lw(4, 6, 4)});
+    toy::Emit(&prog, toy::Halt());
+    return prog;
+}
+
+std::vector<uint32_t> FramebufferFill(uint32_t frames) {
+    std::vector<uint32_t> prog;
+    EmitLoad32(&prog, 8, kSdlBase);
+    toy::Emit(&prog, toy::Ori(9, 1));
+    for (uint32_t frame = 0; frame < frames; ++frame) {
+        EmitLoad32(&prog, 7, kSdlBase + SdlDisplayDevice::kControlRegionSize);
+        EmitLoop(&prog, kFbWidth * kFbHeight, {toy::Sw(2, 7, 0), toy::Addi(7, 4), toy::Addi(2, 1)});
+        toy::Emit(&prog, toy::Sw(9, 8, 0));
+    }
+    toy::Emit(&prog, toy::Halt());
+    return prog;
+}
+
+const std::vector<Workload>& Workloads() {
+    static const std::vector<Workload> workloads = {
+        {"alu_loop", "Register-only loop", TraceMode::None,
+            [](uint32_t scale) { return AluLoop(2000000 * scale); }},
+        {"ram_stream", "Store/load stream through RAM", TraceMode::None,
+            [](uint32_t scale) { return RamStream(1000000 * scale); }},
+        {"mmio_poll", "Timer counter reads through the bus", TraceMode::None,
+            [](uint32_t scale) { return MmioPoll(500000 * scale); }},
+        {"framebuffer_fill", "Full-frame stores and presents", TraceMode::None,
+            [](uint32_t scale) { return FramebufferFill(10 * scale); }},
+        {"trace_binary", "RAM stream with instruction and memory tracing to a binary file",
+            TraceMode::Binary, [](uint32_t scale) { return RamStream(200000 * scale); }},
+        {"trace_text", "RAM stream with formatted tracing through the logger",
+            TraceMode::Text, [](uint32_t scale) { return RamStream(50000 * scale); }},
+    };
+    return workloads;
+}
+
+bool RunWorkload(const Workload& workload, uint32_t scale, ExecutionEngine engine,
+    Result* result, std::string* error) {
+    std::vector<uint32_t> prog = workload.build(scale);
+
+    MemoryBus bus;
+    MemoryDevice ram(kRamSize, false);
+    UartDevice uart;
+    TimerDevice timer;
+    SdlDisplayDevice display;
+    if (!display.initHeadless(kFbWidth, kFbHeight)) {
+        *error = "headless display init failed";
+        return false;
+    }
+    bus.registerDevice(&ram, 0, kRamSize, "RAM");
+    bus.registerDevice(&uart, kUartBase, 0x100, "UART");
+    bus.registerDevice(&timer, kTimerBase, 0x100, "TIMER");
+    bus.registerDevice(&display, kSdlBase, display.getMappedSize(), "SDL");
+    if (!bus.writeBlock(0, reinterpret_cast<const uint8_t*>(prog.data()), prog.size() * 4)) {
+        *error = "program does not fit in RAM";
+        return false;
+    }
+
+    ToyCpuExecutor cpu;
+    cpu.setExecutionEngine(engine);
+    Debugger dbg(&cpu, &bus);
+    bus.setDebugger(&dbg);
+    cpu.setDebugger(&dbg);
+    dbg.setCpuFrequency(1000000);
+    TraceOptions opts;
+    opts.logInstruction = workload.trace != TraceMode::None;
+    opts.logMemEvents = workload.trace != TraceMode::None;
+    opts.logBranchPrediction = false;
+    dbg.configureTrace(opts);
+
+    std::filesystem::path tracePath = std::filesystem::temp_directory_path() /
+        ("emulator_bench_" + std::to_string(getpid()) + ".trace");
+    if (workload.trace == TraceMode::Binary &&
+        !dbg.openBinaryTrace(tracePath.string(), false, error)) {
+        return false;
+    }
+    // Text traces go to stderr; discard them so the terminal is not what
+    // gets measured.
+    int savedStderr = -1;
+    if (workload.trace == TraceMode::Text) {
+        logging::level(logging::Level::Trace);
+        savedStderr = dup(STDERR_FILENO);
+        int devNull = open("/dev/null", O_WRONLY);
+        dup2(devNull, STDERR_FILENO);
+        close(devNull);
+    }
+
+    uint64_t allocationsBefore = g_allocations.load(std::memory_order_relaxed);
+    auto start = std::chrono::steady_clock::now();
+    dbg.run(false);
+    if (workload.trace == TraceMode::Binary) {
+        dbg.closeBinaryTrace();
+    }
+    auto end = std::chrono::steady_clock::now();
+    result->allocations = g_allocations.load(std::memory_order_relaxed) - allocationsBefore;
+
+    if (savedStderr >= 0) {
+        logging::flush();
+        dup2(savedStderr, STDERR_FILENO);
+        close(savedStderr);
+        logging::level(logging::Level::Info);
+    }
+    std::error_code ignored;
+    std::filesystem::remove(tracePath, ignored);
+
+    if (cpu.getLastError().type != CpuErrorType::None) {
+        *error = "guest faulted at 0x" + std::to_string(cpu.getPc());
+        return false;
+    }
+    result->name = workload.name;
+    result->instructions = dbg.getHartStatus(0).instructions;
+    // Binary tracing reuses one record per hart and a fixed ring, so only
+    // setup may allocate.
+    if (workload.trace == TraceMode::Binary &&
+        result->allocations > result->instructions / kMaxTracedAllocationRatio) {
+        *error = std::to_string(result->allocations) + " allocations for " +
+            std::to_string(result->instructions) + " traced instructions";
+        return false;
+    }
+    result->seconds = std::chrono::duration<double>(end - start).count();
+    result->busAccesses = cpu.getDataAccessCount();
+    return true;
+}
+
+void PrintJson(FILE* out, ExecutionEngine engine, uint32_t scale,
+    const std::vector<Result>& results) {
+    std::fprintf(out, "{\n  \"engine\": \"%s\",\n  \"scale\": %u,\n  \"workloads\": [\n",
+        engine == ExecutionEngine::Threaded ? "threaded" : "interpreter", scale);
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        double seconds = r.seconds > 0.0 ? r.seconds : 1e-9;
+        double instructions = static_cast<double>(r.instructions);
+        std::fprintf(out,
+            "    {\"name\": \"%s\", \"instructions\": %llu, \"seconds\": %.6f, "
+            "\"mips\": %.3f, \"ns_per_instruction\": %.3f, \"bus_accesses\": %llu, "
+            "\"bus_accesses_per_second\": %.0f, \"allocations\": %llu}%s\n",
+            r.name.c_str(), (unsigned long long)r.instructions, r.seconds,
+            instructions / seconds / 1e6,
+            r.instructions > 0 ? seconds * 1e9 / instructions : 0.0,
+            (unsigned long long)r.busAccesses, static_cast<double>(r.busAccesses) / seconds,
+            (unsigned long long)r.allocations, i + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(out, "  ]\n}\n");
+}
+
+void PrintUsage() {
+    std::printf("Usage: bench [options]\n"
+        "  --workload <name>  Run only this workload (repeatable)\n"
+        "  --scale <n>        Multiply every workload's length (default: 1)\n"
+        "  --engine <name>    CPU dispatch engine (interpreter, threaded)\n"
+        "  --output <path>    Write the JSON report to a file instead of stdout\n"
+        "  --list             List the workloads\n");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::vector<std::string> selected;
+    uint64_t scale = 1;
+    ExecutionEngine engine = ExecutionEngine::Interpreter;
+    std::string outputPath;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--workload" && hasValue) {
+            selected.push_back(argv[++i]);
+        } else if (arg == "--scale" && hasValue) {
+            if (!parseU64(argv[++i], &scale) || scale == 0 || scale > 1000) {
+                std::fprintf(stderr, "Invalid scale: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (arg == "--engine" && hasValue) {
+            if (!parseExecutionEngine(argv[++i], &engine)) {
+                std::fprintf(stderr, "Invalid engine: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (arg == "--output" && hasValue) {
+            outputPath = argv[++i];
+        } else if (arg == "--list") {
+            for (const Workload& workload : Workloads()) {
+                std::printf("%-18s %s\n", workload.name, workload.description);
+            }
+            return 0;
+        } else {
+            PrintUsage();
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    std::vector<Result> results;
+    for (const Workload& workload : Workloads()) {
+        bool wanted = selected.empty();
+        for (const std::string& name : selected) {
+            wanted = wanted || name == workload.name;
+        }
+        if (!wanted) {
+            continue;
+        }
+        Result result;
+        std::string error;
+        if (!RunWorkload(workload, static_cast<uint32_t>(scale), engine, &result, &error)) {
+            std::fprintf(stderr, "%s: %s\n", workload.name, error.c_str());
+            return 1;
+        }
+        results.push_back(result);
+    }
+    if (results.empty()) {
+        std::fprintf(stderr, "No matching workload\n");
+        return 1;
+    }
+
+    FILE* out = stdout;
+    if (!outputPath.empty()) {
+        out = std::fopen(outputPath.c_str(), "w");
+        if (out == nullptr) {
+            std::fprintf(stderr, "Cannot open %s\n", outputPath.c_str());
+            return 1;
+        }
+    }
+    PrintJson(out, engine, static_cast<uint32_t>(scale), results);
+    if (out != stdout) {
+        std::fclose(out);
+    }
+    return 0;
+}
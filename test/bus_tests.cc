@@ -0,0 +1,503 @@
+#include "test_framework.h"
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "emulator/bus/bus.h"
+#include "emulator/bus/event_scheduler.h"
+#include "emulator/device/memory.h"
+#include "emulator/device/timer.h"
+#include "emulator/device/uart.h"
+
+namespace {
+
+MemAccess MakeAccess(uint64_t address, uint32_t size, MemAccessType type, uint64_t data = 0) {
+    MemAccess access;
+    access.address = address;
+    access.size = size;
+    access.type = type;
+    access.data = data;
+    return access;
+}
+
+class TickingDevice : public Device {
+public:
+    uint64_t mTicked = 0;
+    TickingDevice() {
+        setTickHandler([this](uint64_t cycles) { mTicked += cycles; });
+    }
+};
+
+} // namespace
+
+void RegisterBusTests() {
+}
+
+TEST(bus_direct_memory_ram) {
+    MemoryDevice ram(0x100, false);
+    MemoryBus bus;
+    bus.registerDevice(&ram, 0x8000, 0x100, "RAM");
+
+    DirectMemoryRange range;
+    ASSERT_TRUE(bus.getDirectMemory(0x8010, &range));
+    EXPECT_EQ(range.base, 0x8000u);
+    EXPECT_EQ(range.size, 0x100u);
+    EXPECT_TRUE(range.writable);
+    EXPECT_TRUE(range.contains(0x80fc, 4));
+    EXPECT_TRUE(!range.contains(0x80fd, 4));
+
+    range.store(0x8020, 4, 0xcafef00du);
+    MemResponse r = bus.read(MakeAccess(0x8020, 4, MemAccessType::Read));
+    ASSERT_TRUE(r.success);
+    EXPECT_EQ(static_cast<uint32_t>(r.data), 0xcafef00du);
+
+    ASSERT_TRUE(bus.write(MakeAccess(0x8030, 2, MemAccessType::Write, 0xbeefu)).success);
+    EXPECT_EQ(range.load(0x8030, 2), 0xbeefu);
+}
+
+TEST(bus_direct_memory_rom_read_only) {
+    MemoryDevice rom(0x40, true);
+    MemoryBus bus;
+    bus.registerDevice(&rom, 0, 0x40, "ROM");
+
+    DirectMemoryRange range;
+    ASSERT_TRUE(bus.getDirectMemory(0, &range));
+    EXPECT_TRUE(!range.writable);
+
+    MemResponse w = bus.write(MakeAccess(0, 4, MemAccessType::Write, 1));
+    EXPECT_EQ(w.success, false);
+    EXPECT_EQ(w.error.type, CpuErrorType::AccessFault);
+}
+
+TEST(bus_direct_memory_mmio_slow_path) {
+    UartDevice uart;
+    MemoryBus bus;
+    bus.registerDevice(&uart, 0x1000, 0x100, "UART");
+
+    DirectMemoryRange range;
+    EXPECT_TRUE(!bus.getDirectMemory(0x1000, &range));
+    EXPECT_TRUE(!bus.getDirectMemory(0x5000, &range));
+
+    MemResponse status = bus.read(MakeAccess(0x1004, 4, MemAccessType::Read));
+    ASSERT_TRUE(status.success);
+    EXPECT_TRUE((status.data & 0x2u) != 0);
+}
+
+TEST(bus_block_transfer_across_mappings) {
+    MemoryDevice low(0x1000, false);
+    MemoryDevice high(0x1000, false);
+    TimerDevice timer;
+    MemoryBus bus;
+    bus.registerDevice(&low, 0x0, 0x1000, "LOW");
+    bus.registerDevice(&high, 0x1000, 0x1000, "HIGH");
+    bus.registerDevice(&timer, 0x4000, 0x100, "TIMER");
+
+    // One transfer spanning both RAM devices.
+    std::vector<uint8_t> pattern(0x100);
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        pattern[i] = static_cast<uint8_t>(i * 7);
+    }
+    uint64_t done = 0;
+    ASSERT_TRUE(bus.writeBlock(0xf80, pattern.data(), pattern.size(), &done));
+    EXPECT_EQ(done, pattern.size());
+    EXPECT_EQ(bus.read(MakeAccess(0x1000, 1, MemAccessType::Read)).data, pattern[0x80]);
+    EXPECT_EQ(low.getDirtyPageCount(), 1u);
+
+    std::vector<uint8_t> back(pattern.size());
+    ASSERT_TRUE(bus.readBlock(0xf80, back.data(), back.size()));
+    EXPECT_TRUE(back == pattern);
+
+    // MMIO registers only accept 4-byte accesses, which the fallback issues.
+    uint8_t regs[8] = {};
+    EXPECT_TRUE(bus.readBlock(0x4000, regs, sizeof(regs)));
+
+    // The hole after HIGH stops the transfer.
+    EXPECT_TRUE(!bus.readBlock(0x1ff0, back.data(), 0x20, &done));
+    EXPECT_EQ(done, 0x10u);
+}
+
+TEST(bus_page_table_shared_pages) {
+    MemoryBus bus;
+    std::vector<std::unique_ptr<MemoryDevice>> blocks;
+    for (uint64_t i = 0; i < 32; ++i) {
+        blocks.push_back(std::make_unique<MemoryDevice>(0x40, false));
+        bus.registerDevice(blocks.back().get(), 0x20000000 + i * 0x80, 0x40);
+    }
+    for (uint64_t i = 0; i < 32; ++i) {
+        uint64_t base = 0x20000000 + i * 0x80;
+        EXPECT_TRUE(bus.findDevice(base) == blocks[i].get());
+        EXPECT_TRUE(bus.findDevice(base + 0x3f) == blocks[i].get());
+        EXPECT_TRUE(bus.findDevice(base + 0x40) == nullptr);
+    }
+}
+
+TEST(bus_page_table_large_and_high_mappings) {
+    MemoryBus bus;
+    MemoryDevice ram(0x1000, false);
+    MemoryDevice rom(0x40, true);
+    MemoryDevice high(0x100, false);
+    bus.registerDevice(&ram, 0x80000000, 0x40000000, "RAM");
+    bus.registerDevice(&rom, 0x7ffff000, 0x40, "ROM");
+    bus.registerDevice(&high, 0xffff000000000000ull, 0x100, "HIGH");
+
+    EXPECT_TRUE(bus.findDevice(0x80000000) == &ram);
+    EXPECT_TRUE(bus.findDevice(0xbfffffff) == &ram);
+    EXPECT_TRUE(bus.findDevice(0xc0000000) == nullptr);
+    EXPECT_TRUE(bus.findDevice(0x7ffff020) == &rom);
+    EXPECT_TRUE(bus.findDevice(0x7ffff040) == nullptr);
+    EXPECT_TRUE(bus.findDevice(0xffff0000000000ffull) == &high);
+    EXPECT_TRUE(bus.findDevice(0xffff000000000100ull) == nullptr);
+
+    ASSERT_TRUE(bus.write(MakeAccess(0x7ffffffc, 4, MemAccessType::Write, 1)).success == false);
+    MemResponse fetch = bus.read(MakeAccess(0x7ffff000, 4, MemAccessType::Fetch));
+    EXPECT_TRUE(fetch.success);
+}
+
+TEST(bus_event_scheduler_order_and_cancel) {
+    EventScheduler events;
+    std::vector<int> fired;
+    events.schedule(300, [&](uint64_t) { fired.push_back(3); });
+    events.schedule(100, [&](uint64_t) { fired.push_back(1); });
+    EventScheduler::EventId dropped = events.schedule(200, [&](uint64_t) { fired.push_back(2); });
+    events.schedule(100, [&](uint64_t now) {
+        fired.push_back(4);
+        EXPECT_EQ(now, 160u);
+        events.schedule(150, [&](uint64_t) { fired.push_back(5); });
+    });
+
+    EXPECT_EQ(events.nextEventCycle(), 100u);
+    EXPECT_TRUE(events.cancel(dropped));
+    EXPECT_TRUE(!events.cancel(dropped));
+
+    EXPECT_EQ(events.runDue(99), 0u);
+    EXPECT_EQ(events.runDue(160), 3u);
+    EXPECT_EQ(events.nextEventCycle(), 300u);
+    EXPECT_EQ(events.runDue(1000), 1u);
+    EXPECT_TRUE(events.empty());
+    EXPECT_EQ(events.nextEventCycle(), EventScheduler::kNoEvent);
+
+    std::vector<int> expected = {1, 4, 5, 3};
+    EXPECT_TRUE(fired == expected);
+}
+
+TEST(bus_event_scheduler_device_sync) {
+    MemoryBus bus;
+    TickingDevice ticking;
+    TimerDevice timer;
+    MemoryDevice ram(0x100, false);
+    ticking.setSyncThreshold(100);
+    bus.registerDevice(&ticking, 0x1000, 0x100, "TICK");
+    bus.registerDevice(&timer, 0x3000, 0x100, "TIMER");
+    bus.registerDevice(&ram, 0x2000, 0x100, "RAM");
+
+    // Only the ticking device has periodic work; the timer is computed on
+    // read and RAM schedules nothing.
+    EventScheduler& events = bus.scheduler();
+    EXPECT_EQ(events.size(), 1u);
+    EXPECT_EQ(events.nextEventCycle(), 100u);
+
+    events.runDue(100);
+    EXPECT_EQ(ticking.mTicked, 100u);
+    EXPECT_EQ(timer.getCounterMicros(), 100u);
+    EXPECT_EQ(events.nextEventCycle(), 200u);
+
+    ticking.setSyncThreshold(10);
+    EXPECT_EQ(events.size(), 1u);
+    EXPECT_EQ(events.nextEventCycle(), 110u);
+}
+
+TEST(bus_event_scheduler_device_outlives_bus) {
+    TickingDevice ticking;
+    TimerDevice timer;
+    {
+        MemoryBus bus;
+        bus.registerDevice(&ticking, 0x1000, 0x100, "TICK");
+        bus.registerDevice(&timer, 0x2000, 0x100, "TIMER");
+    }
+    ticking.setSyncThreshold(50);
+    EXPECT_EQ(ticking.mTicked, 0u);
+    EXPECT_EQ(timer.getCounterMicros(), 0u);
+}
+
+TEST(bus_atomic_add_across_threads) {
+    constexpr int kThreads = 4;
+    constexpr int kIterations = 20000;
+    MemoryBus bus;
+    MemoryDevice ram(0x1000, false);
+    bus.registerDevice(&ram, 0x8000, 0x1000, "RAM");
+    bus.setConcurrent(true);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&bus, t]() {
+            for (int i = 0; i < kIterations; ++i) {
+                MemAccess add = MakeAccess(0x8040, 8, MemAccessType::AtomicRmw, 1);
+                add.atomicOp = AtomicOp::Add;
+                add.hartId = static_cast<uint32_t>(t);
+                bus.atomic(add);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(bus.read(MakeAccess(0x8040, 8, MemAccessType::Read)).data,
+        static_cast<uint64_t>(kThreads) * kIterations);
+}
+
+TEST(bus_atomic_mmio_emulated) {
+    MemoryBus bus;
+    Device reg;
+    uint64_t value = 10;
+    reg.setReadHandler([&value](const MemAccess&) {
+        MemResponse response;
+        response.data = value;
+        return response;
+    });
+    reg.setWriteHandler([&value](const MemAccess& access) {
+        value = access.data;
+        return MemResponse{};
+    });
+    bus.registerDevice(&reg, 0x1000, 0x10, "REG");
+
+    MemAccess orAccess = MakeAccess(0x1000, 4, MemAccessType::AtomicRmw, 0x5);
+    orAccess.atomicOp = AtomicOp::Or;
+    EXPECT_EQ(bus.atomic(orAccess).data, 10u);
+    EXPECT_EQ(value, 15u);
+    EXPECT_TRUE(!bus.atomic(MakeAccess(0x1000, 4, MemAccessType::LoadReserved)).success);
+}
+
+TEST(bus_atomic_stores_notify_write_listeners) {
+    MemoryDevice ram(0x1000, false);
+    MemoryBus bus;
+    bus.registerDevice(&ram, 0x8000, 0x1000, "RAM");
+    int notified = 0;
+    uint64_t written = 0;
+    bus.addWriteListener([&](uint64_t address, uint64_t size) {
+        ++notified;
+        written = address + size;
+    });
+
+    MemAccess add = MakeAccess(0x8010, 4, MemAccessType::AtomicRmw, 1);
+    add.atomicOp = AtomicOp::Add;
+    ASSERT_TRUE(bus.atomic(add).success);
+    EXPECT_EQ(notified, 1);
+    EXPECT_EQ(written, 0x8014u);
+
+    // Only accesses that store count: a failed compare-exchange or SC and
+    // a plain LR leave memory, and decoded code, untouched.
+    MemAccess cas = MakeAccess(0x8010, 4, MemAccessType::CompareExchange, 7);
+    cas.expected = 5;
+    ASSERT_TRUE(bus.atomic(cas).success);
+    EXPECT_EQ(notified, 1);
+    cas.expected = 1;
+    ASSERT_TRUE(bus.atomic(cas).success);
+    EXPECT_EQ(notified, 2);
+
+    MemAccess sc = MakeAccess(0x8020, 4, MemAccessType::StoreConditional, 3);
+    EXPECT_EQ(bus.atomic(sc).data, 1u);
+    EXPECT_EQ(notified, 2);
+    ASSERT_TRUE(bus.atomic(MakeAccess(0x8020, 4, MemAccessType::LoadReserved)).success);
+    EXPECT_EQ(notified, 2);
+    EXPECT_EQ(bus.atomic(sc).data, 0u);
+    EXPECT_EQ(notified, 3);
+    EXPECT_EQ(written, 0x8024u);
+}
+
+TEST(bus_stats_count_mappings_and_lookup_cache) {
+    MemoryDevice ram(0x100, false);
+    Device reg;
+    reg.setReadHandler([](const MemAccess&) { return MemResponse{}; });
+    reg.setWriteHandler([](const MemAccess&) { return MemResponse{}; });
+    MemoryBus bus;
+    bus.registerDevice(&ram, 0x8000, 0x100, "RAM");
+    bus.registerDevice(&reg, 0x1000, 0x10, "REG");
+
+    for (int i = 0; i < 4; ++i) {
+        bus.read(MakeAccess(0x8000 + 4 * i, 4, MemAccessType::Read));
+    }
+    bus.write(MakeAccess(0x8000, 4, MemAccessType::Write, 1));
+    bus.write(MakeAccess(0x1000, 4, MemAccessType::Write, 1));
+    uint8_t block[0x20] = {};
+    ASSERT_TRUE(bus.readBlock(0x8000, block, sizeof(block)));
+
+    BusStats stats = bus.getStats();
+    ASSERT_EQ(stats.mappings.size(), 2u);
+    EXPECT_EQ(stats.mappings[0].name, std::string("RAM"));
+    EXPECT_EQ(stats.mappings[0].reads, 5u);
+    EXPECT_EQ(stats.mappings[0].writes, 1u);
+    EXPECT_EQ(stats.mappings[1].reads, 0u);
+    EXPECT_EQ(stats.mappings[1].writes, 1u);
+    // One miss per access kind and page; the rest hit the lookup cache.
+    EXPECT_EQ(stats.tlbMisses, 3u);
+    EXPECT_EQ(stats.tlbHits, 4u);
+}
+
+TEST(bus_stats_sum_counts_from_every_thread) {
+    MemoryDevice ram(0x1000, false);
+    MemoryBus bus;
+    bus.registerDevice(&ram, 0x8000, 0x1000, "RAM");
+
+    constexpr int kThreads = 4;
+    constexpr int kReads = 20000;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&bus, t] {
+            for (int i = 0; i < kReads; ++i) {
+                bus.read(MakeAccess(0x8000 + 0x400 * t + 4 * (i % 0x100), 4,
+                    MemAccessType::Read));
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // Each thread counts into its own shard, so no increment is lost.
+    BusStats stats = bus.getStats();
+    ASSERT_EQ(stats.mappings.size(), 1u);
+    EXPECT_EQ(stats.mappings[0].reads, uint64_t(kThreads) * kReads);
+    EXPECT_EQ(stats.tlbHits + stats.tlbMisses, uint64_t(kThreads) * kReads);
+}
+
+TEST(bus_heatmap_counts_pages_and_access_kinds) {
+    MemoryDevice ram(0x3000, false);
+    MemoryBus bus;
+    bus.registerDevice(&ram, 0x8000, 0x3000, "RAM");
+    DirectMemoryRange direct;
+    ASSERT_TRUE(bus.getDirectMemory(0x8000, &direct));
+
+    bus.read(MakeAccess(0x8000, 4, MemAccessType::Read));
+    bus.setHeatmapEnabled(true);
+    EXPECT_TRUE(!bus.getDirectMemory(0x8000, &direct));
+    bus.read(MakeAccess(0x8004, 4, MemAccessType::Fetch));
+    bus.read(MakeAccess(0x8008, 4, MemAccessType::Fetch));
+    bus.read(MakeAccess(0xA000, 4, MemAccessType::Read));
+    bus.write(MakeAccess(0xA010, 4, MemAccessType::Write, 1));
+    uint8_t block[0x20] = {};
+    ASSERT_TRUE(bus.writeBlock(0x8FF0, block, sizeof(block)));
+    bus.setHeatmapEnabled(false);
+    bus.write(MakeAccess(0xA010, 4, MemAccessType::Write, 2));
+    EXPECT_TRUE(bus.getDirectMemory(0x8000, &direct));
+
+    std::vector<MappingHeat> heatmap = bus.getHeatmap();
+    ASSERT_EQ(heatmap.size(), 1u);
+    EXPECT_EQ(heatmap[0].granuleShift, MemoryBus::kPageShift);
+    EXPECT_EQ(heatmap[0].totals.reads, 1u);
+    EXPECT_EQ(heatmap[0].totals.writes, 3u);
+    EXPECT_EQ(heatmap[0].totals.fetches, 2u);
+    ASSERT_EQ(heatmap[0].cells.size(), 3u);
+    EXPECT_EQ(heatmap[0].cells[0].address, 0x8000u);
+    EXPECT_EQ(heatmap[0].cells[0].fetches, 2u);
+    EXPECT_EQ(heatmap[0].cells[0].writes, 1u);
+    // The block write straddles a page boundary.
+    EXPECT_EQ(heatmap[0].cells[1].address, 0x9000u);
+    EXPECT_EQ(heatmap[0].cells[1].writes, 1u);
+    EXPECT_EQ(heatmap[0].cells[2].address, 0xA000u);
+    EXPECT_EQ(heatmap[0].cells[2].reads, 1u);
+    EXPECT_EQ(heatmap[0].cells[2].writes, 1u);
+
+    bus.clearHeatmap();
+    EXPECT_EQ(bus.getHeatmap()[0].cells.size(), 0u);
+}
+
+TEST(bus_dispatches_static_and_handler_devices) {
+    MemoryBus bus;
+    TimerDevice timer;
+    Device reg;
+    uint64_t value = 3;
+    reg.setReadHandler([&value](const MemAccess&) {
+        MemResponse response;
+        response.data = value;
+        return response;
+    });
+    reg.setWriteHandler([&value](const MemAccess& access) {
+        value = access.data;
+        return MemResponse{};
+    });
+    bus.registerDevice(&timer, 0x2000, 0x100, "TIMER");
+    bus.registerDevice(&reg, 0x1000, 0x10, "REG");
+
+    ASSERT_TRUE(bus.write(MakeAccess(0x1000, 4, MemAccessType::Write, 9)).success);
+    EXPECT_EQ(value, 9u);
+    EXPECT_EQ(bus.read(MakeAccess(0x1000, 4, MemAccessType::Read)).data, 9u);
+    EXPECT_TRUE(bus.read(MakeAccess(0x2000, 4, MemAccessType::Read)).success);
+}
+
+TEST(bus_wide_access_direct_and_mmio) {
+    MemoryDevice ram(0x1000, false);
+    UartDevice uart;
+    MemoryBus bus;
+    bus.registerDevice(&ram, 0x8000, 0x1000, "RAM");
+    bus.registerDevice(&uart, 0x10000, 0x100, "UART");
+    uint64_t written = 0;
+    bus.addWriteListener([&written](uint64_t address, uint64_t size) {
+        written = address + size;
+    });
+
+    std::vector<uint8_t> payload(32, 0x5a);
+    MemAccess store = MakeAccess(0x8100, 32, MemAccessType::Write);
+    store.wide = payload.data();
+    ASSERT_TRUE(bus.write(store).success);
+    EXPECT_EQ(written, 0x8120u);
+    EXPECT_EQ(ram.getDirtyPageCount(), 1u);
+    EXPECT_EQ(bus.read(MakeAccess(0x811c, 4, MemAccessType::Read)).data, 0x5a5a5a5au);
+
+    std::vector<uint8_t> back(64);
+    MemAccess load = MakeAccess(0x80f0, 64, MemAccessType::Read);
+    load.wide = back.data();
+    ASSERT_TRUE(bus.read(load).success);
+    EXPECT_EQ(back[15], 0u);
+    EXPECT_EQ(back[16], 0x5au);
+    EXPECT_EQ(back[48], 0u);
+
+    // Devices without wide registers reject them.
+    MemAccess mmio = MakeAccess(0x10000, 16, MemAccessType::Read);
+    mmio.wide = back.data();
+    EXPECT_TRUE(!bus.read(mmio).success);
+}
+
+TEST(bus_validate_and_register_large_maps) {
+    std::vector<MemoryRegion> regions;
+    std::vector<std::string> names;
+    for (uint64_t i = 0; i < 512; ++i) {
+        names.push_back("R" + std::to_string(i));
+    }
+    // Listed out of order, each one page apart.
+    for (uint64_t i = 0; i < 512; ++i) {
+        uint64_t slot = (i * 37) % 512;
+        regions.push_back({names[slot].c_str(), 0x100000 + slot * 0x1000, 0x1000});
+    }
+    std::string err;
+    EXPECT_TRUE(validateMappings(regions, &err));
+    regions.push_back({"WIDE", 0x0, 0x200000});
+    EXPECT_TRUE(!validateMappings(regions, &err));
+    EXPECT_EQ(err, std::string("Overlapping mappings: WIDE and R0"));
+    regions.pop_back();
+    regions.push_back({"WRAP", ~0ull - 4, 0x10});
+    EXPECT_TRUE(!validateMappings(regions, &err));
+    EXPECT_EQ(err, std::string("Invalid mapping: WRAP"));
+
+    std::vector<std::unique_ptr<MemoryDevice>> banks;
+    std::vector<DeviceRegistration> map;
+    for (uint64_t i = 0; i < 64; ++i) {
+        uint64_t slot = (i * 37) % 64;
+        banks.push_back(std::make_unique<MemoryDevice>(0x1000, false));
+        map.push_back({banks.back().get(), 0x100000 + slot * 0x1000, 0x1000,
+            "BANK" + std::to_string(slot)});
+    }
+    MemoryBus bus;
+    MemoryDevice low(0x1000, false);
+    bus.registerDevice(&low, 0x1000, 0x1000, "LOW");
+    bus.registerDevices(map);
+    for (uint64_t slot = 0; slot < 64; ++slot) {
+        ASSERT_TRUE(bus.write(MakeAccess(0x100000 + slot * 0x1000, 4, MemAccessType::Write,
+            slot)).success);
+    }
+    EXPECT_EQ(bus.read(MakeAccess(0x100000 + 5 * 0x1000, 4, MemAccessType::Read)).data, 5u);
+    EXPECT_TRUE(bus.findDevice(0x100000 + 9 * 0x1000) == bus.getDevice("BANK9"));
+    EXPECT_TRUE(bus.findDevice(0x1800) == &low);
+    EXPECT_TRUE(!bus.read(MakeAccess(0x100000 + 64 * 0x1000, 4, MemAccessType::Read)).success);
+}
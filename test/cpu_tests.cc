@@ -0,0 +1,1169 @@
+#include "test_framework.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "emulator/cpu/block_cache.h"
+#include "emulator/debugger/debugger.h"
+#include "emulator/debugger/gdb_server.h"
+#include "emulator/debugger/pacer.h"
+#include "emulator/device/interrupt_controller.h"
+#include "emulator/device/memory.h"
+#include "emulator/device/uart.h"
+#include "toy_cpu_executor.h"
+#include "toy_isa.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+namespace {
+
+struct CpuTestContext {
+    ToyCpuExecutor Cpu;
+    MemoryBus Bus;
+    MemoryDevice Ram{0x2000, false};
+    Debugger Dbg{&Cpu, &Bus};
+
+    CpuTestContext() {
+        Bus.registerDevice(&Ram, 0, 0x2000, "RAM");
+        Bus.setDebugger(&Dbg);
+        TraceOptions opts;
+        opts.logInstruction = false;
+        opts.logMemEvents = false;
+        opts.logBranchPrediction = false;
+        Dbg.configureTrace(opts);
+        Cpu.setDebugger(&Dbg);
+    }
+
+    void WriteWord(uint64_t address, uint32_t value) {
+        MemAccess access;
+        access.address = address;
+        access.size = 4;
+        access.type = MemAccessType::Write;
+        access.data = value;
+        Bus.write(access);
+    }
+
+    void WriteProgram(const std::vector<uint32_t>& prog, uint64_t base = 0) {
+        for (size_t i = 0; i < prog.size(); ++i) {
+            WriteWord(base + i * 4, prog[i]);
+        }
+    }
+};
+
+// Several harts sharing one bus; the UART lets Debugger::run() use its plain
+// input loop, which returns once every hart has halted.
+struct SmpTestContext {
+    MemoryBus Bus;
+    MemoryDevice Ram{0x2000, false};
+    UartDevice Uart;
+    ToyCpuExecutor Boot;
+    std::vector<std::unique_ptr<ICpuExecutor>> Extra;
+    std::vector<ICpuExecutor*> Harts;
+    Debugger Dbg{&Boot, &Bus};
+
+    explicit SmpTestContext(uint32_t count) {
+        Bus.registerDevice(&Ram, 0, 0x2000, "RAM");
+        Bus.registerDevice(&Uart, 0x4000, 0x100, "UART");
+        Bus.setDebugger(&Dbg);
+        Harts.push_back(&Boot);
+        for (uint32_t id = 1; id < count; ++id) {
+            Extra.emplace_back(Boot.createHart(id));
+            Harts.push_back(Extra.back().get());
+            Dbg.addHart(Extra.back().get());
+        }
+        TraceOptions opts;
+        opts.logInstruction = false;
+        opts.logMemEvents = false;
+        opts.logBranchPrediction = false;
+        Dbg.configureTrace(opts);
+        for (ICpuExecutor* hart : Harts) {
+            hart->setDebugger(&Dbg);
+        }
+    }
+
+    void WriteProgram(const std::vector<uint32_t>& prog) {
+        for (size_t i = 0; i < prog.size(); ++i) {
+            MemAccess access;
+            access.address = i * 4;
+            access.size = 4;
+            access.type = MemAccessType::Write;
+            access.data = prog[i];
+            Bus.write(access);
+        }
+    }
+};
+
+} // namespace
+
+void RegisterCpuTests() {
+}
+
+TEST(cpu_block_cache_build_and_invalidate) {
+    BlockCache<uint32_t> cache;
+    auto decoder = [](uint64_t pc, uint32_t* out, uint32_t* length) {
+        *out = static_cast<uint32_t>(pc);
+        *length = 4;
+        return pc == 0x1008 ? BlockDecodeStatus::EndBlock : BlockDecodeStatus::Continue;
+    };
+
+    const auto* block = cache.lookupOrBuild(0x1000, decoder);
+    ASSERT_TRUE(block != nullptr);
+    EXPECT_EQ(block->insts.size(), 3u);
+    EXPECT_EQ(block->endPc, 0x100cu);
+    EXPECT_TRUE(cache.lookupOrBuild(0x1000, decoder) == block);
+    EXPECT_EQ(cache.stats().hits, 1u);
+
+    uint64_t generation = cache.generation();
+    cache.invalidateRange(0x5000, 4);
+    EXPECT_EQ(cache.generation(), generation);
+    cache.invalidateRange(0x1004, 4);
+    EXPECT_TRUE(cache.generation() != generation);
+    EXPECT_EQ(cache.size(), 0u);
+}
+
+TEST(cpu_block_cache_shares_code_pages) {
+    SharedCodePages pages;
+    BlockCache<uint32_t> cache;
+    cache.share(&pages, 3);
+    // A block running from the end of one page onto the next marks both.
+    auto decoder = [](uint64_t pc, uint32_t* out, uint32_t* length) {
+        *out = static_cast<uint32_t>(pc);
+        *length = 4;
+        return pc == 0x2004 ? BlockDecodeStatus::EndBlock : BlockDecodeStatus::Continue;
+    };
+    ASSERT_TRUE(cache.lookupOrBuild(0x1ff8, decoder) != nullptr);
+    EXPECT_EQ(pages.harts(0x1ffc, 4), 1u << 3);
+    EXPECT_EQ(pages.harts(0x2000, 0x10), 1u << 3);
+    EXPECT_EQ(pages.harts(0x5000, 4), 0u);
+
+    // A whole-address-space invalidation is checked block by block.
+    EXPECT_TRUE(cache.invalidateRange(0, std::numeric_limits<uint64_t>::max()));
+    EXPECT_EQ(cache.size(), 0u);
+    pages.forget(3);
+    EXPECT_EQ(pages.harts(0x1000, 0x2000), 0u);
+}
+
+TEST(cpu_block_cache_loop) {
+    CpuTestContext ctx;
+    std::vector<uint32_t> prog;
+    toy::Emit(&prog, toy::Lui(1, 0));
+    toy::Emit(&prog, toy::Ori(1, 0x1000));
+    toy::Emit(&prog, toy::Lw(2, 1, 0));
+    toy::Emit(&prog, toy::Beq(0, 0, -2));
+    ctx.WriteProgram(prog);
+
+    StepResult result = ctx.Cpu.step(302, 1000000);
+    EXPECT_TRUE(result.success);
+    EXPECT_EQ(result.instructionsExecuted, 302u);
+    EXPECT_EQ(ctx.Cpu.getPc(), 0x8u);
+    EXPECT_TRUE(ctx.Cpu.getBlockCacheStats().hits >= 100u);
+}
+
+TEST(cpu_self_modifying_code) {
+    CpuTestContext ctx;
+    std::vector<uint32_t> prog;
+    // Overwrite the NOP at 0x14 with "LUI r3, 0x42" before reaching it.
+    toy::Emit(&prog, toy::Lui(1, toy::Lui(3, 0x42) >> 16));
+    toy::Emit(&prog, toy::Ori(1, 0x42));
+    toy::Emit(&prog, toy::Lui(2, 0));
+    toy::Emit(&prog, toy::Ori(2, 0x14));
+    toy::Emit(&prog, toy::Sw(1, 2, 0));
+    toy::Emit(&prog, toy::Nop());
+    toy::Emit(&prog, toy::Halt());
+    ctx.WriteProgram(prog);
+
+    StepResult result = ctx.Cpu.step(100, 1000000);
+    EXPECT_EQ(result.success, false);
+    EXPECT_EQ(ctx.Cpu.getLastError().type, CpuErrorType::None);
+    EXPECT_EQ(ctx.Cpu.getRegister(3), 0x420000u);
+}
+
+TEST(cpu_external_write_invalidates) {
+    CpuTestContext ctx;
+    std::vector<uint32_t> prog;
+    toy::Emit(&prog, toy::Lui(3, 0x1));
+    toy::Emit(&prog, toy::Halt());
+    ctx.WriteProgram(prog);
+
+    ctx.Cpu.step(10, 1000000);
+    EXPECT_EQ(ctx.Cpu.getRegister(3), 0x10000u);
+
+    ctx.WriteWord(0, toy::Lui(3, 0x2));
+    ctx.Cpu.setPc(0);
+    ctx.Cpu.step(10, 1000000);
+    EXPECT_EQ(ctx.Cpu.getRegister(3), 0x20000u);
+}
+
+TEST(cpu_threaded_engine_matches_interpreter) {
+    std::vector<uint32_t> prog;
+    toy::Emit(&prog, toy::Lui(1, 0));
+    toy::Emit(&prog, toy::Ori(1, 0x1000));
+    toy::Emit(&prog, toy::Lui(2, 0x7));
+    toy::Emit(&prog, toy::Sw(2, 1, 4));
+    toy::Emit(&prog, toy::Lw(3, 1, 4));
+    toy::Emit(&prog, toy::Beq(0, 0, -3));
+
+    CpuTestContext interp;
+    CpuTestContext threaded;
+    interp.WriteProgram(prog);
+    threaded.WriteProgram(prog);
+    EXPECT_TRUE(threaded.Cpu.setExecutionEngine(ExecutionEngine::Threaded));
+
+    for (int i = 0; i < 5; ++i) {
+        StepResult a = interp.Cpu.step(97, 1000000);
+        StepResult b = threaded.Cpu.step(97, 1000000);
+        EXPECT_EQ(a.instructionsExecuted, b.instructionsExecuted);
+        EXPECT_EQ(interp.Cpu.getPc(), threaded.Cpu.getPc());
+        EXPECT_EQ(interp.Cpu.getCycle(), threaded.Cpu.getCycle());
+    }
+    EXPECT_EQ(threaded.Cpu.getRegister(3), 0x70000u);
+    EXPECT_TRUE(threaded.Cpu.getThreadedCacheStats().hits > 0u);
+    EXPECT_EQ(threaded.Cpu.getBlockCacheStats().misses, 0u);
+}
+
+TEST(cpu_threaded_engine_self_modifying_code) {
+    CpuTestContext ctx;
+    ctx.Cpu.setExecutionEngine(ExecutionEngine::Threaded);
+    std::vector<uint32_t> prog;
+    toy::Emit(&prog, toy::Lui(1, toy::Lui(3, 0x42) >> 16));
+    toy::Emit(&prog, toy::Ori(1, 0x42));
+    toy::Emit(&prog, toy::Lui(2, 0));
+    toy::Emit(&prog, toy::Ori(2, 0x14));
+    toy::Emit(&prog, toy::Sw(1, 2, 0));
+    toy::Emit(&prog, toy::Nop());
+    toy::Emit(&prog, toy::Halt());
+    ctx.WriteProgram(prog);
+
+    StepResult result = ctx.Cpu.step(100, 1000000);
+    EXPECT_EQ(result.success, false);
+    EXPECT_EQ(result.instructionsExecuted, 7u);
+    EXPECT_EQ(ctx.Cpu.getLastError().type, CpuErrorType::None);
+    EXPECT_EQ(ctx.Cpu.getRegister(3), 0x420000u);
+}
+
+TEST(cpu_threaded_engine_invalid_op) {
+    CpuTestContext ctx;
+    ctx.Cpu.setExecutionEngine(ExecutionEngine::Threaded);
+    ctx.WriteProgram({toy::Nop(), 0xff000000u});
+
+    StepResult result = ctx.Cpu.step(10, 1000000);
+    EXPECT_EQ(result.success, false);
+    EXPECT_EQ(ctx.Cpu.getLastError().type, CpuErrorType::InvalidOp);
+    EXPECT_EQ(ctx.Cpu.getLastError().address, 0x4u);
+}
+
+TEST(cpu_trace_options_swap_step_loop) {
+    CpuTestContext ctx;
+    ctx.WriteProgram({toy::Nop(), toy::Nop(), toy::Nop(), toy::Beq(0, 0, -4)});
+    size_t formatted = 0;
+    ctx.Dbg.setTraceFormatter([&formatted](const TraceRecord&, const TraceOptions&) {
+        ++formatted;
+        return std::string();
+    });
+
+    TraceOptions opts;
+    opts.logInstruction = true;
+    opts.logMemEvents = false;
+    opts.logBranchPrediction = false;
+    ctx.Dbg.configureTrace(opts);
+    ctx.Cpu.step(8, 1000000);
+    EXPECT_EQ(formatted, 8u);
+
+    opts.logInstruction = false;
+    ctx.Dbg.configureTrace(opts);
+    StepResult result = ctx.Cpu.step(8, 1000000);
+    EXPECT_TRUE(result.success);
+    EXPECT_EQ(result.instructionsExecuted, 8u);
+    EXPECT_EQ(formatted, 8u);
+}
+
+TEST(cpu_trace_filter_limits_records) {
+    CpuTestContext ctx;
+    ctx.WriteProgram({toy::Sw(2, 1, 0), toy::Nop(), toy::Nop(), toy::Beq(0, 0, -4)});
+    ctx.Cpu.setRegister(1, 0x1000);
+    std::vector<uint64_t> pcs;
+    ctx.Dbg.setTraceFormatter([&pcs](const TraceRecord& record, const TraceOptions&) {
+        pcs.push_back(record.pc);
+        return std::string();
+    });
+
+    TraceOptions opts;
+    opts.logInstruction = true;
+    opts.logMemEvents = true;
+    opts.logBranchPrediction = false;
+    opts.filter.pcRanges = {{0x4, 0x8}};
+    ctx.Dbg.configureTrace(opts);
+    ctx.Cpu.step(40, 1000000);
+    EXPECT_EQ(pcs.size(), 10u);
+    EXPECT_EQ(pcs.empty() ? 0u : pcs.back(), 0x4u);
+
+    // Skip the first 20 instructions, then keep every other match.
+    pcs.clear();
+    opts.filter.skipInstructions = 20;
+    opts.filter.sampleEvery = 2;
+    ctx.Dbg.configureTrace(opts);
+    ctx.Cpu.step(40, 1000000);
+    EXPECT_EQ(pcs.size(), 3u);
+
+    // Only the store touches the data range.
+    pcs.clear();
+    opts.filter = TraceFilter{};
+    opts.filter.dataRanges = {{0x1000, 0x1004}};
+    ctx.Dbg.configureTrace(opts);
+    ctx.Cpu.step(8, 1000000);
+    ASSERT_EQ(pcs.size(), 2u);
+    EXPECT_EQ(pcs[0], 0x0u);
+    EXPECT_EQ(pcs[1], 0x0u);
+}
+
+TEST(cpu_multi_hart_shared_bus) {
+    SmpTestContext ctx(4);
+    ctx.WriteProgram({toy::Sw(2, 1, 0), toy::Halt()});
+    for (uint32_t i = 0; i < ctx.Harts.size(); ++i) {
+        ctx.Harts[i]->setRegister(1, 0x1000 + 4 * i);
+        ctx.Harts[i]->setRegister(2, 0x100 + i);
+    }
+    EXPECT_EQ(ctx.Dbg.getHartCount(), 4u);
+
+    ctx.Dbg.run(false);
+
+    for (uint32_t i = 0; i < ctx.Harts.size(); ++i) {
+        MemAccess access;
+        access.address = 0x1000 + 4 * i;
+        access.size = 4;
+        EXPECT_EQ(ctx.Bus.read(access).data, 0x100u + i);
+        EXPECT_TRUE(ctx.Dbg.getHartStatus(i).halted);
+        EXPECT_EQ(ctx.Harts[i]->getLastError().type, CpuErrorType::None);
+    }
+}
+
+TEST(cpu_multi_hart_cross_modifying_code) {
+    // Hart 1 spins in a loop counting at 0x1000; once it has, hart 0 stores
+    // a Halt over the loop's branch through direct memory. Hart 1 only stops
+    // if its decode caches hear about the store.
+    for (ExecutionEngine engine : {ExecutionEngine::Interpreter, ExecutionEngine::Threaded}) {
+        SmpTestContext ctx(2);
+        ctx.WriteProgram({
+            toy::Beq(5, 0, 3),
+            toy::Addi(1, 1),
+            toy::Sw(1, 2, 0),
+            toy::Beq(0, 0, -3),
+            toy::Lw(3, 2, 0),
+            toy::Beq(3, 0, -2),
+            toy::Sw(7, 4, 0),
+            toy::Halt(),
+        });
+        for (ICpuExecutor* hart : ctx.Harts) {
+            EXPECT_TRUE(hart->setExecutionEngine(engine));
+            hart->setRegister(2, 0x1000);
+        }
+        ctx.Harts[0]->setRegister(4, 0xc);
+        ctx.Harts[0]->setRegister(7, toy::Halt());
+        ctx.Harts[1]->setRegister(5, 1);
+
+        std::thread runner([&ctx]() { ctx.Dbg.run(false); });
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        while (!ctx.Dbg.getHartStatus(1).halted && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        EXPECT_TRUE(ctx.Dbg.getHartStatus(1).halted);
+        ctx.Dbg.processCommand("quit");
+        runner.join();
+        EXPECT_EQ(ctx.Harts[1]->getPc(), 0x10u);
+        EXPECT_EQ(ctx.Harts[1]->getLastError().type, CpuErrorType::None);
+    }
+}
+
+TEST(cpu_multi_hart_bounded_skew_and_pause) {
+    constexpr uint64_t kQuantum = 500;
+    SmpTestContext ctx(2);
+    ctx.WriteProgram({toy::Beq(0, 0, -1)});
+    ctx.Dbg.setHartQuantum(kQuantum);
+
+    std::thread runner([&ctx]() { ctx.Dbg.run(false); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    ctx.Dbg.processCommand("hart pause 1");
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    uint64_t pausedCycle = ctx.Dbg.getHartStatus(1).cycle;
+    uint64_t bootCycle = ctx.Dbg.getHartStatus(0).cycle;
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_EQ(ctx.Dbg.getHartStatus(1).cycle, pausedCycle);
+    EXPECT_TRUE(ctx.Dbg.getHartStatus(0).cycle > bootCycle);
+
+    // Resuming lets the paused hart catch up without the other running away.
+    ctx.Dbg.processCommand("hart run 1");
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (ctx.Dbg.getHartStatus(1).cycle + kQuantum < ctx.Dbg.getHartStatus(0).cycle &&
+        std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    ctx.Dbg.processCommand("quit");
+    runner.join();
+
+    uint64_t a = ctx.Dbg.getHartStatus(0).cycle;
+    uint64_t b = ctx.Dbg.getHartStatus(1).cycle;
+    EXPECT_TRUE(b > pausedCycle);
+    EXPECT_TRUE((a > b ? a - b : b - a) <= kQuantum + 1);
+}
+
+TEST(debugger_batch_size_adapts) {
+    SmpTestContext ctx(1);
+    ctx.WriteProgram({toy::Beq(0, 0, -1)});
+    // A sync threshold beyond the largest batch, so only the policy limits it.
+    ctx.Dbg.setCpuFrequency(std::numeric_limits<uint32_t>::max());
+    auto waitFor = [&ctx](const std::function<bool(const BatchStats&)>& done) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (!done(ctx.Dbg.getBatchStats()) && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return ctx.Dbg.getBatchStats();
+    };
+    std::thread runner([&ctx]() { ctx.Dbg.run(false); });
+
+    // Whole batches double up to the cap and stay there.
+    BatchStats stats = waitFor([](const BatchStats& s) {
+        return s.current == Debugger::kMaxInstructionsPerBatch;
+    });
+    EXPECT_EQ(stats.current, Debugger::kMaxInstructionsPerBatch);
+    EXPECT_TRUE(stats.grows >= 10u);
+    stats = waitFor([](const BatchStats& s) {
+        return s.largest == Debugger::kMaxInstructionsPerBatch;
+    });
+    EXPECT_EQ(stats.largest, Debugger::kMaxInstructionsPerBatch);
+    EXPECT_EQ(stats.current, Debugger::kMaxInstructionsPerBatch);
+
+    // A control task asks for attention, so the next batch is the smallest.
+    uint64_t shrinks = stats.shrinks;
+    ctx.Dbg.runOnMachine([]() {});
+    stats = waitFor([](const BatchStats& s) {
+        return s.smallest == Debugger::kMinInstructionsPerBatch;
+    });
+    EXPECT_EQ(stats.smallest, Debugger::kMinInstructionsPerBatch);
+    EXPECT_TRUE(stats.shrinks > shrinks);
+
+    // A device event every 100 cycles limits each batch to what fits before
+    // it; a batch that fits whole may double, so it stays below 200.
+    std::atomic<bool> ticking{true};
+    std::function<void(uint64_t)> tick = [&](uint64_t) {
+        if (ticking.load()) {
+            ctx.Bus.scheduler().scheduleIn(100, tick);
+        }
+    };
+    uint64_t eventLimited = stats.eventLimited;
+    ctx.Dbg.runOnMachine([&]() { ctx.Bus.scheduler().scheduleIn(100, tick); });
+    stats = waitFor([eventLimited](const BatchStats& s) {
+        return s.eventLimited > eventLimited + 10;
+    });
+    EXPECT_TRUE(stats.eventLimited > eventLimited + 10);
+    EXPECT_TRUE(stats.current < 200u);
+
+    ticking.store(false);
+    ctx.Dbg.processCommand("quit");
+    runner.join();
+}
+
+TEST(debugger_control_tasks_run_between_batches) {
+    SmpTestContext ctx(1);
+    ctx.WriteProgram({toy::Beq(0, 0, -1)});
+    std::thread runner([&ctx]() { ctx.Dbg.run(false); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    // While running and while paused, tasks run on the hart thread.
+    std::thread::id caller = std::this_thread::get_id();
+    std::thread::id ranOn = caller;
+    ctx.Dbg.runOnMachine([&]() { ranOn = std::this_thread::get_id(); });
+    EXPECT_TRUE(ranOn != caller);
+    EXPECT_TRUE(ctx.Dbg.processCommand("mem 0 4"));
+    ctx.Dbg.processCommand("pause");
+    ranOn = caller;
+    ctx.Dbg.runOnMachine([&]() { ranOn = std::this_thread::get_id(); });
+    EXPECT_TRUE(ranOn != caller);
+    EXPECT_TRUE(ctx.Dbg.processCommand("regs"));
+
+    ctx.Dbg.processCommand("quit");
+    runner.join();
+    ctx.Dbg.runOnMachine([&]() { ranOn = std::this_thread::get_id(); });
+    EXPECT_TRUE(ranOn == caller);
+}
+
+// Sends one framed packet and returns the payload of the reply, skipping
+// acks; empty on timeout.
+std::string GdbExchange(int fd, const std::string& payload) {
+    uint8_t sum = 0;
+    for (char c : payload) {
+        sum = static_cast<uint8_t>(sum + static_cast<uint8_t>(c));
+    }
+    char trailer[4];
+    std::snprintf(trailer, sizeof(trailer), "#%02x", sum);
+    std::string packet = "$" + payload + trailer;
+    if (write(fd, packet.data(), packet.size()) != static_cast<ssize_t>(packet.size())) {
+        return "";
+    }
+    std::string input;
+    char c = 0;
+    while (read(fd, &c, 1) == 1) {
+        input.push_back(c);
+        size_t start = input.find('$');
+        size_t hash = input.find('#', start == std::string::npos ? 0 : start);
+        if (start != std::string::npos && hash != std::string::npos &&
+            input.size() == hash + 3) {
+            return input.substr(start + 1, hash - start - 1);
+        }
+    }
+    return "";
+}
+
+TEST(gdb_server_packets_read_and_write_state) {
+    CpuTestContext ctx;
+    GdbServer gdb(&ctx.Dbg);
+    gdb.setRegisterBytes(4);
+    ctx.WriteWord(0x100, 0xdeadbeef);
+    ctx.Cpu.setRegister(1, 0x1234);
+    ctx.Cpu.setPc(0x40);
+
+    std::string reply;
+    EXPECT_TRUE(gdb.handlePacket("qSupported:swbreak+", &reply));
+    EXPECT_TRUE(reply.find("PacketSize=4000") != std::string::npos);
+    gdb.handlePacket("p1", &reply);
+    EXPECT_EQ(reply, std::string("34120000"));
+    gdb.handlePacket("g", &reply);
+    EXPECT_EQ(reply.size(), (ctx.Cpu.getRegisterCount() + 1) * 8u);
+    EXPECT_EQ(reply.substr(reply.size() - 8), std::string("40000000"));
+    gdb.handlePacket("P2=78560000", &reply);
+    EXPECT_EQ(reply, std::string("OK"));
+    EXPECT_EQ(ctx.Cpu.getRegister(2), 0x5678u);
+
+    gdb.handlePacket("m100,4", &reply);
+    EXPECT_EQ(reply, std::string("efbeadde"));
+    gdb.handlePacket("M104,2:aabb", &reply);
+    EXPECT_EQ(reply, std::string("OK"));
+    gdb.handlePacket("m104,2", &reply);
+    EXPECT_EQ(reply, std::string("aabb"));
+    gdb.handlePacket("m100000,4", &reply);
+    EXPECT_EQ(reply, std::string("E14"));
+
+    gdb.handlePacket("Z0,44,4", &reply);
+    EXPECT_EQ(reply, std::string("OK"));
+    EXPECT_TRUE(ctx.Dbg.hasBreakpoints());
+    gdb.handlePacket("z0,44,4", &reply);
+    EXPECT_TRUE(!ctx.Dbg.hasBreakpoints());
+    gdb.handlePacket("?", &reply);
+    EXPECT_EQ(reply, std::string("T05thread:1;"));
+}
+
+TEST(gdb_server_steps_and_continues_over_tcp) {
+    SmpTestContext ctx(1);
+    ctx.WriteProgram({toy::Addi(1, 1), toy::Addi(1, 1), toy::Addi(1, 1), toy::Addi(1, 1),
+        toy::Halt()});
+    GdbServer gdb(&ctx.Dbg);
+    std::string error;
+    ASSERT_TRUE(gdb.start(0, false, &error));
+    ctx.Dbg.setStartPaused(true);
+    ctx.Dbg.setHoldOnHalt(true);
+    std::thread runner([&ctx]() { ctx.Dbg.run(false); });
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(gdb.getPort());
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_TRUE(connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0);
+    timeval timeout{2, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    EXPECT_EQ(GdbExchange(fd, "?"), std::string("T05thread:1;"));
+    EXPECT_EQ(GdbExchange(fd, "s"), std::string("T05thread:1;"));
+    EXPECT_EQ(ctx.Boot.getPc(), 4u);
+    // Breakpoint stops carry the reason qSupported advertised.
+    EXPECT_EQ(GdbExchange(fd, "Z0,8,4"), std::string("OK"));
+    EXPECT_EQ(GdbExchange(fd, "Z1,c,4"), std::string("OK"));
+    EXPECT_EQ(GdbExchange(fd, "c"), std::string("T05swbreak:;thread:1;"));
+    EXPECT_EQ(ctx.Boot.getPc(), 8u);
+    EXPECT_EQ(GdbExchange(fd, "c"), std::string("T05hwbreak:;thread:1;"));
+    EXPECT_EQ(ctx.Boot.getPc(), 0xcu);
+    EXPECT_EQ(GdbExchange(fd, "c"), std::string("W00"));
+    EXPECT_EQ(ctx.Boot.getRegister(1), 4u);
+
+    // Kill gets no reply.
+    ASSERT_TRUE(write(fd, "$k#6b", 5) == 5);
+    runner.join();
+    close(fd);
+    gdb.stop();
+}
+
+TEST(cpu_wfi_sleeps_until_interrupt) {
+    SmpTestContext ctx(1);
+    InterruptController intc;
+    ctx.Bus.registerDevice(&intc, 0x5000, 0x100, "INTC");
+    ctx.Dbg.setInterruptController(&intc);
+    MemAccess enable;
+    enable.address = 0x5004;
+    enable.size = 4;
+    enable.type = MemAccessType::Write;
+    enable.data = 1u << 3;
+    ASSERT_TRUE(ctx.Bus.write(enable).success);
+    ctx.WriteProgram({toy::Wfi(), toy::Sw(2, 1, 0), toy::Halt()});
+    ctx.Boot.setRegister(1, 0x1000);
+    ctx.Boot.setRegister(2, 0x55);
+
+    std::thread runner([&ctx]() { ctx.Dbg.run(false); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    // Parked: the clock stops once the idle batch has skipped ahead.
+    uint64_t idleCycle = ctx.Dbg.getHartStatus(0).cycle;
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_EQ(ctx.Dbg.getHartStatus(0).cycle, idleCycle);
+    EXPECT_EQ(ctx.Dbg.getHartStatus(0).instructions, 1u);
+    EXPECT_TRUE(ctx.Boot.isWaitingForInterrupt());
+
+    intc.setLine(3, true);
+    runner.join();
+
+    MemAccess access;
+    access.address = 0x1000;
+    access.size = 4;
+    EXPECT_EQ(ctx.Bus.read(access).data, 0x55u);
+    EXPECT_TRUE(!ctx.Boot.isWaitingForInterrupt());
+    EXPECT_TRUE(ctx.Dbg.getHartStatus(0).halted);
+}
+
+TEST(debugger_input_record_and_replay) {
+    const std::string logFile = "test_input_replay.bin";
+    // r5 holds the idle status; spin until it changes, then store the byte.
+    std::vector<uint32_t> echo = {toy::Lw(5, 1, 4), toy::Lw(4, 1, 4), toy::Beq(4, 5, -2),
+        toy::Lw(6, 1, 0), toy::Sw(6, 2, 0), toy::Halt()};
+    uint64_t recordedCycle = 0;
+    {
+        SmpTestContext ctx(1);
+        ctx.WriteProgram(echo);
+        ctx.Boot.setRegister(1, 0x4000);
+        ctx.Boot.setRegister(2, 0x1000);
+        std::string err;
+        ASSERT_TRUE(ctx.Dbg.recordInput(logFile, &err));
+        std::thread runner([&ctx]() { ctx.Dbg.run(false); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        const uint8_t input = 'Z';
+        ctx.Dbg.injectUartInput(&input, 1);
+        runner.join();
+        recordedCycle = ctx.Boot.getCycle();
+    }
+    std::vector<InputEvent> events;
+    std::string err;
+    ASSERT_TRUE(readInputLog(logFile, &events, &err));
+    ASSERT_EQ(events.size(), 1u);
+    EXPECT_EQ(events[0].bytes.size(), 1u);
+    EXPECT_TRUE(events[0].cycle > 0u && events[0].cycle < recordedCycle);
+
+    // The replay sees the byte at the same cycle and ends at the same one.
+    {
+        SmpTestContext ctx(1);
+        ctx.WriteProgram(echo);
+        ctx.Boot.setRegister(1, 0x4000);
+        ctx.Boot.setRegister(2, 0x1000);
+        ASSERT_TRUE(ctx.Dbg.replayInput(logFile, &err));
+        ctx.Dbg.run(false);
+        EXPECT_EQ(ctx.Boot.getCycle(), recordedCycle);
+        MemAccess access;
+        access.address = 0x1000;
+        access.size = 4;
+        EXPECT_EQ(ctx.Bus.read(access).data, uint64_t{'Z'});
+    }
+
+    // Events land exactly on their cycles: each group's load runs on cycle
+    // 3 * k and takes whatever arrived by then.
+    {
+        InputLogWriter writer;
+        ASSERT_TRUE(writer.open(logFile, &err));
+        InputEvent first;
+        first.cycle = 100;
+        first.bytes = {'A'};
+        writer.append(first);
+        InputEvent second;
+        second.cycle = 250;
+        second.bytes = {'B', 'C'};
+        writer.append(second);
+    }
+    std::vector<uint32_t> prog;
+    for (int i = 0; i < 100; ++i) {
+        prog.push_back(toy::Lw(4, 1, 0));
+        prog.push_back(toy::Sw(4, 2, 0));
+        prog.push_back(toy::Addi(2, 4));
+    }
+    prog.push_back(toy::Halt());
+    SmpTestContext ctx(1);
+    ctx.WriteProgram(prog);
+    ctx.Boot.setRegister(1, 0x4000);
+    ctx.Boot.setRegister(2, 0x1000);
+    ASSERT_TRUE(ctx.Dbg.replayInput(logFile, &err));
+    ctx.Dbg.run(false);
+    std::string seen;
+    for (uint64_t k = 0; k < 100; ++k) {
+        MemAccess access;
+        access.address = 0x1000 + k * 4;
+        access.size = 4;
+        uint64_t value = ctx.Bus.read(access).data;
+        if (value != 0) {
+            seen += std::to_string(k) + static_cast<char>(value);
+        }
+    }
+    EXPECT_EQ(seen, std::string("34A84B85C"));
+    std::remove(logFile.c_str());
+}
+
+TEST(cpu_machine_snapshot_round_trip) {
+    CpuTestContext ctx;
+    ctx.WriteProgram({toy::Ori(1, 0x1234), toy::Sw(1, 2, 0), toy::Halt()});
+    ctx.Cpu.setRegister(2, 0x1000);
+
+    MachineSnapshot snapshot;
+    std::string err;
+    ASSERT_TRUE(ctx.Dbg.takeSnapshot(&snapshot, &err));
+    EXPECT_EQ(ctx.Ram.getDirtyPageCount(), 0u);
+
+    StepResult first = ctx.Cpu.step(10, 1000);
+    EXPECT_TRUE(!first.success);
+    MemAccess access;
+    access.address = 0x1000;
+    access.size = 4;
+    EXPECT_EQ(ctx.Bus.read(access).data, 0x1234u);
+    EXPECT_EQ(ctx.Ram.getDirtyPageCount(), 1u);
+
+    ASSERT_TRUE(ctx.Dbg.restoreSnapshot(snapshot, &err));
+    EXPECT_EQ(ctx.Cpu.getPc(), 0u);
+    EXPECT_EQ(ctx.Cpu.getCycle(), 0u);
+    EXPECT_EQ(ctx.Cpu.getRegister(1), 0u);
+    EXPECT_EQ(ctx.Bus.read(access).data, 0u);
+    EXPECT_EQ(ctx.Ram.read(access).data, 0u);
+
+    // Replaying from the snapshot reaches the same state.
+    StepResult second = ctx.Cpu.step(10, 1000);
+    EXPECT_EQ(second.instructionsExecuted, first.instructionsExecuted);
+    EXPECT_EQ(ctx.Bus.read(access).data, 0x1234u);
+}
+
+TEST(cpu_reverse_step_and_continue) {
+    // Each pair loads (i << 16) into r1 and stores it, so after 2 * i
+    // instructions both r1 and the word at 0x1000 hold i << 16.
+    std::vector<uint32_t> prog;
+    for (uint16_t i = 1; i <= 300; ++i) {
+        prog.push_back(toy::Lui(1, i));
+        prog.push_back(toy::Sw(1, 2, 0));
+    }
+    prog.push_back(toy::Halt());
+
+    SmpTestContext ctx(1);
+    ctx.WriteProgram(prog);
+    ctx.Boot.setRegister(2, 0x1000);
+    ctx.Dbg.setCheckpointInterval(100);
+    ctx.Dbg.run(false);
+    EXPECT_TRUE(ctx.Dbg.getCheckpointCount() > 2u);
+
+    MemAccess access;
+    access.address = 0x1000;
+    access.size = 4;
+    std::string err;
+    ASSERT_TRUE(ctx.Dbg.travelTo(400, &err));
+    EXPECT_EQ(ctx.Boot.getPc(), 400u * 4);
+    EXPECT_EQ(ctx.Boot.getRegister(1), 200ull << 16);
+    EXPECT_EQ(ctx.Bus.read(access).data, 200ull << 16);
+    EXPECT_EQ(ctx.Dbg.getHartStatus(0).instructions, 400u);
+    EXPECT_TRUE(!ctx.Dbg.getHartStatus(0).halted);
+
+    EXPECT_TRUE(ctx.Dbg.processCommand("rstep 3"));
+    EXPECT_EQ(ctx.Boot.getPc(), 397u * 4);
+    EXPECT_EQ(ctx.Boot.getRegister(1), 199ull << 16);
+    EXPECT_EQ(ctx.Bus.read(access).data, 198ull << 16);
+
+    ctx.Dbg.addBreakpoint(100 * 4);
+    EXPECT_TRUE(ctx.Dbg.processCommand("rcontinue"));
+    EXPECT_EQ(ctx.Dbg.getHartStatus(0).instructions, 100u);
+    EXPECT_EQ(ctx.Boot.getPc(), 100u * 4);
+    EXPECT_EQ(ctx.Bus.read(access).data, 50ull << 16);
+
+    // Nothing earlier: the machine stays where it is.
+    EXPECT_TRUE(!ctx.Dbg.processCommand("rcontinue"));
+    EXPECT_EQ(ctx.Boot.getPc(), 100u * 4);
+    EXPECT_TRUE(!ctx.Dbg.travelTo(101, &err));
+}
+
+TEST(debugger_run_until_stops_mid_batch) {
+    std::vector<uint32_t> prog;
+    for (uint16_t i = 1; i <= 300; ++i) {
+        prog.push_back(toy::Lui(1, i));
+        prog.push_back(toy::Sw(1, 2, 0));
+    }
+    prog.push_back(toy::Halt());
+
+    SmpTestContext ctx(1);
+    ctx.WriteProgram(prog);
+    ctx.Boot.setRegister(2, 0x1000);
+    ctx.Dbg.setCheckpointInterval(100);
+    uint64_t eventCycle = 0;
+    ctx.Bus.scheduler().schedule(150, [&eventCycle](uint64_t now) { eventCycle = now; });
+    // Fast-forward ignores breakpoints.
+    ctx.Dbg.addBreakpoint(10 * 4);
+
+    std::string err;
+    ASSERT_TRUE(ctx.Dbg.runUntil(401, Debugger::RunUntilUnit::Instructions, &err));
+    EXPECT_EQ(ctx.Dbg.getHartStatus(0).instructions, 401u);
+    EXPECT_EQ(ctx.Boot.getPc(), 401u * 4);
+    EXPECT_EQ(ctx.Boot.getRegister(1), 201ull << 16);
+    EXPECT_EQ(eventCycle, 150u);
+    ASSERT_TRUE(ctx.Dbg.runUntil(450, Debugger::RunUntilUnit::Cycles, &err));
+    EXPECT_EQ(ctx.Boot.getCycle(), 450u);
+    EXPECT_TRUE(!ctx.Dbg.runUntil(449, Debugger::RunUntilUnit::Cycles, &err));
+
+    // The command saves a snapshot on arrival, and checkpoints restart there.
+    EXPECT_TRUE(ctx.Dbg.processCommand("until 550 warm"));
+    EXPECT_EQ(ctx.Boot.getPc(), 550u * 4);
+    EXPECT_EQ(ctx.Dbg.getCheckpointCount(), 1u);
+    EXPECT_TRUE(!ctx.Dbg.processCommand("until 10000"));
+    EXPECT_TRUE(ctx.Dbg.getHartStatus(0).halted);
+    EXPECT_TRUE(ctx.Dbg.processCommand("snap load warm"));
+    EXPECT_EQ(ctx.Boot.getPc(), 550u * 4);
+    EXPECT_TRUE(!ctx.Dbg.getHartStatus(0).halted);
+}
+
+TEST(debugger_run_until_interruptible) {
+    // An endless loop, so only an interruption ends the fast-forward.
+    SmpTestContext ctx(1);
+    ctx.WriteProgram({toy::Addi(1, 1), toy::Beq(0, 0, -2)});
+    bool ok = true;
+    std::string err;
+    std::thread runner([&]() {
+        ok = ctx.Dbg.runUntil(~0ull, Debugger::RunUntilUnit::Instructions, &err);
+    });
+
+    // Control tasks run between chunks; the status they see is published
+    // only from inside the fast-forward.
+    uint64_t seen = 0;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (seen == 0 && std::chrono::steady_clock::now() < deadline) {
+        ctx.Dbg.runOnMachine([&]() { seen = ctx.Dbg.getHartStatus(0).instructions; });
+    }
+    EXPECT_TRUE(seen > 0);
+
+    ctx.Dbg.pause();
+    runner.join();
+    EXPECT_TRUE(!ok);
+    EXPECT_TRUE(err.find("Interrupted") != std::string::npos);
+    HartStatus status = ctx.Dbg.getHartStatus(0);
+    EXPECT_TRUE(status.instructions >= seen);
+    EXPECT_EQ(ctx.Boot.getRegister(1), (status.instructions + 1) / 2);
+}
+
+TEST(debugger_pacer_drift_and_slip) {
+    using std::chrono::milliseconds;
+    Pacer pacer;
+    pacer.setFrequency(1000);
+    Pacer::Clock::time_point start = Pacer::Clock::now();
+    pacer.rebase(0, start);
+
+    // Ahead of host time: wait out the difference.
+    EXPECT_TRUE(pacer.update(10, start) == milliseconds(10));
+    // Slightly behind: run on and report the drift.
+    EXPECT_TRUE(pacer.update(10, start + milliseconds(12)) == Pacer::Clock::duration::zero());
+    PacingStats stats = pacer.getStats();
+    EXPECT_EQ(stats.driftNs, 2000000);
+    EXPECT_EQ(stats.slips, 0u);
+
+    // Too far behind: give the time up instead of catching up.
+    Pacer::Clock::time_point late = start + milliseconds(100);
+    EXPECT_TRUE(pacer.update(20, late) == Pacer::Clock::duration::zero());
+    stats = pacer.getStats();
+    EXPECT_EQ(stats.slips, 1u);
+    EXPECT_EQ(stats.slippedNs, 80000000u);
+    EXPECT_EQ(stats.maxDriftNs, 80000000u);
+    EXPECT_TRUE(pacer.update(30, late + milliseconds(5)) == milliseconds(5));
+}
+
+TEST(debugger_perf_report_counts_and_reset) {
+    SmpTestContext ctx(1);
+    // RAM accesses take the core's direct-memory path; UART control writes
+    // go through the bus.
+    ctx.WriteProgram({toy::Ori(1, 200), toy::Ori(2, 0x4000), toy::Sw(0, 2, 8),
+        toy::Addi(1, -1), toy::Beq(1, 0, 1), toy::Beq(0, 0, -4), toy::Halt()});
+    ctx.Dbg.run(false);
+
+    PerfReport report = ctx.Dbg.getPerfReport();
+    EXPECT_EQ(report.instructions, ctx.Dbg.getHartStatus(0).instructions);
+    EXPECT_TRUE(report.batches > 0);
+    EXPECT_TRUE(report.syncs > 0);
+    EXPECT_TRUE(report.stepNs > 0);
+    EXPECT_TRUE(report.seconds > 0.0);
+    uint64_t uartWrites = 0;
+    for (const auto& mapping : report.mappings) {
+        if (mapping.name == "UART") {
+            uartWrites = mapping.writes;
+        }
+    }
+    EXPECT_EQ(uartWrites, 200u);
+
+    std::string json = formatPerfJson(report);
+    EXPECT_TRUE(json.front() == '{' && json.back() == '}');
+    EXPECT_TRUE(json.find("\"UART\":{\"reads\":0,\"writes\":200}") != std::string::npos);
+    EXPECT_TRUE(json.find("\"syncs\":") != std::string::npos);
+    EXPECT_TRUE(ctx.Dbg.processCommand("perf"));
+    EXPECT_TRUE(!ctx.Dbg.processCommand("perf bogus"));
+
+    ctx.Dbg.resetPerfCounters();
+    report = ctx.Dbg.getPerfReport();
+    EXPECT_EQ(report.instructions, 0u);
+    EXPECT_EQ(report.syncs, 0u);
+    for (const auto& mapping : report.mappings) {
+        EXPECT_EQ(mapping.writes, 0u);
+    }
+}
+
+TEST(debugger_profiler_samples_hot_function) {
+    SmpTestContext ctx(1);
+    ctx.WriteProgram({toy::Ori(1, 2000), toy::Addi(1, -1), toy::Beq(1, 0, 1), toy::Beq(0, 0, -3),
+        toy::Ori(2, 200), toy::Addi(2, -1), toy::Beq(2, 0, 1), toy::Beq(0, 0, -3), toy::Halt()});
+    std::filesystem::path dir = std::filesystem::temp_directory_path();
+    std::filesystem::path mapPath = dir / "emulator_profile_test.map";
+    std::filesystem::path foldedPath = dir / "emulator_profile_test.folded";
+    {
+        std::ofstream map(mapPath);
+        map << "00000000 00000004 T main\n0x4 t hot\n# comment\n10 T cold\n";
+    }
+    std::string error;
+    ASSERT_TRUE(ctx.Dbg.loadSymbols(mapPath.string(), &error));
+    const SymbolMap& symbols = ctx.Dbg.getSymbols();
+    ASSERT_EQ(symbols.size(), 3u);
+    EXPECT_EQ(symbols.lookup(0x8)->name, std::string("hot"));
+    EXPECT_EQ(symbols.lookup(0x2)->name, std::string("main"));
+
+    ctx.Dbg.profiler().start(25);
+    ctx.Dbg.run(false);
+    ctx.Dbg.profiler().stop();
+
+    uint64_t samples = ctx.Dbg.profiler().getSampleCount();
+    uint64_t instructions = ctx.Dbg.getHartStatus(0).instructions;
+    EXPECT_TRUE(samples + 1 >= instructions / 25 && samples <= instructions / 25 + 1);
+    std::vector<ProfileHotspot> spots = ctx.Dbg.profiler().hotspots(symbols, 10);
+    ASSERT_TRUE(spots.size() >= 2u);
+    EXPECT_EQ(spots[0].name, std::string("hot"));
+    EXPECT_EQ(spots[1].name, std::string("cold"));
+    EXPECT_TRUE(spots[0].samples > 5 * spots[1].samples);
+    EXPECT_TRUE(ctx.Dbg.processCommand("profile report 5"));
+
+    ASSERT_TRUE(ctx.Dbg.profiler().exportFolded(foldedPath.string(), symbols, &error));
+    std::ifstream folded(foldedPath);
+    std::string contents((std::istreambuf_iterator<char>(folded)),
+        std::istreambuf_iterator<char>());
+    EXPECT_TRUE(contents.find("hart0;hot " + std::to_string(spots[0].samples) + "\n") !=
+        std::string::npos);
+    EXPECT_TRUE(contents.find("hart0;cold ") != std::string::npos);
+    std::filesystem::remove(mapPath);
+    std::filesystem::remove(foldedPath);
+}
+
+TEST(debugger_breakpoint_and_watch_sets) {
+    BreakpointSet breakpoints;
+    EXPECT_TRUE(breakpoints.empty());
+    EXPECT_TRUE(breakpoints.add(0x1000));
+    EXPECT_TRUE(!breakpoints.add(0x1000));
+    EXPECT_TRUE(breakpoints.add(0x5004));
+    EXPECT_TRUE(breakpoints.contains(0x1000));
+    EXPECT_TRUE(!breakpoints.contains(0x1004));
+    EXPECT_TRUE(!breakpoints.contains(0x1000 + PageFilter::kBits * 0x1000));
+    EXPECT_TRUE(breakpoints.remove(0x1000));
+    EXPECT_TRUE(!breakpoints.contains(0x1000));
+    EXPECT_EQ(breakpoints.list().size(), 1u);
+
+    // Retired tables keep a removed breakpoint's condition alive until they
+    // are reclaimed; the live table stays usable.
+    auto condition = std::make_shared<CompiledExpression>();
+    std::string err;
+    ASSERT_TRUE(ExpressionParser::compile("$r1 == 1", condition.get(), &err));
+    std::weak_ptr<const CompiledExpression> retired = condition;
+    EXPECT_TRUE(breakpoints.add(0x2000, std::move(condition)));
+    EXPECT_TRUE(breakpoints.remove(0x2000));
+    EXPECT_TRUE(!retired.expired());
+    breakpoints.reclaim();
+    EXPECT_TRUE(retired.expired());
+    EXPECT_TRUE(breakpoints.contains(0x5004));
+    EXPECT_EQ(breakpoints.list().size(), 1u);
+
+    WatchpointSet watches;
+    Watchpoint watch;
+    watch.address = 0x3010;
+    watch.size = 0x2000;
+    watch.kind = WatchKind::Write;
+    ASSERT_TRUE(watches.add(watch));
+    EXPECT_TRUE(watches.match(0x500c, 8, true, nullptr));
+    EXPECT_TRUE(!watches.match(0x500c, 8, false, nullptr));
+    EXPECT_TRUE(!watches.match(0x5010, 4, true, nullptr));
+    EXPECT_TRUE(watches.isPageWatched(0x4));
+    EXPECT_TRUE(!watches.isPageWatched(0x6));
+
+    // Direct ranges are cut back to the unwatched pages around the address.
+    std::vector<uint8_t> backing(0x10000);
+    DirectMemoryRange range;
+    range.host = backing.data();
+    range.base = 0;
+    range.size = backing.size();
+    DirectMemoryRange below = range;
+    ASSERT_TRUE(watches.clipDirect(0x2000, &below));
+    EXPECT_EQ(below.base, 0u);
+    EXPECT_EQ(below.size, 0x3000u);
+    DirectMemoryRange above = range;
+    ASSERT_TRUE(watches.clipDirect(0x8000, &above));
+    EXPECT_EQ(above.base, 0x6000u);
+    EXPECT_TRUE(above.host == backing.data() + 0x6000);
+    EXPECT_EQ(above.dirtyOffset, 0x6000u);
+    DirectMemoryRange inside = range;
+    EXPECT_TRUE(!watches.clipDirect(0x4000, &inside));
+}
+
+TEST(cpu_breakpoint_and_watchpoint_pause) {
+    SmpTestContext ctx(1);
+    ctx.WriteProgram({toy::Ori(1, 0x55), toy::Nop(), toy::Nop(), toy::Sw(1, 2, 0), toy::Nop(),
+        toy::Nop(), toy::Beq(0, 0, -1)});
+    ctx.Boot.setRegister(2, 0x1000);
+    ctx.Dbg.addBreakpoint(0x8);
+    Watchpoint watch;
+    watch.address = 0x1000;
+    watch.size = 4;
+    ASSERT_TRUE(ctx.Dbg.addWatchpoint(watch));
+
+    auto waitForPc = [&ctx](uint64_t pc) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        while (ctx.Boot.getPc() != pc && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        // Let a wrongly resumed hart run on before checking.
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        return ctx.Dbg.getHartStatus(0).pc;
+    };
+
+    std::thread runner([&ctx]() { ctx.Dbg.run(false); });
+    EXPECT_EQ(waitForPc(0x8), 0x8u);
+    EXPECT_EQ(ctx.Dbg.getHartStatus(0).instructions, 2u);
+
+    // Resuming executes the breakpoint instruction and stops behind the store.
+    ctx.Dbg.processCommand("run");
+    EXPECT_EQ(waitForPc(0x10), 0x10u);
+    MemAccess access;
+    access.address = 0x1000;
+    access.size = 4;
+    EXPECT_EQ(ctx.Bus.read(access).data, 0x55u);
+
+    ctx.Dbg.processCommand("run");
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_TRUE(ctx.Dbg.getHartStatus(0).instructions > 100u);
+    ctx.Dbg.processCommand("quit");
+    runner.join();
+}
+
+TEST(debugger_expression_compile_and_evaluate) {
+    auto eval = [](const std::string& text) {
+        CompiledExpression compiled;
+        std::string err;
+        EXPECT_TRUE(ExpressionParser::compile(text, &compiled, &err));
+        return compiled.evaluate(nullptr, nullptr);
+    };
+    EXPECT_EQ(eval("1 + 2 * 3 == 7 && !(4 < 3)"), 1u);
+    EXPECT_EQ(eval("0x10 - 1 >= 16 || 2 != 2"), 0u);
+    EXPECT_EQ(eval("0 || 5"), 1u);
+    EXPECT_EQ(eval("3 && 0"), 0u);
+    EXPECT_EQ(eval("10 / 0"), 10u);
+    EXPECT_EQ(eval("-1 + 2"), 1u);
+
+    CompiledExpression compiled;
+    std::string err;
+    EXPECT_TRUE(!ExpressionParser::compile("", &compiled, &err));
+    EXPECT_TRUE(!ExpressionParser::compile("1 +", &compiled, &err));
+    EXPECT_TRUE(!ExpressionParser::compile("(1", &compiled, &err));
+    EXPECT_TRUE(!ExpressionParser::compile("1 = 2", &compiled, &err));
+    EXPECT_TRUE(!ExpressionParser::compile("1 2", &compiled, &err));
+    EXPECT_TRUE(!ExpressionParser::compile("$foo", &compiled, &err));
+    EXPECT_TRUE(!ExpressionParser::compile(std::string(100, '(') + "1" +
+        std::string(100, ')'), &compiled, &err));
+}
+
+TEST(debugger_expression_loads_skip_devices) {
+    MemoryDevice ram(0x100, false);
+    Device reg;
+    int deviceReads = 0;
+    reg.setReadHandler([&deviceReads](const MemAccess&) {
+        ++deviceReads;
+        MemResponse response;
+        response.data = 0x1234;
+        return response;
+    });
+    MemoryBus bus;
+    bus.registerDevice(&ram, 0x8000, 0x100, "RAM");
+    bus.registerDevice(&reg, 0x1000, 0x10, "REG");
+    MemAccess store;
+    store.address = 0x8010;
+    store.size = 4;
+    store.type = MemAccessType::Write;
+    store.data = 0xcafe;
+    bus.write(store);
+
+    auto eval = [&bus](const std::string& text) {
+        CompiledExpression compiled;
+        std::string err;
+        EXPECT_TRUE(ExpressionParser::compile(text, &compiled, &err));
+        return compiled.evaluate(nullptr, &bus);
+    };
+    EXPECT_EQ(eval("[0x8010]"), 0xcafeu);
+    EXPECT_EQ(eval("[0x1000]"), 0u);
+    EXPECT_EQ(eval("[0x20000]"), 0u);
+    // Without direct ranges handed out, RAM is still read and devices are not.
+    bus.setHeatmapEnabled(true);
+    EXPECT_EQ(eval("[0x8010] + [0x1000]"), 0xcafeu);
+    EXPECT_EQ(deviceReads, 0);
+}
+
+TEST(debugger_conditional_breakpoint_pause) {
+    // r1 counts loop iterations and the word at 0x1000 trails it by one.
+    SmpTestContext ctx(1);
+    ctx.WriteProgram({toy::Addi(1, 1), toy::Sw(1, 2, 0), toy::Beq(0, 0, -3)});
+    ctx.Boot.setRegister(2, 0x1000);
+    std::string err;
+    EXPECT_TRUE(!ctx.Dbg.addBreakpoint(0x4, "$r1 ==", &err));
+    ASSERT_TRUE(ctx.Dbg.addBreakpoint(0x4, "[$r2] + 1 == $r1 && $r1 == 7", &err));
+    EXPECT_TRUE(ctx.Dbg.processCommand("eval $r2 + 4 > 0x1000"));
+    EXPECT_TRUE(!ctx.Dbg.processCommand("eval $r2 +"));
+
+    std::thread runner([&ctx]() { ctx.Dbg.run(false); });
+    // The hart publishes its count before it flags the breakpoint stop, so
+    // once the flag is up the status is final.
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (!ctx.Dbg.getHartStatus(0).breakpoint && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    HartStatus status = ctx.Dbg.getHartStatus(0);
+    EXPECT_TRUE(status.breakpoint);
+    EXPECT_EQ(status.pc, 0x4u);
+    EXPECT_EQ(status.instructions, 19u);
+    EXPECT_EQ(ctx.Boot.getRegister(1), 7u);
+
+    // Never true again, so the loop runs on.
+    ctx.Dbg.processCommand("run");
+    deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (ctx.Dbg.getHartStatus(0).instructions <= 100u &&
+        std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_TRUE(ctx.Dbg.getHartStatus(0).instructions > 100u);
+    ctx.Dbg.processCommand("quit");
+    runner.join();
+}
@@ -1,12 +1,20 @@
 #include "test_framework.h"
 
+#include <memory>
 #include <string>
+#include <vector>
+
+#include <unistd.h>
 
 #include "emulator/device/device.h"
+#include "emulator/device/dma.h"
+#include "emulator/device/interrupt_controller.h"
 #include "emulator/device/memory.h"
 #include "emulator/device/timer.h"
 #include "emulator/device/uart.h"
 #include "emulator/device/display.h"
+#include "rom_util.h"
+#include "test_helpers.h"
 
 namespace {
 
@@ -44,6 +52,37 @@ TEST(device_memory_oob) {
     EXPECT_EQ(rr.error.type, CpuErrorType::AccessFault);
 }
 
+TEST(device_memory_wide_access) {
+    MemoryDevice ram(0x100, false);
+    std::vector<uint8_t> payload(64);
+    for (size_t i = 0; i < payload.size(); ++i) {
+        payload[i] = static_cast<uint8_t>(i + 1);
+    }
+    MemAccess w = MakeAccess(0x21, 64, MemAccessType::Write);
+    w.wide = payload.data();
+    ASSERT_TRUE(ram.write(w).success);
+    EXPECT_EQ(ram.getDirtyPageCount(), 1u);
+
+    // Byte order matches narrow accesses.
+    MemResponse word = ram.read(MakeAccess(0x21, 4, MemAccessType::Read));
+    EXPECT_EQ(word.data, 0x04030201u);
+    std::vector<uint8_t> back(16);
+    MemAccess r = MakeAccess(0x31, 16, MemAccessType::Read);
+    r.wide = back.data();
+    ASSERT_TRUE(ram.read(r).success);
+    EXPECT_EQ(back[0], 17u);
+    EXPECT_EQ(back[15], 32u);
+
+    // 24 bytes, no payload buffer and past the end all fault.
+    MemAccess odd = MakeAccess(0, 24, MemAccessType::Read);
+    odd.wide = back.data();
+    EXPECT_TRUE(!ram.read(odd).success);
+    EXPECT_TRUE(!ram.read(MakeAccess(0, 16, MemAccessType::Read)).success);
+    MemAccess tail = MakeAccess(0xf0, 32, MemAccessType::Read);
+    tail.wide = payload.data();
+    EXPECT_TRUE(!ram.read(tail).success);
+}
+
 TEST(device_memory_rom_write_fault) {
     MemoryDevice rom(8, true);
     MemAccess w = MakeAccess(0, 4, MemAccessType::Write, 0xdeadbeefu);
@@ -52,6 +91,118 @@ TEST(device_memory_rom_write_fault) {
     EXPECT_EQ(wr.error.type, CpuErrorType::AccessFault);
 }
 
+TEST(device_memory_atomics) {
+    MemoryDevice mem(0x40, false);
+    ASSERT_TRUE(mem.write(MakeAccess(8, 4, MemAccessType::Write, 5)).success);
+
+    MemAccess add = MakeAccess(8, 4, MemAccessType::AtomicRmw, 3);
+    add.atomicOp = AtomicOp::Add;
+    EXPECT_EQ(mem.atomic(add).data, 5u);
+    MemAccess min = MakeAccess(8, 4, MemAccessType::AtomicRmw, 0xfffffffeu);
+    min.atomicOp = AtomicOp::Min;
+    EXPECT_EQ(mem.atomic(min).data, 8u);
+    EXPECT_EQ(mem.read(MakeAccess(8, 4, MemAccessType::Read)).data, 0xfffffffeu);
+    MemAccess maxu = MakeAccess(8, 4, MemAccessType::AtomicRmw, 7);
+    maxu.atomicOp = AtomicOp::MaxU;
+    mem.atomic(maxu);
+    EXPECT_EQ(mem.read(MakeAccess(8, 4, MemAccessType::Read)).data, 0xfffffffeu);
+
+    MemAccess cas = MakeAccess(8, 4, MemAccessType::CompareExchange, 42);
+    cas.expected = 1;
+    EXPECT_EQ(mem.atomic(cas).data, 0xfffffffeu);
+    cas.expected = 0xfffffffeu;
+    EXPECT_EQ(mem.atomic(cas).data, 0xfffffffeu);
+    EXPECT_EQ(mem.read(MakeAccess(8, 4, MemAccessType::Read)).data, 42u);
+
+    MemAccess misaligned = MakeAccess(9, 4, MemAccessType::AtomicRmw, 1);
+    EXPECT_TRUE(!mem.atomic(misaligned).success);
+}
+
+TEST(device_memory_lr_sc) {
+    MemoryDevice mem(0x40, false);
+    MemAccess lr = MakeAccess(0x10, 8, MemAccessType::LoadReserved);
+    MemAccess sc = MakeAccess(0x10, 8, MemAccessType::StoreConditional, 9);
+    EXPECT_EQ(mem.atomic(lr).data, 0u);
+    EXPECT_EQ(mem.atomic(sc).data, 0u);
+    EXPECT_EQ(mem.read(MakeAccess(0x10, 8, MemAccessType::Read)).data, 9u);
+    // The reservation is consumed by the first SC.
+    EXPECT_EQ(mem.atomic(sc).data, 1u);
+
+    // Another hart changing the value in between makes the SC fail.
+    mem.atomic(lr);
+    MemAccess other = MakeAccess(0x10, 8, MemAccessType::AtomicRmw, 1);
+    other.atomicOp = AtomicOp::Add;
+    other.hartId = 1;
+    mem.atomic(other);
+    EXPECT_EQ(mem.atomic(sc).data, 1u);
+    EXPECT_EQ(mem.read(MakeAccess(0x10, 8, MemAccessType::Read)).data, 10u);
+
+    MemoryDevice rom(0x40, true);
+    EXPECT_TRUE(!rom.atomic(MakeAccess(0, 4, MemAccessType::StoreConditional, 1)).success);
+}
+
+TEST(device_memory_mapped_is_lazy) {
+    constexpr uint64_t kSize = 64ull * 1024 * 1024;
+    MemoryDevice ram(kSize, false);
+    ASSERT_TRUE(ram.getBacking() == MemoryBacking::Mapped);
+    EXPECT_TRUE(ram.getResidentSize() < 1024 * 1024);
+
+    ASSERT_TRUE(ram.write(MakeAccess(kSize / 2, 4, MemAccessType::Write, 0xa5a5a5a5u)).success);
+    EXPECT_EQ(ram.read(MakeAccess(kSize / 2, 4, MemAccessType::Read)).data, 0xa5a5a5a5u);
+    EXPECT_EQ(ram.read(MakeAccess(kSize - 8, 8, MemAccessType::Read)).data, 0u);
+    EXPECT_TRUE(ram.getResidentSize() < 1024 * 1024);
+
+    MemoryDevice heap(0x1000, false, MemoryBacking::Heap);
+    EXPECT_TRUE(heap.getBacking() == MemoryBacking::Heap);
+    EXPECT_EQ(heap.getResidentSize(), 0x1000u);
+}
+
+TEST(device_memory_map_image) {
+    std::string err;
+    auto path = testutil::MakeRomPath("mapped_image");
+    ASSERT_TRUE(rom::WriteRomU32LE(path, {0x11223344u, 0x55667788u}, &err));
+
+    MemoryDevice rom(8, true);
+    ASSERT_TRUE(rom.mapImage(path.string(), &err));
+    EXPECT_TRUE(rom.isFileMapped());
+    EXPECT_EQ(rom.read(MakeAccess(4, 4, MemAccessType::Read)).data, 0x55667788u);
+    EXPECT_TRUE(!rom.write(MakeAccess(0, 4, MemAccessType::Write, 1)).success);
+
+    // A device larger than the image falls back to copying it.
+    MemoryDevice larger(16, true);
+    ASSERT_TRUE(larger.mapImage(path.string(), &err));
+    EXPECT_TRUE(!larger.isFileMapped());
+    EXPECT_EQ(larger.read(MakeAccess(0, 4, MemAccessType::Read)).data, 0x11223344u);
+    EXPECT_EQ(larger.read(MakeAccess(8, 4, MemAccessType::Read)).data, 0u);
+}
+
+TEST(device_memory_snapshot_copy_on_write) {
+    constexpr uint64_t kPage = MemoryDevice::kPageSize;
+    MemoryDevice ram(64 * kPage, false);
+    ASSERT_TRUE(ram.write(MakeAccess(0, 4, MemAccessType::Write, 0x11111111u)).success);
+    ASSERT_TRUE(ram.write(MakeAccess(9 * kPage, 4, MemAccessType::Write, 0x22222222u)).success);
+    EXPECT_EQ(ram.getDirtyPageCount(), 2u);
+
+    DeviceSnapshot first = ram.snapshot();
+    EXPECT_EQ(ram.getDirtyPageCount(), 0u);
+
+    ASSERT_TRUE(ram.write(MakeAccess(0, 4, MemAccessType::Write, 0x33333333u)).success);
+    ASSERT_TRUE(ram.write(MakeAccess(20 * kPage, 8, MemAccessType::Write, ~0ull)).success);
+    EXPECT_EQ(ram.getDirtyPageCount(), 2u);
+    DeviceSnapshot second = ram.snapshot();
+
+    ASSERT_TRUE(ram.restore(first));
+    EXPECT_EQ(ram.read(MakeAccess(0, 4, MemAccessType::Read)).data, 0x11111111u);
+    EXPECT_EQ(ram.read(MakeAccess(9 * kPage, 4, MemAccessType::Read)).data, 0x22222222u);
+    EXPECT_EQ(ram.read(MakeAccess(20 * kPage, 8, MemAccessType::Read)).data, 0u);
+    EXPECT_EQ(ram.getDirtyPageCount(), 0u);
+
+    ASSERT_TRUE(ram.restore(second));
+    EXPECT_EQ(ram.read(MakeAccess(0, 4, MemAccessType::Read)).data, 0x33333333u);
+    EXPECT_EQ(ram.read(MakeAccess(9 * kPage, 4, MemAccessType::Read)).data, 0x22222222u);
+    EXPECT_EQ(ram.read(MakeAccess(20 * kPage, 8, MemAccessType::Read)).data, ~0ull);
+}
+
 TEST(device_uart_status_rx) {
     UartDevice uart;
     MemAccess status = MakeAccess(0x4, 4, MemAccessType::Read);
@@ -79,6 +230,85 @@ TEST(device_uart_rx_data) {
     EXPECT_EQ(static_cast<uint32_t>(r1.data & 0xffu), static_cast<uint32_t>('i'));
 }
 
+TEST(device_uart_fifo_output_and_interrupt) {
+    UartDevice uart(4);
+    int fds[2] = {-1, -1};
+    ASSERT_EQ(pipe(fds), 0);
+    uart.setOutputFd(fds[1]);
+    std::vector<bool> levels;
+    uart.setInterruptHandler([&](bool asserted) { levels.push_back(asserted); });
+
+    const uint8_t input[] = {'a', 'b', 'c', 'd', 'e', 'f'};
+    EXPECT_EQ(uart.pushRx(input, sizeof(input)), 4u);
+    EXPECT_EQ(uart.read(MakeAccess(0xC, 4, MemAccessType::Read)).data, 4u);
+
+    // RX interrupt is level-triggered on a non-empty FIFO.
+    ASSERT_TRUE(uart.write(MakeAccess(0x8, 4, MemAccessType::Write, 1)).success);
+    ASSERT_EQ(levels.size(), 1u);
+    EXPECT_TRUE(levels[0]);
+    EXPECT_TRUE((uart.read(MakeAccess(0x4, 4, MemAccessType::Read)).data & 0x8u) != 0);
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_EQ(uart.read(MakeAccess(0x0, 4, MemAccessType::Read)).data,
+            static_cast<uint64_t>('a' + i));
+    }
+    ASSERT_EQ(levels.size(), 2u);
+    EXPECT_TRUE(!levels[1]);
+    ASSERT_TRUE(uart.write(MakeAccess(0x8, 4, MemAccessType::Write, 0)).success);
+
+    // TX goes out through the drain thread, more bytes than the FIFO holds.
+    const std::string message = "hello uart";
+    for (char ch : message) {
+        ASSERT_TRUE(uart.write(MakeAccess(0x0, 4, MemAccessType::Write,
+            static_cast<uint8_t>(ch))).success);
+    }
+    uart.flush();
+    EXPECT_TRUE((uart.read(MakeAccess(0x4, 4, MemAccessType::Read)).data & 0x4u) != 0);
+    char out[32] = {};
+    ssize_t got = read(fds[0], out, sizeof(out));
+    EXPECT_EQ(std::string(out, got > 0 ? static_cast<size_t>(got) : 0), message);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(device_interrupt_controller_levels_edges_and_target) {
+    InterruptController intc;
+    UartDevice uart;
+    uart.setInterruptHandler(intc.lineHandler(1));
+    int notified = 0;
+    intc.setListener([&]() { ++notified; });
+
+    // Nothing reaches the hart until the line is enabled.
+    intc.setLine(0, true);
+    intc.setLine(0, false);
+    EXPECT_EQ(intc.read(MakeAccess(0x0, 4, MemAccessType::Read)).data, 1u);
+    EXPECT_TRUE(!intc.isAsserted(0));
+    EXPECT_EQ(notified, 0);
+
+    // A pulse stays pending until acknowledged.
+    ASSERT_TRUE(intc.write(MakeAccess(0x4, 4, MemAccessType::Write, 0x3)).success);
+    EXPECT_TRUE(intc.isAsserted(0));
+    EXPECT_EQ(notified, 1);
+    ASSERT_TRUE(intc.write(MakeAccess(0x8, 4, MemAccessType::Write, 0x1)).success);
+    EXPECT_TRUE(!intc.isAsserted(0));
+
+    // A level source stays pending through an ack while it is high.
+    uart.pushRx('x');
+    ASSERT_TRUE(uart.write(MakeAccess(0x8, 4, MemAccessType::Write, 1)).success);
+    EXPECT_TRUE(uart.getInterruptLevel());
+    ASSERT_TRUE(intc.write(MakeAccess(0x8, 4, MemAccessType::Write, 0x2)).success);
+    EXPECT_TRUE(intc.isAsserted(0));
+    uart.read(MakeAccess(0x0, 4, MemAccessType::Read));
+    ASSERT_TRUE(intc.write(MakeAccess(0x8, 4, MemAccessType::Write, 0x2)).success);
+    EXPECT_TRUE(!intc.isAsserted(0));
+
+    // Routing to another hart.
+    intc.setLine(0, true);
+    ASSERT_TRUE(intc.write(MakeAccess(0xC, 4, MemAccessType::Write, 1)).success);
+    EXPECT_TRUE(!intc.isAsserted(0));
+    EXPECT_TRUE(intc.isAsserted(1));
+    EXPECT_TRUE(!intc.read(MakeAccess(0x10, 4, MemAccessType::Read)).success);
+}
+
 TEST(device_uart_invalid_access) {
     UartDevice uart;
     MemAccess bad = MakeAccess(0x2, 2, MemAccessType::Read);
@@ -126,6 +356,91 @@ TEST(device_display_dirty_and_present) {
     EXPECT_TRUE(display.consumePresentRequest());
 }
 
+TEST(device_display_dirty_rows) {
+    SdlDisplayDevice display;
+    ASSERT_TRUE(display.initHeadless(4, 70));
+    std::vector<SdlDisplayDevice::DirtyBand> all = display.getDirtyBands();
+    ASSERT_EQ(all.size(), 1u);
+    EXPECT_EQ(all[0].rowCount, 70u);
+    EXPECT_TRUE(!display.hasPendingFrame());
+    EXPECT_TRUE(display.publishFrame());
+    EXPECT_TRUE(display.getDirtyBands().empty());
+    EXPECT_TRUE(!display.publishFrame());
+
+    // An 8-byte store straddling rows 0 and 1, and a block write into row 65.
+    uint64_t fb = SdlDisplayDevice::kFrameBufferOffset;
+    uint32_t pitch = display.getPitch();
+    ASSERT_TRUE(display.write(MakeAccess(fb + pitch - 4, 8, MemAccessType::Write, ~0ull)).success);
+    uint8_t pixel[4] = {1, 2, 3, 4};
+    ASSERT_TRUE(display.writeBlock(fb + 65ull * pitch, pixel, sizeof(pixel)));
+
+    std::vector<SdlDisplayDevice::DirtyBand> bands = display.getDirtyBands();
+    ASSERT_EQ(bands.size(), 2u);
+    EXPECT_EQ(bands[0].firstRow, 0u);
+    EXPECT_EQ(bands[0].rowCount, 2u);
+    EXPECT_EQ(bands[1].firstRow, 65u);
+    EXPECT_EQ(bands[1].rowCount, 1u);
+
+    // A second publish before the SDL side presents replaces the pending frame.
+    EXPECT_TRUE(display.publishFrame());
+    EXPECT_TRUE(display.hasPendingFrame());
+    display.present();
+    EXPECT_TRUE(!display.hasPendingFrame());
+    EXPECT_TRUE(display.getDirtyBands().empty());
+
+    // Writes after the publish stay readable from the working framebuffer.
+    ASSERT_TRUE(display.write(MakeAccess(fb + 4, 4, MemAccessType::Write, 0x12345678)).success);
+    EXPECT_EQ(display.read(MakeAccess(fb + 4, 4, MemAccessType::Read)).data, 0x12345678u);
+    EXPECT_EQ(display.read(MakeAccess(fb + 65ull * pitch, 4, MemAccessType::Read)).data,
+        0x04030201u);
+}
+
+TEST(device_display_frame_sink_sees_published_frames) {
+    struct CaptureSink : FrameSink {
+        std::vector<std::vector<uint8_t>> frames;
+        std::vector<uint64_t> sequences;
+        bool write(const FrameView& frame, std::string* error) override {
+            (void)error;
+            frames.emplace_back(frame.pixels, frame.pixels + frame.pitch * frame.height);
+            sequences.push_back(frame.sequence);
+            return true;
+        }
+    };
+    SdlDisplayDevice display;
+    ASSERT_TRUE(display.initHeadless(2, 3));
+    auto sink = std::make_unique<CaptureSink>();
+    CaptureSink* capture = sink.get();
+    display.setFrameSink(std::move(sink), 1);
+
+    // One row per frame; after three frames every slot has been reused, so the
+    // last one only shows all rows if stale rows were carried across slots.
+    uint64_t fb = SdlDisplayDevice::kFrameBufferOffset;
+    uint32_t pitch = display.getPitch();
+    for (uint32_t row = 0; row < 4; ++row) {
+        uint64_t address = fb + static_cast<uint64_t>(row % 3) * pitch;
+        ASSERT_TRUE(display.write(MakeAccess(address, 4, MemAccessType::Write, row + 1)).success);
+        ASSERT_TRUE(display.publishFrame());
+        display.present();
+    }
+    ASSERT_EQ(capture->frames.size(), 4u);
+    EXPECT_EQ(capture->sequences.back(), 4u);
+    const std::vector<uint8_t>& last = capture->frames.back();
+    EXPECT_EQ(last[0], 4u);
+    EXPECT_EQ(last[pitch], 2u);
+    EXPECT_EQ(last[2 * pitch], 3u);
+
+    // Sampling keeps every other presented frame.
+    auto sampled = std::make_unique<CaptureSink>();
+    capture = sampled.get();
+    display.setFrameSink(std::move(sampled), 2);
+    for (uint32_t i = 0; i < 5; ++i) {
+        ASSERT_TRUE(display.write(MakeAccess(fb, 4, MemAccessType::Write, i)).success);
+        ASSERT_TRUE(display.publishFrame());
+        display.present();
+    }
+    EXPECT_EQ(capture->frames.size(), 3u);
+}
+
 TEST(device_display_keyboard_queue) {
     SdlDisplayDevice display;
     ASSERT_TRUE(display.initHeadless(4, 4));
@@ -171,6 +486,187 @@ TEST(device_display_oob) {
     EXPECT_EQ(r.error.type, CpuErrorType::AccessFault);
 }
 
+TEST(device_display_blit_and_wide_access) {
+    SdlDisplayDevice display;
+    ASSERT_TRUE(display.initHeadless(8, 4));
+    uint64_t fb = SdlDisplayDevice::kFrameBufferOffset;
+    auto setBlit = [&display](uint32_t dstX, uint32_t dstY, uint32_t srcX, uint32_t srcY,
+        uint32_t width, uint32_t height, uint32_t color) {
+        uint32_t values[] = {dstX, dstY, srcX, srcY, width, height, color};
+        for (uint32_t i = 0; i < 7; ++i) {
+            ASSERT_TRUE(display.write(MakeAccess(0x40 + i * 4, 4, MemAccessType::Write,
+                values[i])).success);
+        }
+    };
+    auto pixel = [&display, fb](uint32_t x, uint32_t y) {
+        return display.read(MakeAccess(fb + (y * 8 + x) * 4, 4, MemAccessType::Read)).data;
+    };
+    EXPECT_TRUE(display.publishFrame());
+
+    // Fill clipped at the right edge.
+    setBlit(5, 1, 0, 0, 10, 2, 0xff00ff00u);
+    ASSERT_TRUE(display.write(MakeAccess(0x5c, 4, MemAccessType::Write, 1)).success);
+    EXPECT_EQ(pixel(4, 1), 0u);
+    EXPECT_EQ(pixel(5, 1), 0xff00ff00u);
+    EXPECT_EQ(pixel(7, 2), 0xff00ff00u);
+    EXPECT_EQ(pixel(5, 3), 0u);
+    std::vector<SdlDisplayDevice::DirtyBand> bands = display.getDirtyBands();
+    ASSERT_EQ(bands.size(), 1u);
+    EXPECT_EQ(bands[0].firstRow, 1u);
+    EXPECT_EQ(bands[0].rowCount, 2u);
+
+    // Overlapping copy one row down and two pixels left.
+    setBlit(3, 2, 5, 1, 3, 2, 0);
+    ASSERT_TRUE(display.write(MakeAccess(0x5c, 4, MemAccessType::Write, 2)).success);
+    EXPECT_EQ(pixel(3, 2), 0xff00ff00u);
+    EXPECT_EQ(pixel(5, 3), 0xff00ff00u);
+    EXPECT_EQ(pixel(6, 3), 0u);
+    EXPECT_EQ(display.read(MakeAccess(0x50, 4, MemAccessType::Read)).data, 3u);
+    EXPECT_TRUE(!display.write(MakeAccess(0x5c, 4, MemAccessType::Write, 7)).success);
+
+    // A 32-byte store covers a whole row; wide register accesses fault.
+    std::vector<uint8_t> row(32, 0x11);
+    MemAccess wide = MakeAccess(fb, 32, MemAccessType::Write);
+    wide.wide = row.data();
+    ASSERT_TRUE(display.write(wide).success);
+    EXPECT_EQ(pixel(7, 0), 0x11111111u);
+    std::vector<uint8_t> back(16);
+    MemAccess wideRead = MakeAccess(fb + 8 * 4 * 2 + 12, 16, MemAccessType::Read);
+    wideRead.wide = back.data();
+    ASSERT_TRUE(display.read(wideRead).success);
+    EXPECT_EQ(back[0], 0x00u);
+    EXPECT_EQ(back[4], 0x00u);
+    EXPECT_EQ(back[5], 0xffu);
+    MemAccess wideReg = MakeAccess(0x40, 16, MemAccessType::Read);
+    wideReg.wide = back.data();
+    EXPECT_TRUE(!display.read(wideReg).success);
+}
+
+TEST(device_dma_register_and_chained_transfers) {
+    MemoryDevice ram(0x2000, false);
+    MemoryBus bus;
+    DmaDevice dma(&bus);
+    bus.registerDevice(&ram, 0x0, 0x2000, "RAM");
+    bus.registerDevice(&dma, 0x4000, 0x100, "DMA");
+    EventScheduler& events = bus.scheduler();
+
+    std::vector<uint8_t> pattern(100);
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        pattern[i] = static_cast<uint8_t>(i * 3 + 1);
+    }
+    ASSERT_TRUE(bus.writeBlock(0x100, pattern.data(), pattern.size()));
+
+    auto reg = [&](uint64_t offset, uint32_t value) {
+        EXPECT_TRUE(bus.write(MakeAccess(0x4000 + offset, 4, MemAccessType::Write, value)).success);
+    };
+    auto status = [&]() { return bus.read(MakeAccess(0x4018, 4, MemAccessType::Read)).data; };
+
+    reg(0x00, 0x100);
+    reg(0x08, 0x800);
+    reg(0x10, static_cast<uint32_t>(pattern.size()));
+    reg(0x14, 1);
+    EXPECT_EQ(status(), 1u);
+    uint64_t cost = DmaDevice::transferCycles(pattern.size());
+    EXPECT_EQ(cost, DmaDevice::kSetupCycles + 13);
+    events.runDue(cost - 1);
+    EXPECT_EQ(status(), 1u);
+    events.runDue(cost);
+    EXPECT_EQ(status(), 2u);
+    std::vector<uint8_t> copied(pattern.size());
+    ASSERT_TRUE(bus.readBlock(0x800, copied.data(), copied.size()));
+    EXPECT_TRUE(copied == pattern);
+    reg(0x18, 2);
+    EXPECT_EQ(status(), 0u);
+
+    // Two chained descriptors at 0x1000 and 0x1020, then one pointing at a hole.
+    auto descriptor = [&](uint64_t at, uint64_t src, uint64_t dst, uint64_t len, uint64_t next) {
+        uint64_t words[4] = {src, dst, len, next};
+        ASSERT_TRUE(bus.writeBlock(at, words, sizeof(words)));
+    };
+    descriptor(0x1000, 0x100, 0xa00, 10, 0x1020);
+    descriptor(0x1020, 0x10a, 0xb00, 20, 0);
+    reg(0x1c, 0x1000);
+    reg(0x14, 2);
+    events.runDue(events.now() + DmaDevice::transferCycles(10) +
+        DmaDevice::transferCycles(20));
+    EXPECT_EQ(status(), 2u);
+    EXPECT_EQ(bus.read(MakeAccess(0xa09, 1, MemAccessType::Read)).data, pattern[9]);
+    EXPECT_EQ(bus.read(MakeAccess(0xb13, 1, MemAccessType::Read)).data, pattern[29]);
+
+    descriptor(0x1040, 0x100, 0x9000, 4, 0);
+    reg(0x1c, 0x1040);
+    reg(0x14, 2);
+    events.runDue(events.now() + DmaDevice::transferCycles(4));
+    EXPECT_EQ(status(), 4u);
+}
+
+TEST(device_dma_destroyed_mid_transfer) {
+    MemoryDevice ram(0x1000, false);
+    MemoryBus bus;
+    auto dma = std::make_unique<DmaDevice>(&bus);
+    bus.registerDevice(&ram, 0x0, 0x1000, "RAM");
+    bus.registerDevice(dma.get(), 0x4000, 0x100, "DMA");
+    EventScheduler& events = bus.scheduler();
+
+    EXPECT_TRUE(bus.write(MakeAccess(0x4008, 4, MemAccessType::Write, 0x800)).success);
+    EXPECT_TRUE(bus.write(MakeAccess(0x4010, 4, MemAccessType::Write, 64)).success);
+    EXPECT_TRUE(bus.write(MakeAccess(0x4014, 4, MemAccessType::Write, 1)).success);
+    EXPECT_EQ(events.size(), 1u);
+
+    // The scheduler outlives the device, so the pending completion must go.
+    dma.reset();
+    EXPECT_EQ(events.size(), 0u);
+    EXPECT_EQ(events.nextEventCycle(), EventScheduler::kNoEvent);
+    events.runDue(events.now() + DmaDevice::transferCycles(64));
+}
+
+TEST(device_timer_lazy_counter_and_alarm) {
+    MemoryBus bus;
+    TimerDevice timer;
+    InterruptController intc;
+    timer.setInterruptHandler(intc.lineHandler(0));
+    bus.registerDevice(&timer, 0x1000, 0x100, "TIMER");
+    EventScheduler& events = bus.scheduler();
+    EXPECT_TRUE(events.empty());
+    auto reg = [&](uint64_t offset, uint32_t value) {
+        ASSERT_TRUE(timer.write(MakeAccess(offset, 4, MemAccessType::Write, value)).success);
+    };
+    auto read = [&](uint64_t offset) {
+        return timer.read(MakeAccess(offset, 4, MemAccessType::Read)).data;
+    };
+
+    // The counter follows the clock between events.
+    uint64_t cycle = 250;
+    events.setClock([&]() { return cycle; });
+    EXPECT_EQ(read(0x0), 250u);
+    reg(0x8, 1);
+    cycle = 300;
+    EXPECT_EQ(read(0x0), 50u);
+
+    // A one-shot alarm at counter 100 is an event at cycle 350.
+    reg(0x10, 100);
+    reg(0x18, 0x3);
+    EXPECT_EQ(events.nextEventCycle(), 350u);
+    events.runDue(349);
+    EXPECT_EQ(read(0x20), 0u);
+    events.runDue(360);
+    EXPECT_EQ(read(0x20), 1u);
+    EXPECT_TRUE(timer.getInterruptLevel());
+    EXPECT_EQ(events.nextEventCycle(), EventScheduler::kNoEvent);
+    reg(0x20, 1);
+    EXPECT_TRUE(!timer.getInterruptLevel());
+
+    // A periodic alarm re-arms from the compare value, not from when it ran.
+    reg(0x1C, 40);
+    reg(0x10, 200);
+    events.runDue(470);
+    EXPECT_EQ(read(0x10), 240u);
+    EXPECT_EQ(events.nextEventCycle(), 490u);
+    reg(0x18, 0);
+    EXPECT_EQ(events.nextEventCycle(), EventScheduler::kNoEvent);
+    events.setClock(nullptr);
+}
+
 TEST(device_timer_large_tick) {
     TimerDevice timer;
     timer.tick(4294968296ULL);
@@ -201,3 +697,70 @@ TEST(device_sync_threshold) {
     dev.sync(300);
     EXPECT_EQ(dev.mTickedCycles, 150u + 150u);
 }
+
+TEST(device_mmio_static_dispatch) {
+    class Counter : public MmioDevice<Counter> {
+    public:
+        uint64_t mValue = 0;
+        uint64_t mTicked = 0;
+        MemResponse handleRead(const MemAccess&) {
+            MemResponse response;
+            response.data = mValue;
+            return response;
+        }
+        MemResponse handleWrite(const MemAccess& access) {
+            mValue = access.data;
+            return MemResponse{};
+        }
+        void handleTick(uint64_t cycles) { mTicked += cycles; }
+    };
+
+    Counter counter;
+    const DeviceDispatch& dispatch = counter.getDispatch();
+    EXPECT_TRUE(dispatch.read != nullptr);
+    EXPECT_TRUE(dispatch.write != nullptr);
+    EXPECT_TRUE(dispatch.atomic == nullptr);
+    EXPECT_TRUE(dispatch.tick != nullptr);
+
+    ASSERT_TRUE(counter.write(MakeAccess(0, 4, MemAccessType::Write, 7)).success);
+    EXPECT_EQ(counter.read(MakeAccess(0, 4, MemAccessType::Read)).data, 7u);
+    // Without handleAtomic, atomics are still emulated with a read and a write.
+    MemAccess add = MakeAccess(0, 4, MemAccessType::AtomicRmw, 5);
+    add.atomicOp = AtomicOp::Add;
+    EXPECT_EQ(counter.atomic(add).data, 7u);
+    EXPECT_EQ(counter.mValue, 12u);
+    counter.tick(30);
+    EXPECT_EQ(counter.mTicked, 30u);
+
+    MemoryDevice ram(16, false);
+    EXPECT_TRUE(ram.getDispatch().atomic != nullptr);
+}
+
+TEST(device_memory_map_file_range) {
+    auto path = testutil::RomDir() / "file_range.bin";
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        std::vector<char> bytes(0x3000);
+        for (size_t i = 0; i < bytes.size(); ++i) {
+            bytes[i] = static_cast<char>(i * 7 + 1);
+        }
+        out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    }
+    std::string err;
+    // Page-congruent offsets map the middle page; the unaligned range copies.
+    for (uint64_t fileOffset : {0x0ull, 0x3ull}) {
+        for (bool readOnly : {true, false}) {
+            MemoryDevice mem(0x4000, readOnly);
+            ASSERT_TRUE(mem.mapFileRange(path.string(), fileOffset + 0x800, 0x800, 0x2000, &err));
+            for (uint64_t offset : {0x7fcull, 0x800ull, 0x1234ull, 0x27fcull, 0x2800ull}) {
+                uint64_t file = fileOffset + offset;
+                uint8_t want = offset >= 0x800 && offset < 0x2800 ?
+                    static_cast<uint8_t>(file * 7 + 1) : 0;
+                EXPECT_EQ(mem.read(MakeAccess(offset, 1, MemAccessType::Read)).data,
+                    static_cast<uint64_t>(want));
+            }
+            EXPECT_EQ(mem.getDirtyPageCount(), readOnly ? 0u : 3u);
+            EXPECT_TRUE(!mem.mapFileRange(path.string(), 0, 0x3000, 0x2000, &err));
+        }
+    }
+}
@@ -1,8 +1,15 @@
 #include "test_framework.h"
 
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "emulator/app/farm.h"
+#include "emulator/app/machine.h"
+#include "emulator/device/elf.h"
 #include "rom_util.h"
 #include "stdout_capture.h"
 #include "test_helpers.h"
@@ -98,3 +105,211 @@ TEST(integration_timer_smoke) {
     ASSERT_EQ(rc, 0);
     EXPECT_TRUE(testutil::LastErrorIs(CpuErrorType::None));
 }
+
+TEST(integration_farm_runs_independent_machines) {
+    std::vector<uint32_t> hello;
+    toy::Emit(&hello, toy::Lui(1, 0x2000));
+    toy::Emit(&hello, toy::Ori(2, static_cast<uint16_t>('H')));
+    toy::Emit(&hello, toy::Sw(2, 1, 0));
+    toy::Emit(&hello, toy::Halt());
+    std::vector<uint32_t> fault;
+    toy::Emit(&fault, toy::Lui(1, 0x1000));
+    toy::Emit(&fault, toy::Lw(2, 1, 0));
+    std::vector<uint32_t> spin;
+    toy::Emit(&spin, toy::Beq(0, 0, -1));
+
+    std::string err;
+    std::vector<std::string> roms;
+    for (const auto& [name, prog] : {std::pair{"farm_hello", hello}, std::pair{"farm_fault", fault},
+        std::pair{"farm_spin", spin}, std::pair{"farm_hello2", hello}}) {
+        auto romPath = testutil::MakeRomPath(name);
+        ASSERT_TRUE(rom::WriteRomU32LE(romPath, prog, &err));
+        roms.push_back(romPath.string());
+    }
+    auto outputDir = testutil::RomDir() / "farm_uart";
+    std::filesystem::create_directories(outputDir);
+
+    EmulatorConfig config;
+    config.width = 16;
+    config.height = 16;
+    config.ramSize = 65536;
+    config.maxCycles = 100000;
+    config.farmOutputDir = outputDir.string();
+    std::vector<FarmResult> results = runFarmJobs(config, roms, 2,
+        []() { return std::make_unique<ToyCpuExecutor>(); });
+
+    ASSERT_EQ(results.size(), 4u);
+    EXPECT_TRUE(results[0].outcome == FarmOutcome::Halted);
+    EXPECT_TRUE(results[1].outcome == FarmOutcome::Fault);
+    EXPECT_TRUE(results[2].outcome == FarmOutcome::Timeout);
+    EXPECT_TRUE(results[2].cycles >= 100000u);
+    EXPECT_TRUE(results[3].outcome == FarmOutcome::Halted);
+    EXPECT_EQ(results[3].instructions, 4u);
+    for (size_t index : {0u, 3u}) {
+        std::ifstream uart(outputDir / (std::to_string(index) + ".uart"));
+        std::string text((std::istreambuf_iterator<char>(uart)), std::istreambuf_iterator<char>());
+        EXPECT_EQ(text, std::string("H"));
+    }
+    std::string report = formatFarmReport(results);
+    EXPECT_TRUE(report.find("farm_fault.bin,fault,0x") != std::string::npos);
+}
+
+TEST(integration_machine_from_description) {
+    std::vector<uint32_t> prog;
+    toy::Emit(&prog, toy::Lui(1, 0x2000));
+    toy::Emit(&prog, toy::Ori(2, static_cast<uint16_t>('A')));
+    toy::Emit(&prog, toy::Sw(2, 1, 0));
+    toy::Emit(&prog, toy::Lui(1, 0x2001));
+    toy::Emit(&prog, toy::Ori(3, static_cast<uint16_t>('B')));
+    toy::Emit(&prog, toy::Sw(3, 1, 0));
+    toy::Emit(&prog, toy::Lui(1, 0x9000));
+    toy::Emit(&prog, toy::Sw(3, 1, 4));
+    toy::Emit(&prog, toy::Halt());
+    std::string err;
+    auto romPath = testutil::MakeRomPath("soc_two_uarts");
+    ASSERT_TRUE(rom::WriteRomU32LE(romPath, prog, &err));
+
+    auto dir = testutil::RomDir();
+    auto consolePath = dir / "soc_console.uart";
+    auto auxPath = dir / "soc_aux.uart";
+    auto confPath = dir / "soc.conf";
+    {
+        std::ofstream conf(confPath);
+        conf << "headless = true\n"
+             << "[rom]\n"
+             << "[uart]\nbase = 0x20000000\noutput = " << consolePath.string() << "\n"
+             << "[uart aux]\nbase = 0x20010000\nirq = 3\noutput = " << auxPath.string() << "\n"
+             << "[intc]\nbase = 0x20003000\n"
+             << "[ram]\nbase = 0x80000000\nsize = 0x10000\n"
+             << "[ram]\nbase = 0x90000000\nsize = 0x1000\n";
+    }
+    EmulatorConfig config;
+    ASSERT_TRUE(loadConfigFile(confPath.string(), true, &config, &err));
+    config.romPath = romPath.string();
+    ASSERT_EQ(config.soc.size(), 6u);
+    EXPECT_TRUE(config.headless);
+
+    std::vector<SocDevice> devices;
+    ASSERT_TRUE(describeMachine(config, &devices, &err));
+    EXPECT_EQ(devices[1].name, std::string("UART"));
+    EXPECT_EQ(devices[1].irq, static_cast<int32_t>(kUartIrqLine));
+    EXPECT_EQ(devices[2].name, std::string("aux"));
+    EXPECT_EQ(devices[5].name, std::string("RAM1"));
+    EXPECT_EQ(devices[0].size, prog.size() * 4u);
+
+    {
+        ToyCpuExecutor cpu;
+        Machine machine;
+        ASSERT_TRUE(machine.build(config, &cpu, &err));
+        EXPECT_TRUE(machine.bus().getDevice("TIMER") == nullptr);
+        machine.debugger().setHostInput(false);
+        machine.debugger().run(false);
+        MemAccess load;
+        load.address = 0x90000004;
+        load.size = 4;
+        load.type = MemAccessType::Read;
+        EXPECT_EQ(machine.bus().read(load).data, static_cast<uint64_t>('B'));
+    }
+    for (const auto& [path, expected] : {std::pair{consolePath, "A"}, std::pair{auxPath, "B"}}) {
+        std::ifstream uart(path);
+        std::string text((std::istreambuf_iterator<char>(uart)), std::istreambuf_iterator<char>());
+        EXPECT_EQ(text, std::string(expected));
+    }
+
+    config.soc[5].base = 0x8000f000;
+    EXPECT_TRUE(!describeMachine(config, &devices, &err));
+    EXPECT_EQ(err, std::string("Overlapping mappings: RAM and RAM1"));
+    {
+        std::ofstream conf(confPath);
+        conf << "[uart]\nbase = 0x20000000\nwidth = 4\n";
+    }
+    EmulatorConfig bad;
+    EXPECT_TRUE(!loadConfigFile(confPath.string(), true, &bad, &err));
+    EXPECT_EQ(err, std::string("Invalid config line 3: Unknown uart key: width"));
+    // Devices that raise no interrupts take no irq line.
+    for (const char* type : {"rom", "ram", "dma", "intc"}) {
+        {
+            std::ofstream conf(confPath);
+            conf << "[" << type << "]\nbase = 0x20000000\nirq = 2\n";
+        }
+        EXPECT_TRUE(!loadConfigFile(confPath.string(), true, &bad, &err));
+        EXPECT_EQ(err, "Invalid config line 3: Unknown " + std::string(type) + " key: irq");
+    }
+}
+
+TEST(integration_machine_boots_elf_segments) {
+    std::vector<uint32_t> code;
+    toy::Emit(&code, toy::Lui(1, 0x8000));
+    toy::Emit(&code, toy::Lw(2, 1, 0));
+    toy::Emit(&code, toy::Lui(3, 0x2000));
+    toy::Emit(&code, toy::Sw(2, 3, 0));
+    toy::Emit(&code, toy::Halt());
+    // Code starts past a full page of padding, so the segment's first page
+    // is mapped from the file and the rest copied.
+    constexpr uint32_t kEntry = 0x1010;
+    rom::ElfSegmentSpec text;
+    text.bytes.assign(kEntry, 0);
+    for (uint32_t word : code) {
+        for (int i = 0; i < 4; ++i) {
+            text.bytes.push_back(static_cast<uint8_t>(word >> (8 * i)));
+        }
+    }
+    rom::ElfSegmentSpec data;
+    data.address = 0x80000000;
+    data.bytes = {'*', 0, 0, 0, 0x11, 0x22, 0x33, 0x44};
+    data.memorySize = 0x2000;
+    data.writable = true;
+
+    auto elfPath = testutil::MakeRomPath("elf_boot");
+    ASSERT_TRUE(rom::WriteElf32LE(elfPath, kEntry, {text, data},
+        {{"boot", kEntry, static_cast<uint32_t>(code.size() * 4)}}));
+    // Out-of-segment file bytes must not leak into BSS.
+    {
+        std::ofstream tail(elfPath, std::ios::binary | std::ios::app);
+        std::string junk(64, '\xff');
+        tail.write(junk.data(), static_cast<std::streamsize>(junk.size()));
+    }
+    ElfImage image;
+    std::string err;
+    ASSERT_TRUE(readElfImage(elfPath.string(), &image, &err));
+    ASSERT_EQ(image.segments.size(), 2u);
+    EXPECT_EQ(image.entry, static_cast<uint64_t>(kEntry));
+    EXPECT_TRUE(image.segments[1].writable && !image.segments[1].executable);
+
+    auto uartPath = testutil::RomDir() / "elf_boot.uart";
+    EmulatorConfig config;
+    config.romPath = elfPath.string();
+    config.headless = true;
+    config.width = 16;
+    config.height = 16;
+    config.ramSize = 65536;
+    config.uartOutput = uartPath.string();
+    std::vector<SocDevice> devices;
+    ASSERT_TRUE(describeMachine(config, &devices, &err));
+    EXPECT_EQ(devices[0].size, 0x2000u);
+    {
+        ToyCpuExecutor cpu;
+        Machine machine;
+        ASSERT_TRUE(machine.build(config, &cpu, &err));
+        EXPECT_EQ(cpu.getPc(), static_cast<uint64_t>(kEntry));
+        const Symbol* boot = machine.debugger().getSymbols().lookup(kEntry + 8);
+        ASSERT_TRUE(boot != nullptr);
+        EXPECT_EQ(boot->name, std::string("boot"));
+        machine.debugger().setHostInput(false);
+        machine.debugger().run(false);
+        EXPECT_TRUE(cpu.getLastError().type == CpuErrorType::Halt ||
+            cpu.getLastError().type == CpuErrorType::None);
+        MemAccess load;
+        load.size = 4;
+        load.type = MemAccessType::Read;
+        load.address = 0x80000004;
+        EXPECT_EQ(machine.bus().read(load).data, 0x44332211u);
+        load.address = 0x80000008;
+        EXPECT_EQ(machine.bus().read(load).data, 0u);
+        load.address = 0x80001ffc;
+        EXPECT_EQ(machine.bus().read(load).data, 0u);
+    }
+    std::ifstream uart(uartPath);
+    std::string output((std::istreambuf_iterator<char>(uart)), std::istreambuf_iterator<char>());
+    EXPECT_EQ(output, std::string("*"));
+}
@@ -1,7 +1,9 @@
 #ifndef TEST_ROM_UTIL_H
 #define TEST_ROM_UTIL_H
 
+#include <algorithm>
 #include <cstdint>
+#include <iterator>
 #include <filesystem>
 #include <fstream>
 #include <string>
@@ -44,6 +46,106 @@ inline bool WriteRomU32LE(const std::filesystem::path& path, const std::vector<u
     return out.good();
 }
 
+struct ElfSegmentSpec {
+    uint32_t address = 0;
+    std::vector<uint8_t> bytes;
+    // Zero means bytes.size(); anything above it is BSS.
+    uint32_t memorySize = 0;
+    bool writable = false;
+};
+
+struct ElfSymbolSpec {
+    std::string name;
+    uint32_t address = 0;
+    uint32_t size = 0;
+};
+
+// A little-endian ELF32 executable with one PT_LOAD per segment, each at a
+// file offset congruent to its address modulo 4 KiB, and a .symtab of
+// function symbols.
+inline bool WriteElf32LE(const std::filesystem::path& path, uint32_t entry,
+    const std::vector<ElfSegmentSpec>& segments, const std::vector<ElfSymbolSpec>& symbols) {
+    std::vector<uint8_t> image(0x1000, 0);
+    auto put = [&image](size_t offset, uint32_t value, uint32_t size) {
+        if (image.size() < offset + size) {
+            image.resize(offset + size, 0);
+        }
+        for (uint32_t i = 0; i < size; ++i) {
+            image[offset + i] = static_cast<uint8_t>(value >> (8 * i));
+        }
+    };
+    const uint32_t phoff = 0x34;
+    const uint32_t phnum = static_cast<uint32_t>(segments.size());
+    const uint32_t strtabOffset = phoff + 32 * phnum;
+    std::string strtab(1, '\0');
+    for (const auto& symbol : symbols) {
+        strtab += symbol.name + '\0';
+    }
+    const uint32_t symtabOffset = (strtabOffset + static_cast<uint32_t>(strtab.size()) + 3) & ~3u;
+    const uint32_t symtabSize = 16 * static_cast<uint32_t>(symbols.size() + 1);
+    const uint32_t shoff = symtabOffset + symtabSize;
+    if (shoff + 3 * 40 > image.size()) {
+        return false;
+    }
+
+    const uint8_t ident[] = {0x7f, 'E', 'L', 'F', 1, 1, 1};
+    std::copy(std::begin(ident), std::end(ident), image.begin());
+    put(0x10, 2, 2);
+    put(0x12, 0, 2);
+    put(0x14, 1, 4);
+    put(0x18, entry, 4);
+    put(0x1C, phoff, 4);
+    put(0x20, shoff, 4);
+    put(0x28, 0x34, 2);
+    put(0x2A, 32, 2);
+    put(0x2C, phnum, 2);
+    put(0x2E, 40, 2);
+    put(0x30, 3, 2);
+
+    std::copy(strtab.begin(), strtab.end(), image.begin() + strtabOffset);
+    uint32_t nameOffset = 1;
+    for (size_t i = 0; i < symbols.size(); ++i) {
+        size_t base = symtabOffset + 16 * (i + 1);
+        put(base, nameOffset, 4);
+        put(base + 4, symbols[i].address, 4);
+        put(base + 8, symbols[i].size, 4);
+        put(base + 12, 0x12, 1);
+        put(base + 14, 1, 2);
+        nameOffset += static_cast<uint32_t>(symbols[i].name.size() + 1);
+    }
+    // Section 1 is .strtab, section 2 .symtab.
+    put(shoff + 40 + 4, 3, 4);
+    put(shoff + 40 + 16, strtabOffset, 4);
+    put(shoff + 40 + 20, static_cast<uint32_t>(strtab.size()), 4);
+    put(shoff + 80 + 4, 2, 4);
+    put(shoff + 80 + 16, symtabOffset, 4);
+    put(shoff + 80 + 20, symtabSize, 4);
+    put(shoff + 80 + 24, 1, 4);
+    put(shoff + 80 + 36, 16, 4);
+
+    for (uint32_t i = 0; i < phnum; ++i) {
+        const ElfSegmentSpec& segment = segments[i];
+        uint32_t fileOffset = static_cast<uint32_t>((image.size() + 0xfff) & ~size_t{0xfff}) +
+            (segment.address & 0xfff);
+        uint32_t fileSize = static_cast<uint32_t>(segment.bytes.size());
+        image.resize(fileOffset, 0);
+        image.insert(image.end(), segment.bytes.begin(), segment.bytes.end());
+        size_t base = phoff + 32 * i;
+        put(base, 1, 4);
+        put(base + 4, fileOffset, 4);
+        put(base + 8, segment.address, 4);
+        put(base + 12, segment.address, 4);
+        put(base + 16, fileSize, 4);
+        put(base + 20, segment.memorySize != 0 ? segment.memorySize : fileSize, 4);
+        put(base + 24, segment.writable ? 6 : 5, 4);
+        put(base + 28, 0x1000, 4);
+    }
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(image.data()),
+        static_cast<std::streamsize>(image.size()));
+    return out.good();
+}
+
 } // namespace rom
 
 #endif
@@ -1,6 +1,16 @@
 #include "test_framework.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <exception>
+#include <thread>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "emulator/app/farm.h"
 
 namespace testfw {
 namespace {
@@ -35,6 +45,174 @@ const char*& CurrentNameRef() {
     return name;
 }
 
+struct RunResult {
+    std::vector<std::string> Failures;
+    bool Skipped = false;
+    std::string SkipReason;
+    double Seconds = 0.0;
+};
+
+RunResult RunInProcess(const TestCase& tc) {
+    RunResult result;
+    size_t before = Failures().size();
+    SetCurrentTestName(tc.Name.c_str());
+    auto start = std::chrono::steady_clock::now();
+    try {
+        tc.Fn();
+    } catch (const SkipException& e) {
+        result.Skipped = true;
+        result.SkipReason = e.Why;
+    } catch (const std::exception& e) {
+        AddFailure(std::string("Unhandled exception: ") + e.what());
+    } catch (...) {
+        AddFailure("Unhandled non-std exception");
+    }
+    result.Seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (size_t i = before; i < Failures().size(); ++i) {
+        result.Failures.push_back(Failures()[i].Message);
+    }
+    Failures().resize(before);
+    return result;
+}
+
+// A forked test reports back over a pipe as tagged, length-prefixed records:
+// 'F' failure, 'S' skip, 'T' seconds, then 'E' once the result is complete.
+void WriteRecord(int fd, char tag, const void* data, size_t size) {
+    std::string record(1, tag);
+    uint32_t length = static_cast<uint32_t>(size);
+    record.append(reinterpret_cast<const char*>(&length), sizeof(length));
+    record.append(static_cast<const char*>(data), size);
+    const char* cursor = record.data();
+    size_t left = record.size();
+    while (left > 0) {
+        ssize_t written = ::write(fd, cursor, left);
+        if (written <= 0) {
+            return;
+        }
+        cursor += written;
+        left -= static_cast<size_t>(written);
+    }
+}
+
+RunResult RunForked(const TestCase& tc) {
+    RunResult result;
+    int fds[2];
+    if (::pipe(fds) != 0) {
+        result.Failures.push_back("Cannot create a pipe for the test process");
+        return result;
+    }
+    pid_t pid = ::fork();
+    if (pid < 0) {
+        ::close(fds[0]);
+        ::close(fds[1]);
+        result.Failures.push_back("Cannot fork the test process");
+        return result;
+    }
+    if (pid == 0) {
+        ::close(fds[0]);
+        RunResult child = RunInProcess(tc);
+        for (const auto& message : child.Failures) {
+            WriteRecord(fds[1], 'F', message.data(), message.size());
+        }
+        if (child.Skipped) {
+            WriteRecord(fds[1], 'S', child.SkipReason.data(), child.SkipReason.size());
+        }
+        WriteRecord(fds[1], 'T', &child.Seconds, sizeof(child.Seconds));
+        WriteRecord(fds[1], 'E', nullptr, 0);
+        std::fflush(nullptr);
+        ::_exit(0);
+    }
+
+    ::close(fds[1]);
+    std::string data;
+    char buffer[4096];
+    ssize_t got = 0;
+    while ((got = ::read(fds[0], buffer, sizeof(buffer))) > 0) {
+        data.append(buffer, static_cast<size_t>(got));
+    }
+    ::close(fds[0]);
+    int status = 0;
+    ::waitpid(pid, &status, 0);
+
+    bool complete = false;
+    size_t pos = 0;
+    while (!complete && data.size() - pos >= 1 + sizeof(uint32_t)) {
+        char tag = data[pos];
+        uint32_t length = 0;
+        std::memcpy(&length, data.data() + pos + 1, sizeof(length));
+        pos += 1 + sizeof(length);
+        if (data.size() - pos < length) {
+            break;
+        }
+        std::string payload = data.substr(pos, length);
+        pos += length;
+        if (tag == 'F') {
+            result.Failures.push_back(payload);
+        } else if (tag == 'S') {
+            result.Skipped = true;
+            result.SkipReason = payload;
+        } else if (tag == 'T' && length == sizeof(result.Seconds)) {
+            std::memcpy(&result.Seconds, payload.data(), sizeof(result.Seconds));
+        } else if (tag == 'E') {
+            complete = true;
+        }
+    }
+    if (WIFSIGNALED(status)) {
+        result.Failures.push_back("Test process killed by signal " +
+            std::to_string(WTERMSIG(status)));
+    } else if (!complete) {
+        result.Failures.push_back("Test process exited with status " +
+            std::to_string(WIFEXITED(status) ? WEXITSTATUS(status) : -1) +
+            " before reporting a result");
+    }
+    return result;
+}
+
+void PrintTiming(const std::vector<std::vector<double>>& seconds, double wallSeconds,
+    uint32_t jobs) {
+    struct Row {
+        size_t Index;
+        double Median;
+        double Min;
+        double Max;
+    };
+    std::vector<Row> rows;
+    double total = 0.0;
+    for (size_t i = 0; i < seconds.size(); ++i) {
+        std::vector<double> runs = seconds[i];
+        std::sort(runs.begin(), runs.end());
+        for (double run : runs) {
+            total += run;
+        }
+        rows.push_back({i, runs[runs.size() / 2], runs.front(), runs.back()});
+    }
+    std::sort(rows.begin(), rows.end(),
+        [](const Row& a, const Row& b) { return a.Median > b.Median; });
+    bool repeated = !seconds.empty() && seconds[0].size() > 1;
+    for (const auto& row : rows) {
+        const std::string& name = Registry()[row.Index].Name;
+        if (repeated) {
+            std::fprintf(stdout, "  %10.3f ms  (min %.3f, max %.3f)  %s\n", row.Median * 1e3,
+                row.Min * 1e3, row.Max * 1e3, name.c_str());
+        } else {
+            std::fprintf(stdout, "  %10.3f ms  %s\n", row.Median * 1e3, name.c_str());
+        }
+    }
+    std::fprintf(stdout, "%.3f s in tests, %.3f s wall on %u job%s\n", total, wallSeconds, jobs,
+        jobs == 1 ? "" : "s");
+}
+
+bool ParseCount(const char* text, uint32_t* value) {
+    char* end = nullptr;
+    unsigned long parsed = std::strtoul(text, &end, 10);
+    if (end == text || *end != '\0' || parsed > 100000) {
+        return false;
+    }
+    *value = static_cast<uint32_t>(parsed);
+    return true;
+}
+
 } // namespace
 
 void RegisterTest(const char* name, TestFn fn) {
@@ -67,22 +245,84 @@ std::string FormatEqFailure(const char* file, int line, const char* aExpr, const
     return std::string(buf);
 }
 
-int RunAllTests() {
+bool ParseRunOptions(int argc, char** argv, RunOptions* options, std::string* error) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--timing") {
+            options->Timing = true;
+            continue;
+        }
+        if (arg != "--jobs" && arg != "-j" && arg != "--repeat") {
+            if (error != nullptr) *error = "Unknown option: " + arg;
+            return false;
+        }
+        uint32_t value = 0;
+        if (i + 1 >= argc || !ParseCount(argv[i + 1], &value) ||
+            (arg == "--repeat" && value == 0)) {
+            if (error != nullptr) *error = "Invalid value for " + arg;
+            return false;
+        }
+        ++i;
+        if (arg == "--repeat") {
+            options->Repeat = value;
+        } else {
+            options->Jobs = value;
+        }
+    }
+    return true;
+}
+
+int RunAllTests(const RunOptions& options) {
+    const std::vector<TestCase>& tests = Registry();
+    uint32_t jobs = options.Jobs != 0 ? options.Jobs :
+        std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::vector<RunResult>> results(tests.size());
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t round = 0; round < options.Repeat; ++round) {
+        std::vector<RunResult> runs(tests.size());
+        if (jobs == 1) {
+            for (size_t i = 0; i < tests.size(); ++i) {
+                runs[i] = RunInProcess(tests[i]);
+            }
+        } else {
+            // Children inherit stdio buffers; flush them so nothing is
+            // written twice.
+            std::fflush(nullptr);
+            runWorkStealing(tests.size(), jobs,
+                [&tests, &runs](size_t index) { runs[index] = RunForked(tests[index]); });
+        }
+        for (size_t i = 0; i < tests.size(); ++i) {
+            results[i].push_back(std::move(runs[i]));
+        }
+    }
+    double wallSeconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
     size_t passed = 0;
-    for (const auto& tc : Registry()) {
-        SetCurrentTestName(tc.Name.c_str());
-        try {
-            tc.Fn();
+    std::vector<std::vector<double>> seconds(tests.size());
+    for (size_t i = 0; i < tests.size(); ++i) {
+        bool failed = false;
+        const RunResult* skipped = nullptr;
+        for (const auto& run : results[i]) {
+            for (const auto& message : run.Failures) {
+                Failures().push_back({tests[i].Name, message});
+            }
+            failed = failed || !run.Failures.empty();
+            if (run.Skipped && skipped == nullptr) {
+                skipped = &run;
+            }
+            seconds[i].push_back(run.Seconds);
+        }
+        if (skipped != nullptr) {
+            Skips().push_back(tests[i].Name + ": " + skipped->SkipReason);
+        } else if (!failed) {
             ++passed;
-        } catch (const SkipException& e) {
-            Skips().push_back(tc.Name + ": " + e.Why);
-        } catch (const std::exception& e) {
-            AddFailure(std::string("Unhandled exception: ") + e.what());
-        } catch (...) {
-            AddFailure("Unhandled non-std exception");
         }
     }
 
+    if (options.Timing && !tests.empty()) {
+        PrintTiming(seconds, wallSeconds, jobs);
+    }
     PrintReport();
     if (!Failures().empty()) {
         return 1;
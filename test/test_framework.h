@@ -46,7 +46,22 @@ std::string ToString(const T& v) {
     }
 }
 
-int RunAllTests();
+struct RunOptions {
+    // Tests run at once. Above 1 every test runs in a forked process of its
+    // own, so loggers, captured stdout and GetLastToyCpu() stay per test;
+    // 0 uses one job per hardware thread.
+    uint32_t Jobs = 1;
+    // Runs of every test. Each round finishes before the next starts, so a
+    // test never runs alongside itself.
+    uint32_t Repeat = 1;
+    // Print per-test wall times, slowest first.
+    bool Timing = false;
+};
+
+// Parses --jobs/-j N, --repeat N and --timing.
+bool ParseRunOptions(int argc, char** argv, RunOptions* options, std::string* error);
+
+int RunAllTests(const RunOptions& options = RunOptions());
 void PrintReport();
 
 } // namespace testfw
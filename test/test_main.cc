@@ -3,12 +3,21 @@
 extern void RegisterIntegrationTests();
 extern void RegisterDeviceTests();
 extern void RegisterTraceTests();
+extern void RegisterBusTests();
+extern void RegisterCpuTests();
 
 int main(int argc, char** argv) {
-    (void)argc;
-    (void)argv;
+    testfw::RunOptions options;
+    std::string error;
+    if (!testfw::ParseRunOptions(argc, argv, &options, &error)) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        std::fprintf(stderr, "Usage: %s [--jobs N] [--repeat N] [--timing]\n", argv[0]);
+        return 2;
+    }
     RegisterIntegrationTests();
     RegisterDeviceTests();
     RegisterTraceTests();
-    return testfw::RunAllTests();
+    RegisterBusTests();
+    RegisterCpuTests();
+    return testfw::RunAllTests(options);
 }
@@ -1,11 +1,13 @@
 #include "toy_cpu_executor.h"
 
+#include <algorithm>
 #include <chrono>
 #include <cstring>
 #include <thread>
 #include <vector>
 
 #include "emulator/debugger/debugger.h"
+#include "emulator/snapshot/snapshot.h"
 
 #include "toy_isa.h"
 
@@ -37,24 +39,53 @@ int64_t OffsetToWords(int8_t off) {
     return static_cast<int64_t>(off) * 4;
 }
 
+constexpr uint32_t OpIndex(toy::Op op) {
+    return static_cast<uint32_t>(op);
+}
+
+constexpr uint32_t kTraceInstructions = 1u << 0;
+constexpr uint32_t kTraceMemEvents = 1u << 1;
+constexpr uint32_t kTraceBranches = 1u << 2;
+
+uint32_t TraceMask(const TraceOptions& options) {
+    return (options.logInstruction ? kTraceInstructions : 0u) |
+        (options.logMemEvents ? kTraceMemEvents : 0u) |
+        (options.logBranchPrediction ? kTraceBranches : 0u);
+}
+
 } // namespace
 
 ToyCpuExecutor* GetLastToyCpu() {
     return g_last;
 }
 
-ToyCpuExecutor::ToyCpuExecutor() {
-    g_last = this;
+ToyCpuExecutor::ToyCpuExecutor() : ToyCpuExecutor(0) {
+}
+
+// Only hart 0 is reported by GetLastToyCpu(), so tests keep seeing the boot hart.
+ToyCpuExecutor::ToyCpuExecutor(uint32_t hartId) : mHartId(hartId) {
+    if (hartId == 0) {
+        g_last = this;
+    }
     reset();
 }
 
-ToyCpuExecutor::~ToyCpuExecutor() = default;
+ToyCpuExecutor::~ToyCpuExecutor() {
+    if (g_last == this) {
+        g_last = nullptr;
+    }
+}
 
 void ToyCpuExecutor::reset() {
     std::memset(mRegs, 0, sizeof(mRegs));
     mPc = 0;
     mCycle = 0;
     mLastError = CpuErrorDetail{};
+    mWaiting = false;
+    mFetchRange = DirectMemoryRange{};
+    mDataRange = DirectMemoryRange{};
+    mBlockCache.clear();
+    mThreaded.clear();
 }
 
 CpuErrorDetail ToyCpuExecutor::getLastError() const {
@@ -95,6 +126,16 @@ void ToyCpuExecutor::setRegister(uint32_t regId, uint64_t value) {
 
 void ToyCpuExecutor::setDebugger(ICpuDebugger* debugger) {
     mDbg = debugger;
+    mFetchRange = DirectMemoryRange{};
+    mDataRange = DirectMemoryRange{};
+    mBlockCache.clear();
+    mThreaded.clear();
+    mTraceMask.store(mDbg ? TraceMask(mDbg->getTraceOptions()) : 0u,
+        std::memory_order_relaxed);
+}
+
+void ToyCpuExecutor::onTraceOptionsChanged(const TraceOptions& options) {
+    mTraceMask.store(TraceMask(options), std::memory_order_relaxed);
 }
 
 uint32_t ToyCpuExecutor::getRegisterCount() const {
@@ -108,10 +149,27 @@ bool ToyCpuExecutor::fault(CpuErrorType type, uint64_t addr, uint32_t size) {
     return false;
 }
 
+bool ToyCpuExecutor::findDirect(DirectMemoryRange* cache, uint64_t addr, uint32_t size) {
+    if (cache->contains(addr, size)) {
+        return true;
+    }
+    DirectMemoryRange range;
+    if (!mDbg->getDirectMemory(addr, &range) || !range.contains(addr, size)) {
+        return false;
+    }
+    *cache = range;
+    return true;
+}
+
 uint32_t ToyCpuExecutor::fetchU32(uint64_t pc, MemResponse* out) {
     if (out == nullptr || mDbg == nullptr) {
         return 0;
     }
+    if (findDirect(&mFetchRange, pc, 4)) {
+        *out = MemResponse{};
+        out->data = mFetchRange.load(pc, 4);
+        return static_cast<uint32_t>(out->data);
+    }
     MemAccess access;
     access.address = pc;
     access.size = 4;
@@ -123,124 +181,212 @@ uint32_t ToyCpuExecutor::fetchU32(uint64_t pc, MemResponse* out) {
     return static_cast<uint32_t>(out->data & 0xffffffffu);
 }
 
-StepResult ToyCpuExecutor::step(uint64_t maxInstructions, uint64_t maxCycles) {
-    StepResult result;
-    result.success = true;
-    result.instructionsExecuted = 0;
-    result.cyclesExecuted = 0;
+MemResponse ToyCpuExecutor::readU32(uint64_t addr) {
+    ++mDataAccesses;
+    if (findDirect(&mDataRange, addr, 4)) {
+        MemResponse response;
+        response.data = mDataRange.load(addr, 4);
+        return response;
+    }
+    MemAccess access;
+    access.address = addr;
+    access.size = 4;
+    access.type = MemAccessType::Read;
+    return mDbg->busRead(access);
+}
 
-    if (mDbg == nullptr) {
-        fault(CpuErrorType::DeviceFault, mPc, 0);
-        result.success = false;
-        return result;
+MemResponse ToyCpuExecutor::writeU32(uint64_t addr, uint32_t value) {
+    ++mDataAccesses;
+    if (findDirect(&mDataRange, addr, 4) && mDataRange.writable) {
+        mDataRange.store(addr, 4, value);
+        invalidateCode(addr, 4);
+        if (mSharedCode != nullptr) {
+            uint64_t others = mSharedCode->harts(addr, 4) & ~(1ull << mSharedHart);
+            if (others != 0) {
+                mDbg->onCodeWritten(addr, 4, others);
+            }
+        }
+        return MemResponse{};
     }
+    MemAccess access;
+    access.address = addr;
+    access.size = 4;
+    access.type = MemAccessType::Write;
+    access.data = value;
+    return mDbg->busWrite(access);
+}
 
-    auto traceOption = (mDbg) ? mDbg->getTraceOptions() : TraceOptions{};
-    bool hasBreakpoints = mDbg && mDbg->hasBreakpoints();
+void ToyCpuExecutor::invalidateCode(uint64_t address, uint64_t size) {
+    bool removed = mBlockCache.invalidateRange(address, size);
+    removed = mThreaded.invalidateRange(address, size) || removed;
+    mCodeModified = mCodeModified || removed;
+}
 
-    while (result.instructionsExecuted < maxInstructions && result.cyclesExecuted < maxCycles) {
-        bool logInstructions = traceOption.logInstruction;
-        bool logMemEvents = traceOption.logMemEvents;
-        bool logBranchPrediction = traceOption.logBranchPrediction;
+bool ToyCpuExecutor::shareCodePages(SharedCodePages* pages, uint32_t hart) {
+    mSharedCode = pages;
+    mSharedHart = hart;
+    mBlockCache.share(pages, hart);
+    mThreaded.share(pages, hart);
+    return true;
+}
 
-        if (hasBreakpoints && mDbg->isBreakpoint(mPc)) {
-             return result;
-        }
+void ToyCpuExecutor::invalidateDirectMemory() {
+    mFetchRange = DirectMemoryRange{};
+    mDataRange = DirectMemoryRange{};
+}
 
-        TraceRecord record;
-        record.pc = mPc;
-        record.cycleBegin = mCycle;
-        record.isBranch = false;
-
-        MemResponse fetch;
-        uint32_t inst = fetchU32(mPc, &fetch);
-
-        if (logMemEvents) {
-            MemAccessEvent evt;
-            evt.type = MemAccessType::Fetch;
-            evt.address = mPc;
-            evt.size = 4;
-            evt.data = inst;
-            evt.latencyCycles = fetch.latencyCycles;
-            record.memEvents.push_back(evt);
-        }
+bool ToyCpuExecutor::setExecutionEngine(ExecutionEngine engine) {
+    mEngine = engine;
+    return true;
+}
 
-        if (!fetch.success) {
-            mLastError = fetch.error;
-            if (logMemEvents) {
-                record.inst = 0;
-                record.decoded = "FETCH_ERROR";
-                record.cycleEnd = mCycle;
-                mDbg->logTrace(record);
-            }
-            result.success = false;
-            return result;
-        }
+void ToyCpuExecutor::setInterruptLine(bool asserted) {
+    mInterruptLine = asserted;
+}
 
-        record.inst = inst;
-        uint64_t pcBefore = mPc;
-        mPc += 4;
-        ++mCycle;
-        
-        result.instructionsExecuted++;
-        result.cyclesExecuted++;
-        
-        uint8_t op = OpCode(inst);
-        bool success = true;
-
-        if (op == static_cast<uint8_t>(toy::Op::Nop)) {
-            if (logInstructions) record.decoded = "NOP";
-        } else if (op == static_cast<uint8_t>(toy::Op::Halt)) {
-            if (logInstructions) record.decoded = "HALT";
-            success = fault(CpuErrorType::None, pcBefore, 4);
-        } else if (op == static_cast<uint8_t>(toy::Op::Lui)) {
-            uint8_t rd = Rd(inst);
-            uint16_t imm = Imm16(inst);
-            if (logInstructions) record.decoded = "LUI r" + std::to_string(rd) + ", " + std::to_string(imm);
-            
-            uint64_t value = static_cast<uint64_t>(imm) << 16;
-            setRegister(rd, value);
-        } else if (op == static_cast<uint8_t>(toy::Op::Ori)) {
-            uint8_t rd = Rd(inst);
-            uint16_t imm = Imm16(inst);
-            if (logInstructions) record.decoded = "ORI r" + std::to_string(rd) + ", " + std::to_string(imm);
-
-            uint64_t value = getRegister(rd) | static_cast<uint64_t>(imm);
-            setRegister(rd, value);
-        } else if (op == static_cast<uint8_t>(toy::Op::Beq)) {
-            uint8_t r0 = Rd(inst);
-            uint8_t r1 = Rs(inst);
-            int8_t off = Off8(inst);
-            if (logInstructions) {
-                record.decoded = "BEQ r" + std::to_string(r0) + ", r" + std::to_string(r1) +
-                    ", " + std::to_string(off);
-            }
+bool ToyCpuExecutor::isWaitingForInterrupt() const {
+    return mWaiting;
+}
 
-            record.isBranch = true;
-            record.branch.predictedTaken = false;
-            record.branch.predictedTarget = mPc + OffsetToWords(off);
+ICpuExecutor* ToyCpuExecutor::createHart(uint32_t hartId) {
+    return new ToyCpuExecutor(hartId);
+}
 
-            bool taken = getRegister(r0) == getRegister(r1);
-            record.branch.taken = taken;
-            record.branch.target = mPc + OffsetToWords(off);
-            if (taken) {
-                mPc = mPc + OffsetToWords(off);
-            }
-        } else if (op == static_cast<uint8_t>(toy::Op::Lw)) {
-            uint8_t rd = Rd(inst);
-            uint8_t rs = Rs(inst);
-            int8_t off = Off8(inst);
-            if (logInstructions) {
-                record.decoded = "LW r" + std::to_string(rd) + ", [r" + std::to_string(rs) + "+" + std::to_string(off) + "]";
-            }
+bool ToyCpuExecutor::saveState(std::vector<uint8_t>* out) const {
+    if (out == nullptr) {
+        return false;
+    }
+    StateWriter writer;
+    writer.put(mRegs);
+    writer.put(mPc);
+    writer.put(mCycle);
+    writer.put(mLastError);
+    writer.put<uint8_t>(mWaiting ? 1 : 0);
+    *out = writer.take();
+    return true;
+}
+
+bool ToyCpuExecutor::loadState(const std::vector<uint8_t>& in) {
+    StateReader reader(in);
+    uint64_t regs[kRegCount] = {};
+    uint64_t pc = 0;
+    uint64_t cycle = 0;
+    CpuErrorDetail error;
+    uint8_t waiting = 0;
+    if (!reader.get(&regs) || !reader.get(&pc) || !reader.get(&cycle) ||
+        !reader.get(&error) || !reader.get(&waiting) || !reader.atEnd()) {
+        return false;
+    }
+    std::memcpy(mRegs, regs, sizeof(mRegs));
+    mPc = pc;
+    mCycle = cycle;
+    mLastError = error;
+    mWaiting = waiting != 0;
+    mFetchRange = DirectMemoryRange{};
+    mDataRange = DirectMemoryRange{};
+    mBlockCache.clear();
+    mThreaded.clear();
+    return true;
+}
 
-            uint64_t addr = getRegister(rs) + static_cast<int64_t>(off);
-            MemAccess access;
-            access.address = addr;
-            access.size = 4;
-            access.type = MemAccessType::Read;
-            MemResponse r = mDbg->busRead(access);
+BlockDecodeStatus ToyCpuExecutor::decode(uint64_t pc, ToyDecodedInst* out, uint32_t* length) {
+    // Only look ahead through plain memory; fetching past the block start
+    // from a device could have side effects.
+    if (pc != mPc && !findDirect(&mFetchRange, pc, 4)) {
+        return BlockDecodeStatus::Fault;
+    }
+    MemResponse fetch;
+    uint32_t inst = fetchU32(pc, &fetch);
+    if (!fetch.success) {
+        return BlockDecodeStatus::Fault;
+    }
+    *length = 4;
+    out->raw = inst;
+    out->op = OpCode(inst);
+    out->rd = Rd(inst);
+    out->rs = Rs(inst);
+    out->imm = Imm16(inst);
+    out->off = Off8(inst);
+
+    switch (static_cast<toy::Op>(out->op)) {
+        case toy::Op::Nop:
+            out->text = "NOP";
+            return BlockDecodeStatus::Continue;
+        case toy::Op::Halt:
+            out->text = "HALT";
+            return BlockDecodeStatus::EndBlock;
+        case toy::Op::Lui:
+            out->text = "LUI r" + std::to_string(out->rd) + ", " + std::to_string(out->imm);
+            return BlockDecodeStatus::Continue;
+        case toy::Op::Ori:
+            out->text = "ORI r" + std::to_string(out->rd) + ", " + std::to_string(out->imm);
+            return BlockDecodeStatus::Continue;
+        case toy::Op::Wfi:
+            out->text = "WFI";
+            return BlockDecodeStatus::EndBlock;
+        case toy::Op::Addi:
+            out->text = "ADDI r" + std::to_string(out->rd) + ", " +
+                std::to_string(static_cast<int16_t>(out->imm));
+            return BlockDecodeStatus::Continue;
+        case toy::Op::Beq:
+            out->text = "BEQ r" + std::to_string(out->rd) + ", r" + std::to_string(out->rs) +
+                ", " + std::to_string(out->off);
+            return BlockDecodeStatus::EndBlock;
+        case toy::Op::Lw:
+            out->text = "LW r" + std::to_string(out->rd) + ", [r" + std::to_string(out->rs) +
+                "+" + std::to_string(out->off) + "]";
+            return BlockDecodeStatus::Continue;
+        case toy::Op::Sw:
+            out->text = "SW r" + std::to_string(out->rd) + ", [r" + std::to_string(out->rs) +
+                "+" + std::to_string(out->off) + "]";
+            return BlockDecodeStatus::Continue;
+    }
+    out->text = "INVALID_OP";
+    return BlockDecodeStatus::EndBlock;
+}
 
+template <uint32_t Op, bool kTrace>
+bool ToyCpuExecutor::executeOp(const ToyDecodedInst& inst, TraceRecord* record,
+    bool logMemEvents) {
+    uint64_t pcBefore = mPc;
+    mPc += 4;
+    ++mCycle;
+
+    if constexpr (Op == OpIndex(toy::Op::Nop)) {
+        return true;
+    } else if constexpr (Op == OpIndex(toy::Op::Halt)) {
+        return fault(CpuErrorType::None, pcBefore, 4);
+    } else if constexpr (Op == OpIndex(toy::Op::Lui)) {
+        setRegister(inst.rd, static_cast<uint64_t>(inst.imm) << 16);
+        return true;
+    } else if constexpr (Op == OpIndex(toy::Op::Ori)) {
+        setRegister(inst.rd, getRegister(inst.rd) | static_cast<uint64_t>(inst.imm));
+        return true;
+    } else if constexpr (Op == OpIndex(toy::Op::Addi)) {
+        setRegister(inst.rd, getRegister(inst.rd) +
+            static_cast<uint64_t>(static_cast<int64_t>(static_cast<int16_t>(inst.imm))));
+        return true;
+    } else if constexpr (Op == OpIndex(toy::Op::Wfi)) {
+        mWaiting = !mInterruptLine;
+        return true;
+    } else if constexpr (Op == OpIndex(toy::Op::Beq)) {
+        uint64_t target = mPc + OffsetToWords(inst.off);
+        bool taken = getRegister(inst.rd) == getRegister(inst.rs);
+        if constexpr (kTrace) {
+            record->isBranch = true;
+            record->branch.predictedTaken = false;
+            record->branch.predictedTarget = target;
+            record->branch.taken = taken;
+            record->branch.target = target;
+        }
+        if (taken) {
+            mPc = target;
+        }
+        return true;
+    } else if constexpr (Op == OpIndex(toy::Op::Lw)) {
+        uint64_t addr = getRegister(inst.rs) + static_cast<int64_t>(inst.off);
+        MemResponse r = readU32(addr);
+        if constexpr (kTrace) {
             if (logMemEvents) {
                 MemAccessEvent evt;
                 evt.type = MemAccessType::Read;
@@ -248,63 +394,269 @@ StepResult ToyCpuExecutor::step(uint64_t maxInstructions, uint64_t maxCycles) {
                 evt.size = 4;
                 evt.data = r.data;
                 evt.latencyCycles = r.latencyCycles;
-                record.memEvents.push_back(evt);
-            }
-
-            if (!r.success) {
-                mLastError = r.error;
-                success = false;
-            } else {
-                setRegister(rd, static_cast<uint32_t>(r.data & 0xffffffffu));
+                record->memEvents.push_back(evt);
             }
-        } else if (op == static_cast<uint8_t>(toy::Op::Sw)) {
-            uint8_t rs = Rd(inst);
-            uint8_t rd = Rs(inst);
-            int8_t off = Off8(inst);
-            if (logInstructions) {
-                record.decoded = "SW r" + std::to_string(rs) + ", [r" + std::to_string(rd) + "+" + std::to_string(off) + "]";
-            }
-
-            uint64_t addr = getRegister(rd) + static_cast<int64_t>(off);
-            MemAccess access;
-            access.address = addr;
-            access.size = 4;
-            access.type = MemAccessType::Write;
-            access.data = static_cast<uint32_t>(getRegister(rs) & 0xffffffffu);
-            MemResponse w = mDbg->busWrite(access);
-
+        }
+        if (!r.success) {
+            mLastError = r.error;
+            return false;
+        }
+        setRegister(inst.rd, static_cast<uint32_t>(r.data & 0xffffffffu));
+        return true;
+    } else if constexpr (Op == OpIndex(toy::Op::Sw)) {
+        // SW encodes the source register in the rd slot and the base in rs.
+        uint64_t addr = getRegister(inst.rs) + static_cast<int64_t>(inst.off);
+        uint32_t value = static_cast<uint32_t>(getRegister(inst.rd) & 0xffffffffu);
+        MemResponse w = writeU32(addr, value);
+        if constexpr (kTrace) {
             if (logMemEvents) {
                 MemAccessEvent evt;
                 evt.type = MemAccessType::Write;
                 evt.address = addr;
                 evt.size = 4;
-                evt.data = access.data;
+                evt.data = value;
                 evt.latencyCycles = w.latencyCycles;
-                record.memEvents.push_back(evt);
-            }
-
-            if (!w.success) {
-                mLastError = w.error;
-                success = false;
+                record->memEvents.push_back(evt);
             }
-        } else {
-            if (logInstructions) record.decoded = "INVALID_OP";
-            success = fault(CpuErrorType::InvalidOp, pcBefore, 4);
         }
+        if (!w.success) {
+            mLastError = w.error;
+            return false;
+        }
+        return true;
+    } else {
+        (void)inst;
+        (void)record;
+        (void)logMemEvents;
+        return fault(CpuErrorType::InvalidOp, pcBefore, 4);
+    }
+}
 
+template <bool kTrace>
+bool ToyCpuExecutor::execute(const ToyDecodedInst& inst, TraceRecord* record,
+    bool logMemEvents) {
+    switch (static_cast<toy::Op>(inst.op)) {
+        case toy::Op::Nop:
+            return executeOp<OpIndex(toy::Op::Nop), kTrace>(inst, record, logMemEvents);
+        case toy::Op::Halt:
+            return executeOp<OpIndex(toy::Op::Halt), kTrace>(inst, record, logMemEvents);
+        case toy::Op::Lui:
+            return executeOp<OpIndex(toy::Op::Lui), kTrace>(inst, record, logMemEvents);
+        case toy::Op::Ori:
+            return executeOp<OpIndex(toy::Op::Ori), kTrace>(inst, record, logMemEvents);
+        case toy::Op::Wfi:
+            return executeOp<OpIndex(toy::Op::Wfi), kTrace>(inst, record, logMemEvents);
+        case toy::Op::Addi:
+            return executeOp<OpIndex(toy::Op::Addi), kTrace>(inst, record, logMemEvents);
+        case toy::Op::Beq:
+            return executeOp<OpIndex(toy::Op::Beq), kTrace>(inst, record, logMemEvents);
+        case toy::Op::Lw:
+            return executeOp<OpIndex(toy::Op::Lw), kTrace>(inst, record, logMemEvents);
+        case toy::Op::Sw:
+            return executeOp<OpIndex(toy::Op::Sw), kTrace>(inst, record, logMemEvents);
+    }
+    return executeOp<kInvalidOpIndex, kTrace>(inst, record, logMemEvents);
+}
+
+uint32_t ToyCpuExecutor::threadedOpIndex(const ToyDecodedInst& inst) {
+    return inst.op < kInvalidOpIndex ? inst.op : kInvalidOpIndex;
+}
+
+template <uint32_t Op>
+ThreadedStatus ToyCpuExecutor::threadedExecute(ToyCpuExecutor& cpu, const ToyDecodedInst& inst) {
+    uint64_t next = cpu.mPc + 4;
+    if (!cpu.executeOp<Op, false>(inst, nullptr, false)) {
+        return ThreadedStatus::Stop;
+    }
+    if (cpu.mPc != next || cpu.mCodeModified) {
+        return ThreadedStatus::Exit;
+    }
+    return ThreadedStatus::Next;
+}
+
+void ToyCpuExecutor::reportFetchFault(bool logMemEvents) {
+    MemResponse fetch;
+    fetchU32(mPc, &fetch);
+    mLastError = fetch.error;
+    if (logMemEvents) {
+        TraceRecord record;
+        record.pc = mPc;
+        record.cycleBegin = mCycle;
+        MemAccessEvent evt;
+        evt.type = MemAccessType::Fetch;
+        evt.address = mPc;
+        evt.size = 4;
+        evt.latencyCycles = fetch.latencyCycles;
+        record.memEvents.push_back(evt);
+        record.decoded = "FETCH_ERROR";
         record.cycleEnd = mCycle;
-        if (logInstructions || logBranchPrediction || logMemEvents) mDbg->logTrace(record);
+        mDbg->logTrace(record);
+    }
+}
+
+StepResult ToyCpuExecutor::stepThreaded(uint64_t maxInstructions, uint64_t maxCycles) {
+    StepResult result;
+    result.success = true;
+    result.instructionsExecuted = 0;
+    result.cyclesExecuted = 0;
+
+    auto decoder = [this](uint64_t pc, ToyDecodedInst* out, uint32_t* length) {
+        return decode(pc, out, length);
+    };
+
+    while (result.instructionsExecuted < maxInstructions && result.cyclesExecuted < maxCycles &&
+        !mWaiting) {
+        const auto* block = mThreaded.lookupOrBuild(mPc, decoder);
+        if (block == nullptr) {
+            reportFetchFault(false);
+            result.success = false;
+            return result;
+        }
+
+        // Every toy instruction takes one cycle, so one budget covers both limits.
+        uint64_t budget = std::min(maxInstructions - result.instructionsExecuted,
+            maxCycles - result.cyclesExecuted);
+        mCodeModified = false;
+        ThreadedStatus status = ThreadedStatus::Next;
+        uint64_t executed = Engine::run(*this, *block, budget, &status);
+        result.instructionsExecuted += executed;
+        result.cyclesExecuted += executed;
+        if (status == ThreadedStatus::Stop) {
+            result.success = false;
+            return result;
+        }
+    }
+
+    return result;
+}
 
-        if (!success) {
+StepResult ToyCpuExecutor::step(uint64_t maxInstructions, uint64_t maxCycles) {
+    if (mDbg == nullptr) {
+        fault(CpuErrorType::DeviceFault, mPc, 0);
+        StepResult result;
+        result.success = false;
+        return result;
+    }
+
+    // Waiting retires nothing; the whole budget passes as idle cycles.
+    if (mWaiting) {
+        if (!mInterruptLine) {
+            mCycle += maxCycles;
+            StepResult result;
+            result.success = true;
+            result.instructionsExecuted = 0;
+            result.cyclesExecuted = maxCycles;
+            return result;
+        }
+        mWaiting = false;
+    }
+
+    using StepFn = StepResult (ToyCpuExecutor::*)(uint64_t, uint64_t, bool);
+    static constexpr StepFn kStepFns[] = {
+        &ToyCpuExecutor::stepInterpreted<false, false, false>,
+        &ToyCpuExecutor::stepInterpreted<true, false, false>,
+        &ToyCpuExecutor::stepInterpreted<false, true, false>,
+        &ToyCpuExecutor::stepInterpreted<true, true, false>,
+        &ToyCpuExecutor::stepInterpreted<false, false, true>,
+        &ToyCpuExecutor::stepInterpreted<true, false, true>,
+        &ToyCpuExecutor::stepInterpreted<false, true, true>,
+        &ToyCpuExecutor::stepInterpreted<true, true, true>,
+    };
+
+    uint32_t traceMask = mTraceMask.load(std::memory_order_relaxed);
+    bool hasBreakpoints = mDbg->hasBreakpoints();
+    // The threaded engine has no per-instruction hooks, so tracing and
+    // breakpoints keep using the interpreter loop.
+    if (mEngine == ExecutionEngine::Threaded && !hasBreakpoints && traceMask == 0) {
+        return stepThreaded(maxInstructions, maxCycles);
+    }
+    return (this->*kStepFns[traceMask & 7u])(maxInstructions, maxCycles, hasBreakpoints);
+}
+
+template <bool kInst, bool kMem, bool kBranch>
+StepResult ToyCpuExecutor::stepInterpreted(uint64_t maxInstructions, uint64_t maxCycles,
+    bool hasBreakpoints) {
+    constexpr bool kTrace = kInst || kMem || kBranch;
+
+    StepResult result;
+    result.success = true;
+    result.instructionsExecuted = 0;
+    result.cyclesExecuted = 0;
+
+    auto decoder = [this](uint64_t pc, ToyDecodedInst* out, uint32_t* length) {
+        return decode(pc, out, length);
+    };
+
+    while (result.instructionsExecuted < maxInstructions && result.cyclesExecuted < maxCycles &&
+        !mWaiting) {
+        if (hasBreakpoints && mDbg->isBreakpoint(mPc)) {
+            return result;
+        }
+
+        const auto* block = mBlockCache.lookupOrBuild(mPc, decoder);
+        if (block == nullptr) {
+            reportFetchFault(kMem);
             result.success = false;
             return result;
         }
+
+        uint64_t generation = mBlockCache.generation();
+        for (size_t i = 0; i < block->insts.size(); ++i) {
+            if (result.instructionsExecuted >= maxInstructions ||
+                result.cyclesExecuted >= maxCycles) {
+                return result;
+            }
+            if (i > 0 && hasBreakpoints && mDbg->isBreakpoint(mPc)) {
+                return result;
+            }
+
+            const ToyDecodedInst& inst = block->insts[i];
+            bool success = false;
+            if (kTrace && mDbg->shouldTrace(mPc, mCycle)) {
+                TraceRecord& record = mTraceRecord;
+                record.reset();
+                record.pc = mPc;
+                record.inst = inst.raw;
+                record.cycleBegin = mCycle;
+                if constexpr (kMem) {
+                    MemAccessEvent evt;
+                    evt.type = MemAccessType::Fetch;
+                    evt.address = mPc;
+                    evt.size = 4;
+                    evt.data = inst.raw;
+                    record.memEvents.push_back(evt);
+                }
+                if constexpr (kInst) {
+                    record.decoded.assign(inst.text);
+                }
+                success = execute<true>(inst, &record, kMem);
+                record.cycleEnd = mCycle;
+                mDbg->logTrace(record);
+            } else {
+                success = execute<false>(inst, nullptr, false);
+            }
+            result.instructionsExecuted++;
+            result.cyclesExecuted++;
+
+            if (!success) {
+                result.success = false;
+                return result;
+            }
+            if (mPc != block->pcs[i] + 4 || mBlockCache.generation() != generation) {
+                break;
+            }
+        }
     }
-    
+
     return result;
 }
 
+// The boot core outlives every test, so each emulator run in the same
+// process (a later test or a --repeat round) gets it reset and reported by
+// GetLastToyCpu() again.
 extern "C" ICpuExecutor* CreateCpuExecutor() {
     static ToyCpuExecutor cpu;
+    cpu.reset();
+    g_last = &cpu;
     return &cpu;
 }
@@ -1,9 +1,14 @@
 #ifndef TEST_TOY_CPU_EXECUTOR_H
 #define TEST_TOY_CPU_EXECUTOR_H
 
+#include <atomic>
 #include <cstdint>
+#include <string>
+#include <vector>
 
+#include "emulator/cpu/block_cache.h"
 #include "emulator/cpu/cpu.h"
+#include "emulator/cpu/threaded_engine.h"
 
 class ToyCpuExecutor;
 
@@ -11,9 +16,20 @@ ToyCpuExecutor* GetLastToyCpu();
 
 class Debugger;
 
+struct ToyDecodedInst {
+    uint32_t raw = 0;
+    uint8_t op = 0;
+    uint8_t rd = 0;
+    uint8_t rs = 0;
+    uint16_t imm = 0;
+    int8_t off = 0;
+    std::string text;
+};
+
 class ToyCpuExecutor : public ICpuExecutor {
 public:
     ToyCpuExecutor();
+    explicit ToyCpuExecutor(uint32_t hartId);
     ~ToyCpuExecutor() override;
 
     void reset() override;
@@ -29,20 +45,79 @@ public:
     void setRegister(uint32_t regId, uint64_t value) override;
 
     void setDebugger(ICpuDebugger* debugger) override;
+    void onTraceOptionsChanged(const TraceOptions& options) override;
 
     uint32_t getRegisterCount() const override;
+    void invalidateCode(uint64_t address, uint64_t size) override;
+    void invalidateDirectMemory() override;
+    bool shareCodePages(SharedCodePages* pages, uint32_t hart) override;
+    bool setExecutionEngine(ExecutionEngine engine) override;
+    void setInterruptLine(bool asserted) override;
+    bool isWaitingForInterrupt() const override;
+    ICpuExecutor* createHart(uint32_t hartId) override;
+    bool saveState(std::vector<uint8_t>* out) const override;
+    bool loadState(const std::vector<uint8_t>& in) override;
+
+    uint32_t getHartId() const { return mHartId; }
+    ExecutionEngine getExecutionEngine() const { return mEngine; }
+    const BlockCacheStats& getBlockCacheStats() const { return mBlockCache.stats(); }
+    const BlockCacheStats& getThreadedCacheStats() const { return mThreaded.stats(); }
+    // Loads and stores issued, whether served from direct memory or the bus.
+    uint64_t getDataAccessCount() const { return mDataAccesses; }
+
+    // Threaded engine hooks. Op indices are the opcode byte; anything outside
+    // the 7-bit opcode space maps to kInvalidOpIndex.
+    static constexpr uint32_t kInvalidOpIndex = 0x80;
+    static constexpr uint32_t kThreadedOpCount = kInvalidOpIndex + 1;
+    static uint32_t threadedOpIndex(const ToyDecodedInst& inst);
+    template <uint32_t Op>
+    static ThreadedStatus threadedExecute(ToyCpuExecutor& cpu, const ToyDecodedInst& inst);
 
 private:
+    using Engine = ThreadedEngine<ToyCpuExecutor, ToyDecodedInst, kThreadedOpCount>;
+
+    BlockDecodeStatus decode(uint64_t pc, ToyDecodedInst* out, uint32_t* length);
+    template <bool kTrace>
+    bool execute(const ToyDecodedInst& inst, TraceRecord* record, bool logMemEvents);
+    template <uint32_t Op, bool kTrace>
+    bool executeOp(const ToyDecodedInst& inst, TraceRecord* record, bool logMemEvents);
+    template <bool kInst, bool kMem, bool kBranch>
+    StepResult stepInterpreted(uint64_t maxInstructions, uint64_t maxCycles, bool hasBreakpoints);
+    StepResult stepThreaded(uint64_t maxInstructions, uint64_t maxCycles);
+    void reportFetchFault(bool logMemEvents);
     bool fault(CpuErrorType type, uint64_t addr, uint32_t size);
     uint32_t fetchU32(uint64_t pc, MemResponse* out);
+    MemResponse readU32(uint64_t addr);
+    MemResponse writeU32(uint64_t addr, uint32_t value);
+    bool findDirect(DirectMemoryRange* cache, uint64_t addr, uint32_t size);
 
     ICpuDebugger* mDbg = nullptr;
+    uint32_t mHartId = 0;
 
     static constexpr uint32_t kRegCount = 16;
     uint64_t mRegs[kRegCount] = {};
     uint64_t mPc = 0;
     uint64_t mCycle = 0;
     CpuErrorDetail mLastError;
+
+    DirectMemoryRange mFetchRange;
+    DirectMemoryRange mDataRange;
+    BlockCache<ToyDecodedInst> mBlockCache;
+    Engine mThreaded;
+    SharedCodePages* mSharedCode = nullptr;
+    uint32_t mSharedHart = 0;
+    ExecutionEngine mEngine = ExecutionEngine::Interpreter;
+    bool mCodeModified = false;
+    bool mInterruptLine = false;
+    bool mWaiting = false;
+    uint64_t mDataAccesses = 0;
+    // Reused for every traced instruction so tracing does not allocate.
+    TraceRecord mTraceRecord;
+
+    // Bit 0: instructions, bit 1: memory events, bit 2: branch prediction.
+    // Selects the stepInterpreted<> instantiation; written by the debugger
+    // thread through onTraceOptionsChanged().
+    std::atomic<uint32_t> mTraceMask{0};
 };
 
 #endif
@@ -13,6 +13,11 @@ enum class Op : uint8_t {
     Lw = 0x03,
     Sw = 0x04,
     Beq = 0x05,
+    // Waits until the interrupt line is high, then continues with the next
+    // instruction; the toy core has no trap vector.
+    Wfi = 0x06,
+    // rd += sign-extended imm16.
+    Addi = 0x07,
     Halt = 0x7f,
 };
 
@@ -41,6 +46,10 @@ inline uint32_t Halt() {
     return static_cast<uint32_t>(Op::Halt) << 24;
 }
 
+inline uint32_t Wfi() {
+    return static_cast<uint32_t>(Op::Wfi) << 24;
+}
+
 inline uint32_t Lui(uint8_t rd, uint16_t imm16) {
     return EncodeRImm16(Op::Lui, rd, imm16);
 }
@@ -49,6 +58,10 @@ inline uint32_t Ori(uint8_t rd, uint16_t imm16) {
     return EncodeRImm16(Op::Ori, rd, imm16);
 }
 
+inline uint32_t Addi(uint8_t rd, int16_t imm16) {
+    return EncodeRImm16(Op::Addi, rd, static_cast<uint16_t>(imm16));
+}
+
 inline uint32_t Lw(uint8_t rd, uint8_t rs, int8_t off) {
     return EncodeMem(Op::Lw, rd, rs, off);
 }
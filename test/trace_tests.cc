@@ -1,11 +1,19 @@
 #include "test_framework.h"
 
+#include <cstddef>
 #include <cstdio>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
+#include <iterator>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "emulator/debugger/debugger.h"
+#include "emulator/debugger/input_log.h"
+#include "emulator/debugger/trace_buffer.h"
+#include "emulator/debugger/trace_file.h"
 #include "emulator/device/device.h"
 #include "emulator/device/memory.h"
 #include "emulator/logging/logger.h"
@@ -224,3 +232,365 @@ TEST(trace_all_enabled) {
     EXPECT_TRUE(AnyLineContains(lines, "Mem:[W:0x80000000="));
     std::remove(logFile.c_str());
 }
+
+TEST(trace_binary_file_roundtrip) {
+    std::string logFile = "test_binary_trace.log";
+    std::string traceFile = "test_binary_trace.bin";
+    TraceTestContext ctx(logFile);
+
+    TraceOptions opts;
+    opts.logInstruction = true;
+    opts.logMemEvents = true;
+    opts.logBranchPrediction = true;
+    ctx.Dbg->configureTrace(opts);
+    std::string error;
+    ASSERT_TRUE(ctx.Dbg->openBinaryTrace(traceFile, false, &error));
+
+    std::vector<uint32_t> prog;
+    toy::Emit(&prog, toy::Lui(1, 0));
+    toy::Emit(&prog, toy::Ori(1, 0x100));
+    toy::Emit(&prog, toy::Sw(1, 1, 0));
+    toy::Emit(&prog, toy::Beq(0, 0, 0));
+    ctx.WriteProgram(prog);
+    ctx.RunSteps(4);
+    ctx.Dbg->closeBinaryTrace();
+
+    EXPECT_TRUE(!AnyLineContains(ctx.ReadLog(), "PC:0x"));
+
+    TraceFileView view;
+    ASSERT_TRUE(view.open(traceFile, &error));
+    std::vector<std::string> lines;
+    BinaryTraceRecord binary;
+    for (uint64_t i = 0; view.readRecord(i, &binary); ++i) {
+        TraceRecord record;
+        TraceOptions recordOpts;
+        decodeTraceRecord(binary, &record, &recordOpts);
+        lines.push_back(formatTraceRecord(record, recordOpts));
+    }
+    EXPECT_EQ(lines.size(), 4u);
+    EXPECT_TRUE(AnyLineContains(lines, "(ORI r1, 256)"));
+    EXPECT_TRUE(AnyLineContains(lines, "Mem:[W:0x100=100]"));
+    EXPECT_TRUE(AnyLineContains(lines, "BP:(T:1 P:0 Target:0x10 PTarget:0x10)"));
+    std::remove(logFile.c_str());
+    std::remove(traceFile.c_str());
+}
+
+TEST(trace_ring_wraps) {
+    TraceRing ring(4);
+    BinaryTraceRecord record{};
+    BinaryTraceRecord out[4];
+    for (uint64_t round = 0; round < 3; ++round) {
+        for (uint64_t i = 0; i < 4; ++i) {
+            record.pc = round * 4 + i;
+            EXPECT_TRUE(ring.tryPush(record));
+        }
+        EXPECT_TRUE(!ring.tryPush(record));
+        EXPECT_EQ(ring.pop(out, 4), 4u);
+        EXPECT_EQ(out[3].pc, round * 4 + 3);
+        EXPECT_TRUE(ring.empty());
+    }
+}
+
+TEST(trace_file_index_lookup) {
+    std::string traceFile = "test_trace_index.bin";
+    for (bool compress : {false, true}) {
+        TraceFileWriter writer;
+        std::string error;
+        ASSERT_TRUE(writer.open(traceFile, compress, &error, 16));
+        // 200 records cycling through 10 PCs, one cycle each.
+        for (uint64_t i = 0; i < 200; ++i) {
+            TraceRecord record;
+            record.pc = 0x1000 + (i % 10) * 4;
+            record.cycleBegin = i;
+            record.cycleEnd = i + 1;
+            record.decoded = "NOP";
+            BinaryTraceRecord binary;
+            encodeTraceRecord(record, TraceOptions{}, &binary);
+            writer.append(&binary, 1);
+        }
+        writer.close();
+
+        TraceFileView view;
+        ASSERT_TRUE(view.open(traceFile, &error));
+        EXPECT_EQ(view.recordCount(), 200u);
+        EXPECT_EQ(view.chunkCount(), 13u);
+        EXPECT_TRUE(view.hasPcIndex());
+        EXPECT_EQ(view.findCycle(57), 57u);
+        EXPECT_EQ(view.findCycle(1000), 200u);
+
+        std::vector<uint64_t> hits = view.findPc(0x100c);
+        EXPECT_EQ(hits.size(), 20u);
+        EXPECT_EQ(hits.front(), 3u);
+        EXPECT_EQ(hits.back(), 193u);
+        EXPECT_TRUE(view.findPc(0x2000).empty());
+
+        BinaryTraceRecord binary;
+        ASSERT_TRUE(view.readRecord(123, &binary));
+        EXPECT_EQ(binary.cycleBegin, 123u);
+        EXPECT_EQ(binary.pc, 0x100cu);
+    }
+    std::remove(traceFile.c_str());
+}
+
+TEST(trace_file_validates_index_and_write_errors) {
+    std::string traceFile = "test_trace_corrupt.bin";
+    // Records out of cycle order, as interleaved harts write them: the
+    // second chunk runs ahead of all the others.
+    auto writeTrace = [&traceFile]() {
+        TraceFileWriter writer;
+        std::string error;
+        EXPECT_TRUE(writer.open(traceFile, false, &error, 16));
+        for (uint64_t i = 0; i < 200; ++i) {
+            TraceRecord record;
+            record.pc = 0x1000 + i * 4;
+            record.cycleBegin = i >= 16 && i < 32 ? 1000 + i : i;
+            BinaryTraceRecord binary;
+            encodeTraceRecord(record, TraceOptions{}, &binary);
+            writer.append(&binary, 1);
+        }
+        EXPECT_TRUE(writer.close(&error));
+    };
+    auto readBytes = [&traceFile]() {
+        std::ifstream in(traceFile, std::ios::binary);
+        return std::vector<char>(std::istreambuf_iterator<char>(in), {});
+    };
+    auto writeBytes = [&traceFile](const std::vector<char>& bytes) {
+        std::ofstream out(traceFile, std::ios::binary | std::ios::trunc);
+        out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    };
+
+    writeTrace();
+    TraceFileView view;
+    std::string error;
+    ASSERT_TRUE(view.open(traceFile, &error));
+    EXPECT_EQ(view.findCycle(500), 16u);
+    EXPECT_EQ(view.findCycle(10), 10u);
+    EXPECT_EQ(view.findCycle(1100), 200u);
+    view.close();
+
+    // A chunk entry pointing past the file drops the footer; the chunks are
+    // still walked.
+    std::vector<char> bytes = readBytes();
+    TraceFileFooter footer;
+    std::memcpy(&footer, bytes.data() + bytes.size() - sizeof(footer), sizeof(footer));
+    std::vector<char> badIndex = bytes;
+    uint64_t farOffset = 1ull << 40;
+    std::memcpy(badIndex.data() + footer.chunkIndexOffset, &farOffset, sizeof(farOffset));
+    writeBytes(badIndex);
+    ASSERT_TRUE(view.open(traceFile, &error));
+    EXPECT_EQ(view.recordCount(), 200u);
+    EXPECT_TRUE(!view.hasPcIndex());
+    EXPECT_EQ(view.findCycle(500), 16u);
+    view.close();
+
+    // A whole chunk header that disagrees with its payload is corrupt.
+    std::vector<char> badChunk = bytes;
+    uint32_t recordCount = 9;
+    std::memcpy(badChunk.data() + sizeof(TraceFileHeader) + offsetof(TraceChunkHeader,
+        recordCount), &recordCount, sizeof(recordCount));
+    writeBytes(badChunk);
+    EXPECT_TRUE(!view.open(traceFile, &error));
+
+    // Cut inside the last chunk: the whole chunks before it remain.
+    std::vector<char> truncated(bytes.begin(), bytes.begin() + footer.chunkIndexOffset - 100);
+    writeBytes(truncated);
+    ASSERT_TRUE(view.open(traceFile, &error));
+    EXPECT_EQ(view.recordCount(), 192u);
+    view.close();
+    std::remove(traceFile.c_str());
+
+    if (!std::filesystem::exists("/dev/full")) {
+        SKIP("/dev/full is not available");
+    }
+    TraceFileWriter full;
+    ASSERT_TRUE(full.open("/dev/full", false, &error, 16));
+    BinaryTraceRecord binary{};
+    for (int i = 0; i < 2000; ++i) {
+        full.append(&binary, 1);
+    }
+    EXPECT_TRUE(!full.close(&error));
+    EXPECT_TRUE(error.find("/dev/full") != std::string::npos);
+}
+
+TEST(input_log_round_trip_and_truncation) {
+    std::string logFile = "test_input_log.bin";
+    InputLogWriter writer;
+    std::string error;
+    ASSERT_TRUE(writer.open(logFile, &error));
+    InputEvent text;
+    text.cycle = 100;
+    text.bytes = {'h', 'i'};
+    writer.append(text);
+    InputEvent key;
+    key.cycle = 100000;
+    key.kind = InputEventKind::Key;
+    key.key = 0x40000052;
+    writer.append(key);
+    writer.close();
+
+    std::vector<InputEvent> events;
+    ASSERT_TRUE(readInputLog(logFile, &events, &error));
+    ASSERT_EQ(events.size(), 2u);
+    EXPECT_EQ(events[0].cycle, 100u);
+    EXPECT_TRUE(events[0].kind == InputEventKind::Uart);
+    EXPECT_EQ(events[0].bytes.size(), 2u);
+    EXPECT_EQ(events[0].bytes[1], 'i');
+    EXPECT_EQ(events[1].cycle, 100000u);
+    EXPECT_TRUE(events[1].kind == InputEventKind::Key);
+    EXPECT_EQ(events[1].key, 0x40000052u);
+
+    // A record cut off mid-way is dropped; the ones before it still load.
+    std::filesystem::resize_file(logFile, std::filesystem::file_size(logFile) - 1);
+    ASSERT_TRUE(readInputLog(logFile, &events, &error));
+    EXPECT_EQ(events.size(), 1u);
+
+    std::ofstream(logFile, std::ios::binary | std::ios::trunc) << "not a log";
+    EXPECT_TRUE(!readInputLog(logFile, &events, &error));
+    std::remove(logFile.c_str());
+}
+
+TEST(logging_async_drains_all_messages) {
+    std::string logFile = "test_async_log.log";
+    logging::Config config;
+    config.level = logging::Level::Trace;
+    config.mFile = logFile;
+    config.mAsync = true;
+    config.mFlushIntervalMs = 5;
+    logging::init(config);
+
+    std::vector<std::thread> producers;
+    for (int t = 0; t < 4; ++t) {
+        producers.emplace_back([t]() {
+            for (int i = 0; i < 500; ++i) {
+                TRACE("async %d:%d", t, i);
+            }
+        });
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    std::string longText(1000, 'x');
+    INFO("%s", longText.c_str());
+    logging::flush();
+
+    std::vector<std::string> lines;
+    {
+        std::ifstream f(logFile);
+        std::string line;
+        while (std::getline(f, line)) {
+            lines.push_back(line);
+        }
+    }
+    EXPECT_EQ(lines.size(), 2001u);
+    EXPECT_TRUE(AnyLineContains(lines, "async 3:499"));
+    EXPECT_TRUE(AnyLineContains(lines, longText));
+
+    logging::shutdown();
+    logging::init(logging::Config{});
+    std::remove(logFile.c_str());
+}
+
+TEST(logging_async_long_messages_stay_whole) {
+    std::vector<std::string> messages;
+    logging::Config config;
+    config.level = logging::Level::Info;
+    config.mAsync = true;
+    config.mFlushIntervalMs = 5;
+    config.mOnMessage = [&messages](const char* msg) { messages.push_back(msg); };
+    logging::init(config);
+
+    // Each message spans several queue slots; concurrent producers must not
+    // tear them.
+    std::vector<std::thread> producers;
+    for (int t = 0; t < 4; ++t) {
+        producers.emplace_back([t]() {
+            std::string body(700, static_cast<char>('a' + t));
+            for (int i = 0; i < 200; ++i) {
+                INFO("<%s>", body.c_str());
+            }
+        });
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    logging::flush();
+    logging::shutdown();
+    logging::init(logging::Config{});
+
+    ASSERT_EQ(messages.size(), 800u);
+    size_t whole = 0;
+    for (const auto& msg : messages) {
+        size_t open = msg.find('<');
+        if (open == std::string::npos || msg.size() != open + 703 || msg[open + 701] != '>' ||
+            msg.back() != '\n') {
+            continue;
+        }
+        std::string body = msg.substr(open + 1, 700);
+        if (body == std::string(700, body[0])) {
+            ++whole;
+        }
+    }
+    EXPECT_EQ(whole, 800u);
+}
+
+TEST(logging_contexts_route_per_thread) {
+    std::vector<std::string> first;
+    std::vector<std::string> second;
+    logging::Config config;
+    config.level = logging::Level::Debug;
+    config.mOnMessage = [&first](const char* msg) { first.push_back(msg); };
+    logging::Context a(config);
+    config.mOnMessage = [&second](const char* msg) { second.push_back(msg); };
+    config.level = logging::Level::Warn;
+    logging::Context b(config);
+    uint64_t processMessages = logging::Context::process().getStats().messages;
+
+    std::thread worker([&a]() {
+        logging::ScopedContext scope(&a);
+        DEBUG("from a");
+        // Threads started under a context keep logging to it.
+        logging::startThread([]() { INFO("from a's child"); }).join();
+    });
+    worker.join();
+    {
+        logging::ScopedContext scope(&b);
+        INFO("filtered by b");
+        WARN("from b");
+        EXPECT_EQ(logging::getStats().messages, 1u);
+    }
+
+    ASSERT_EQ(first.size(), 2u);
+    EXPECT_TRUE(first[0].find("from a") != std::string::npos);
+    EXPECT_TRUE(first[1].find("from a's child") != std::string::npos);
+    ASSERT_EQ(second.size(), 1u);
+    EXPECT_TRUE(second[0].find("from b") != std::string::npos);
+    EXPECT_EQ(logging::Context::process().getStats().messages, processMessages);
+    EXPECT_TRUE(&logging::current() == &logging::Context::process());
+}
+
+TEST(logging_level_gate_skips_filtered_messages) {
+    std::vector<std::string> lines;
+    logging::Config config;
+    config.level = logging::Level::Warn;
+    config.mOnMessage = [&lines](const char* msg) { lines.push_back(msg); };
+    logging::Context context(config);
+    logging::ScopedContext scope(&context);
+
+    int evaluated = 0;
+    auto touch = [&evaluated]() { return ++evaluated; };
+    INFO("%d", touch());
+    EXPECT_EQ(evaluated, 0);
+    EXPECT_EQ(context.getStats().messages, 0u);
+    WARN("value %d", touch());
+    EXPECT_EQ(evaluated, 1);
+    ASSERT_EQ(lines.size(), 1u);
+    EXPECT_TRUE(lines[0].find("[WARN ]") != std::string::npos);
+    EXPECT_TRUE(lines[0].find("value 1\n") != std::string::npos);
+
+    // Truncated messages still end in a newline.
+    std::string longText(8000, 'y');
+    ERROR("%s", longText.c_str());
+    ASSERT_EQ(lines.size(), 2u);
+    EXPECT_TRUE(lines[1].size() < 8000u);
+    EXPECT_EQ(lines[1].back(), '\n');
+}
@@ -0,0 +1,105 @@
+#include "emulator/debugger/trace_file.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// Prints a binary trace (written with --trace-file) in the same format as
+// the live trace log, one record per line.
+//
+//   trace_decode [--cycle N] [--pc ADDR] [--count N] <trace-file>
+//
+// --cycle starts at the first record at or after cycle N, --pc prints only
+// the visits to ADDR; both use the file's indices instead of scanning.
+
+namespace {
+
+void printUsage(const char* exe) {
+    std::fprintf(stderr, "Usage: %s [--cycle N] [--pc ADDR] [--count N] <trace-file>\n", exe);
+}
+
+bool parseNumber(const char* text, uint64_t* out) {
+    char* end = nullptr;
+    *out = std::strtoull(text, &end, 0);
+    return end != text && *end == '\0';
+}
+
+void printRecord(TraceFileView* view, uint64_t index) {
+    BinaryTraceRecord binary;
+    if (!view->readRecord(index, &binary)) {
+        return;
+    }
+    TraceRecord record;
+    TraceOptions options;
+    decodeTraceRecord(binary, &record, &options);
+    std::string line = formatTraceRecord(record, options);
+    if (!line.empty()) {
+        std::fprintf(stdout, "%s\n", line.c_str());
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const char* exe = argc > 0 ? argv[0] : "trace_decode";
+    const char* path = nullptr;
+    uint64_t cycle = 0;
+    uint64_t count = UINT64_MAX;
+    uint64_t pc = 0;
+    bool byPc = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        uint64_t* target = nullptr;
+        if (arg == "--cycle") {
+            target = &cycle;
+        } else if (arg == "--count") {
+            target = &count;
+        } else if (arg == "--pc") {
+            target = &pc;
+            byPc = true;
+        } else if (path == nullptr && !arg.empty() && arg[0] != '-') {
+            path = argv[i];
+            continue;
+        } else {
+            printUsage(exe);
+            return 2;
+        }
+        if (i + 1 >= argc || !parseNumber(argv[i + 1], target)) {
+            printUsage(exe);
+            return 2;
+        }
+        ++i;
+    }
+    if (path == nullptr) {
+        printUsage(exe);
+        return 2;
+    }
+
+    TraceFileView view;
+    std::string error;
+    if (!view.open(path, &error)) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+
+    uint64_t printed = 0;
+    if (byPc) {
+        for (uint64_t index : view.findPc(pc)) {
+            if (printed >= count) {
+                break;
+            }
+            BinaryTraceRecord binary;
+            if (view.readRecord(index, &binary) && binary.cycleBegin >= cycle) {
+                printRecord(&view, index);
+                ++printed;
+            }
+        }
+        return 0;
+    }
+    for (uint64_t index = view.findCycle(cycle); index < view.recordCount() && printed < count;
+         ++index, ++printed) {
+        printRecord(&view, index);
+    }
+    return 0;
+}